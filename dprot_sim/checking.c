@@ -1,21 +1,205 @@
+#include <string.h>
 #include "checking.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CHECKING_X86_CRC32
+#include <nmmintrin.h>
+#endif
+
 /*************************************************************/
-uint8_t crc8_table[256]; // 8-bit crc table
+// the crc tables are constant - generated once by gen_checking_tables.c
+#include "checking_tables.h"
 
 /*************************************************************/
 void init_crc8()
 {
-	int i;
-	int j;
-	unsigned char crc;
+	// nothing to do - the tables are built at compile time
+}
+
+/*************************************************************/
+static uint32_t crc8_block(uint32_t c, uint8_t* data, uint16_t len)
+{
+	uint8_t crc = c;
+
+	// 8 independent lookups instead of a chain of 8
+	while (len >= 8)
+	{
+		crc = crc8_slice[7][crc ^ data[0]] ^ crc8_slice[6][data[1]] ^
+			  crc8_slice[5][data[2]] ^ crc8_slice[4][data[3]] ^
+			  crc8_slice[3][data[4]] ^ crc8_slice[2][data[5]] ^
+			  crc8_slice[1][data[6]] ^ crc8_slice[0][data[7]];
+		data += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		crc8_add_byte(crc, *data++);
+	}
+
+	return crc;
+}
+
+/*************************************************************/
+static uint32_t crc16_block(uint32_t c, uint8_t* data, uint16_t len)
+{
+	uint16_t crc = c;
+
+	while (len >= 8)
+	{
+		crc = crc16_slice[7][(crc >> 8) ^ data[0]] ^ crc16_slice[6][(crc & 0xff) ^ data[1]] ^
+			  crc16_slice[5][data[2]] ^ crc16_slice[4][data[3]] ^
+			  crc16_slice[3][data[4]] ^ crc16_slice[2][data[5]] ^
+			  crc16_slice[1][data[6]] ^ crc16_slice[0][data[7]];
+		data += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		crc = (crc << 8) ^ crc16_slice[0][((crc >> 8) ^ *data++) & 0xff];
+	}
+
+	return crc;
+}
+
+/*************************************************************/
+static uint32_t crc32c_slice8(uint32_t c, uint8_t* data, uint16_t len)
+{
+	uint32_t lo;
+	uint32_t hi;
+
+	while (len >= 8)
+	{
+		lo = c ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+				  ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+		hi = (uint32_t)data[4] | ((uint32_t)data[5] << 8) |
+			 ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+		c = crc32c_slice[7][lo & 0xff] ^ crc32c_slice[6][(lo >> 8) & 0xff] ^
+			crc32c_slice[5][(lo >> 16) & 0xff] ^ crc32c_slice[4][lo >> 24] ^
+			crc32c_slice[3][hi & 0xff] ^ crc32c_slice[2][(hi >> 8) & 0xff] ^
+			crc32c_slice[1][(hi >> 16) & 0xff] ^ crc32c_slice[0][hi >> 24];
+		data += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		c = (c >> 8) ^ crc32c_slice[0][(c ^ *data++) & 0xff];
+	}
+
+	return c;
+}
+
+#ifdef CHECKING_X86_CRC32
+/*************************************************************/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t c, uint8_t* data, uint16_t len)
+{
+#ifdef __x86_64__
+	unsigned long long v;
+	unsigned long long c64 = c;
 
-	for (i=0; i<256; i++) {
-		crc = i;
-		for (j=0; j<8; j++) {
-			crc = (crc << 1) ^ ((crc & 0x80) ? 0x07 : 0);
-		}
-		crc8_table[i] = crc & 0xFF;
+	while (len >= 8)
+	{
+		memcpy (&v, data, 8);
+		c64 = _mm_crc32_u64 (c64, v);
+		data += 8;
+		len -= 8;
+	}
+	c = (uint32_t)c64;
+#endif
+
+	while (len--)
+	{
+		c = _mm_crc32_u8 (c, *data++);
+	}
+
+	return c;
+}
+#endif
+
+/*************************************************************/
+uint8_t checking_size(uint8_t type)
+{
+	switch (type)
+	{
+		case CHECKING_CRC8:
+		case CHECKING_CHS8:
+		case CHECKING_XOR8:
+			return 1;
+		case CHECKING_CRC16:
+			return 2;
+		case CHECKING_CRC32C:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+/*************************************************************/
+uint32_t checking_start(uint8_t type)
+{
+	switch (type)
+	{
+		case CHECKING_CRC16:
+			return 0xffff;
+		case CHECKING_CRC32C:
+			return 0xffffffff;
+		default:
+			return 0;
+	}
+}
+
+/*************************************************************/
+uint32_t checking_update(uint8_t type, uint32_t c, uint8_t* data, uint16_t len)
+{
+	uint16_t i;
+
+	switch (type)
+	{
+		case CHECKING_CRC8:
+			return crc8_block (c, data, len);
+
+		// a wide accumulator - the loops vectorize
+		case CHECKING_CHS8:
+			for (i = 0; i < len; i++) c += data[i];
+			return c & 0xff;
+
+		case CHECKING_XOR8:
+			for (i = 0; i < len; i++) c ^= data[i];
+			return c & 0xff;
+
+		case CHECKING_CRC16:
+			return crc16_block (c, data, len);
+
+		case CHECKING_CRC32C:
+			// asked every time - no shared state to set up
+#ifdef CHECKING_X86_CRC32
+			if (__builtin_cpu_supports ("sse4.2")) return crc32c_sse42 (c, data, len);
+#endif
+			return crc32c_slice8 (c, data, len);
+
+		default:
+			return c;
 	}
 }
 
+/*************************************************************/
+uint8_t checking_finish(uint8_t type, uint32_t c, uint8_t* out)
+{
+	uint8_t size = checking_size (type);
+	uint8_t i;
+
+	if (type == CHECKING_CRC32C)
+	{
+		c ^= 0xffffffff;
+	}
+
+	for (i = 0; i < size; i++)
+	{
+		out[i] = (c >> (8 * i)) & 0xff;
+	}
+
+	return size;
+}
@@ -4,7 +4,7 @@
 #include "spec_types.h"
 
 /****************************************************/
-extern uint8_t crc8_table[256]; /*< 8-bit crc table */
+extern const uint8_t crc8_table[256]; /*< 8-bit crc table */
 
 
 /*! \def crc8_add_byte
@@ -22,6 +22,11 @@ extern uint8_t crc8_table[256]; /*< 8-bit crc table */
  */
 #define xor8_add_byte(c,d)		(c)^=(d)
 
+/*! \def CHECKING_MAX_SIZE
+ * \brief The size of the longest checking (crc32c)
+ */
+#define CHECKING_MAX_SIZE		4
+
 /*!
  * Different checking typed available
  */
@@ -29,13 +34,55 @@ typedef enum
 {
 	CHECKING_CRC8 = 0,  /**< 8bit crc calculation */
 	CHECKING_CHS8 = 1,  /**< 8bit checksum - simply addition of all bytes */
-	CHECKING_XOR8 = 2   /**< 8bit xoring of each byte in message */
+	CHECKING_XOR8 = 2,  /**< 8bit xoring of each byte in message */
+	CHECKING_CRC16 = 3, /**< 16bit crc (CCITT, polynomial 0x1021, initial 0xffff) */
+	CHECKING_CRC32C = 4 /**< 32bit crc (Castagnoli) - the SSE4.2 'crc32' instruction on x86 */
 } CHECKING_TYPE;
 
 /*!
- * \brief init the crc8 table - needed before any usage of the crc generation
+ * \brief init the crc8 table - kept for compatibility, the tables are
+ * constant (see checking_tables.h) and need no initialization
  */
 void init_crc8();
 
-#endif //__CHECKING_H__
+/*!
+ * \brief the number of bytes the checking takes in the frame
+ * \param type one of CHECKING_TYPE
+ * \return 1, 2 or 4 (0 for unknown types)
+ */
+uint8_t checking_size(uint8_t type);
+
+/*!
+ * \brief the initial value of a checking calculation
+ * \param type one of CHECKING_TYPE
+ * \return the value to pass to the first 'checking_update'
+ */
+uint32_t checking_start(uint8_t type);
 
+/*!
+ * \brief adds a block of bytes to a checking calculation
+ * The crc types work on 8 bytes at a time (slicing-by-8 tables
+ * or the crc32 instruction).
+ *
+ * \param type one of CHECKING_TYPE
+ * \param c the value returned by 'checking_start' or the last update
+ * \param data the bytes to be added
+ * \param len the number of bytes
+ *
+ * \return the updated value
+ */
+uint32_t checking_update(uint8_t type, uint32_t c, uint8_t* data, uint16_t len);
+
+/*!
+ * \brief ends a checking calculation
+ * The checking is written into 'out' (little endian).
+ *
+ * \param type one of CHECKING_TYPE
+ * \param c the value returned by the last 'checking_update'
+ * \param out 'checking_size' bytes long buffer
+ *
+ * \return the number of bytes written
+ */
+uint8_t checking_finish(uint8_t type, uint32_t c, uint8_t* out);
+
+#endif //__CHECKING_H__
@@ -4,6 +4,8 @@
 #include "spec_types.h"
 #include "slip.h"
 #include "checking.h"
+#include "dprot_trace.h"
+#include "lzss.h"
 
 /*! \file dprot.h
  * \brief Transport layer
@@ -21,9 +23,90 @@
  * is 256 bytes. Longer messages have to be framed in higher
  * layer. The checking8 byte is one of 'crc8'/'chs8'/
  * /'xor8' checksum methods (you choose) of 'type'+'length'
- * +'data'.
+ * +'data'. Longer checkings ('crc16' - 2 bytes, 'crc32c' -
+ * 4 bytes, little endian) take the place of the checking8
+ * byte and shorten the maximal payload accordingly (see
+ * DPROT_PAYLOAD). Both sides have to use the same checking.
  * The sequencial parity will keep a track on the
  * 'sequencial number' of single bit long.
+ *
+ * Window mode (sliding window ARQ):
+ *
+ *	| 7bit |1bit | 8bit |  8bit  | 'length'-1 bytes |  8bit   |
+ *	|------|-----|------|--------|------------------|---------|
+ *  |wdata |  0  |length|  seq   |   d a t a ...    |checking8|
+ *
+ * In window mode the master keeps up to 'window size' data
+ * frames in flight. Every frame carries an 8-bit sequence
+ * number as the first payload byte. The slave answers with
+ * 'wack' frames carrying the cumulative ack (the next
+ * expected sequence number) and the sequence number of the
+ * frame that triggered the ack, or with 'wnack' frames
+ * carrying the cumulative ack only. Two flavours exist:
+ * Go-Back-N (the slave accepts frames only in order) and
+ * selective repeat (the slave keeps out of order frames in
+ * a reorder buffer and the master resends only the missing
+ * ones).
+ *
+ * Messages (fragmentation):
+ *
+ *	| 8bit  | 32bit (first only) | fragment data ... |
+ *	|-------|--------------------|-------------------|
+ *  |marker |   total length     |                   |
+ *
+ * Messages longer than a single frame are sent as 'data'
+ * ('wdata' in window mode) frames with the DPROT_FLAG_FRAG
+ * bit set in the type byte. The fragment header is the
+ * beginning of the payload (after the window sequence
+ * number): a marker byte (DPROT_FRAG_FIRST/DPROT_FRAG_LAST,
+ * none of them for middle fragments) followed on the first
+ * fragment by the total message length (little endian).
+ * The slave reassembles the message into a pre-allocated
+ * buffer.
+ *
+ * Piggybacked acks (stop-and-wait):
+ *
+ * A slave with piggybacking on holds the ack of a request back
+ * for a short delay. When its answer is ready in time, the
+ * answer ('data' frame with the request's parity) is sent with
+ * the DPROT_FLAG_ACK bit set and acks the request by itself -
+ * a request/response costs two frames instead of three. The
+ * next request (the other parity) acks the answer. A repeated
+ * request is answered with the same answer again.
+ *
+ * Asynchronous requests (stop-and-wait):
+ *
+ * 'dprot_master_submit_data'/'dprot_master_submit_ping' queue a
+ * caller owned request and return at once. The frame is sent
+ * when the requests before it are done; the acks are pushed to
+ * 'dprot_master_async_frame' (from a receive context) and the
+ * retransmissions are driven by 'dprot_master_async_poll' at
+ * the deadline given by 'dprot_master_async_due'. A finished
+ * request is passed to its completion function - or, without
+ * one, kept for 'dprot_master_async_completed'.
+ *
+ * Compression (stop-and-wait):
+ *
+ * The payload of a 'data' frame may be LZSS encoded (lzss.h),
+ * marked by the DPROT_FLAG_LZ bit in the type byte; the checking
+ * covers the encoded frame. The master offers it with the flag
+ * set on a ping ('dprot_master_set_compression') - a slave that
+ * takes it acks with the flag set, an older or unwilling one
+ * with a plain ack. From then on both sides encode the single
+ * frame messages ('dprot_master_send_data_msg', the slave's
+ * answers) of DPROT_LZ_MIN_LEN bytes and more when it makes
+ * them shorter, and send the rest as they are. A ping without
+ * the flag switches it off.
+ *
+ * Forward error correction:
+ *
+ * A link can carry its frames with Reed-Solomon parity (rs.h,
+ * 'dprot_link_set_fec', 'dprot_rx_set_fec') - the frames are
+ * corrected by slip before anything here sees them, so a frame
+ * with a few wrong bytes doesn't cost a nack and a resend. A
+ * frame beyond repair fails its checking and the ARQ takes
+ * over as without the FEC. Both sides have to use the same
+ * number of parity bytes, it isn't negotiated.
  */
 
 /*********************************************************/
@@ -43,16 +126,132 @@
  */
 #define DPROT_MAX_PAYLOAD			(DPROT_MAX_MSG-DPROT_PTOT_SIZE)
 
-/*! \def DPROT_CHECKING
- * \brief The checking algorithm used by dProt
+/*! \def DPROT_CHECKING_DEFAULT
+ * \brief The checking algorithm used by dProt unless set otherwise
+ */
+#define DPROT_CHECKING_DEFAULT		CHECKING_CRC8
+
+/*! \def DPROT_PAYLOAD
+ * \brief The neto payload size with a checking of 's' bytes
  */
-#define DPROT_CHECKING(c,d)			crc8_add_byte((c),(d))
+#define DPROT_PAYLOAD(s)			(DPROT_MAX_MSG-2-(s))
 
 /*! \def DPROT_MASTER_NUM_RETRIES
- * \brief The number of retries on communication
+ * \brief The default number of retries on communication ('dprot_master_set_retries')
  */
 #define DPROT_MASTER_NUM_RETRIES	5
 
+/*! \def DPROT_RTO_INIT
+ * \brief The retransmission timeout before the first round trip is measured [us]
+ */
+#define DPROT_RTO_INIT				(SLIP_RX_TIMEOUT*1000)
+
+/*! \def DPROT_RTO_MIN
+ * \brief The lower bound of the retransmission timeout [us]
+ */
+#define DPROT_RTO_MIN				2000
+
+/*! \def DPROT_RTO_MAX
+ * \brief The upper bound of the retransmission timeout, backoff included [us]
+ */
+#define DPROT_RTO_MAX				1000000
+
+/*! \def DPROT_RTO_GRANULARITY
+ * \brief The resolution of the transport timeouts (milliseconds) [us]
+ */
+#define DPROT_RTO_GRANULARITY		1000
+
+/*! \def DPROT_RTO_MAX_BACKOFF
+ * \brief The maximal number of doublings of the timeout on timeouts in a row
+ */
+#define DPROT_RTO_MAX_BACKOFF		6
+
+/*! \def DPROT_WINDOW_MAX
+ * \brief The maximal number of frames in flight in window mode. The
+ * selective repeat slave needs a reorder buffer of DPROT_REORDER_SIZE
+ * bytes ('dprot_slave_set_reorder_buffer').
+ */
+#ifndef DPROT_WINDOW_MAX
+#define DPROT_WINDOW_MAX			8
+#endif
+
+/*! \def DPROT_REORDER_SIZE
+ * \brief The size of the reorder buffer of a selective repeat slave
+ */
+#define DPROT_REORDER_SIZE			(DPROT_WINDOW_MAX*DPROT_MAX_MSG)
+
+/*! \def DPROT_WINDOW_MAX_PAYLOAD
+ * \brief The neto payload size of a single window mode frame
+ */
+#define DPROT_WINDOW_MAX_PAYLOAD	(DPROT_MAX_PAYLOAD-1)
+
+/*! \def DPROT_TYPE_MASK
+ * \brief The message type bits of the type byte. The rest are flags and parity.
+ */
+#define DPROT_TYPE_MASK				0xf0
+
+/*! \def DPROT_FLAG_FRAG
+ * \brief Type byte flag - the payload starts with a fragment header
+ */
+#define DPROT_FLAG_FRAG				0x08
+
+/*! \def DPROT_FLAG_LZ
+ * \brief Type byte flag - the payload is LZSS encoded (a ping or an ack: compression offered/taken)
+ */
+#define DPROT_FLAG_LZ				0x04
+
+/*! \def DPROT_LZ_MIN_LEN
+ * \brief The shortest payload worth trying to compress
+ */
+#define DPROT_LZ_MIN_LEN			16
+
+/*! \def DPROT_FLAG_ACK
+ * \brief Type byte flag - a slave's data frame that acks the master's frame of the same parity
+ */
+#define DPROT_FLAG_ACK				0x02
+
+/*! \def DPROT_ACK_DELAY
+ * \brief The default delay of a held back ack [us]
+ */
+#define DPROT_ACK_DELAY				500
+
+/*! \def DPROT_FRAG_HEADER
+ * \brief The size of the fragment header (marker byte)
+ */
+#define DPROT_FRAG_HEADER			1
+
+/*! \def DPROT_FRAG_FIRST_HEADER
+ * \brief The size of the first fragment's header (marker and total length)
+ */
+#define DPROT_FRAG_FIRST_HEADER		5
+
+/*! \def DPROT_FRAG_MAX_COUNT
+ * \brief The maximal number of fragments of a single message
+ */
+#define DPROT_FRAG_MAX_COUNT		65535
+
+/*! \def DPROT_STATS_BUCKETS
+ * \brief The buckets of the transaction latency histogram - the
+ * first one up to 64us, every next one twice as wide, the last
+ * one everything above
+ */
+#define DPROT_STATS_BUCKETS			16
+
+/*! \def DPROT_STAT_ADD
+ * \brief Adds to a link counter (see SLIP_STAT_ADD)
+ */
+#define DPROT_STAT_ADD(link, counter, n)	SLIP_STAT_ADD ((link)->stats.counter, n)
+
+/*! \def DPROT_TRACE_EVENT
+ * \brief Adds an event to the trace of a link, if it has one
+ */
+#if DPROT_TRACING
+#define DPROT_TRACE_EVENT(link, event, header, len) \
+	do { if ((link)->trace) dprot_trace_event ((link)->trace, event, header, len); } while (0)
+#else
+#define DPROT_TRACE_EVENT(link, event, header, len)	((void)0)
+#endif
+
 
 
 
@@ -67,7 +266,29 @@ enum
 	DROPT_TYPE_ARP = 0x20,  /**< ARP like 'ping' message */
 	DPROT_TYPE_ACK = 0x30,  /**< Acknowledge signs that a message was accepted by the slave */
 	DPROT_TYPE_NACK = 0x40, /**< Not-Acknowledge - some data was received but it was corrupted */
-	DPROT_TYPE_SYNC = 0xA0  /**< Future use for syncing transmitter to receiver (auto-baudrate) */
+	DPROT_TYPE_WDATA = 0x50,/**< Window mode data message - the first payload byte is the sequence number */
+	DPROT_TYPE_WACK = 0x60, /**< Window mode ack - payload: next expected sequence, acked sequence */
+	DPROT_TYPE_WNACK = 0x70,/**< Window mode nack - payload: next expected sequence */
+	DPROT_TYPE_SYNC = 0xA0  /**< Syncing transmitter to receiver. With a single byte payload it resets the window sequence */
+};
+
+/*********************************************************/
+/*! dProt fragment header markers
+ */
+enum
+{
+	DPROT_FRAG_FIRST = 0x01,    /**< The first fragment of a message */
+	DPROT_FRAG_LAST = 0x02      /**< The last fragment of a message */
+};
+
+/*********************************************************/
+/*! dProt ARQ (retransmission) modes
+ */
+enum
+{
+	DPROT_WINDOW_NONE = 0x00,   /**< 1-bit stop-and-wait (a single frame in flight) */
+	DPROT_WINDOW_GBN = 0x01,    /**< sliding window, Go-Back-N */
+	DPROT_WINDOW_SR = 0x02      /**< sliding window, selective repeat */
 };
 
 /*********************************************************/
@@ -81,38 +302,475 @@ enum
 	DPROT_DATA_ERROR = 0x02, 	/**< The received message had data error - crc8/checksum8/xor8 mismatch */
 	DPROT_LOGICAL_ERROR = 0x03, /**< The received data contained logical error like msg-type inconsistence, lentgh problem */
 	DPROT_MSG_SIZE_ERROR = 0x04,/**< The received data had size problem */
+	DPROT_NO_MSG = 0x05,        /**< The frame was handled by the protocol - no message for the higher layer */
+	DPROT_MSG_READY = 0x06,     /**< A whole fragmented message is waiting in the message buffer */
+	DPROT_TIMEOUT = 0x07,       /**< No answer to any of the retries (asynchronous requests) */
 	DPROT_ACK_ACCEPTED = 0xA0,  /**< Ack message was received */
 	DPROT_NACK_ACCEPTED = 0xB0  /**< Nack message was received */
 };
 
 /*********************************************************/
+/*! \typedef fn_dprot_frame
+ * \brief Called by the receive context for every received frame
+ *
+ * \param user the user pointer given to 'dprot_rx_init'
+ * \param status DPROT_NO_ERROR for a checked frame, otherwise the error
+ * \param frame the whole frame (type, length, data, checking) - in a
+ * buffer of DPROT_MAX_MSG bytes at least
+ * \param len the number of bytes in 'frame'
+ */
+typedef void (*fn_dprot_frame)(void* user, uint8_t status, uint8_t* frame, uint16_t len);
+
+/*! \struct dprot_rx_ctx
+ * \brief Push based (non-blocking) receive context
+ * The received bytes are fed to the context in chunks of any size.
+ * The partial frame (and a pending ESC byte) is kept between the
+ * calls, so a single thread can serve many links.
+ */
+typedef struct
+{
+	slip_decoder decoder;
+	fn_dprot_frame on_frame;
+	void* user;
+	uint8_t checking;
+	uint8_t frame[SLIP_FEC_ENCODED_MAX(DPROT_MAX_MSG)]; /**< room for the FEC parity */
+} dprot_rx_ctx;
+
+/*! \typedef fn_dprot_clock
+ * \brief A free running microsecond clock (it may wrap)
+ */
+typedef uint32_t (*fn_dprot_clock)(void);
+
+/*********************************************************/
+/*! dProt asynchronous request states
+ */
+enum
+{
+	DPROT_REQ_IDLE = 0x00,      /**< Not submitted (or taken from the completion queue) */
+	DPROT_REQ_QUEUED = 0x01,    /**< Waiting for the requests before it */
+	DPROT_REQ_IN_FLIGHT = 0x02, /**< Sent, waiting for the ack */
+	DPROT_REQ_DONE = 0x03       /**< Finished - 'result' is valid */
+};
+
+typedef struct dprot_request_s dprot_request;
+
+/*! \typedef fn_dprot_complete
+ * \brief Called when an asynchronous request is finished
+ * The request can be submitted again from the function.
+ *
+ * \param user the user pointer given at the submit
+ * \param req the request - its 'result' is set
+ */
+typedef void (*fn_dprot_complete)(void* user, dprot_request* req);
+
+/*! \struct dprot_request
+ * \brief An asynchronous request - the handle of a frame in the queue
+ * The memory belongs to the caller, as well as the data buffer -
+ * both have to stay valid until the request is finished. A new
+ * request is zeroed (DPROT_REQ_IDLE).
+ */
+struct dprot_request_s
+{
+	uint8_t header[2];
+	uint8_t check[CHECKING_MAX_SIZE];
+	uint8_t* buffer;
+	uint8_t len;
+	uint8_t retries;            /**< transmissions left */
+	uint8_t resent;             /**< not measured (Karn) */
+	uint8_t state;              /**< DPROT_REQ_XXX */
+	uint8_t result;             /**< DPROT_ACK_ACCEPTED, DPROT_NACK_ACCEPTED, DPROT_DATA_ERROR or DPROT_TIMEOUT */
+	uint32_t started;           /**< the clock at the first transmission */
+	fn_dprot_complete on_complete;
+	void* user;
+	dprot_request* next;
+};
+
+/*! \struct dprot_rtt
+ * \brief The round trip estimator of a master link (Jacobson/Karn)
+ * All the times are in microseconds. Only the frames acked on their
+ * first transmission are measured - the ack of a retransmitted frame
+ * can belong to any of its copies.
+ */
+typedef struct
+{
+	uint32_t srtt;      /**< smoothed round trip time (0 - not measured yet) */
+	uint32_t rttvar;    /**< round trip time variation */
+	uint32_t rto;       /**< retransmission timeout (without backoff) */
+	uint32_t timeout;   /**< the timeout of the running ack wait */
+	uint32_t armed;     /**< the clock when the ack wait was armed */
+	uint8_t backoff;    /**< the number of timeouts in a row */
+	uint32_t seed;      /**< jitter generator state */
+} dprot_rtt;
+
+/*! \struct dprot_stats
+ * \brief The counters of a link
+ * The frame and byte counts include the retransmissions. The
+ * master counts the transactions and their outcomes, the slave
+ * the frames it drops or answers again. All the counters wrap.
+ */
+typedef struct
+{
+	uint32_t tx_frames;         /**< frames sent */
+	uint32_t tx_bytes;          /**< their bytes before the slip encoding */
+	uint32_t tx_wire;           /**< the bytes on the line - ESC and END included */
+	uint32_t tx_escapes;        /**< the bytes added by the encoding (ESC, COBS codes) */
+	uint32_t rx_frames;         /**< frames received */
+	uint32_t rx_bytes;
+	uint32_t rx_wire;           /**< the bytes read from the line (pull transports only) */
+	uint32_t acks_tx;
+	uint32_t nacks_tx;
+	uint32_t acks_rx;           /**< acks (and answers carrying an ack) */
+	uint32_t nacks_rx;
+	uint32_t transactions;      /**< finished requests (master) */
+	uint32_t failures;          /**< ... out of retries (master) */
+	uint32_t retries;           /**< frames sent again (master) */
+	uint32_t timeouts;          /**< ack waits that ran out (master) */
+	uint32_t crc_errors;        /**< frames failing the checking */
+	uint32_t framing_errors;    /**< frames too short or of a wrong length */
+	uint32_t logical_errors;    /**< frames breaking the protocol */
+	uint32_t duplicates;        /**< frames of the previous parity - repeated requests, late acks */
+	uint32_t compressed;        /**< data frames sent compressed */
+	uint32_t compress_saved;    /**< the payload bytes it saved */
+	uint32_t fec_corrected;     /**< bytes corrected by the FEC (pull transports only) */
+	uint32_t fec_failed;        /**< frames beyond its repair (pull transports only) */
+	uint32_t latency[DPROT_STATS_BUCKETS]; /**< acked transactions by latency (with a clock) */
+} dprot_stats;
+
+/*! \struct dprot_link
+ * \brief The state of a single dProt link (master or slave side)
+ * Every dprot_master_* / dprot_slave_* function works on a link, so
+ * a single process can drive any number of independent links. The
+ * side specific state shares the memory - a link is a master or a
+ * slave, as initialized. The big buffers of a slave (the message
+ * and the reorder buffer) belong to the caller, so both sides take
+ * about the same memory.
+ */
+typedef struct dprot_link_s
+{
+	slip_channel channel;
+	uint8_t last_parity;
+	uint8_t window_mode;
+	uint8_t window_size;
+	uint8_t checking;
+	uint8_t check_size;
+	uint8_t compress;               /**< the data frames are compressed (negotiated) */
+	struct dprot_link_s* pool_next; /**< the next free link in the pool */
+	dprot_stats stats;              /**< the slip counters live in 'channel' */
+	dprot_trace* trace;             /**< the event trace, NULL if not traced */
+	
+	union
+	{
+		struct
+		{
+			uint8_t next_seq;
+			uint8_t window_sync;
+			uint8_t retries;                    /**< the transmissions of a frame */
+			uint8_t* msg;
+			uint32_t msg_len;
+			fn_dprot_clock clock;
+			dprot_rtt rtt;
+			uint16_t response_len;              /**< a piggybacked answer waiting for 'wait_for_data' */
+			uint8_t response[DPROT_MAX_MSG];
+			dprot_request* async_head;          /**< the request in flight, then the queued ones */
+			dprot_request* async_tail;
+			dprot_request* done_head;           /**< the finished requests without a completion function */
+			dprot_request* done_tail;
+			uint32_t async_due;                 /**< the ack deadline of the request in flight */
+			uint32_t async_sent;
+		} master;
+		
+		struct
+		{
+			uint8_t expected_seq;
+			uint8_t msg_active;
+			uint8_t* msg_buf;
+			uint32_t msg_size;
+			uint32_t msg_len;
+			uint32_t msg_total;
+			uint8_t piggyback;
+			uint8_t compress_ok;                /**< an offer of compression is taken */
+			uint8_t ack_pending;                /**< the ack of the last request is held back */
+			uint32_t ack_delay;
+			uint32_t ack_due;
+			fn_dprot_clock clock;
+			uint8_t resp_valid;                 /**< the answer to the last request */
+			uint8_t resp_len;
+			uint8_t resp_buf[DPROT_MAX_MSG];
+			uint8_t reorder_valid[DPROT_WINDOW_MAX];
+			uint8_t (*reorder_buf)[DPROT_MAX_MSG]; /**< the caller's, selective repeat only */
+		} slave;
+	};
+} dprot_link;
+
+/*! \struct dprot_link_pool
+ * \brief A pool of links in a single (caller allocated) array
+ * A fresh pool hands out its links lowest address first. The free
+ * links are a stack - a freed link is the next one handed out, so
+ * the links in use stay warm in the cache.
+ */
+typedef struct
+{
+	dprot_link* links;
+	dprot_link* free_list;
+	uint32_t count;
+	uint32_t used;
+} dprot_link_pool;
+
+/*********************************************************/
+
+/*!
+ * \brief Initializing a pool of links
+ *
+ * \param pool the pool to be initialized
+ * \param links the array of links the pool hands out
+ * \param count the number of links in the array
+ *
+ * \return success (DPROT_NO_ERROR), error otherwise
+ */
+uint8_t dprot_link_pool_init (dprot_link_pool* pool, dprot_link* links, uint32_t count);
+
+/*!
+ * \brief Takes a link from the pool
+ * The link has to be initialized with one of the dprot_master_init_* or
+ * dprot_slave_init_* functions.
+ *
+ * \param pool the pool
+ *
+ * \return the link, NULL if the pool is exhausted
+ */
+dprot_link* dprot_link_alloc (dprot_link_pool* pool);
+
+/*!
+ * \brief Returns a link to the pool
+ *
+ * \param pool the pool the link was taken from
+ * \param link the link
+ */
+void dprot_link_free (dprot_link_pool* pool, dprot_link* link);
+
+/*!
+ * \brief Attaches an event trace to a link (after its init)
+ *
+ * \param link the link
+ * \param trace the trace, NULL to stop tracing
+ */
+void dprot_link_set_trace (dprot_link* link, dprot_trace* trace);
+
+/*!
+ * \brief Choose the framing of a link (SLIP after its init)
+ * Both sides have to use the same one - it isn't negotiated,
+ * the frames of the other framing aren't even found.
+ *
+ * \param link the link
+ * \param framing SLIP_FRAMING_SLIP or SLIP_FRAMING_COBS
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on unknown framing
+ */
+uint8_t dprot_link_set_framing (dprot_link* link, uint8_t framing);
+
+/*!
+ * \brief Protect the frames of a link by Reed-Solomon parity
+ * Both sides have to use the same 'nroots'.
+ *
+ * \param link the link
+ * \param nroots the parity bytes of every block of 255 - nroots frame
+ * bytes (nroots / 2 bytes corrected), 0 for none (after the init)
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on a bad 'nroots'
+ */
+uint8_t dprot_link_set_fec (dprot_link* link, uint8_t nroots);
+
+/*!
+ * \brief Takes a snapshot of the counters of a link
+ * The counters are kept without locks by the thread driving the
+ * link - the snapshot can be taken from any thread, every counter
+ * is read whole (the set of them isn't a single instant).
+ *
+ * \param link the link
+ * \param stats the copy
+ */
+void dprot_link_stats (dprot_link* link, dprot_stats* stats);
+
+/*!
+ * \brief Clears the counters of a link
+ * From the thread driving the link only.
+ *
+ * \param link the link
+ */
+void dprot_link_stats_reset (dprot_link* link);
+
+/*!
+ * \brief Formats a snapshot as a JSON object
+ *
+ * \param stats the snapshot
+ * \param buf the text
+ * \param size the size of 'buf' (1024 is enough)
+ *
+ * \return the length of the text, 0 if it didn't fit
+ */
+uint16_t dprot_stats_json (const dprot_stats* stats, char* buf, uint16_t size);
+
+/*!
+ * \brief Adds a transaction to the latency histogram
+ *
+ * \param stats the counters of the link
+ * \param us the latency [us]
+ */
+void dprot_stats_latency (dprot_stats* stats, uint32_t us);
+
+/*********************************************************/
+
+/*!
+ * \brief Calculates the checking of a frame
+ * The checking covers 'head' followed by 'data'.
+ *
+ * \param checking one of CHECKING_TYPE
+ * \param head the beginning of the frame (type, length, ...)
+ * \param head_len the number of bytes in 'head'
+ * \param data the rest of the frame
+ * \param len the number of bytes in 'data'
+ * \param out the checking bytes (up to CHECKING_MAX_SIZE)
+ *
+ * \return the number of checking bytes
+ */
+uint8_t dprot_calc_checking (uint8_t checking, uint8_t* head, uint16_t head_len, uint8_t* data, uint16_t len, uint8_t* out);
+
+/*!
+ * \brief Checks the length and the checking bytes of a whole frame
+ *
+ * \param checking one of CHECKING_TYPE
+ * \param frame the frame (type, length, data, checking)
+ * \param len the number of received bytes
+ *
+ * \return result:
+ * \return      DPROT_NO_ERROR - the frame is consistent
+ * \return      DPROT_FRAMING_ERROR - too short to be a frame
+ * \return      DPROT_LOGICAL_ERROR - the length field doesn't match the frame
+ * \return      DPROT_DATA_ERROR - the crc/chs/xor didn't match
+ */
+uint8_t dprot_check_frame (uint8_t checking, uint8_t* frame, uint16_t len);
+
+/*!
+ * \brief Decodes the payload of a checked DPROT_FLAG_LZ frame in place
+ * The flag is cleared and the length set to the decoded payload -
+ * the checking bytes don't match the frame any more.
+ *
+ * \param frame the frame
+ * \param size the room in 'frame'
+ *
+ * \return DPROT_NO_ERROR, DPROT_LOGICAL_ERROR on a broken payload
+ * or a payload longer than a frame
+ */
+uint8_t dprot_unpack_frame (uint8_t* frame, uint16_t size);
+
+/*!
+ * \brief Initializing a push based receive context
+ *
+ * \param ctx the context to be initialized
+ * \param on_frame the function called for every received frame
+ * \param user the pointer passed to 'on_frame'
+ */
+void dprot_rx_init (dprot_rx_ctx* ctx, fn_dprot_frame on_frame, void* user);
+
+/*!
+ * \brief Set the checking the receive context verifies the frames with
+ *
+ * \param ctx the receive context
+ * \param checking one of CHECKING_TYPE (DPROT_CHECKING_DEFAULT after init)
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on unknown checking
+ */
+uint8_t dprot_rx_set_checking (dprot_rx_ctx* ctx, uint8_t checking);
+
+/*!
+ * \brief Set the framing the receive context reads (the link's one)
+ *
+ * \param ctx the receive context
+ * \param framing SLIP_FRAMING_SLIP (after init) or SLIP_FRAMING_COBS
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on unknown framing
+ */
+uint8_t dprot_rx_set_framing (dprot_rx_ctx* ctx, uint8_t framing);
+
+/*!
+ * \brief Set the FEC of the frames the receive context reads (the link's one)
+ * The corrections are counted in 'decoder.fec_corrected' and
+ * 'decoder.fec_failed'.
+ *
+ * \param ctx the receive context
+ * \param nroots the parity bytes of a block, 0 for none (after init)
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on a bad 'nroots'
+ */
+uint8_t dprot_rx_set_fec (dprot_rx_ctx* ctx, uint8_t nroots);
+
+/*!
+ * \brief Feeds received bytes to the receive context
+ * Never blocks. 'on_frame' is called for every frame that ends
+ * inside the chunk, partial frames are kept for the next call.
+ *
+ * \param ctx the receive context
+ * \param bytes the received (SLIP encoded) bytes
+ * \param n the number of bytes
+ */
+void dprot_rx_feed (dprot_rx_ctx* ctx, uint8_t* bytes, uint16_t n);
 
 /*!
  * \brief Initializing the master side protocol of the dProt
  *
+ * \param link the link context
  * \param put_function the 'putchar' function to be assigned to the lower layers
  * \param get_function the 'getchar' function to be assigned to the lower layers
  *
  * \return success (DPROT_NO_ERROR), error otherwise
  *
  */
-uint8_t dprot_master_init_protocol (fn_put_char put_function, fn_get_char_to get_function);
+uint8_t dprot_master_init_protocol (dprot_link* link, fn_put_char put_function, fn_get_char_to get_function);
+
+/*!
+ * \brief Initializing the master side protocol of the dProt over a bulk transport
+ *
+ * \param link the link context
+ * \param write_function the buffer writing function to be assigned to the lower layers
+ * \param read_function the block reading function to be assigned to the lower layers
+ * \param io_ctx the transport context passed to both functions
+ *
+ * \return success (DPROT_NO_ERROR), error otherwise
+ *
+ */
+uint8_t dprot_master_init_protocol_buf (dprot_link* link, fn_write_buf write_function, fn_read_buf read_function, void* io_ctx);
 
 /*!
  * \brief dProt master send ping message to the slave
+ * \param link the link context
  * \return success (DPROT_NO_ERROR), error otherwise
  */
-uint8_t dprot_master_send_ping ( void );
+uint8_t dprot_master_send_ping (dprot_link* link);
+
+/*!
+ * \brief Offers the slave the compression of the data frames
+ * A ping with the DPROT_FLAG_LZ flag - the compression is on when
+ * the slave acks with the flag. Switching it off is a plain ping.
+ *
+ * \param link the link context
+ * \param enable 1 - compression offered, 0 - off
+ *
+ * \return DPROT_ACK_ACCEPTED when the ping was acked ('link->compress'
+ * tells if the slave took it), the error of the ping otherwise
+ */
+uint8_t dprot_master_set_compression (dprot_link* link, uint8_t enable);
 
 /*!
  * \brief dProt master send sync message to the slave
+ * \param link the link context
  * \return success (DPROT_NO_ERROR), error otherwise
  */
-uint8_t dprot_master_send_sync ( void );
+uint8_t dprot_master_send_sync (dprot_link* link);
 
 /*!
  * \brief dProt master send data to the slave
  *
+ * \param link the link context
  * \param pre-allocated buffer to be sent to the slave
  * \param the number of bytes of buffer to be sent
  *
@@ -120,40 +778,339 @@ uint8_t dprot_master_send_sync ( void );
  * \return          DPROT_NO_ERROR - Success
  * \return          DPROT_MSG_SIZE_ERROR - the requested buffer is too big for a single transaction.
  */
-uint8_t dprot_master_send_data_msg (uint8_t* buffer, uint8_t len);
+uint8_t dprot_master_send_data_msg (dprot_link* link, uint8_t* buffer, uint8_t len);
+
+/*!
+ * \brief Set the ARQ mode of the master
+ *
+ * \param link the link context
+ * \param mode one of DPROT_WINDOW_NONE/DPROT_WINDOW_GBN/DPROT_WINDOW_SR
+ * \param size the number of frames in flight (1..DPROT_WINDOW_MAX)
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on wrong parameters
+ */
+uint8_t dprot_master_set_window (dprot_link* link, uint8_t mode, uint8_t size);
+
+/*!
+ * \brief Set the checking of the master's frames (must match the slave)
+ *
+ * \param link the link context
+ * \param checking one of CHECKING_TYPE
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on unknown checking
+ */
+uint8_t dprot_master_set_checking (dprot_link* link, uint8_t checking);
+
+/*!
+ * \brief Set the clock of the master's round trip measurement
+ * Without a clock the master waits SLIP_RX_TIMEOUT for every ack.
+ * With a clock the wait is the retransmission timeout derived from
+ * the measured round trips, doubled on every timeout in a row (up
+ * to DPROT_RTO_MAX) and with random jitter added. The clock bounds
+ * the whole wait - the bytes of line noise don't extend it
+ * ('slip_set_clock').
+ *
+ * \param link the link context
+ * \param clock the microsecond clock, NULL to switch the measurement off
+ */
+void dprot_master_set_clock (dprot_link* link, fn_dprot_clock clock);
+
+/*!
+ * \brief Seed the random jitter of the master's retransmission timeouts
+ * Every link starts with its own seed - a fixed one makes the runs
+ * of a simulation repeatable.
+ *
+ * \param link the link context
+ * \param seed the seed (not 0)
+ */
+void dprot_master_set_seed (dprot_link* link, uint32_t seed);
+
+/*!
+ * \brief Set the number of transmissions of a frame before giving up
+ *
+ * \param link the link context
+ * \param retries the transmissions (DPROT_MASTER_NUM_RETRIES by default)
+ *
+ * \return      DPROT_NO_ERROR or DPROT_LOGICAL_ERROR if 'retries' is 0
+ */
+uint8_t dprot_master_set_retries (dprot_link* link, uint8_t retries);
+
+/*!
+ * \brief The smoothed round trip time of the master link
+ * \param link the link context
+ * \return the round trip time [us], 0 if not measured yet
+ */
+uint32_t dprot_master_get_rtt (dprot_link* link);
+
+/*!
+ * \brief The current retransmission timeout of the master link
+ * \param link the link context
+ * \return the timeout with the backoff in effect, without jitter [us]
+ */
+uint32_t dprot_master_get_rto (dprot_link* link);
+
+/*!
+ * \brief dProt master send a batch of data messages to the slave
+ * In window mode several frames are kept in flight at once. In
+ * DPROT_WINDOW_NONE mode the messages are sent one by one using
+ * 'dprot_master_send_data_msg'.
+ *
+ * \param link the link context
+ * \param buffers the pre-allocated buffers to be sent to the slave
+ * \param lens the number of bytes to be sent from each buffer
+ * \param count the number of buffers
+ * \param acked if not NULL, returns the number of buffers acked in order
+ *
+ * \return operation result:
+ * \return          DPROT_ACK_ACCEPTED - all the buffers were acked
+ * \return          DPROT_NACK_ACCEPTED - retries ran out on nack
+ * \return          DPROT_DATA_ERROR - retries ran out on timeout or junk
+ * \return          DPROT_MSG_SIZE_ERROR - one of the buffers is too big (DPROT_WINDOW_MAX_PAYLOAD
+ *                  with the 8-bit checkings, one byte less per extra checking byte)
+ */
+uint8_t dprot_master_send_data_window (dprot_link* link, uint8_t** buffers, uint8_t* lens, uint16_t count, uint16_t* acked);
+
+/*!
+ * \brief dProt master send a message of any size to the slave
+ * The message is fragmented into data frames (window frames in
+ * window mode) and reassembled by the slave. A single result is
+ * returned for the whole message.
+ *
+ * \param link the link context
+ * \param buffer the message to be sent
+ * \param len the number of bytes of the message
+ *
+ * \return operation result:
+ * \return          DPROT_ACK_ACCEPTED - all the fragments were acked
+ * \return          DPROT_NACK_ACCEPTED - retries ran out on nack
+ * \return          DPROT_DATA_ERROR - retries ran out on timeout or junk
+ * \return          DPROT_MSG_SIZE_ERROR - too many fragments (DPROT_FRAG_MAX_COUNT)
+ */
+uint8_t dprot_master_send_message (dprot_link* link, uint8_t* buffer, uint32_t len);
 
 /*!
  * \brief master node waiting for the ack/nack message from the slave
+ * \param link the link context
  * \return result:
- * \return      DPROT_ACK_ACCEPTED - ack was received
+ * \return      DPROT_ACK_ACCEPTED - ack (or an answer carrying the ack) was received
  * \return      DPROT_NACK_ACCEPTED - nack was received
  * \return      DPROT_DATA_ERROR - 	the crc/chs/xor didn't match or unexpected type of msg was received
  */
-uint8_t dprot_master_wait_for_ack_nack ( void );
+uint8_t dprot_master_wait_for_ack_nack (dprot_link* link);
 
 
 /*!
  * \brief master node waiting a data message from the slave.
  * \brief It can happen adter the master intiated data request transactions.
+ * An answer that acked the request (DPROT_FLAG_ACK) was already received
+ * by the request's ack wait and is returned at once.
+ * \param link the link context
  * \return result:
  * \return          DPROT_NO_ERROR - Success
  * \retrun          DPROT_MAX_PAYLOAD - data came corrupted - length is too big
- * \return          DPROT_DATA_ERROR - checking error
+ * \return          DPROT_DATA_ERROR - checking error or no frame came in time
  * \return          DPROT_LOGICAL_ERROR - the incoming frame didn't contain data type of message
  */
-uint8_t dprot_master_wait_for_data (uint8_t* buffer, uint8_t max_len);
+uint8_t dprot_master_wait_for_data (dprot_link* link, uint8_t* buffer, uint8_t max_len);
+
+/*!
+ * \brief Queue a data frame for sending - returns at once
+ * The link needs a clock ('dprot_master_set_clock') for the ack
+ * deadlines. Don't mix the asynchronous and the blocking calls on
+ * a single link.
+ *
+ * \param link the link context
+ * \param req the request (the handle)
+ * \param buffer the data - valid until the request is finished
+ * \param len the number of bytes to be sent
+ * \param on_complete the completion function, NULL for the completion queue
+ * \param user the pointer passed to 'on_complete'
+ *
+ * \return DPROT_NO_ERROR - queued (sent if the link was idle)
+ * \return DPROT_MSG_SIZE_ERROR - the buffer doesn't fit a frame
+ * \return DPROT_LOGICAL_ERROR - no clock or the request is in use (queued,
+ * in flight or not taken from the completion queue yet)
+ */
+uint8_t dprot_master_submit_data (dprot_link* link, dprot_request* req, uint8_t* buffer, uint8_t len,
+								  fn_dprot_complete on_complete, void* user);
+
+/*!
+ * \brief Queue a ping - returns at once
+ * Like 'dprot_master_submit_data' with an ARP frame.
+ */
+uint8_t dprot_master_submit_ping (dprot_link* link, dprot_request* req, fn_dprot_complete on_complete, void* user);
+
+/*!
+ * \brief Pass a received frame to the asynchronous requests
+ * The signature is the one of 'fn_dprot_frame' with the link as
+ * the user pointer, so it can be given directly to 'dprot_rx_init'.
+ * An answer of the slave is kept for 'dprot_master_wait_for_data'.
+ *
+ * \param user the link context
+ * \param status the check result of the receive context
+ * \param frame the received frame
+ * \param len the number of bytes in 'frame'
+ */
+void dprot_master_async_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len);
+
+/*!
+ * \brief Retransmit or fail the request in flight if its deadline passed
+ * \param link the link context
+ * \return DPROT_NO_ERROR
+ */
+uint8_t dprot_master_async_poll (dprot_link* link);
+
+/*!
+ * \brief The ack deadline of the request in flight
+ * \param link the link context
+ * \param due returns the deadline (the link's clock) [us]
+ * \return 1 if a request is in flight, 0 if the link is idle
+ */
+uint8_t dprot_master_async_due (dprot_link* link, uint32_t* due);
+
+/*!
+ * \brief Take the slave's answer kept by 'dprot_master_async_frame'
+ * The blocking counterpart is 'dprot_master_wait_for_data'.
+ *
+ * \param link the link context
+ * \param buffer the buffer for the whole frame (type, length, data, checking)
+ * \param max_len the size of 'buffer'
+ * \return the number of bytes copied, 0 if no answer is kept
+ */
+uint16_t dprot_master_async_answer (dprot_link* link, uint8_t* buffer, uint16_t max_len);
+
+/*!
+ * \brief Take a finished request from the completion queue
+ * Only the requests submitted without a completion function
+ * get there.
+ *
+ * \param link the link context
+ * \return the oldest finished request, NULL if none
+ */
+dprot_request* dprot_master_async_completed (dprot_link* link);
 
 /*!
  * \brief Initializing the slave side protocol of the dProt
  *
+ * \param link the link context
  * \param put_function the 'putchar' function to be assigned to the lower layers
  * \param get_function the 'getchar' function to be assigned to the lower layers
  *
  * \return success (DPROT_NO_ERROR), error otherwise
  *
  */
-uint8_t dprot_slave_init_protocol (fn_put_char put_function, fn_get_char get_function);
+uint8_t dprot_slave_init_protocol (dprot_link* link, fn_put_char put_function, fn_get_char get_function);
+
+/*!
+ * \brief Initializing the slave side protocol of the dProt over a bulk transport
+ * The slave reads the transport with no timeout (SLIP_RX_BLOCKING).
+ *
+ * \param link the link context
+ * \param write_function the buffer writing function to be assigned to the lower layers
+ * \param read_function the block reading function to be assigned to the lower layers
+ * \param io_ctx the transport context passed to both functions
+ *
+ * \return success (DPROT_NO_ERROR), error otherwise
+ *
+ */
+uint8_t dprot_slave_init_protocol_buf (dprot_link* link, fn_write_buf write_function, fn_read_buf read_function, void* io_ctx);
+
+/*!
+ * \brief Set the ARQ mode of the slave (must match the master)
+ * The selective repeat mode needs a reorder buffer first
+ * ('dprot_slave_set_reorder_buffer').
+ *
+ * \param link the link context
+ * \param mode one of DPROT_WINDOW_NONE/DPROT_WINDOW_GBN/DPROT_WINDOW_SR
+ * \param size the number of frames in flight (1..DPROT_WINDOW_MAX)
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on wrong parameters
+ * or selective repeat without a reorder buffer
+ */
+uint8_t dprot_slave_set_window (dprot_link* link, uint8_t mode, uint8_t size);
+
+
+/*!
+ * \brief Set the checking of the slave's frames (must match the master)
+ *
+ * \param link the link context
+ * \param checking one of CHECKING_TYPE
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR on unknown checking
+ */
+uint8_t dprot_slave_set_checking (dprot_link* link, uint8_t checking);
+
+/*!
+ * \brief Lets the slave take the master's offer of compression
+ * The compressed frames are always decoded in the buffer of the
+ * received frame - one that doesn't fit it once decoded is refused.
+ *
+ * \param link the link context
+ * \param enable 1 - an offer is taken, 0 - refused (and off)
+ *
+ * \return success (DPROT_NO_ERROR)
+ */
+uint8_t dprot_slave_set_compression (dprot_link* link, uint8_t enable);
+
+/*!
+ * \brief Set the piggybacking of the slave's acks (stop-and-wait)
+ * The ack of a delivered request is held back until the answer
+ * ('dprot_slave_send_data_msg') carries it, the 'delay' passes
+ * ('dprot_slave_poll'), the next frame comes in or the slave waits
+ * for the next message ('dprot_slave_wait_for_msg'). The master has
+ * to know the DPROT_FLAG_ACK frames.
+ *
+ * \param link the link context
+ * \param enable 1 - piggybacking on, 0 - every request acked at once
+ * \param clock the microsecond clock of the delay, NULL - no delay timer
+ * \param delay the longest hold of an ack [us] (DPROT_ACK_DELAY)
+ *
+ * \return success (DPROT_NO_ERROR)
+ */
+uint8_t dprot_slave_set_piggyback (dprot_link* link, uint8_t enable, fn_dprot_clock clock, uint32_t delay);
+
+/*!
+ * \brief Sends a held back ack whose delay ran out
+ * Has to be called periodically by a non-blocking slave with
+ * piggybacking on.
+ *
+ * \param link the link context
+ * \return success (DPROT_NO_ERROR)
+ */
+uint8_t dprot_slave_poll (dprot_link* link);
+
+/*!
+ * \brief Set the buffer the slave reassembles the fragmented messages into
+ * Fragmented messages bigger than 'size' (or without a buffer) are
+ * dropped with DPROT_MSG_SIZE_ERROR.
+ *
+ * \param link the link context
+ * \param buffer pre-allocated message buffer
+ * \param size the size of the buffer
+ *
+ * \return success (DPROT_NO_ERROR)
+ */
+uint8_t dprot_slave_set_message_buffer (dprot_link* link, uint8_t* buffer, uint32_t size);
+
+/*!
+ * \brief Set the buffer the selective repeat slave keeps the frames
+ * received out of order in
+ *
+ * \param link the link context
+ * \param buffer pre-allocated reorder buffer, NULL to remove it
+ * \param size the size of the buffer (at least DPROT_REORDER_SIZE)
+ *
+ * \return success (DPROT_NO_ERROR), DPROT_LOGICAL_ERROR if it is too
+ * small or removed in the selective repeat mode
+ */
+uint8_t dprot_slave_set_reorder_buffer (dprot_link* link, uint8_t* buffer, uint32_t size);
 
+/*!
+ * \brief The length of the last reassembled message
+ * \param link the link context
+ * \return the number of bytes in the message buffer
+ */
+uint32_t dprot_slave_message_len (dprot_link* link);
 
 /*!
  * \brief dProt slave waits for data message.
@@ -165,8 +1122,15 @@ uint8_t dprot_slave_init_protocol (fn_put_char put_function, fn_get_char get_fun
  * which accumulate to additional 3 bytes. That means that
  * the maximum possible 'payload length' is 256-3=253 bytes
  * per transaction.
+ * In window mode the messages are returned in order, the
+ * buffer holds the whole frame (the sequence number is
+ * the first data byte).
+ * Fragments are collected in the message buffer (see
+ * 'dprot_slave_set_message_buffer') and DPROT_MSG_READY is
+ * returned once the whole message is there.
 
  *
+ * \param link the link context
  * \param pre-allocated buffer to store the rx elements
  * \param maximal length of buffer.
  *
@@ -175,27 +1139,67 @@ uint8_t dprot_slave_init_protocol (fn_put_char put_function, fn_get_char get_fun
  * \return      DPROT_FRAMING_ERROR (faming error occured)
  * \return      DPROT_DATA_ERROR (the crc/chs/xor didn't match)
  * \return      DPROT_LOGICAL_ERROR - sync/length or something else went wrong
+ * \return      DPROT_MSG_READY - a whole fragmented message was reassembled
+ * \return      DPROT_MSG_SIZE_ERROR - a fragmented message doesn't fit the message buffer
+ */
+uint8_t dprot_slave_wait_for_msg (dprot_link* link, uint8_t* buffer, uint16_t max_len);
+
+/*!
+ * \brief dProt slave handles a single received frame
+ * The non-blocking counterpart of 'dprot_slave_wait_for_msg' for
+ * the frames of a receive context (see 'dprot_rx_feed'). The
+ * answers (ack/nack) are sent from here.
+ *
+ * \param link the link context
+ * \param buffer the received frame
+ * \param actual_rx the number of bytes in the frame
+ * \param max_len the size of 'buffer' (a compressed frame is decoded in it)
+ *
+ * \return the result:
+ * \return      DPROT_NO_ERROR - 'buffer' holds a message for the higher layer
+ * \return      DPROT_NO_MSG - the frame was handled (a repeated request too),
+ *              nothing to deliver
+ * \return      otherwise the errors of 'dprot_slave_wait_for_msg'
+ */
+uint8_t dprot_slave_process_msg (dprot_link* link, uint8_t* buffer, uint16_t actual_rx, uint16_t max_len);
+
+/*!
+ * \brief dProt slave takes the next message out of the reorder buffer
+ * In selective repeat mode an in-order message can release messages
+ * that arrived before it. Should be called after every delivered
+ * message of 'dprot_slave_process_msg' until it returns DPROT_NO_MSG.
+ *
+ * \param link the link context
+ * \param buffer pre-allocated buffer to store the message
+ * \param max_len maximal length of buffer
+ *
+ * \return DPROT_NO_ERROR if a message was copied, DPROT_MSG_READY if it
+ * completed a fragmented message, DPROT_NO_MSG otherwise
  */
-uint8_t dprot_slave_wait_for_msg (uint8_t* buffer, uint8_t max_len);
+uint8_t dprot_slave_reordered_msg (dprot_link* link, uint8_t* buffer, uint16_t max_len);
 
 
 /*!
  * \brief dProt slave sending ack to the master
+ * \param link the link context
  * \return success (DPROT_NO_ERROR), error otherwise
  */
-uint8_t dprot_slave_send_ack ( void );
+uint8_t dprot_slave_send_ack (dprot_link* link);
 
 /*!
  * \brief dProt slave sends 'nack' to the master (message error)
+ * \param link the link context
  * \return success (DPROT_NO_ERROR), error otherwise
  */
-uint8_t dprot_slave_send_nack ( void );
+uint8_t dprot_slave_send_nack (dprot_link* link);
 
 /*!
  * \brief dProt slave send data to the master
  * This function will be always conducted by the slave in order to
- * send back data to the initiator (master)
+ * send back data to the initiator (master). With piggybacking on
+ * it carries the held back ack of the request.
  *
+ * \param link the link context
  * \param pre-allocated buffer to be sent to the master
  * \param the number of bytes of buffer to be sent
  *
@@ -203,7 +1207,7 @@ uint8_t dprot_slave_send_nack ( void );
  * \return          DPROT_NO_ERROR - Success
  * \return          DPROT_MSG_SIZE_ERROR - the requested buffer is too big for a single transaction.
  */
-uint8_t dprot_slave_send_data_msg (uint8_t* buffer, uint8_t len);
+uint8_t dprot_slave_send_data_msg (dprot_link* link, uint8_t* buffer, uint8_t len);
 
 #endif //__DPROT_H__
 
@@ -0,0 +1,1547 @@
+/*
+ * dProt hot path benchmarks
+ *
+ * build: make dprot_bench
+ * run:   ./dprot_bench [-j] [encode|decode|slip|framing|fec|checking|trace|lz|queue|protocol|window ...]
+ *
+ * Every result is a line of text, with -j a JSON object per line
+ * (group, variant, parameters, value, unit) to be kept and
+ * compared between the versions ('make bench').
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include "slip.h"
+#include "checking.h"
+#include "ts_char_queue.h"
+#include "dprot.h"
+#include "dprot_loop.h"
+#include "lzss.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_BUF_SIZE		4096
+#define BENCH_MIN_BYTES		(32*1024*1024)
+#define BENCH_QUEUE_BYTES	(8*1024*1024)
+#define BENCH_TRANSACTIONS	20000
+#define BENCH_WINDOW_MSGS	2000
+#define BENCH_WINDOW_ERRORS	2048	// a byte in that many spoiled on the window line
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION		"unknown"
+#endif
+
+uint8_t bench_in[BENCH_BUF_SIZE];
+uint8_t bench_out[SLIP_ENCODED_MAX(BENCH_BUF_SIZE)];
+uint8_t bench_ref[SLIP_ENCODED_MAX(BENCH_BUF_SIZE)];
+uint16_t bench_ref_len = 0;
+
+//===============================================
+// cycles on x86, nanoseconds elsewhere
+static unsigned long long bench_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc ();
+#else
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+//===============================================
+// the results - a line of text or a JSON object each. the
+// parameters are 'nparams' pairs of a name and a double
+int bench_json = 0;
+
+void bench_result (const char* group, const char* variant, double value, const char* unit, int nparams, ...)
+{
+	char params[128] = "";
+	const char* name;
+	int len = 0;
+	double v;
+	va_list ap;
+	int i;
+
+	va_start (ap, nparams);
+	for (i = 0; i < nparams; i++)
+	{
+		name = va_arg (ap, const char*);
+		v = va_arg (ap, double);
+		if (bench_json) len += snprintf (params + len, sizeof(params) - len, ",\"%s\":%g", name, v);
+		else len += snprintf (params + len, sizeof(params) - len, "%s%s=%g", i ? " " : "", name, v);
+	}
+	va_end (ap);
+
+	if (bench_json)
+	{
+		printf("{\"group\":\"%s\",\"variant\":\"%s\"%s,\"value\":%.4f,\"unit\":\"%s\"}\n",
+			   group, variant, params, value, unit);
+	}
+	else
+	{
+		printf("%-9s %-13s %-28s %12.3f %s\n", group, variant, params, value, unit);
+	}
+	fflush (stdout);
+}
+
+static double bench_seconds (struct timespec* start, struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+//===============================================
+// the reference - the byte by byte 'slip_tx' loop
+// writing through a per-byte put function
+void bench_ref_put_char (uint8_t c)
+{
+	bench_ref[bench_ref_len++] = c;
+}
+
+uint16_t bench_ref_encode (fn_put_char put, uint8_t* buffer, uint16_t len, uint8_t start_end)
+{
+	if (start_end&SLIP_MSG_START) put (SLIP_END);
+	while (len--)
+	{
+		switch (*buffer)
+		{
+			case SLIP_END:
+				put (SLIP_ESC);
+				put (SLIP_DATA_END);
+				break;
+			case SLIP_ESC:
+				put (SLIP_ESC);
+				put (SLIP_DATA_ESC);
+				break;
+			default:
+				put (*buffer);
+		}
+		buffer ++;
+	}
+	if (start_end&SLIP_MSG_END) put (SLIP_END);
+	return bench_ref_len;
+}
+
+//===============================================
+// random payload with END/ESC bytes at 'density'
+void bench_fill (uint8_t* buffer, uint16_t len, double density)
+{
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if ((double)rand() / RAND_MAX < density)
+		{
+			buffer[i] = (rand() & 1) ? SLIP_END : SLIP_ESC;
+		}
+		else
+		{
+			do buffer[i] = rand(); while (buffer[i] == SLIP_END || buffer[i] == SLIP_ESC);
+		}
+	}
+}
+
+//===============================================
+// the encoders must produce the same bytes as 'slip_tx'
+int bench_check_encode (uint8_t kernel)
+{
+	uint16_t lens[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 255, 1000, BENCH_BUF_SIZE };
+	double densities[] = { 0.0, 0.01, 0.5, 1.0 };
+	uint8_t stages[] = { SLIP_MSG_START, SLIP_MSG_MIDDLE, SLIP_MSG_END, SLIP_MSG_REG };
+	unsigned int l, d, s;
+	uint16_t n;
+
+	slip_set_kernel (kernel);
+
+	for (l = 0; l < sizeof(lens)/sizeof(lens[0]); l++)
+	for (d = 0; d < sizeof(densities)/sizeof(densities[0]); d++)
+	for (s = 0; s < sizeof(stages); s++)
+	{
+		bench_fill (bench_in, lens[l], densities[d]);
+		bench_ref_len = 0;
+		bench_ref_encode (bench_ref_put_char, bench_in, lens[l], stages[s]);
+		n = slip_encode (bench_in, lens[l], bench_out, stages[s]);
+
+		if (n != bench_ref_len || memcmp (bench_out, bench_ref, n))
+		{
+			fprintf(stderr, "slip_encode mismatch: kernel %u len %u density %.2f stage %u\n",
+				   kernel, lens[l], densities[d], stages[s]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//===============================================
+// encoding cycles per input byte
+void bench_encode (void)
+{
+	uint16_t sizes[] = { 16, 64, 253, 1024, BENCH_BUF_SIZE };
+	double densities[] = { 0.0, 0.01, 0.1 };
+	const char* names[] = { "", "scalar", "sse2", "avx2" };
+	uint8_t kernels[] = { SLIP_KERNEL_SCALAR, SLIP_KERNEL_SSE2, SLIP_KERNEL_AVX2 };
+	unsigned long long start, ticks;
+	unsigned long iters, it;
+	volatile uint16_t sink = 0;
+	unsigned int s, d, k;
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	for (d = 0; d < sizeof(densities)/sizeof(densities[0]); d++)
+	{
+		bench_fill (bench_in, sizes[s], densities[d]);
+		iters = BENCH_MIN_BYTES / sizes[s];
+
+		// the per-byte callback path
+		start = bench_ticks ();
+		for (it = 0; it < iters; it++)
+		{
+			bench_ref_len = 0;
+			sink += bench_ref_encode (bench_ref_put_char, bench_in, sizes[s], SLIP_MSG_REG);
+		}
+		ticks = bench_ticks () - start;
+		bench_result ("encode", "per-byte", (double)ticks / ((double)iters * sizes[s]), "ticks/byte",
+					  2, "size", (double)sizes[s], "escapes", densities[d]);
+
+		for (k = 0; k < sizeof(kernels); k++)
+		{
+			if (slip_set_kernel (kernels[k]) != kernels[k]) continue;
+
+			start = bench_ticks ();
+			for (it = 0; it < iters; it++)
+			{
+				sink += slip_encode (bench_in, sizes[s], bench_out, SLIP_MSG_REG);
+			}
+			ticks = bench_ticks () - start;
+			bench_result ("encode", names[kernels[k]], (double)ticks / ((double)iters * sizes[s]), "ticks/byte",
+						  2, "size", (double)sizes[s], "escapes", densities[d]);
+		}
+	}
+}
+
+//===============================================
+// the reference - the byte by byte 'slip_rx' loop
+// reading through a per-byte get function
+uint8_t* bench_stream = NULL;
+uint32_t bench_stream_pos = 0;
+uint32_t bench_stream_len = 0;
+
+uint8_t bench_ref_get_char (void)
+{
+	return bench_stream[bench_stream_pos++];
+}
+
+uint16_t bench_ref_decode (fn_get_char get, uint8_t* buffer, uint16_t len)
+{
+	uint16_t bytes_read_so_far = 0;
+	uint8_t c;
+
+	while (1)
+	{
+		c = get ();
+		switch (c)
+		{
+			case SLIP_END:
+				if (bytes_read_so_far) return bytes_read_so_far;
+				break;
+			case SLIP_ESC:
+				c = get ();
+				if (c==SLIP_DATA_END) c = SLIP_END;
+				else if (c==SLIP_DATA_ESC) c = SLIP_ESC;
+			default:
+				if (bytes_read_so_far<len) buffer[bytes_read_so_far++] = c;
+		}
+	}
+}
+
+//===============================================
+// a stream of 'frames' encoded frames, with some line noise -
+// empty frames, broken escapes and frames too long for the
+// receiver. returns the stream length.
+uint32_t bench_make_stream (uint8_t* stream, uint32_t frames, uint16_t size, double density)
+{
+	uint32_t n = 0;
+	uint32_t f;
+	uint16_t len;
+
+	for (f = 0; f < frames; f++)
+	{
+		len = 1 + rand() % size;
+		bench_fill (bench_in, len, density);
+		n += slip_encode (bench_in, len, stream + n, SLIP_MSG_REG);
+
+		switch (rand() % 8)
+		{
+			case 0: stream[n++] = SLIP_END; break;
+			case 1: stream[n++] = SLIP_ESC; stream[n++] = rand(); break;
+			case 2: stream[n++] = SLIP_ESC; stream[n++] = SLIP_END; break;
+			default: break;
+		}
+	}
+
+	// the reference reads until the last END
+	stream[n++] = SLIP_END;
+	return n;
+}
+
+//===============================================
+// the block decoder must return the same frames as 'slip_rx'
+// whatever the block boundaries are
+int bench_check_decode (uint8_t kernel)
+{
+	uint32_t frames = 2000;
+	uint8_t* stream = malloc (frames * SLIP_ENCODED_MAX(BENCH_BUF_SIZE / 4 + 2));
+	uint16_t sizes[] = { 64, 1000 };
+	double densities[] = { 0.0, 0.05, 0.5 };
+	uint8_t frame[BENCH_BUF_SIZE];
+	uint32_t stream_len, pos;
+	uint16_t ref_len, block;
+	unsigned int s, d;
+	slip_decoder dec;
+	int ret = 0;
+
+	slip_set_kernel (kernel);
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	for (d = 0; d < sizeof(densities)/sizeof(densities[0]); d++)
+	{
+		stream_len = bench_make_stream (stream, frames, BENCH_BUF_SIZE / 4, densities[d]);
+		bench_stream = stream;
+		bench_stream_pos = 0;
+		slip_decoder_init (&dec, frame, sizes[s]);
+
+		for (pos = 0; pos < stream_len; )
+		{
+			// random block boundaries
+			block = 1 + rand() % 300;
+			if (block > stream_len - pos) block = stream_len - pos;
+			pos += slip_decode (&dec, stream + pos, block);
+			if (!dec.complete) continue;
+
+			ref_len = bench_ref_decode (bench_ref_get_char, bench_ref, sizes[s]);
+			if (ref_len != dec.len || memcmp (bench_ref, frame, ref_len))
+			{
+				fprintf(stderr, "slip_decode mismatch: kernel %u size %u density %.2f at %u\n",
+					   kernel, sizes[s], densities[d], pos);
+				ret = 1;
+				break;
+			}
+		}
+	}
+
+	free (stream);
+	return ret;
+}
+
+//===============================================
+// decoding cycles per received byte
+void bench_decode (void)
+{
+	uint16_t sizes[] = { 16, 64, 253, 1024 };
+	double densities[] = { 0.0, 0.01, 0.1 };
+	const char* names[] = { "", "scalar", "sse2", "avx2" };
+	uint8_t kernels[] = { SLIP_KERNEL_SCALAR, SLIP_KERNEL_SSE2, SLIP_KERNEL_AVX2 };
+	uint8_t* stream = malloc (BENCH_MIN_BYTES / 8 + 2 * SLIP_ENCODED_MAX(BENCH_BUF_SIZE));
+	uint8_t frame[BENCH_BUF_SIZE];
+	unsigned long long start, ticks;
+	uint32_t stream_len, pos, frames;
+	volatile uint16_t sink = 0;
+	unsigned int s, d, k;
+	slip_decoder dec;
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	for (d = 0; d < sizeof(densities)/sizeof(densities[0]); d++)
+	{
+		// back to back frames of 'size' bytes
+		bench_fill (bench_in, sizes[s], densities[d]);
+		for (stream_len = 0, frames = 0; stream_len < BENCH_MIN_BYTES / 8; frames++)
+		{
+			stream_len += slip_encode (bench_in, sizes[s], stream + stream_len, SLIP_MSG_REG);
+		}
+
+		// the per-byte callback path
+		bench_stream = stream;
+		bench_stream_pos = 0;
+		start = bench_ticks ();
+		while (bench_stream_pos < stream_len)
+		{
+			sink += bench_ref_decode (bench_ref_get_char, frame, BENCH_BUF_SIZE);
+		}
+		ticks = bench_ticks () - start;
+		bench_result ("decode", "per-byte", (double)ticks / stream_len, "ticks/byte",
+					  2, "size", (double)sizes[s], "escapes", densities[d]);
+
+		for (k = 0; k < sizeof(kernels); k++)
+		{
+			if (slip_set_kernel (kernels[k]) != kernels[k]) continue;
+
+			slip_decoder_init (&dec, frame, BENCH_BUF_SIZE);
+			start = bench_ticks ();
+			for (pos = 0; pos < stream_len; )
+			{
+				// receive blocks of BENCH_BUF_SIZE
+				pos += slip_decode (&dec, stream + pos, (stream_len - pos < BENCH_BUF_SIZE) ? stream_len - pos : BENCH_BUF_SIZE);
+				sink += dec.len;
+			}
+			ticks = bench_ticks () - start;
+			bench_result ("decode", names[kernels[k]], (double)ticks / stream_len, "ticks/byte",
+						  2, "size", (double)sizes[s], "escapes", densities[d]);
+		}
+	}
+
+	free (stream);
+}
+
+//===============================================
+// the channel path - 'slip_tx' and 'slip_rx' over the bulk
+// transport functions, the line is memory
+unsigned long bench_sink_bytes = 0;
+
+void bench_sink_write (void* ctx, uint8_t* buf, uint16_t len)
+{
+	bench_sink_bytes += len;
+}
+
+uint16_t bench_stream_read (void* ctx, uint8_t* buf, uint16_t max, uint16_t to)
+{
+	uint32_t n = bench_stream_len - bench_stream_pos;
+
+	if (n > max) n = max;
+	memcpy (buf, bench_stream + bench_stream_pos, n);
+	bench_stream_pos += n;
+	return n;
+}
+
+void bench_channel (void)
+{
+	uint8_t sizes[] = { 16, 64, DPROT_PAYLOAD(1) };
+	double densities[] = { 0.0, 0.01, 0.1 };
+	uint8_t* stream = malloc (BENCH_MIN_BYTES / 8 + 2 * SLIP_ENCODED_MAX(BENCH_BUF_SIZE));
+	uint8_t frame[DPROT_MAX_MSG];
+	struct timespec start, end;
+	unsigned long iters, it;
+	volatile uint16_t sink = 0;
+	slip_channel ch;
+	uint32_t frames, f;
+	unsigned int s, d;
+
+	slip_set_kernel (SLIP_KERNEL_AUTO);
+
+	for (s = 0; s < sizeof(sizes); s++)
+	for (d = 0; d < sizeof(densities)/sizeof(densities[0]); d++)
+	{
+		bench_fill (bench_in, sizes[s], densities[d]);
+		iters = BENCH_MIN_BYTES / sizes[s];
+
+		slip_init_buf (bench_sink_write, NULL, NULL, SLIP_RX_BLOCKING, &ch);
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (it = 0; it < iters; it++)
+		{
+			sink += slip_tx (&ch, bench_in, sizes[s], SLIP_MSG_REG);
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		bench_result ("slip", "slip_tx", (double)iters * sizes[s] / bench_seconds (&start, &end) / 1e6, "MB/s",
+					  2, "size", (double)sizes[s], "escapes", densities[d]);
+
+		// back to back frames, read in SLIP_RX_BLOCK blocks
+		for (bench_stream_len = 0, frames = 0; bench_stream_len < BENCH_MIN_BYTES / 8; frames++)
+		{
+			bench_stream_len += slip_encode (bench_in, sizes[s], stream + bench_stream_len, SLIP_MSG_REG);
+		}
+		bench_stream = stream;
+		bench_stream_pos = 0;
+
+		slip_init_buf (NULL, bench_stream_read, NULL, SLIP_RX_BLOCKING, &ch);
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (f = 0; f < frames; f++)
+		{
+			sink += slip_rx (&ch, frame, sizeof(frame));
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		bench_result ("slip", "slip_rx", (double)frames * sizes[s] / bench_seconds (&start, &end) / 1e6, "MB/s",
+					  2, "size", (double)sizes[s], "escapes", densities[d]);
+	}
+
+	free (stream);
+}
+
+//===============================================
+// COBS - the streaming 'slip_tx' against the block encoder, no
+// zeros inside the frames, and back through the block decoder
+void bench_capture_write (void* ctx, uint8_t* buf, uint16_t len)
+{
+	memcpy (bench_ref + bench_ref_len, buf, len);
+	bench_ref_len += len;
+}
+
+int bench_check_cobs (void)
+{
+	uint16_t lens[] = { 0, 1, 2, 253, 254, 255, 508, 509, 1000 };
+	double zeros[] = { 0.0, 0.01, 0.5, 1.0 };
+	uint8_t frame[BENCH_BUF_SIZE];
+	uint16_t n, i, pos, block, split;
+	unsigned int l, z;
+	slip_channel ch;
+	slip_decoder dec;
+
+	slip_init_buf (bench_capture_write, NULL, NULL, SLIP_RX_BLOCKING, &ch);
+	slip_set_framing (&ch, SLIP_FRAMING_COBS);
+	slip_decoder_init (&dec, frame, sizeof(frame));
+	slip_decoder_set_framing (&dec, SLIP_FRAMING_COBS);
+
+	for (l = 0; l < sizeof(lens)/sizeof(lens[0]); l++)
+	for (z = 0; z < sizeof(zeros)/sizeof(zeros[0]); z++)
+	{
+		for (i = 0; i < lens[l]; i++)
+		{
+			bench_in[i] = ((double)rand() / RAND_MAX < zeros[z]) ? 0 : 1 + rand() % 255;
+		}
+		n = slip_cobs_encode (bench_in, lens[l], bench_out, SLIP_MSG_REG);
+
+		// the frame given in three pieces, slip_tx pieces are up to 255 bytes
+		split = lens[l] ? rand() % lens[l] : 0;
+		if (split > 255) split = 255;
+		bench_ref_len = 0;
+		slip_tx (&ch, bench_in, split, SLIP_MSG_START);
+		for (i = split; lens[l] - i > 255; i += 255)
+		{
+			slip_tx (&ch, bench_in + i, 255, SLIP_MSG_MIDDLE);
+		}
+		slip_tx (&ch, bench_in + i, lens[l] - i, SLIP_MSG_END);
+
+		if (n > SLIP_COBS_ENCODED_MAX(lens[l]) || n != bench_ref_len || memcmp (bench_out, bench_ref, n) ||
+			memchr (bench_out + 1, 0, n - 2) != NULL)
+		{
+			fprintf(stderr, "slip_cobs_encode mismatch: len %u zeros %.2f\n", lens[l], zeros[z]);
+			return 1;
+		}
+
+		// random block boundaries. an empty frame isn't returned
+		for (pos = 0; pos < n && !dec.complete; pos += block)
+		{
+			block = 1 + rand() % 100;
+			if (block > n - pos) block = n - pos;
+			block = slip_decode (&dec, bench_out + pos, block);
+		}
+		if ((lens[l] && (!dec.complete || dec.len != lens[l] || memcmp (frame, bench_in, lens[l]))) ||
+			(!lens[l] && dec.complete))
+		{
+			fprintf(stderr, "slip_cobs_decode mismatch: len %u zeros %.2f\n", lens[l], zeros[z]);
+			return 1;
+		}
+		slip_decode (&dec, NULL, 0);
+	}
+	return 0;
+}
+
+//===============================================
+// SLIP against COBS - the bytes on the wire and the block
+// coding speed for the kinds of payloads
+void bench_framing (void)
+{
+	uint16_t sizes[] = { 16, 64, DPROT_PAYLOAD(1), 1024 };
+	const char* framings[] = { "slip", "cobs" };
+	const char* kinds[] = { "text", "random", "specials", "zeros" };
+	uint8_t* stream = malloc (BENCH_MIN_BYTES / 8 + 2 * SLIP_ENCODED_MAX(BENCH_BUF_SIZE));
+	uint8_t frame[BENCH_BUF_SIZE];
+	struct timespec start, end;
+	unsigned long iters, it;
+	volatile uint16_t sink = 0;
+	uint32_t stream_len, pos, frames;
+	unsigned int s, k, f, i;
+	char variant[32];
+	slip_decoder dec;
+	uint16_t n = 0;
+
+	slip_set_kernel (SLIP_KERNEL_AUTO);
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	for (k = 0; k < sizeof(kinds)/sizeof(kinds[0]); k++)
+	{
+		for (i = 0; i < sizes[s]; i++)
+		{
+			switch (k)
+			{
+				case 0: bench_in[i] = ' ' + rand() % 95; break;
+				case 1: bench_in[i] = rand(); break;
+				case 2: bench_in[i] = (rand() & 1) ? SLIP_END : SLIP_ESC; break;
+				default: bench_in[i] = 0; break;
+			}
+		}
+
+		for (f = 0; f < 2; f++)
+		{
+			snprintf (variant, sizeof(variant), "%s.%s", framings[f], kinds[k]);
+			iters = BENCH_MIN_BYTES / sizes[s];
+
+			clock_gettime (CLOCK_MONOTONIC, &start);
+			for (it = 0; it < iters; it++)
+			{
+				n = f ? slip_cobs_encode (bench_in, sizes[s], bench_out, SLIP_MSG_REG) :
+						slip_encode (bench_in, sizes[s], bench_out, SLIP_MSG_REG);
+				sink += n;
+			}
+			clock_gettime (CLOCK_MONOTONIC, &end);
+			bench_result ("framing", variant, (double)(n - sizes[s]) * 100 / sizes[s], "% overhead",
+						  1, "size", (double)sizes[s]);
+			bench_result ("framing", variant, (double)iters * sizes[s] / bench_seconds (&start, &end) / 1e6, "MB/s",
+						  2, "size", (double)sizes[s], "encode", 1.0);
+
+			// back to back frames, decoded in SLIP_RX_BLOCK blocks
+			for (stream_len = 0, frames = 0; stream_len < BENCH_MIN_BYTES / 8; frames++)
+			{
+				memcpy (stream + stream_len, bench_out, n);
+				stream_len += n;
+			}
+			slip_decoder_init (&dec, frame, sizeof(frame));
+			slip_decoder_set_framing (&dec, f ? SLIP_FRAMING_COBS : SLIP_FRAMING_SLIP);
+
+			clock_gettime (CLOCK_MONOTONIC, &start);
+			for (pos = 0; pos < stream_len; )
+			{
+				pos += slip_decode (&dec, stream + pos, (stream_len - pos < SLIP_RX_BLOCK) ? stream_len - pos : SLIP_RX_BLOCK);
+				sink += dec.complete;
+			}
+			clock_gettime (CLOCK_MONOTONIC, &end);
+			bench_result ("framing", variant, (double)frames * sizes[s] / bench_seconds (&start, &end) / 1e6, "MB/s",
+						  2, "size", (double)sizes[s], "encode", 0.0);
+		}
+	}
+
+	free (stream);
+}
+
+//===============================================
+// FEC - frames through the streaming 'slip_tx' and the block
+// decoder, clean and with up to nroots / 2 bytes spoiled on the
+// wire (SLIP - a spoiled END or ESC would break the framing)
+int bench_check_fec (void)
+{
+#if SLIP_FEC
+	uint8_t roots[] = { 2, 8, 16, 32 };
+	uint16_t lens[] = { 1, 100, 222, 223, 254, 255, 600, 1000 };
+	static uint8_t frame[SLIP_FEC_ENCODED_MAX(1000)];
+	uint8_t spoiled[SLIP_ENCODED_MAX(SLIP_FEC_ENCODED_MAX(1000))];
+	uint16_t i, pos, block, split, errors, e;
+	unsigned int r, l, f;
+	slip_channel ch;
+	slip_decoder dec;
+
+	slip_init_buf (bench_capture_write, NULL, NULL, SLIP_RX_BLOCKING, &ch);
+	slip_decoder_init (&dec, frame, sizeof(frame));
+
+	for (r = 0; r < sizeof(roots); r++)
+	for (l = 0; l < sizeof(lens)/sizeof(lens[0]); l++)
+	for (f = 0; f < 2; f++)
+	{
+		slip_set_framing (&ch, f ? SLIP_FRAMING_COBS : SLIP_FRAMING_SLIP);
+		slip_set_fec (&ch, roots[r]);
+		slip_decoder_set_framing (&dec, f ? SLIP_FRAMING_COBS : SLIP_FRAMING_SLIP);
+		slip_decoder_set_fec (&dec, roots[r]);
+
+		for (i = 0; i < lens[l]; i++) bench_in[i] = rand();
+
+		split = rand() % lens[l];
+		if (split > 255) split = 255;
+		bench_ref_len = 0;
+		slip_tx (&ch, bench_in, split, SLIP_MSG_START);
+		for (i = split; lens[l] - i > 255; i += 255)
+		{
+			slip_tx (&ch, bench_in + i, 255, SLIP_MSG_MIDDLE);
+		}
+		slip_tx (&ch, bench_in + i, lens[l] - i, SLIP_MSG_END);
+
+		// as many spoiled bytes as a single block can take, in
+		// distinct data bytes not next to an escape
+		memcpy (spoiled, bench_ref, bench_ref_len);
+		errors = f ? 0 : roots[r] / 2;
+		for (e = 0; e < errors; )
+		{
+			pos = 1 + rand() % (bench_ref_len - 2);
+			if (spoiled[pos] != bench_ref[pos] || bench_ref[pos] == SLIP_ESC || bench_ref[pos - 1] == SLIP_ESC) continue;
+			do spoiled[pos] = rand(); while (spoiled[pos] == bench_ref[pos] || spoiled[pos] == SLIP_END || spoiled[pos] == SLIP_ESC);
+			e++;
+		}
+
+		dec.fec_corrected = 0;
+		dec.fec_failed = 0;
+		for (pos = 0; pos < bench_ref_len && !dec.complete; pos += block)
+		{
+			block = 1 + rand() % 100;
+			if (block > bench_ref_len - pos) block = bench_ref_len - pos;
+			block = slip_decode (&dec, spoiled + pos, block);
+		}
+		if (!dec.complete || dec.len != lens[l] || memcmp (frame, bench_in, lens[l]) ||
+			dec.fec_corrected != errors || dec.fec_failed)
+		{
+			fprintf(stderr, "fec mismatch: nroots %u len %u %s, %u of %u errors corrected\n", roots[r], lens[l],
+					f ? "cobs" : "slip", dec.fec_corrected, errors);
+			return 1;
+		}
+		slip_decode (&dec, NULL, 0);
+	}
+#endif
+	return 0;
+}
+
+//===============================================
+// Reed-Solomon - the overhead on a frame and the speed of the
+// full blocks, clean and with all the errors the code takes
+void bench_fec (void)
+{
+	uint8_t roots[] = { 4, 8, 16, 32 };
+	uint8_t block[RS_BLOCK];
+	uint8_t work[RS_BLOCK];
+	struct timespec start, end;
+	unsigned long iters, it;
+	volatile int sink = 0;
+	unsigned int r, i, e;
+	uint16_t k;
+	char variant[32];
+	rs_code rs;
+
+	for (r = 0; r < sizeof(roots); r++)
+	{
+		rs_init (&rs, roots[r]);
+		k = SLIP_FEC_DATA(roots[r]);
+		for (i = 0; i < k; i++) block[i] = rand();
+		snprintf (variant, sizeof(variant), "rs.%u", roots[r]);
+		iters = BENCH_MIN_BYTES / 8 / k;
+
+		// a full frame is two blocks
+		bench_result ("fec", variant, (double)((DPROT_MAX_MSG + k - 1) / k) * roots[r] * 100 / DPROT_MAX_MSG,
+					  "% overhead", 1, "size", (double)DPROT_MAX_MSG);
+
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (it = 0; it < iters; it++)
+		{
+			memset (block + k, 0, roots[r]);
+			rs_encode (&rs, block + k, block, k);
+			sink += block[k];
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		bench_result ("fec", variant, (double)iters * k / bench_seconds (&start, &end) / 1e6, "MB/s",
+					  2, "encode", 1.0, "errors", 0.0);
+
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (it = 0; it < iters; it++)
+		{
+			sink += rs_decode (&rs, block, RS_BLOCK);
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		bench_result ("fec", variant, (double)iters * k / bench_seconds (&start, &end) / 1e6, "MB/s",
+					  2, "encode", 0.0, "errors", 0.0);
+
+		// the copy and the spoiling are part of the time
+		iters /= 4;
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (it = 0; it < iters; it++)
+		{
+			memcpy (work, block, RS_BLOCK);
+			for (e = 0; e < roots[r] / 2u; e++) work[(it + e * 37) % RS_BLOCK] ^= 1 + e;
+			sink += rs_decode (&rs, work, RS_BLOCK);
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		bench_result ("fec", variant, (double)iters * k / bench_seconds (&start, &end) / 1e6, "MB/s",
+					  2, "encode", 0.0, "errors", (double)(roots[r] / 2));
+	}
+}
+
+//===============================================
+// the reference - bit by bit crc
+uint32_t bench_ref_crc (uint8_t type, uint8_t* buffer, uint16_t len)
+{
+	uint32_t c = (type == CHECKING_CRC8) ? 0 : (type == CHECKING_CRC16) ? 0xffff : 0xffffffff;
+	int b;
+
+	while (len--)
+	{
+		if (type == CHECKING_CRC32C)
+		{
+			c ^= *buffer++;
+			for (b = 0; b < 8; b++) c = (c >> 1) ^ ((c & 1) ? 0x82F63B78 : 0);
+		}
+		else if (type == CHECKING_CRC16)
+		{
+			c ^= (uint32_t)*buffer++ << 8;
+			for (b = 0; b < 8; b++) c = ((c << 1) ^ ((c & 0x8000) ? 0x1021 : 0)) & 0xffff;
+		}
+		else
+		{
+			c ^= *buffer++;
+			for (b = 0; b < 8; b++) c = ((c << 1) ^ ((c & 0x80) ? 0x07 : 0)) & 0xff;
+		}
+	}
+
+	return (type == CHECKING_CRC32C) ? c ^ 0xffffffff : c;
+}
+
+//===============================================
+// the block checkings must match the bitwise ones - in one
+// go and split at random points
+int bench_check_checking (void)
+{
+	uint8_t types[] = { CHECKING_CRC8, CHECKING_CRC16, CHECKING_CRC32C };
+	uint8_t out[CHECKING_MAX_SIZE];
+	uint32_t c, ref, got;
+	uint16_t len, split;
+	unsigned int t, i, b;
+
+	for (t = 0; t < sizeof(types); t++)
+	for (i = 0; i < 1000; i++)
+	{
+		len = rand () % 300;
+		split = len ? rand () % len : 0;
+		bench_fill (bench_in, len, 0.5);
+
+		c = checking_start (types[t]);
+		c = checking_update (types[t], c, bench_in, split);
+		c = checking_update (types[t], c, bench_in + split, len - split);
+		checking_finish (types[t], c, out);
+
+		for (got = 0, b = 0; b < checking_size (types[t]); b++)
+		{
+			got |= (uint32_t)out[b] << (8 * b);
+		}
+
+		ref = bench_ref_crc (types[t], bench_in, len);
+		if (got != ref)
+		{
+			fprintf(stderr, "checking %u mismatch: len %u split %u (%08x != %08x)\n", types[t], len, split, got, ref);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//===============================================
+// checking throughput - bytes per tick
+void bench_checking (void)
+{
+	uint16_t sizes[] = { 16, 64, 253, 1024 };
+	const char* names[] = { "crc8", "chs8", "xor8", "crc16", "crc32c" };
+	unsigned long long start, ticks;
+	unsigned long iters, it;
+	volatile uint32_t sink = 0;
+	unsigned int s, t;
+	uint16_t i;
+	uint8_t c;
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	{
+		bench_fill (bench_in, sizes[s], 0.5);
+		iters = BENCH_MIN_BYTES / sizes[s];
+
+		// the byte by byte crc8 macro
+		start = bench_ticks ();
+		for (it = 0; it < iters; it++)
+		{
+			for (c = 0, i = 0; i < sizes[s]; i++)
+			{
+				crc8_add_byte(c, bench_in[i]);
+			}
+			sink += c;
+		}
+		ticks = bench_ticks () - start;
+		bench_result ("checking", "crc8_add_byte", (double)iters * sizes[s] / ticks, "bytes/tick",
+					  1, "size", (double)sizes[s]);
+
+		for (t = CHECKING_CRC8; t <= CHECKING_CRC32C; t++)
+		{
+			start = bench_ticks ();
+			for (it = 0; it < iters; it++)
+			{
+				sink += checking_update (t, checking_start (t), bench_in, sizes[s]);
+			}
+			ticks = bench_ticks () - start;
+			bench_result ("checking", names[t], (double)iters * sizes[s] / ticks, "bytes/tick",
+						  1, "size", (double)sizes[s]);
+		}
+	}
+}
+
+//===============================================
+// the cost of a trace event - with the ring in the cache and
+// spread over a big one, and of a snapshot of a full ring
+void bench_trace (void)
+{
+	uint32_t sizes[] = { 1024, 1u << 20 };
+	dprot_trace_record* records = malloc ((1u << 20) * sizeof(dprot_trace_record));
+	dprot_trace_record* copy = malloc ((1u << 20) * sizeof(dprot_trace_record));
+	struct timespec start, end;
+	dprot_trace trace;
+	unsigned long iters = 4 * 1024 * 1024;
+	unsigned long it;
+	unsigned int s;
+	uint32_t n = 0;
+	double ns;
+
+	if (records == NULL || copy == NULL)
+	{
+		free (records);
+		free (copy);
+		return;
+	}
+
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+	{
+		dprot_trace_init (&trace, records, sizes[s], 0);
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (it = 0; it < iters; it++)
+		{
+			dprot_trace_event (&trace, DPROT_TRACE_RX_FRAME, (uint8_t)it, (uint16_t)it);
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		bench_result ("trace", "event", ns / iters, "ns/event", 1, "records", (double)sizes[s]);
+
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		n = dprot_trace_snapshot (&trace, copy, sizes[s]);
+		clock_gettime (CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		bench_result ("trace", "snapshot", ns / n, "ns/record", 1, "records", (double)sizes[s]);
+	}
+
+	free (records);
+	free (copy);
+}
+
+//===============================================
+// the representative payloads of the compression - 'n' is the
+// number of the record, the records move slowly
+#define BENCH_LZ_RECORDS	2000
+
+uint16_t bench_lz_payload (int kind, uint8_t* buffer, unsigned long n)
+{
+	uint16_t len = 0;
+	int i;
+
+	switch (kind)
+	{
+		case 0:
+			// text telemetry
+			len = snprintf ((char*)buffer, 240, "{\"t\":%lu,\"node\":\"pump-07\",\"state\":\"RUN\"", 1700000000ul + n);
+			for (i = 0; len < 200; i++)
+			{
+				len += snprintf ((char*)buffer + len, 240 - len, ",\"s%d\":{\"temp\":%d,\"v\":%d}", i,
+								 215 + rand() % 4, 3300 + rand() % 8);
+			}
+			buffer[len++] = '}';
+			break;
+
+		case 1:
+			// binary sensor records - id, value, time (little endian)
+			for (i = 0; i < 24; i++)
+			{
+				buffer[len++] = (uint8_t)i;
+				buffer[len++] = 0;
+				buffer[len++] = (uint8_t)(100 + rand() % 3);
+				buffer[len++] = 0;
+				buffer[len++] = (uint8_t)n;
+				buffer[len++] = (uint8_t)(n >> 8);
+				buffer[len++] = 0x5e;
+				buffer[len++] = 0x65;
+			}
+			break;
+
+		default:
+			// already compressed or encrypted
+			bench_fill (buffer, 192, 0.01);
+			len = 192;
+			break;
+	}
+	return len;
+}
+
+// the wire bytes of a stop-and-wait transaction - the slip
+// encoded data frame (crc8) and its ack
+unsigned long bench_lz_wire (uint8_t flags, uint8_t* payload, uint16_t len)
+{
+	uint8_t frame[DPROT_MAX_MSG];
+	uint8_t out[SLIP_ENCODED_MAX(DPROT_MAX_MSG)];
+
+	frame[0] = DPROT_TYPE_DATA | flags;
+	frame[1] = (uint8_t)len;
+	memcpy (frame + 2, payload, len);
+	dprot_calc_checking (CHECKING_CRC8, frame, len + 2, NULL, 0, frame + len + 2);
+	return slip_encode (frame, len + 3, out, SLIP_MSG_REG) + 5;
+}
+
+// the compression - its ratio and speed, and the goodput of a
+// stop-and-wait link at the slow baud rates with and without it
+void bench_lz (void)
+{
+	const char* kinds[] = { "text", "binary", "random" };
+	uint32_t bauds[] = { 9600, 57600 };
+	uint8_t payload[256];
+	uint8_t packed[256];
+	uint8_t back[256];
+	unsigned long raw_bytes, packed_bytes, decoded, raw_wire, lz_wire, n;
+	char variant[32];
+	struct timespec start, end;
+	double comp_ns, decomp_ns;
+	uint16_t len, plen, dlen;
+	int kind;
+	unsigned int b;
+
+	for (kind = 0; kind < 3; kind++)
+	{
+		raw_bytes = packed_bytes = decoded = raw_wire = lz_wire = 0;
+		comp_ns = decomp_ns = 0;
+		srand (1);
+
+		for (n = 0; n < BENCH_LZ_RECORDS; n++)
+		{
+			len = bench_lz_payload (kind, payload, n);
+
+			clock_gettime (CLOCK_MONOTONIC, &start);
+			plen = lzss_compress (payload, len, packed, len - 1);
+			clock_gettime (CLOCK_MONOTONIC, &end);
+			comp_ns += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+			raw_bytes += len;
+			raw_wire += bench_lz_wire (0, payload, len);
+			if (plen == 0)
+			{
+				// sent as it is
+				packed_bytes += len;
+				lz_wire += bench_lz_wire (0, payload, len);
+				continue;
+			}
+
+			clock_gettime (CLOCK_MONOTONIC, &start);
+			dlen = lzss_decompress (packed, plen, back, sizeof(back));
+			clock_gettime (CLOCK_MONOTONIC, &end);
+			decomp_ns += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+			if (dlen != len || memcmp (back, payload, len))
+			{
+				fprintf(stderr, "lz: record %lu of %s doesn't decode\n", n, kinds[kind]);
+				return;
+			}
+
+			packed_bytes += plen;
+			decoded += len;
+			lz_wire += bench_lz_wire (DPROT_FLAG_LZ, packed, plen);
+		}
+
+		bench_result ("lz", kinds[kind], (double)packed_bytes / raw_bytes, "ratio", 0);
+		snprintf (variant, sizeof(variant), "%s.enc", kinds[kind]);
+		bench_result ("lz", variant, comp_ns / raw_bytes, "ns/byte", 0);
+		if (decoded)
+		{
+			// only the blocks sent compressed are decoded
+			snprintf (variant, sizeof(variant), "%s.dec", kinds[kind]);
+			bench_result ("lz", variant, decomp_ns / decoded, "ns/byte", 0);
+		}
+		for (b = 0; b < sizeof(bauds)/sizeof(bauds[0]); b++)
+		{
+			bench_result ("lz", kinds[kind], raw_bytes * (bauds[b] / 10.0) / raw_wire, "bytes/sec",
+						  2, "baud", (double)bauds[b], "compress", 0.0);
+			bench_result ("lz", kinds[kind], raw_bytes * (bauds[b] / 10.0) / lz_wire, "bytes/sec",
+						  2, "baud", (double)bauds[b], "compress", 1.0);
+		}
+	}
+}
+
+//===============================================
+// the reference - the old mutex protected queue
+typedef struct
+{
+	uint8_t ar[4096];
+	uint32_t cap;
+	uint32_t front;
+	uint32_t size;
+	pthread_mutex_t m;
+} bench_mutex_queue;
+
+int bench_mq_push_n (void* ctx, uint8_t* items, int n)
+{
+	bench_mutex_queue* q = (bench_mutex_queue*)ctx;
+	int i;
+
+	pthread_mutex_lock (&q->m);
+	if (n > (int)(q->cap - q->size)) n = q->cap - q->size;
+	for (i = 0; i < n; i++)
+	{
+		q->ar[(q->front + q->size + i) % q->cap] = items[i];
+	}
+	q->size += n;
+	pthread_mutex_unlock (&q->m);
+	return n;
+}
+
+int bench_mq_pop_n (void* ctx, uint8_t* items, int max)
+{
+	bench_mutex_queue* q = (bench_mutex_queue*)ctx;
+	int i;
+
+	pthread_mutex_lock (&q->m);
+	if (max > (int)q->size) max = q->size;
+	for (i = 0; i < max; i++)
+	{
+		items[i] = q->ar[(q->front + i) % q->cap];
+	}
+	q->front = (q->front + max) % q->cap;
+	q->size -= max;
+	pthread_mutex_unlock (&q->m);
+	return max;
+}
+
+int bench_spsc_push_n (void* ctx, uint8_t* items, int n)
+{
+	if (n == 1) return tsq_push_item ((ts_queue*)ctx, *items) == 0;
+	return tsq_push_n ((ts_queue*)ctx, items, n);
+}
+
+int bench_spsc_pop_n (void* ctx, uint8_t* items, int max)
+{
+	if (max == 1) return tsq_pop_item ((ts_queue*)ctx, items) == 0;
+	return tsq_pop_n ((ts_queue*)ctx, items, max);
+}
+
+typedef int (*fn_bench_queue)(void* q, uint8_t* items, int n);
+
+typedef struct
+{
+	void* q;
+	fn_bench_queue push;
+	fn_bench_queue pop;
+	int chunk;
+	int errors;
+} bench_queue_run;
+
+//===============================================
+// the producer pushes a counting pattern, the consumer
+// checks it arrives complete and in order
+void* bench_queue_producer (void* ptr)
+{
+	bench_queue_run* r = (bench_queue_run*)ptr;
+	uint8_t buf[256];
+	uint32_t sent = 0;
+	int n;
+	int i;
+
+	while (sent < BENCH_QUEUE_BYTES)
+	{
+		for (i = 0; i < r->chunk; i++) buf[i] = (uint8_t)(sent + i);
+		while ((n = r->push (r->q, buf, r->chunk)) == 0)
+		{
+			sched_yield ();
+		}
+		// what didn't fit is pushed again next time
+		sent += n;
+	}
+	return NULL;
+}
+
+void bench_queue_consume (bench_queue_run* r)
+{
+	uint8_t buf[256];
+	uint32_t got = 0;
+	int n;
+	int i;
+
+	while (got < BENCH_QUEUE_BYTES)
+	{
+		if ((n = r->pop (r->q, buf, r->chunk)) == 0)
+		{
+			sched_yield ();
+			continue;
+		}
+		for (i = 0; i < n; i++)
+		{
+			if (buf[i] != (uint8_t)(got + i)) r->errors++;
+		}
+		got += n;
+	}
+}
+
+//===============================================
+// queue throughput - a producer and a consumer thread
+int bench_queue (void)
+{
+	int chunks[] = { 1, 16, 256 };
+	uint32_t caps[] = { TSQ_DEFAULT_SIZE, 4096 };
+	bench_mutex_queue mq;
+	bench_queue_run r;
+	pthread_t producer;
+	struct timespec start, end;
+	double sec;
+	unsigned int c, k, v;
+
+	for (k = 0; k < sizeof(caps)/sizeof(caps[0]); k++)
+	{
+		for (c = 0; c < sizeof(chunks)/sizeof(chunks[0]); c++)
+		{
+			for (v = 0; v < 3; v++)
+			{
+				r.chunk = chunks[c];
+				r.errors = 0;
+				if (v == 0)
+				{
+					mq.cap = caps[k];
+					mq.front = mq.size = 0;
+					pthread_mutex_init (&mq.m, NULL);
+					r.q = &mq;
+					r.push = bench_mq_push_n;
+					r.pop = bench_mq_pop_n;
+				}
+				else
+				{
+					r.q = tsq_create (caps[k]);
+					if (v == 2) tsq_set_mode ((ts_queue*)r.q, TSQ_MODE_BLOCK);
+					r.push = bench_spsc_push_n;
+					r.pop = bench_spsc_pop_n;
+				}
+
+				clock_gettime (CLOCK_MONOTONIC, &start);
+				pthread_create (&producer, NULL, bench_queue_producer, &r);
+				bench_queue_consume (&r);
+				pthread_join (producer, NULL);
+				clock_gettime (CLOCK_MONOTONIC, &end);
+
+				if (v == 0) pthread_mutex_destroy (&mq.m);
+				else tsq_delete ((ts_queue*)r.q);
+
+				if (r.errors)
+				{
+					fprintf(stderr, "queue: %d bytes lost or out of order\n", r.errors);
+					return 1;
+				}
+
+				sec = bench_seconds (&start, &end);
+				bench_result ("queue", (v == 2) ? "spsc-block" : v ? "spsc" : "mutex", BENCH_QUEUE_BYTES / sec / 1e6, "MB/s",
+							  2, "capacity", (double)caps[k], "chunk", (double)chunks[c]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+//===============================================
+// end to end transactions - a master on one end of a socket
+// pair, the slave served by the event loop on the other
+uint32_t bench_clock_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+void bench_slave_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	dprot_loop_slave* s = (dprot_loop_slave*)user;
+
+	dprot_slave_process_msg (s->link, frame, len, DPROT_MAX_MSG);
+}
+
+void* bench_loop_thread (void* ptr)
+{
+	dprot_loop_run ((dprot_loop*)ptr);
+	return NULL;
+}
+
+int bench_cmp_double (const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+int bench_protocol (void)
+{
+	static dprot_link master, slave;
+	uint8_t sizes[] = { 16, 128, DPROT_PAYLOAD(1) };
+	double percentiles[] = { 50, 90, 99, 99.9, 100 };
+	double* latency = malloc (BENCH_TRANSACTIONS * sizeof(double));
+	struct timespec start, end, t0, t1;
+	dprot_serial ports[2];
+	dprot_loop_slave served;
+	dprot_timer* heap[1];
+	dprot_loop loop;
+	pthread_t thread;
+	unsigned int s, i, p;
+	int fds[2];
+	int errors = 0;
+
+	for (s = 0; s < sizeof(sizes) && !errors; s++)
+	{
+		if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0 ||
+			dprot_loop_init (&loop, bench_clock_us, heap, 1) != 0)
+		{
+			perror ("protocol");
+			return 1;
+		}
+		ports[0].fd = fds[0];
+		ports[1].fd = fds[1];
+
+		dprot_slave_init_protocol_buf (&slave, dprot_serial_write_buf, NULL, &ports[1]);
+		dprot_loop_add_slave (&served, &loop, &slave, &ports[1], bench_slave_frame);
+		pthread_create (&thread, NULL, bench_loop_thread, &loop);
+
+		dprot_master_init_protocol_buf (&master, dprot_serial_write_buf, dprot_serial_read_buf, &ports[0]);
+		dprot_master_set_clock (&master, bench_clock_us);
+		bench_fill (bench_in, sizes[s], 0.01);
+
+		// the round trip estimate settles first
+		for (i = 0; i < 100; i++)
+		{
+			dprot_master_send_data_msg (&master, bench_in, sizes[s]);
+		}
+
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		for (i = 0; i < BENCH_TRANSACTIONS; i++)
+		{
+			clock_gettime (CLOCK_MONOTONIC, &t0);
+			if (dprot_master_send_data_msg (&master, bench_in, sizes[s]) != DPROT_ACK_ACCEPTED) errors++;
+			clock_gettime (CLOCK_MONOTONIC, &t1);
+			latency[i] = bench_seconds (&t0, &t1) * 1e6;
+		}
+		clock_gettime (CLOCK_MONOTONIC, &end);
+
+		dprot_loop_stop (&loop);
+		pthread_join (thread, NULL);
+		dprot_loop_remove_slave (&served);
+		dprot_loop_close (&loop);
+		close (fds[0]);
+		close (fds[1]);
+
+		bench_result ("protocol", "send_data_msg", BENCH_TRANSACTIONS / bench_seconds (&start, &end), "transactions/s",
+					  1, "size", (double)sizes[s]);
+
+		qsort (latency, BENCH_TRANSACTIONS, sizeof(double), bench_cmp_double);
+		for (p = 0; p < sizeof(percentiles)/sizeof(percentiles[0]); p++)
+		{
+			i = (unsigned int)(percentiles[p] / 100 * (BENCH_TRANSACTIONS - 1));
+			bench_result ("protocol", "latency", latency[i], "us", 2, "size", (double)sizes[s], "percentile", percentiles[p]);
+		}
+	}
+
+	free (latency);
+	if (errors)
+	{
+		fprintf(stderr, "protocol: %d transactions not acked\n", errors);
+		return 1;
+	}
+	return 0;
+}
+
+//===============================================
+// window transfers over a line that spoils a bit now and then,
+// both ways - every message has to arrive once and in order,
+// and a lost frame mustn't cost the whole window
+typedef struct
+{
+	dprot_serial port;
+	uint32_t seed;
+} bench_noisy_port;
+
+void bench_noisy_write (void* ctx, uint8_t* buf, uint16_t len)
+{
+	bench_noisy_port* p = (bench_noisy_port*)ctx;
+	uint8_t out[SLIP_TX_BLOCK];
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		// xorshift32
+		p->seed ^= p->seed << 13;
+		p->seed ^= p->seed >> 17;
+		p->seed ^= p->seed << 5;
+		out[i] = buf[i];
+		if (p->seed % BENCH_WINDOW_ERRORS == 0) out[i] ^= 1 << (p->seed >> 16) % 8;
+	}
+	dprot_serial_write_buf (&p->port, out, len);
+}
+
+typedef struct
+{
+	dprot_loop_slave served;    // first - the frames come with it
+	uint8_t reorder[DPROT_REORDER_SIZE];
+	uint32_t expected;
+	int errors;
+} bench_window_slave;
+
+void bench_window_deliver (bench_window_slave* w, uint8_t ret, uint8_t* msg)
+{
+	// the message number is the start of the payload (after the sequence)
+	if (ret == DPROT_NO_ERROR)
+	{
+		if (msg[3] != (uint8_t)w->expected || msg[4] != (uint8_t)(w->expected >> 8)) w->errors++;
+		w->expected++;
+	}
+}
+
+void bench_window_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	bench_window_slave* w = (bench_window_slave*)user;
+	uint8_t buffer[DPROT_MAX_MSG];
+	uint8_t ret = dprot_slave_process_msg (w->served.link, frame, len, DPROT_MAX_MSG);
+
+	bench_window_deliver (w, ret, frame);
+
+	// a message might release the ones waiting for it
+	while (ret != DPROT_NO_MSG)
+	{
+		ret = dprot_slave_reordered_msg (w->served.link, buffer, sizeof(buffer));
+		bench_window_deliver (w, ret, buffer);
+	}
+}
+
+int bench_window (void)
+{
+	static dprot_link master, slave;
+	static bench_window_slave w;
+	static uint8_t msgs[BENCH_WINDOW_MSGS][64];
+	uint8_t* buffers[BENCH_WINDOW_MSGS];
+	uint8_t lens[BENCH_WINDOW_MSGS];
+	uint8_t modes[] = { DPROT_WINDOW_GBN, DPROT_WINDOW_SR };
+	double limits[] = { 0.5, 0.1 };           // retransmissions per message
+	bench_noisy_port ports[2];
+	dprot_timer* heap[1];
+	dprot_loop loop;
+	dprot_stats stats;
+	pthread_t thread;
+	uint16_t acked;
+	unsigned int m, i;
+	double retrans;
+	int fds[2];
+	int errors = 0;
+
+	for (i = 0; i < BENCH_WINDOW_MSGS; i++)
+	{
+		bench_fill (msgs[i], sizeof(msgs[i]), 0.01);
+		msgs[i][0] = (uint8_t)i;
+		msgs[i][1] = (uint8_t)(i >> 8);
+		buffers[i] = msgs[i];
+		lens[i] = sizeof(msgs[i]);
+	}
+
+	for (m = 0; m < sizeof(modes) && !errors; m++)
+	{
+		if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0 ||
+			dprot_loop_init (&loop, bench_clock_us, heap, 1) != 0)
+		{
+			perror ("window");
+			return 1;
+		}
+		ports[0].port.fd = fds[0];
+		ports[1].port.fd = fds[1];
+		ports[0].seed = 2463534242u;
+		ports[1].seed = 88675123u;
+		w.expected = 0;
+		w.errors = 0;
+
+		dprot_slave_init_protocol_buf (&slave, bench_noisy_write, NULL, &ports[1]);
+		dprot_slave_set_reorder_buffer (&slave, w.reorder, sizeof(w.reorder));
+		dprot_slave_set_window (&slave, modes[m], 8);
+		dprot_loop_add_slave (&w.served, &loop, &slave, &ports[1].port, bench_window_frame);
+		pthread_create (&thread, NULL, bench_loop_thread, &loop);
+
+		dprot_master_init_protocol_buf (&master, bench_noisy_write, dprot_serial_read_buf, &ports[0]);
+		dprot_master_set_clock (&master, bench_clock_us);
+		dprot_master_set_window (&master, modes[m], 8);
+
+		// like the simulator, a message out of retries is skipped
+		for (i = 0; i < BENCH_WINDOW_MSGS; i += acked)
+		{
+			if (dprot_master_send_data_window (&master, buffers + i, lens + i, BENCH_WINDOW_MSGS - i, &acked) != DPROT_ACK_ACCEPTED)
+			{
+				errors++;
+				break;
+			}
+		}
+
+		dprot_loop_stop (&loop);
+		pthread_join (thread, NULL);
+		dprot_loop_remove_slave (&w.served);
+		dprot_loop_close (&loop);
+		close (fds[0]);
+		close (fds[1]);
+
+		dprot_link_stats (&master, &stats);
+		retrans = (double)stats.retries / BENCH_WINDOW_MSGS;
+		bench_result ("window", (modes[m] == DPROT_WINDOW_SR) ? "sr" : "gbn", retrans, "retransmissions/message",
+					  2, "window", 8.0, "byte_errors", 1.0 / BENCH_WINDOW_ERRORS);
+
+		if (errors || w.errors || w.expected != BENCH_WINDOW_MSGS || retrans > limits[m])
+		{
+			fprintf(stderr, "window: %u of %u messages delivered, %d out of order, %.3f retransmissions per message\n",
+					w.expected, BENCH_WINDOW_MSGS, w.errors, retrans);
+			errors++;
+		}
+	}
+
+	return errors ? 1 : 0;
+}
+
+//===============================================
+int bench_selected (int argc, char** argv, const char* group)
+{
+	int i;
+	int any = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-') continue;
+		if (!strcmp (argv[i], group)) return 1;
+		any = 1;
+	}
+	return !any;
+}
+
+int main (int argc, char** argv)
+{
+	uint8_t k;
+	int ret = 0;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp (argv[i], "-j")) bench_json = 1;
+		else if (argv[i][0] == '-')
+		{
+			printf("usage: %s [-j] [encode|decode|slip|framing|fec|checking|trace|lz|queue|protocol|window ...]\n", argv[0]);
+			printf("  -j  a JSON object per result\n");
+			return 1;
+		}
+	}
+
+	for (k = SLIP_KERNEL_SCALAR; k <= SLIP_KERNEL_AVX2; k++)
+	{
+		if (slip_set_kernel (k) != k) continue;
+		if (bench_check_encode (k) || bench_check_decode (k)) return 1;
+	}
+	if (bench_check_checking () || bench_check_cobs () || bench_check_fec ()) return 1;
+
+	// what the numbers are
+#if defined(__x86_64__) || defined(__i386__)
+	bench_result ("meta", BENCH_VERSION, (double)time (NULL), "unix time", 1, "ticks_are_cycles", 1.0);
+#else
+	bench_result ("meta", BENCH_VERSION, (double)time (NULL), "unix time", 1, "ticks_are_cycles", 0.0);
+#endif
+
+	if (bench_selected (argc, argv, "encode")) bench_encode ();
+	if (bench_selected (argc, argv, "decode")) bench_decode ();
+	if (bench_selected (argc, argv, "slip")) bench_channel ();
+	if (bench_selected (argc, argv, "framing")) bench_framing ();
+	if (bench_selected (argc, argv, "fec")) bench_fec ();
+	if (bench_selected (argc, argv, "checking")) bench_checking ();
+	if (bench_selected (argc, argv, "trace")) bench_trace ();
+	if (bench_selected (argc, argv, "lz")) bench_lz ();
+	if (bench_selected (argc, argv, "queue")) ret |= bench_queue ();
+	if (bench_selected (argc, argv, "window")) ret |= bench_window ();
+	if (bench_selected (argc, argv, "protocol")) ret |= bench_protocol ();
+	return ret;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include "dprot.h"
+
+/***********************************************************/
+uint8_t dprot_link_pool_init (dprot_link_pool* pool, dprot_link* links, uint32_t count)
+{
+	uint32_t i;
+	
+	if (links == NULL && count)
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	pool->links = links;
+	pool->count = count;
+	pool->used = 0;
+	pool->free_list = NULL;
+	
+	// chained backwards - the first link is taken first
+	for (i = count; i > 0; i--)
+	{
+		links[i - 1].pool_next = pool->free_list;
+		pool->free_list = &links[i - 1];
+	}
+	
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+dprot_link* dprot_link_alloc (dprot_link_pool* pool)
+{
+	dprot_link* link = pool->free_list;
+	
+	if (link == NULL)
+	{
+		return NULL;
+	}
+	
+	pool->free_list = link->pool_next;
+	link->pool_next = NULL;
+	pool->used++;
+	return link;
+}
+
+/***********************************************************/
+void dprot_link_free (dprot_link_pool* pool, dprot_link* link)
+{
+	// the last freed link is the next one handed out - it is
+	// still warm in the cache
+	link->pool_next = pool->free_list;
+	pool->free_list = link;
+	pool->used--;
+}
+
+/***********************************************************/
+void dprot_link_set_trace (dprot_link* link, dprot_trace* trace)
+{
+	link->trace = trace;
+}
+
+/***********************************************************/
+uint8_t dprot_link_set_framing (dprot_link* link, uint8_t framing)
+{
+	return slip_set_framing (&link->channel, framing) ? DPROT_LOGICAL_ERROR : DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_link_set_fec (dprot_link* link, uint8_t nroots)
+{
+	return slip_set_fec (&link->channel, nroots) ? DPROT_LOGICAL_ERROR : DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+void dprot_link_stats (dprot_link* link, dprot_stats* stats)
+{
+	const uint32_t* from = (const uint32_t*)&link->stats;
+	uint32_t* to = (uint32_t*)stats;
+	uint16_t i;
+	
+	// the struct is nothing but the counters
+	for (i = 0; i < sizeof(dprot_stats) / sizeof(uint32_t); i++)
+	{
+#ifdef __GNUC__
+		to[i] = __atomic_load_n (&from[i], __ATOMIC_RELAXED);
+#else
+		to[i] = from[i];
+#endif
+	}
+	
+	// the sending side is counted by slip
+#ifdef __GNUC__
+	stats->tx_frames = __atomic_load_n (&link->channel.tx_frames, __ATOMIC_RELAXED);
+	stats->tx_bytes = __atomic_load_n (&link->channel.tx_bytes, __ATOMIC_RELAXED);
+	stats->tx_wire = __atomic_load_n (&link->channel.tx_wire, __ATOMIC_RELAXED);
+	stats->tx_escapes = __atomic_load_n (&link->channel.tx_escapes, __ATOMIC_RELAXED);
+	stats->rx_wire = __atomic_load_n (&link->channel.rx_wire, __ATOMIC_RELAXED);
+	stats->fec_corrected = __atomic_load_n (&link->channel.rx_fec_corrected, __ATOMIC_RELAXED);
+	stats->fec_failed = __atomic_load_n (&link->channel.rx_fec_failed, __ATOMIC_RELAXED);
+#else
+	stats->tx_frames = link->channel.tx_frames;
+	stats->tx_bytes = link->channel.tx_bytes;
+	stats->tx_wire = link->channel.tx_wire;
+	stats->tx_escapes = link->channel.tx_escapes;
+	stats->rx_wire = link->channel.rx_wire;
+	stats->fec_corrected = link->channel.rx_fec_corrected;
+	stats->fec_failed = link->channel.rx_fec_failed;
+#endif
+}
+
+/***********************************************************/
+void dprot_link_stats_reset (dprot_link* link)
+{
+	memset (&link->stats, 0, sizeof(dprot_stats));
+	link->channel.tx_frames = 0;
+	link->channel.tx_bytes = 0;
+	link->channel.tx_wire = 0;
+	link->channel.tx_escapes = 0;
+	link->channel.rx_wire = 0;
+	link->channel.rx_fec_corrected = 0;
+	link->channel.rx_fec_failed = 0;
+}
+
+/***********************************************************/
+void dprot_stats_latency (dprot_stats* stats, uint32_t us)
+{
+	uint8_t bucket = 0;
+	
+	// up to 64us, 128us, 256us, ...
+	for (us >>= 6; us && bucket < DPROT_STATS_BUCKETS - 1; us >>= 1)
+	{
+		bucket++;
+	}
+	SLIP_STAT_ADD (stats->latency[bucket], 1);
+}
+
+/***********************************************************/
+uint16_t dprot_stats_json (const dprot_stats* stats, char* buf, uint16_t size)
+{
+	int n;
+	int i;
+	
+	n = snprintf (buf, size,
+		"{\"tx_frames\":%u,\"tx_bytes\":%u,\"tx_wire\":%u,\"tx_escapes\":%u,"
+		"\"rx_frames\":%u,\"rx_bytes\":%u,\"rx_wire\":%u,"
+		"\"acks_tx\":%u,\"nacks_tx\":%u,\"acks_rx\":%u,\"nacks_rx\":%u,"
+		"\"transactions\":%u,\"failures\":%u,\"retries\":%u,\"timeouts\":%u,"
+		"\"crc_errors\":%u,\"framing_errors\":%u,\"logical_errors\":%u,\"duplicates\":%u,"
+		"\"compressed\":%u,\"compress_saved\":%u,\"fec_corrected\":%u,\"fec_failed\":%u,"
+		"\"latency_us\":{",
+		stats->tx_frames, stats->tx_bytes, stats->tx_wire, stats->tx_escapes,
+		stats->rx_frames, stats->rx_bytes, stats->rx_wire,
+		stats->acks_tx, stats->nacks_tx, stats->acks_rx, stats->nacks_rx,
+		stats->transactions, stats->failures, stats->retries, stats->timeouts,
+		stats->crc_errors, stats->framing_errors, stats->logical_errors, stats->duplicates,
+		stats->compressed, stats->compress_saved, stats->fec_corrected, stats->fec_failed);
+	
+	// the non-empty buckets by their upper bound, "inf" for the last
+	for (i = 0; i < DPROT_STATS_BUCKETS && n > 0 && n < size; i++)
+	{
+		if (stats->latency[i] == 0) continue;
+		if (i == DPROT_STATS_BUCKETS - 1)
+		{
+			n += snprintf (buf + n, size - n, "%s\"inf\":%u", buf[n - 1] == '{' ? "" : ",", stats->latency[i]);
+		}
+		else
+		{
+			n += snprintf (buf + n, size - n, "%s\"%u\":%u", buf[n - 1] == '{' ? "" : ",", 64u << i, stats->latency[i]);
+		}
+	}
+	if (n > 0 && n < size) n += snprintf (buf + n, size - n, "}}");
+	
+	if (n <= 0 || n >= size)
+	{
+		if (size) buf[0] = 0;
+		return 0;
+	}
+	return (uint16_t)n;
+}
@@ -0,0 +1,443 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "dprot_loop.h"
+
+// the timers compare with the wrap of the clock in mind
+#define DPROT_TIMER_BEFORE(a, b)	((int32_t)((a) - (b)) < 0)
+
+/***********************************************************/
+static void dprot_timer_place (dprot_loop* loop, dprot_timer* t, uint32_t slot)
+{
+	loop->heap[slot] = t;
+	t->slot = slot;
+}
+
+/***********************************************************/
+static void dprot_timer_up (dprot_loop* loop, uint32_t slot)
+{
+	dprot_timer* t = loop->heap[slot];
+	uint32_t parent;
+
+	while (slot)
+	{
+		parent = (slot - 1) / 2;
+		if (!DPROT_TIMER_BEFORE (t->due, loop->heap[parent]->due)) break;
+
+		dprot_timer_place (loop, loop->heap[parent], slot);
+		slot = parent;
+	}
+	dprot_timer_place (loop, t, slot);
+}
+
+/***********************************************************/
+static void dprot_timer_down (dprot_loop* loop, uint32_t slot)
+{
+	dprot_timer* t = loop->heap[slot];
+	uint32_t child;
+
+	while ((child = 2 * slot + 1) < loop->timers)
+	{
+		// the earlier of the children
+		if (child + 1 < loop->timers &&
+			DPROT_TIMER_BEFORE (loop->heap[child + 1]->due, loop->heap[child]->due))
+		{
+			child++;
+		}
+		if (!DPROT_TIMER_BEFORE (loop->heap[child]->due, t->due)) break;
+
+		dprot_timer_place (loop, loop->heap[child], slot);
+		slot = child;
+	}
+	dprot_timer_place (loop, t, slot);
+}
+
+/***********************************************************/
+static void dprot_loop_woken (void* user, uint32_t events)
+{
+	dprot_loop* loop = (dprot_loop*)user;
+	uint64_t count;
+
+	if (read (loop->wakefd, &count, sizeof(count)) < 0)
+	{
+		// nothing to take - woken already
+	}
+}
+
+/***********************************************************/
+int dprot_loop_init (dprot_loop* loop, fn_dprot_clock clock, dprot_timer** heap, uint32_t max_timers)
+{
+	if (clock == NULL || (heap == NULL && max_timers))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	loop->epfd = epoll_create1 (EPOLL_CLOEXEC);
+	if (loop->epfd < 0)
+	{
+		return -1;
+	}
+
+	loop->wakefd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->wakefd < 0 ||
+		dprot_loop_add (loop, &loop->wake, loop->wakefd, EPOLLIN, dprot_loop_woken, loop) != 0)
+	{
+		dprot_loop_close (loop);
+		return -1;
+	}
+
+	loop->clock = clock;
+	loop->heap = heap;
+	loop->timers = 0;
+	loop->max_timers = max_timers;
+	loop->running = 0;
+	loop->wakeups = 0;
+	loop->events = 0;
+	loop->fired = 0;
+	return 0;
+}
+
+/***********************************************************/
+void dprot_loop_close (dprot_loop* loop)
+{
+	if (loop->wakefd >= 0)
+	{
+		close (loop->wakefd);
+		loop->wakefd = -1;
+	}
+	if (loop->epfd >= 0)
+	{
+		close (loop->epfd);
+		loop->epfd = -1;
+	}
+}
+
+/***********************************************************/
+int dprot_loop_add (dprot_loop* loop, dprot_loop_handler* h, int fd, uint32_t events, fn_dprot_loop_io on_io, void* user)
+{
+	struct epoll_event ev;
+
+	h->fd = fd;
+	h->on_io = on_io;
+	h->user = user;
+
+	ev.events = events;
+	ev.data.ptr = h;
+	return epoll_ctl (loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/***********************************************************/
+void dprot_loop_remove (dprot_loop* loop, dprot_loop_handler* h)
+{
+	if (h->fd < 0) return;
+
+	epoll_ctl (loop->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+	h->fd = -1;
+}
+
+/***********************************************************/
+void dprot_timer_init (dprot_timer* t, fn_dprot_loop_timer on_timer, void* user)
+{
+	t->due = 0;
+	t->slot = DPROT_TIMER_IDLE;
+	t->on_timer = on_timer;
+	t->user = user;
+}
+
+/***********************************************************/
+int dprot_timer_start (dprot_loop* loop, dprot_timer* t, uint32_t due)
+{
+	uint32_t was = t->due;
+
+	t->due = due;
+	if (t->slot != DPROT_TIMER_IDLE)
+	{
+		// a running timer just moves
+		if (DPROT_TIMER_BEFORE (due, was)) dprot_timer_up (loop, t->slot);
+		else dprot_timer_down (loop, t->slot);
+		return 0;
+	}
+
+	if (loop->timers == loop->max_timers)
+	{
+		return -1;
+	}
+
+	dprot_timer_place (loop, t, loop->timers++);
+	dprot_timer_up (loop, t->slot);
+	return 0;
+}
+
+/***********************************************************/
+void dprot_timer_stop (dprot_loop* loop, dprot_timer* t)
+{
+	uint32_t slot = t->slot;
+	dprot_timer* last;
+
+	if (slot == DPROT_TIMER_IDLE) return;
+
+	t->slot = DPROT_TIMER_IDLE;
+	last = loop->heap[--loop->timers];
+	if (last == t) return;
+
+	// the last timer fills the hole - and goes where it belongs
+	dprot_timer_place (loop, last, slot);
+	if (DPROT_TIMER_BEFORE (last->due, t->due)) dprot_timer_up (loop, slot);
+	else dprot_timer_down (loop, slot);
+}
+
+/***********************************************************/
+/*
+ * fires the due timers - a timer started from a callback
+ * for 'now' runs at the next call
+ */
+static int dprot_loop_fire (dprot_loop* loop)
+{
+	uint32_t now = loop->clock ();
+	uint32_t n = loop->timers;
+	dprot_timer* t;
+	int fired = 0;
+
+	while (loop->timers && n-- && !DPROT_TIMER_BEFORE (now, loop->heap[0]->due))
+	{
+		t = loop->heap[0];
+		dprot_timer_stop (loop, t);
+		t->on_timer (t->user);
+		fired++;
+	}
+
+	loop->fired += fired;
+	return fired;
+}
+
+/***********************************************************/
+int dprot_loop_run_once (dprot_loop* loop, int max_wait)
+{
+	struct epoll_event ev[DPROT_LOOP_EVENTS];
+	dprot_loop_handler* h;
+	int32_t left;
+	int wait = max_wait;
+	int n;
+	int i;
+
+	// sleep up to the earliest timer (rounded up to whole ms)
+	if (loop->timers)
+	{
+		left = (int32_t)(loop->heap[0]->due - loop->clock ());
+		left = (left <= 0) ? 0 : (left + 999) / 1000;
+		if (wait < 0 || left < wait) wait = left;
+	}
+
+	n = epoll_wait (loop->epfd, ev, DPROT_LOOP_EVENTS, wait);
+	if (n < 0)
+	{
+		return (errno == EINTR) ? 0 : -1;
+	}
+	loop->wakeups++;
+
+	for (i = 0; i < n; i++)
+	{
+		h = (dprot_loop_handler*)ev[i].data.ptr;
+		h->on_io (h->user, ev[i].events);
+	}
+	loop->events += n;
+
+	return n + dprot_loop_fire (loop);
+}
+
+/***********************************************************/
+void dprot_loop_run (dprot_loop* loop)
+{
+	loop->running = 1;
+	while (loop->running)
+	{
+		if (dprot_loop_run_once (loop, -1) < 0) break;
+	}
+}
+
+/***********************************************************/
+void dprot_loop_stop (dprot_loop* loop)
+{
+	uint64_t one = 1;
+
+	loop->running = 0;
+	if (write (loop->wakefd, &one, sizeof(one)) < 0)
+	{
+		// the counter is full - the loop is being woken anyway
+	}
+}
+
+//===============================================
+// the slave links
+
+/***********************************************************/
+static void dprot_loop_slave_ack (void* user)
+{
+	dprot_loop_slave* s = (dprot_loop_slave*)user;
+
+	dprot_slave_poll (s->link);
+}
+
+/***********************************************************/
+static void dprot_loop_slave_io (void* user, uint32_t events)
+{
+	dprot_loop_slave* s = (dprot_loop_slave*)user;
+	uint8_t buf[DPROT_LOOP_READ];
+	ssize_t n;
+
+	// all there is - the descriptor is non-blocking
+	do
+	{
+		n = read (s->port->fd, buf, sizeof(buf));
+		if (n > 0)
+		{
+			dprot_rx_feed (&s->rx, buf, (uint16_t)n);
+		}
+	} while (n == sizeof(buf) || (n < 0 && errno == EINTR));
+
+	if (n == 0 || (n < 0 && errno != EAGAIN))
+	{
+		// the other end is gone
+		dprot_loop_remove (s->loop, &s->handler);
+		dprot_timer_stop (s->loop, &s->ack_timer);
+		return;
+	}
+
+	// an ack held back for the answer goes out on time anyway
+	if (s->link->slave.ack_pending && s->link->slave.clock)
+	{
+		dprot_timer_start (s->loop, &s->ack_timer, s->link->slave.ack_due);
+	}
+	else
+	{
+		dprot_timer_stop (s->loop, &s->ack_timer);
+	}
+}
+
+/***********************************************************/
+int dprot_loop_add_slave (dprot_loop_slave* s, dprot_loop* loop, dprot_link* link, dprot_serial* port, fn_dprot_frame on_frame)
+{
+	int flags = fcntl (port->fd, F_GETFL);
+
+	if (flags < 0 || fcntl (port->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		return -1;
+	}
+
+	s->loop = loop;
+	s->link = link;
+	s->port = port;
+	dprot_rx_init (&s->rx, on_frame, s);
+	dprot_rx_set_checking (&s->rx, link->checking);
+	dprot_rx_set_framing (&s->rx, link->channel.framing);
+	dprot_rx_set_fec (&s->rx, SLIP_FEC_NROOTS(&link->channel));
+	dprot_timer_init (&s->ack_timer, dprot_loop_slave_ack, s);
+
+	return dprot_loop_add (loop, &s->handler, port->fd, EPOLLIN, dprot_loop_slave_io, s);
+}
+
+/***********************************************************/
+void dprot_loop_remove_slave (dprot_loop_slave* s)
+{
+	dprot_loop_remove (s->loop, &s->handler);
+	dprot_timer_stop (s->loop, &s->ack_timer);
+}
+
+//===============================================
+// the master links
+
+/***********************************************************/
+void dprot_loop_master_update (dprot_loop_master* m)
+{
+	uint32_t due;
+
+	if (dprot_master_async_due (m->link, &due))
+	{
+		dprot_timer_start (m->loop, &m->rto_timer, due);
+	}
+	else
+	{
+		dprot_timer_stop (m->loop, &m->rto_timer);
+	}
+}
+
+/***********************************************************/
+static void dprot_loop_master_rto (void* user)
+{
+	dprot_loop_master* m = (dprot_loop_master*)user;
+
+	dprot_master_async_poll (m->link);
+	dprot_loop_master_update (m);
+}
+
+/***********************************************************/
+static void dprot_loop_master_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	dprot_loop_master* m = (dprot_loop_master*)user;
+
+	dprot_master_async_frame (m->link, status, frame, len);
+}
+
+/***********************************************************/
+static void dprot_loop_master_io (void* user, uint32_t events)
+{
+	dprot_loop_master* m = (dprot_loop_master*)user;
+	uint8_t buf[DPROT_LOOP_READ];
+	ssize_t n;
+
+	do
+	{
+		n = read (m->port->fd, buf, sizeof(buf));
+		if (n > 0)
+		{
+			dprot_rx_feed (&m->rx, buf, (uint16_t)n);
+		}
+	} while (n == sizeof(buf) || (n < 0 && errno == EINTR));
+
+	if (n == 0 || (n < 0 && errno != EAGAIN))
+	{
+		// the requests run out of retries on their own
+		dprot_loop_remove (m->loop, &m->handler);
+	}
+
+	dprot_loop_master_update (m);
+}
+
+/***********************************************************/
+int dprot_loop_add_master (dprot_loop_master* m, dprot_loop* loop, dprot_link* link, dprot_serial* port)
+{
+	int flags = fcntl (port->fd, F_GETFL);
+
+	if (flags < 0 || fcntl (port->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		return -1;
+	}
+
+	m->loop = loop;
+	m->link = link;
+	m->port = port;
+	dprot_rx_init (&m->rx, dprot_loop_master_frame, m);
+	dprot_rx_set_checking (&m->rx, link->checking);
+	dprot_rx_set_framing (&m->rx, link->channel.framing);
+	dprot_rx_set_fec (&m->rx, SLIP_FEC_NROOTS(&link->channel));
+	dprot_timer_init (&m->rto_timer, dprot_loop_master_rto, m);
+
+	if (dprot_loop_add (loop, &m->handler, port->fd, EPOLLIN, dprot_loop_master_io, m) != 0)
+	{
+		return -1;
+	}
+
+	// the requests submitted before
+	dprot_loop_master_update (m);
+	return 0;
+}
+
+/***********************************************************/
+void dprot_loop_remove_master (dprot_loop_master* m)
+{
+	dprot_loop_remove (m->loop, &m->handler);
+	dprot_timer_stop (m->loop, &m->rto_timer);
+}
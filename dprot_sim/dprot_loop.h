@@ -0,0 +1,267 @@
+#ifndef __DPROT_LOOP_H__
+#define __DPROT_LOOP_H__
+
+#include "spec_types.h"
+#include "dprot.h"
+#include "dprot_serial.h"
+
+/*! \file dprot_loop.h
+ * \brief Event loop driver (Linux epoll)
+ *
+ * A single thread serves any number of links. The file
+ * descriptors (tty, pty, socketpair) are registered with
+ * epoll and the timers are kept in a binary min-heap - the
+ * loop sleeps in epoll_wait until a descriptor is ready or
+ * the earliest timer is due, so an idle loop doesn't use
+ * any cpu.
+ *
+ * The handlers and the timers are owned by the caller (no
+ * allocations in the loop). A slave link is attached with
+ * 'dprot_loop_add_slave' - the received bytes are fed to its
+ * receive context and the held back acks are sent by a
+ * timer. A master link attached with 'dprot_loop_add_master'
+ * runs the asynchronous requests - the acks complete them
+ * and a timer at the ack deadline retransmits.
+ */
+
+/*! \def DPROT_LOOP_EVENTS
+ * \brief The number of events taken from epoll at once
+ */
+#ifndef DPROT_LOOP_EVENTS
+#define DPROT_LOOP_EVENTS	64
+#endif
+
+/*! \def DPROT_LOOP_READ
+ * \brief The size of a single read of a ready descriptor
+ */
+#ifndef DPROT_LOOP_READ
+#define DPROT_LOOP_READ		512
+#endif
+
+/*********************************************************/
+/*! \typedef fn_dprot_loop_io
+ * \brief Called when a registered descriptor is ready
+ * \param user the user pointer of the handler
+ * \param events the epoll events (EPOLLIN, EPOLLOUT...)
+ */
+typedef void (*fn_dprot_loop_io)(void* user, uint32_t events);
+
+/*! \typedef fn_dprot_loop_timer
+ * \brief Called when a timer is due
+ * \param user the user pointer of the timer
+ */
+typedef void (*fn_dprot_loop_timer)(void* user);
+
+/*! \struct dprot_loop_handler
+ * \brief A registered descriptor
+ */
+typedef struct
+{
+	int fd;
+	fn_dprot_loop_io on_io;
+	void* user;
+} dprot_loop_handler;
+
+/*! \struct dprot_timer
+ * \brief A one-shot timer
+ */
+typedef struct
+{
+	uint32_t due;               /**< the time it fires at [us] */
+	uint32_t slot;              /**< its place in the heap, DPROT_TIMER_IDLE if stopped */
+	fn_dprot_loop_timer on_timer;
+	void* user;
+} dprot_timer;
+
+#define DPROT_TIMER_IDLE	0xffffffff
+
+/*! \struct dprot_loop
+ * \brief The state of an event loop
+ */
+typedef struct
+{
+	int epfd;
+	fn_dprot_clock clock;       /**< the time of the timers [us] */
+	dprot_timer** heap;         /**< the running timers, the earliest first */
+	uint32_t timers;            /**< the number of the running timers */
+	uint32_t max_timers;        /**< the size of 'heap' */
+	volatile int running;
+	int wakefd;                 /**< wakes the loop up from other threads */
+	dprot_loop_handler wake;
+	uint32_t wakeups;           /**< the returns from epoll_wait */
+	uint32_t events;            /**< the descriptor events handled */
+	uint32_t fired;             /**< the timers fired */
+} dprot_loop;
+
+/*! \struct dprot_loop_slave
+ * \brief A slave link served by the loop
+ */
+typedef struct
+{
+	dprot_loop* loop;
+	dprot_link* link;
+	dprot_serial* port;         /**< the descriptor of the link */
+	dprot_loop_handler handler;
+	dprot_timer ack_timer;      /**< sends the held back ack */
+	dprot_rx_ctx rx;
+} dprot_loop_slave;
+
+/*! \struct dprot_loop_master
+ * \brief A master link (asynchronous requests) served by the loop
+ */
+typedef struct
+{
+	dprot_loop* loop;
+	dprot_link* link;
+	dprot_serial* port;         /**< the descriptor of the link */
+	dprot_loop_handler handler;
+	dprot_timer rto_timer;      /**< the ack deadline of the request in flight */
+	dprot_rx_ctx rx;
+} dprot_loop_master;
+
+/*********************************************************/
+
+/*!
+ * \brief Creates an event loop
+ *
+ * \param loop the loop
+ * \param clock the time source of the timers [us]
+ * \param heap preallocated room for 'max_timers' running timers
+ * \param max_timers the size of 'heap'
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_loop_init (dprot_loop* loop, fn_dprot_clock clock, dprot_timer** heap, uint32_t max_timers);
+
+/*!
+ * \brief Releases the loop (not the registered descriptors)
+ * \param loop the loop
+ */
+void dprot_loop_close (dprot_loop* loop);
+
+/*!
+ * \brief Registers a descriptor
+ *
+ * \param loop the loop
+ * \param h the handler - it has to stay valid until removed
+ * \param fd the descriptor
+ * \param events the epoll events to wait for
+ * \param on_io the function called when 'fd' is ready
+ * \param user the pointer passed to 'on_io'
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_loop_add (dprot_loop* loop, dprot_loop_handler* h, int fd, uint32_t events, fn_dprot_loop_io on_io, void* user);
+
+/*!
+ * \brief Unregisters a descriptor
+ * \param loop the loop
+ * \param h the handler given to 'dprot_loop_add'
+ */
+void dprot_loop_remove (dprot_loop* loop, dprot_loop_handler* h);
+
+/*!
+ * \brief Initializes a timer (stopped)
+ *
+ * \param t the timer
+ * \param on_timer the function called when it is due
+ * \param user the pointer passed to 'on_timer'
+ */
+void dprot_timer_init (dprot_timer* t, fn_dprot_loop_timer on_timer, void* user);
+
+/*!
+ * \brief Starts (or restarts) a timer
+ *
+ * \param loop the loop
+ * \param t the timer
+ * \param due the time it fires at [us]
+ *
+ * \return 0 on success, -1 if the heap is full
+ */
+int dprot_timer_start (dprot_loop* loop, dprot_timer* t, uint32_t due);
+
+/*!
+ * \brief Stops a timer - nothing happens if it isn't running
+ * \param loop the loop
+ * \param t the timer
+ */
+void dprot_timer_stop (dprot_loop* loop, dprot_timer* t);
+
+/*!
+ * \brief Waits for the descriptors and the timers once
+ *
+ * \param loop the loop
+ * \param max_wait the longest wait [ms], -1 up to the next timer
+ *
+ * \return the number of the handled events and timers, -1 on error
+ */
+int dprot_loop_run_once (dprot_loop* loop, int max_wait);
+
+/*!
+ * \brief Runs the loop until 'dprot_loop_stop'
+ * \param loop the loop
+ */
+void dprot_loop_run (dprot_loop* loop);
+
+/*!
+ * \brief Makes 'dprot_loop_run' return
+ * It can be called from any thread - a sleeping loop is woken up.
+ *
+ * \param loop the loop
+ */
+void dprot_loop_stop (dprot_loop* loop);
+
+/*!
+ * \brief Serves a slave link from the loop
+ * The link has to be initialized with 'dprot_slave_init_protocol_buf'
+ * writing to 'port' (e.g. 'dprot_serial_write_buf'). The descriptor
+ * is made non-blocking for the reads.
+ *
+ * \param s the state of the served link
+ * \param loop the loop
+ * \param link the slave link
+ * \param port the descriptor of the link
+ * \param on_frame the function the received frames are passed to -
+ * it calls 'dprot_slave_process_msg' (with 's' as the user pointer)
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_loop_add_slave (dprot_loop_slave* s, dprot_loop* loop, dprot_link* link, dprot_serial* port, fn_dprot_frame on_frame);
+
+/*!
+ * \brief Stops serving a slave link
+ * \param s the state of the served link
+ */
+void dprot_loop_remove_slave (dprot_loop_slave* s);
+
+/*!
+ * \brief Serves a master link from the loop
+ * The link has to be initialized with 'dprot_master_init_protocol_buf'
+ * writing to 'port' and have the loop's clock. The requests are
+ * submitted with 'dprot_master_submit_data'/'dprot_master_submit_ping'.
+ *
+ * \param m the state of the served link
+ * \param loop the loop
+ * \param link the master link
+ * \param port the descriptor of the link
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_loop_add_master (dprot_loop_master* m, dprot_loop* loop, dprot_link* link, dprot_serial* port);
+
+/*!
+ * \brief Follows the link's ack deadline with the timer
+ * To be called after a submit - except from a completion function
+ * of the same link, which the loop follows by itself.
+ *
+ * \param m the state of the served link
+ */
+void dprot_loop_master_update (dprot_loop_master* m);
+
+/*!
+ * \brief Stops serving a master link (the requests stay queued)
+ * \param m the state of the served link
+ */
+void dprot_loop_remove_master (dprot_loop_master* m);
+
+#endif //__DPROT_LOOP_H__
@@ -1,69 +1,263 @@
+#include <string.h>
 #include "dprot.h"
 
-slip_channel    master_channel = {0};
-uint8_t         master_last_parity = 1;
-
 /***********************************************************/
-uint8_t dprot_master_init_protocol (fn_put_char put_function, fn_get_char_to get_function)
+uint8_t dprot_master_init_protocol (dprot_link* link, fn_put_char put_function, fn_get_char_to get_function)
 {
-	// initialize the crc table
-	init_crc8( );
-    
-    master_last_parity = 0;
+    link->last_parity = 0;
+    link->window_mode = DPROT_WINDOW_NONE;
+    link->window_size = 1;
+    link->master.next_seq = 0;
+    link->master.window_sync = 1;
+    link->master.retries = DPROT_MASTER_NUM_RETRIES;
+    link->master.msg = NULL;
+    link->master.msg_len = 0;
+    link->master.clock = NULL;
+    link->master.response_len = 0;
+    link->master.async_head = link->master.async_tail = NULL;
+    link->master.done_head = link->master.done_tail = NULL;
+    memset (&link->master.rtt, 0, sizeof(dprot_rtt));
+    link->master.rtt.rto = DPROT_RTO_INIT;
+    link->master.rtt.seed = 0x9e3779b9u ^ (uint32_t)(size_t)link;
+    link->checking = DPROT_CHECKING_DEFAULT;
+    link->check_size = checking_size (DPROT_CHECKING_DEFAULT);
+    memset (&link->stats, 0, sizeof(dprot_stats));
+    link->trace = NULL;
+    link->compress = 0;
 	
 	// initialize the slip protocol
-	return slip_init (put_function, NULL, get_function, &master_channel);
+	return slip_init (put_function, NULL, get_function, &link->channel);
+}
+
+/***********************************************************/
+uint8_t dprot_master_init_protocol_buf (dprot_link* link, fn_write_buf write_function, fn_read_buf read_function, void* io_ctx)
+{
+	uint8_t ret = dprot_master_init_protocol (link, NULL, NULL);
+	
+	// the same protocol state over the bulk functions
+	if (ret == DPROT_NO_ERROR)
+	{
+		ret = slip_init_buf (write_function, read_function, io_ctx, SLIP_RX_TIMEOUT, &link->channel);
+	}
+	return ret;
+}
+
+/***********************************************************/
+void dprot_master_set_clock (dprot_link* link, fn_dprot_clock clock)
+{
+	link->master.clock = clock;
+	
+	// the timeout is the deadline of the whole ack wait
+	slip_set_clock (&link->channel, clock);
+	
+	// back to the fixed timeout
+	if (clock == NULL)
+	{
+		link->channel.rx_timeout = SLIP_RX_TIMEOUT;
+	}
+}
+
+/***********************************************************/
+void dprot_master_set_seed (dprot_link* link, uint32_t seed)
+{
+	// xorshift never leaves 0
+	link->master.rtt.seed = seed ? seed : 0x9e3779b9u;
+}
+
+/***********************************************************/
+uint8_t dprot_master_set_retries (dprot_link* link, uint8_t retries)
+{
+	if (retries == 0)
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	link->master.retries = retries;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint32_t dprot_master_get_rtt (dprot_link* link)
+{
+	return link->master.rtt.srtt;
+}
+
+/***********************************************************/
+uint32_t dprot_master_get_rto (dprot_link* link)
+{
+	uint32_t rto = link->master.rtt.rto << link->master.rtt.backoff;
+	
+	return (rto > DPROT_RTO_MAX) ? DPROT_RTO_MAX : rto;
+}
+
+/***********************************************************/
+static uint32_t dprot_master_now (dprot_link* link)
+{
+	return link->master.clock ? link->master.clock () : 0;
+}
+
+/***********************************************************/
+/*
+ * sets the timeout of the next ack wait - the rto doubled for
+ * every timeout in a row, plus up to a quarter of it at random,
+ * so the links that lost their frames at once don't retransmit
+ * in lock step. returns the clock when armed.
+ */
+static uint32_t dprot_master_arm_timeout (dprot_link* link)
+{
+	dprot_rtt* r = &link->master.rtt;
+	uint32_t to;
+	
+	if (link->master.clock == NULL)
+	{
+		return 0;
+	}
+	
+	to = dprot_master_get_rto (link);
+	
+	// xorshift32
+	r->seed ^= r->seed << 13;
+	r->seed ^= r->seed >> 17;
+	r->seed ^= r->seed << 5;
+	to += r->seed % (to / 4 + 1);
+	
+	r->timeout = to;
+	r->armed = link->master.clock ();
+	link->channel.rx_timeout = (to + 999) / 1000;
+	return r->armed;
 }
 
 /***********************************************************/
-uint8_t dprot_master_wait_for_data (uint8_t* buffer, uint8_t max_len)
+/*
+ * a round trip of a frame acked on its first transmission
+ * (RFC 6298 with the usual 1/8 and 1/4 gains)
+ */
+static void dprot_master_rtt_sample (dprot_link* link, uint32_t sent)
+{
+	dprot_rtt* r = &link->master.rtt;
+	uint32_t m;
+	uint32_t delta;
+	
+	if (link->master.clock == NULL)
+	{
+		return;
+	}
+	
+	m = link->master.clock () - sent;
+	
+	if (r->srtt == 0)
+	{
+		// the first measurement
+		r->srtt = m ? m : 1;
+		r->rttvar = m / 2;
+	}
+	else
+	{
+		delta = (r->srtt > m) ? r->srtt - m : m - r->srtt;
+		r->rttvar = r->rttvar - r->rttvar / 4 + delta / 4;
+		r->srtt = r->srtt - r->srtt / 8 + m / 8;
+	}
+	
+	r->rto = r->srtt + ((4 * r->rttvar > DPROT_RTO_GRANULARITY) ? 4 * r->rttvar : DPROT_RTO_GRANULARITY);
+	if (r->rto < DPROT_RTO_MIN) r->rto = DPROT_RTO_MIN;
+	if (r->rto > DPROT_RTO_MAX) r->rto = DPROT_RTO_MAX;
+	
+	// a fresh measurement ends the backoff
+	r->backoff = 0;
+}
+
+/***********************************************************/
+/*
+ * the ack wait failed - only a real timeout backs off, a nack
+ * or a corrupted answer proves the line is alive
+ */
+static void dprot_master_rtt_failed (dprot_link* link)
+{
+	dprot_rtt* r = &link->master.rtt;
+	
+	if (link->master.clock == NULL)
+	{
+		return;
+	}
+	
+	if (link->master.clock () - r->armed >= r->timeout && r->backoff < DPROT_RTO_MAX_BACKOFF)
+	{
+		r->backoff++;
+	}
+}
+
+/***********************************************************/
+/*
+ * counts a finished transaction - 'started' is the clock at
+ * its first transmission
+ */
+static void dprot_master_count_done (dprot_link* link, uint8_t result, uint32_t started)
+{
+	DPROT_STAT_ADD (link, transactions, 1);
+	if (result != DPROT_ACK_ACCEPTED)
+	{
+		DPROT_STAT_ADD (link, failures, 1);
+	}
+	else if (link->master.clock)
+	{
+		dprot_stats_latency (&link->stats, link->master.clock () - started);
+	}
+}
+
+/***********************************************************/
+uint8_t dprot_master_wait_for_data (dprot_link* link, uint8_t* buffer, uint8_t max_len)
 {
 	uint8_t actual_rx = 0;
 	uint8_t type = 0;
-	uint8_t length = 0;
     uint8_t seq_parity = 0;
-	uint8_t calc_check = 0;
-	uint8_t i = 0;
-	uint8_t *data_ptr = NULL;
+	uint8_t ret = 0;
 	
-	// read a slip frame with maximum 'max_len' size
-	actual_rx = slip_rx(&master_channel, buffer, max_len);
+	if (link->master.response_len)
+	{
+		// the answer came with the ack of the request
+		actual_rx = (link->master.response_len < max_len) ? link->master.response_len : max_len;
+		memcpy (buffer, link->master.response, actual_rx);
+		link->master.response_len = 0;
+	}
+	else
+	{
+		// read a slip frame with maximum 'max_len' size
+		actual_rx = slip_rx(&link->channel, buffer, max_len);
+		if (actual_rx == 0)
+		{
+			// nothing came - the buffer holds whatever was there
+			DPROT_STAT_ADD (link, timeouts, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_TIMEOUT, 0, 0);
+			return DPROT_DATA_ERROR;
+		}
+		DPROT_STAT_ADD (link, rx_frames, 1);
+		DPROT_STAT_ADD (link, rx_bytes, actual_rx);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_FRAME, buffer[0], actual_rx);
+	}
 	
 	// read out all needed information
     seq_parity = (buffer[0] & 0x01);
-	type = (buffer[0]&0xfe);
-	length = buffer[1];
-	data_ptr = &buffer[2];
+	type = (buffer[0]&DPROT_TYPE_MASK);
     
     // check parity
-    if (seq_parity != master_last_parity)
+    if (seq_parity != link->last_parity)
 	{
         // error - we got an ack of encient message
+        DPROT_STAT_ADD (link, duplicates, 1);
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_DUPLICATE, buffer[0], actual_rx);
         return DPROT_DATA_ERROR;
     }
     
-    // check the length
-	if (length > DPROT_MAX_PAYLOAD)
+    // check the length and the checking
+	ret = dprot_check_frame (link->checking, buffer, actual_rx);
+	if (ret != DPROT_NO_ERROR)
 	{
-		// length error - checking method can't be applied
-		// because we don't know where actually the msg ends
-		return DPROT_LOGICAL_ERROR;
-	}
-	
-	// calculate the checking byte
-	DPROT_CHECKING(calc_check,buffer[0]);
-	DPROT_CHECKING(calc_check,buffer[1]);
-	for (i = 0; i < length; i++)
-	{
-		DPROT_CHECKING(calc_check,data_ptr[i]);
-	}
-    
-	
-	// compare the checking byte
-	if (data_ptr[i] != calc_check)
-	{
-		// checksum/crc8 error. return a DATA_ERROR
-		return DPROT_DATA_ERROR;
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		if (ret == DPROT_DATA_ERROR) DPROT_STAT_ADD (link, crc_errors, 1);
+		else DPROT_STAT_ADD (link, framing_errors, 1);
+		// a length error is a logical one - the checking can't be
+		// applied because we don't know where actually the msg ends
+		return (ret == DPROT_DATA_ERROR) ? DPROT_DATA_ERROR : DPROT_LOGICAL_ERROR;
 	}
     
 	// check the type
@@ -76,44 +270,79 @@ uint8_t dprot_master_wait_for_data (uint8_t* buffer, uint8_t max_len)
         case DPROT_TYPE_SYNC:
         default:
 			// this message is not a data packet
+			DPROT_STAT_ADD (link, logical_errors, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
 			return DPROT_LOGICAL_ERROR;
 	}
 	
+	// a compressed answer
+	if ((buffer[0] & DPROT_FLAG_LZ) && dprot_unpack_frame (buffer, max_len) != DPROT_NO_ERROR)
+	{
+		DPROT_STAT_ADD (link, logical_errors, 1);
+		return DPROT_LOGICAL_ERROR;
+	}
+	
     
 	return DPROT_NO_ERROR;
 }
 
 
 /***********************************************************/
-uint8_t dprot_master_wait_for_ack_nack ( void )
+/*
+ * checks the answer to a request - an answer that acks it
+ * is kept in 'link->master.response'. DPROT_NO_MSG for an
+ * answer to the previous request
+ */
+static uint8_t dprot_master_check_answer (dprot_link* link, uint8_t* buffer, uint16_t actual_rx)
 {
 	uint8_t type = 0;
 	uint8_t length = 0;
-	uint8_t calc_check = 0;
-	uint8_t buffer[4] = {0};
-	uint8_t actual_rx = 0;
-	uint8_t parity = 0;
-    
-	// the expectes size of ack message is 3
-	actual_rx = slip_rx(&master_channel, buffer, 3);
+	
+	if (actual_rx >= 2 + link->check_size &&
+		(buffer[0] & ~DPROT_FLAG_LZ) == (DPROT_TYPE_DATA | DPROT_FLAG_ACK | link->last_parity))
+	{
+		if (dprot_check_frame (link->checking, buffer, actual_rx) != DPROT_NO_ERROR)
+		{
+			DPROT_STAT_ADD (link, crc_errors, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+			return DPROT_DATA_ERROR;
+		}
+		
+		// kept for 'dprot_master_wait_for_data'
+		if (buffer != link->master.response) memcpy (link->master.response, buffer, actual_rx);
+		link->master.response_len = actual_rx;
+		DPROT_STAT_ADD (link, acks_rx, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_ACK, buffer[0], actual_rx);
+		return DPROT_ACK_ACCEPTED;
+	}
+	
+	// an answer of the previous request (its retransmission was
+	// answered twice) - it says nothing about this one. a nack is
+	// not dropped - the slave nacks a corrupted frame with the
+	// parity it holds
+	if (actual_rx >= 2 + link->check_size && (buffer[0] & 0x01) != link->last_parity &&
+		(buffer[0] & DPROT_TYPE_MASK) != DPROT_TYPE_NACK &&
+		dprot_check_frame (link->checking, buffer, actual_rx) == DPROT_NO_ERROR)
+	{
+		DPROT_STAT_ADD (link, duplicates, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_DUPLICATE, buffer[0], actual_rx);
+		return DPROT_NO_MSG;
+	}
 	
 	// check that we got exactly the length we needed
-	if (actual_rx != 3)
+	if (actual_rx != 2 + link->check_size)
 	{
 		// the input data is shorter than expected
+		if (actual_rx)
+		{
+			DPROT_STAT_ADD (link, framing_errors, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		}
 		return DPROT_DATA_ERROR;
 	}
 	
-    parity = buffer[0]&0x1;
-	type = buffer[0]&0xfe;
+	type = buffer[0]&~(0x01|DPROT_FLAG_LZ);   // a compressing slave flags its acks
 	length = buffer[1];
-    
-    // check parity
-    if (parity != master_last_parity)
-	{
-        // error - we got an ack of encient message
-        return DPROT_DATA_ERROR;
-    }
         
 	// check type
 	if (type != DPROT_TYPE_ACK && type != DPROT_TYPE_NACK)
@@ -121,6 +350,8 @@ uint8_t dprot_master_wait_for_ack_nack ( void )
 		// an unexpected data type has been received
 		// return and let the master sender to decide what
 		// to do next
+		DPROT_STAT_ADD (link, logical_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
 		return DPROT_DATA_ERROR;
 	}
 	
@@ -129,103 +360,962 @@ uint8_t dprot_master_wait_for_ack_nack ( void )
 	{
 		// an unexpected data length (other then 0) was received
 		// return with error because it violates the protocol
+		DPROT_STAT_ADD (link, logical_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
 		return DPROT_DATA_ERROR;
 	}
 	
-	// check the checking byte - calculate and compare
-	DPROT_CHECKING(calc_check,buffer[0]);
-	DPROT_CHECKING(calc_check,buffer[1]);
-	
-	if (buffer[2] != calc_check)
+	// check the checking bytes - calculate and compare
+	if (dprot_check_frame (link->checking, buffer, actual_rx) != DPROT_NO_ERROR)
 	{
 		// checksum error
+		DPROT_STAT_ADD (link, crc_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
 		return DPROT_DATA_ERROR;
 	}
 	
-	if (type == DPROT_TYPE_ACK) return DPROT_ACK_ACCEPTED;
+	if (type == DPROT_TYPE_ACK)
+	{
+		DPROT_STAT_ADD (link, acks_rx, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_ACK, buffer[0], actual_rx);
+		return DPROT_ACK_ACCEPTED;
+	}
+	DPROT_STAT_ADD (link, nacks_rx, 1);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_NACK, buffer[0], actual_rx);
 	return DPROT_NACK_ACCEPTED;
 }
 
 /***********************************************************/
-uint8_t dprot_master_send_data_msg (uint8_t* buffer, uint8_t len)
+uint8_t dprot_master_wait_for_ack_nack (dprot_link* link)
 {
-	uint8_t i;
-    uint8_t ret = 0;
-	uint8_t calc_check = 0;
-    uint8_t retry = DPROT_MASTER_NUM_RETRIES;
-	uint8_t header[2] = { DPROT_TYPE_DATA, len };
+	uint16_t actual_rx = 0;
+	uint8_t ret;
     
-   
+	// the expectes size of ack message is the header and the checking,
+	// but a piggybacking slave may answer the request right away
+	link->master.response_len = 0;
 	
-	if (len > DPROT_MAX_PAYLOAD)
+	// a stale answer is dropped and the wait goes on
+	do
 	{
-		// the buffer is bigger than the maximal allowed
-		// transaction size
-		return DPROT_MSG_SIZE_ERROR;
-	}
+		actual_rx = slip_rx(&link->channel, link->master.response, DPROT_MAX_MSG);
+		if (actual_rx == 0)
+		{
+			DPROT_STAT_ADD (link, timeouts, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_TIMEOUT, 0, 0);
+		}
+		else
+		{
+			DPROT_STAT_ADD (link, rx_frames, 1);
+			DPROT_STAT_ADD (link, rx_bytes, actual_rx);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_FRAME, link->master.response[0], actual_rx);
+		}
+		ret = dprot_master_check_answer (link, link->master.response, actual_rx);
+	} while (ret == DPROT_NO_MSG);
+	
+	return ret;
+}
+
+/***********************************************************/
+/*
+ * sends a data frame and waits for the ack. 'head' is sent
+ * right after the length byte as part of the payload
+ * (the fragment header).
+ */
+static uint8_t dprot_master_send_data_frame (dprot_link* link, uint8_t flags, uint8_t* head, uint8_t head_len, uint8_t* buffer, uint8_t len)
+{
+    uint8_t ret = 0;
+	uint8_t calc_check[CHECKING_MAX_SIZE];
+    uint8_t retry = link->master.retries;
+	uint8_t resent = 0;
+	uint32_t sent;
+	uint32_t started = 0;
+	uint8_t header[2+DPROT_FRAG_FIRST_HEADER] = { DPROT_TYPE_DATA | flags, head_len + len };
+	
+    // advance the parity and embed it - a new message
+    link->last_parity = !link->last_parity;
+    header[0] |= link->last_parity;
+	if (head_len) memcpy (header + 2, head, head_len);
 		
 	// calculate the checking
-	DPROT_CHECKING(calc_check,header[0]);
-	DPROT_CHECKING(calc_check,header[1]);
-	for (i = 0; i < len; i++)
-	{
-		DPROT_CHECKING(calc_check,buffer[i]);
-	}
+	dprot_calc_checking (link->checking, header, head_len + 2, buffer, len, calc_check);
 	
     while (retry--)
     {
         // finally send the data
-        slip_tx(&master_channel, header, 2, SLIP_MSG_START);
-        slip_tx(&master_channel, buffer, len, SLIP_MSG_MIDDLE);
-        slip_tx(&master_channel, &calc_check, 1, SLIP_MSG_END);
+        sent = dprot_master_arm_timeout (link);
+        if (resent)
+        {
+            DPROT_STAT_ADD (link, retries, 1);
+            DPROT_TRACE_EVENT (link, DPROT_TRACE_RETRY, header[0], head_len + 2 + len + link->check_size);
+        }
+        else started = sent;
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, header[0], head_len + 2 + len + link->check_size);
+        slip_tx(&link->channel, header, head_len + 2, SLIP_MSG_START);
+        slip_tx(&link->channel, buffer, len, SLIP_MSG_MIDDLE);
+        slip_tx(&link->channel, calc_check, link->check_size, SLIP_MSG_END);
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, header[0], head_len + 2 + len + link->check_size);
         
         // wait for response
-        ret = dprot_master_wait_for_ack_nack ( );
+        ret = dprot_master_wait_for_ack_nack (link);
         if (ret == DPROT_ACK_ACCEPTED)
         {
             // stop trying
+            if (!resent) dprot_master_rtt_sample (link, sent);
             break;
         }
-
+        
+        dprot_master_rtt_failed (link);
+        resent = 1;
     }
+    dprot_master_count_done (link, ret, started);
+	return ret;
+}
+
+/***********************************************************/
+uint8_t dprot_master_send_data_msg (dprot_link* link, uint8_t* buffer, uint8_t len)
+{
+	uint8_t packed[DPROT_MAX_MSG];
+	uint16_t n;
+	
+	if (len > DPROT_PAYLOAD(link->check_size))
+	{
+		// the buffer is bigger than the maximal allowed
+		// transaction size
+		return DPROT_MSG_SIZE_ERROR;
+	}
+	
+	// on a slow line a shorter frame is all that counts
+	if (link->compress && len >= DPROT_LZ_MIN_LEN)
+	{
+		n = lzss_compress (buffer, len, packed, len - 1);
+		if (n)
+		{
+			DPROT_STAT_ADD (link, compressed, 1);
+			DPROT_STAT_ADD (link, compress_saved, len - n);
+			return dprot_master_send_data_frame (link, DPROT_FLAG_LZ, NULL, 0, packed, (uint8_t)n);
+		}
+	}
+	
+	return dprot_master_send_data_frame (link, 0, NULL, 0, buffer, len);
+}
+
+/***********************************************************/
+uint8_t dprot_master_set_window (dprot_link* link, uint8_t mode, uint8_t size)
+{
+	if (mode > DPROT_WINDOW_SR || size == 0 || size > DPROT_WINDOW_MAX)
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	link->window_mode = mode;
+	link->window_size = size;
+	
+	// the slave has to learn the sequence before the next transfer
+	link->master.window_sync = 1;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_master_set_checking (dprot_link* link, uint8_t checking)
+{
+	if (!checking_size (checking))
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	link->checking = checking;
+	link->check_size = checking_size (checking);
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+static void dprot_master_send_window_frame (dprot_link* link, uint8_t flags, uint8_t* head, uint8_t head_len, uint8_t* buffer, uint8_t len, uint8_t seq)
+{
+	uint8_t calc_check[CHECKING_MAX_SIZE];
+	uint8_t header[3+DPROT_FRAG_FIRST_HEADER] = { DPROT_TYPE_WDATA | flags, head_len + len + 1, seq };
+	
+	if (head_len) memcpy (header + 3, head, head_len);
+	
+	// calculate the checking
+	dprot_calc_checking (link->checking, header, head_len + 3, buffer, len, calc_check);
+	
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, header[0], head_len + 3 + len + link->check_size);
+	slip_tx(&link->channel, header, head_len + 3, SLIP_MSG_START);
+	slip_tx(&link->channel, buffer, len, SLIP_MSG_MIDDLE);
+	slip_tx(&link->channel, calc_check, link->check_size, SLIP_MSG_END);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, header[0], head_len + 3 + len + link->check_size);
+}
+
+/***********************************************************/
+/*
+ * waits for a 'wack'/'wnack' frame. 'next' gets the cumulative
+ * ack (the next sequence the slave expects) and 'seq' the
+ * sequence number acked by a 'wack'. DPROT_TIMEOUT when nothing
+ * came, DPROT_DATA_ERROR for a corrupted frame.
+ */
+static uint8_t dprot_master_wait_for_window_ack (dprot_link* link, uint8_t* next, uint8_t* seq)
+{
+	uint8_t type = 0;
+	uint8_t length = 0;
+	uint8_t buffer[5+CHECKING_MAX_SIZE] = {0};
+	uint8_t actual_rx = 0;
+	
+	// the biggest expected message is a 'wack' of 4 bytes and the checking
+	actual_rx = slip_rx(&link->channel, buffer, sizeof(buffer));
+	
+	if (actual_rx == 0)
+	{
+		DPROT_STAT_ADD (link, timeouts, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_TIMEOUT, 0, 0);
+		return DPROT_TIMEOUT;
+	}
+	DPROT_STAT_ADD (link, rx_frames, 1);
+	DPROT_STAT_ADD (link, rx_bytes, actual_rx);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_FRAME, buffer[0], actual_rx);
+	
+	if (actual_rx < 3 + link->check_size)
+	{
+		// a truncated frame
+		DPROT_STAT_ADD (link, framing_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		return DPROT_DATA_ERROR;
+	}
+	
+	type = buffer[0]&0xfe;
+	length = buffer[1];
+	
+	// check type and length
+	if ((type == DPROT_TYPE_WACK && length != 2) ||
+		(type == DPROT_TYPE_WNACK && length != 1) ||
+		(type != DPROT_TYPE_WACK && type != DPROT_TYPE_WNACK))
+	{
+		DPROT_STAT_ADD (link, logical_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		return DPROT_DATA_ERROR;
+	}
+	
+	// check the length and the checking bytes
+	if (dprot_check_frame (link->checking, buffer, actual_rx) != DPROT_NO_ERROR)
+	{
+		// checksum error
+		DPROT_STAT_ADD (link, crc_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		return DPROT_DATA_ERROR;
+	}
+	
+	*next = buffer[2];
+	*seq = buffer[3];
+	
+	if (type == DPROT_TYPE_WACK)
+	{
+		DPROT_STAT_ADD (link, acks_rx, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_ACK, buffer[0], actual_rx);
+		return DPROT_ACK_ACCEPTED;
+	}
+	DPROT_STAT_ADD (link, nacks_rx, 1);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_NACK, buffer[0], actual_rx);
+	return DPROT_NACK_ACCEPTED;
+}
+
+/***********************************************************/
+/*
+ * the fragment 'idx' of the message being sent ('link->master.msg').
+ * 'payload' is the room of a single frame - the first fragment
+ * carries the total length too.
+ */
+static uint8_t dprot_master_fragment (dprot_link* link, uint16_t idx, uint8_t payload, uint8_t* head, uint8_t** data, uint8_t* len)
+{
+	uint32_t first = payload - DPROT_FRAG_FIRST_HEADER;
+	uint32_t offset = idx ? first + (uint32_t)(idx - 1) * (payload - DPROT_FRAG_HEADER) : 0;
+	uint32_t left = link->master.msg_len - offset;
+	uint32_t room = idx ? payload - DPROT_FRAG_HEADER : first;
+	uint8_t head_len = DPROT_FRAG_HEADER;
+	
+	head[0] = 0;
+	if (idx == 0)
+	{
+		head[0] |= DPROT_FRAG_FIRST;
+		head[1] = link->master.msg_len & 0xff;
+		head[2] = (link->master.msg_len >> 8) & 0xff;
+		head[3] = (link->master.msg_len >> 16) & 0xff;
+		head[4] = (link->master.msg_len >> 24) & 0xff;
+		head_len = DPROT_FRAG_FIRST_HEADER;
+	}
+	if (left <= room)
+	{
+		head[0] |= DPROT_FRAG_LAST;
+		room = left;
+	}
+	
+	*data = link->master.msg + offset;
+	*len = room;
+	return head_len;
+}
+
+/***********************************************************/
+/*
+ * the number of fragments of a 'len' bytes long message
+ */
+static uint32_t dprot_master_fragment_count (uint32_t len, uint8_t payload)
+{
+	uint32_t first = payload - DPROT_FRAG_FIRST_HEADER;
+	uint32_t rest = payload - DPROT_FRAG_HEADER;
+	
+	if (len <= first) return 1;
+	return 1 + (len - first + rest - 1) / rest;
+}
+
+/***********************************************************/
+/*
+ * resets the slave's window to the master's next sequence
+ * number using the 'sync' message
+ */
+static uint8_t dprot_master_window_sync (dprot_link* link)
+{
+	uint8_t ret = DPROT_DATA_ERROR;
+	uint8_t retry = link->master.retries;
+	uint8_t buffer[3+CHECKING_MAX_SIZE] = { DPROT_TYPE_SYNC, 1, link->master.next_seq };
+	uint8_t next = 0;
+	uint8_t seq = 0;
+	uint8_t resent = 0;
+	uint32_t sent;
+	
+	// calculate checking
+	dprot_calc_checking (link->checking, buffer, 3, NULL, 0, buffer + 3);
+	
+	while (retry--)
+	{
+		sent = dprot_master_arm_timeout (link);
+		if (resent)
+		{
+			DPROT_STAT_ADD (link, retries, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_RETRY, buffer[0], 3 + link->check_size);
+		}
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, buffer[0], 3 + link->check_size);
+		slip_tx(&link->channel, buffer, 3 + link->check_size, SLIP_MSG_REG);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, buffer[0], 3 + link->check_size);
+		
+		ret = dprot_master_wait_for_window_ack (link, &next, &seq);
+		if (ret == DPROT_ACK_ACCEPTED && next == link->master.next_seq)
+		{
+			if (!resent) dprot_master_rtt_sample (link, sent);
+			link->master.window_sync = 0;
+			return DPROT_ACK_ACCEPTED;
+		}
+		
+		dprot_master_rtt_failed (link);
+		resent = 1;
+	}
+	
+	return (ret == DPROT_ACK_ACCEPTED || ret == DPROT_TIMEOUT) ? DPROT_DATA_ERROR : ret;
+}
+
+/***********************************************************/
+/*
+ * sends the buffer 'idx' of a window transfer - the fragment
+ * 'idx' of 'link->master.msg' without buffers
+ */
+static void dprot_master_send_window_idx (dprot_link* link, uint8_t** buffers, uint8_t* lens, uint16_t idx, uint8_t seq)
+{
+	uint8_t head[DPROT_FRAG_FIRST_HEADER];
+	uint8_t head_len;
+	uint8_t* data;
+	uint8_t len;
+	
+	if (buffers)
+	{
+		dprot_master_send_window_frame (link, 0, NULL, 0, buffers[idx], lens[idx], seq);
+		return;
+	}
+	
+	head_len = dprot_master_fragment (link, idx, DPROT_PAYLOAD(link->check_size) - 1, head, &data, &len);
+	dprot_master_send_window_frame (link, DPROT_FLAG_FRAG, head, head_len, data, len, seq);
+}
+
+/***********************************************************/
+/*
+ * the window transfer of 'count' buffers. without buffers it
+ * sends the fragments of 'link->master.msg'.
+ * Only the frames known to be lost are sent again: the one a
+ * 'wnack' names, the ones Go-Back-N dropped and the ones sent
+ * before a frame that made it. The line keeps the order, so the
+ * answers come in the order of the transmissions - a 'wnack'
+ * names the frame again only once its last copy got answered.
+ * The whole window is sent again only after a timeout, when no
+ * ack is in flight any more.
+ */
+static uint8_t dprot_master_window_transfer (dprot_link* link, uint8_t** buffers, uint8_t* lens, uint16_t count, uint16_t* acked)
+{
+	uint16_t base = 0;          // the oldest unacked buffer
+	uint16_t next = 0;          // the next buffer to be sent
+	uint8_t base_seq = link->master.next_seq;
+	uint8_t sacked[DPROT_WINDOW_MAX] = {0};    // selective acks relative to 'base'
+	uint8_t lost[DPROT_WINDOW_MAX] = {0};      // to be sent again
+	uint32_t sent_at[DPROT_WINDOW_MAX];        // the clock at the last transmission
+	uint32_t sent_no[DPROT_WINDOW_MAX];        // the order of the last transmission
+	uint8_t resent[DPROT_WINDOW_MAX] = {0};    // not to be measured (Karn)
+	uint32_t sent_count = 0;                   // the transmissions so far
+	uint32_t arrived = 0;                      // the last transmission known to have arrived
+	uint32_t answered = 0;                     // the transmission of the last answer
+	uint8_t first;                             // the ack is of a first transmission
+	uint8_t retry = link->master.retries;      // of the oldest frame
+	uint8_t ret = DPROT_ACK_ACCEPTED;
+	uint8_t cum = 0;
+	uint8_t seq = 0;
+	uint8_t d;
+	uint16_t i;
+	uint32_t started = dprot_master_now (link);
+	
+	// the slave has to start from the same sequence number
+	if (link->master.window_sync)
+	{
+		ret = dprot_master_window_sync (link);
+		if (ret != DPROT_ACK_ACCEPTED)
+		{
+			dprot_master_count_done (link, ret, started);
+			return ret;
+		}
+		base_seq = link->master.next_seq;
+	}
+	
+	while (base < count)
+	{
+		// the oldest frame is out of retries
+		if (lost[0] && !retry--)
+		{
+			break;
+		}
+		
+		// the lost frames first, then fill up the window
+		for (i = base; i < next; i++)
+		{
+			if (lost[i - base])
+			{
+				DPROT_STAT_ADD (link, retries, 1);
+				DPROT_TRACE_EVENT (link, DPROT_TRACE_RETRY, DPROT_TYPE_WDATA, 0);
+				sent_at[i - base] = dprot_master_now (link);
+				sent_no[i - base] = ++sent_count;
+				resent[i - base] = 1;
+				lost[i - base] = 0;
+				dprot_master_send_window_idx (link, buffers, lens, i, (uint8_t)(base_seq + i));
+			}
+		}
+		while (next < count && next - base < link->window_size)
+		{
+			sent_at[next - base] = dprot_master_now (link);
+			sent_no[next - base] = ++sent_count;
+			resent[next - base] = 0;
+			dprot_master_send_window_idx (link, buffers, lens, next, (uint8_t)(base_seq + next));
+			next++;
+		}
+		
+		dprot_master_arm_timeout (link);
+		ret = dprot_master_wait_for_window_ack (link, &cum, &seq);
+		
+		if (ret == DPROT_TIMEOUT)
+		{
+			// nothing came back - the frames in flight are lost.
+			// selective repeat skips the frames the slave holds.
+			dprot_master_rtt_failed (link);
+			answered = sent_count;
+			for (i = 0; i < next - base; i++)
+			{
+				lost[i] = !sacked[i];
+			}
+			continue;
+		}
+		
+		answered++;
+		if (ret != DPROT_ACK_ACCEPTED && ret != DPROT_NACK_ACCEPTED)
+		{
+			// a corrupted ack - the ones behind it tell the rest
+			continue;
+		}
+		
+		// the round trip of the frame that triggered the ack -
+		// once, a duplicate ack comes later than the frame did.
+		// a retransmitted frame doesn't tell which copy arrived.
+		d = (uint8_t)(seq - (uint8_t)(base_seq + base));
+		first = (ret == DPROT_ACK_ACCEPTED && d < next - base && !resent[d]);
+		if (first)
+		{
+			dprot_master_rtt_sample (link, sent_at[d]);
+			if (sent_no[d] > arrived) arrived = sent_no[d];
+			answered = sent_no[d];
+			resent[d] = 1;
+		}
+		
+		// slide the window according to the cumulative ack. acks
+		// outside of the window are old duplicates.
+		d = (uint8_t)(cum - (uint8_t)(base_seq + base));
+		if (d > 0 && d <= next - base)
+		{
+			base += d;
+			memmove (sacked, sacked + d, DPROT_WINDOW_MAX - d);
+			memset (sacked + DPROT_WINDOW_MAX - d, 0, d);
+			memmove (lost, lost + d, DPROT_WINDOW_MAX - d);
+			memset (lost + DPROT_WINDOW_MAX - d, 0, d);
+			memmove (sent_at, sent_at + d, (DPROT_WINDOW_MAX - d) * sizeof(uint32_t));
+			memmove (sent_no, sent_no + d, (DPROT_WINDOW_MAX - d) * sizeof(uint32_t));
+			memmove (resent, resent + d, DPROT_WINDOW_MAX - d);
+			memset (resent + DPROT_WINDOW_MAX - d, 0, d);
+			retry = link->master.retries;
+		}
+		
+		// the slave misses the frame its cumulative ack names,
+		// whatever it acked before
+		sacked[0] = 0;
+		
+		if (ret == DPROT_ACK_ACCEPTED)
+		{
+			// a frame acked beyond the cumulative ack arrived out of
+			// order - selective repeat holds it, Go-Back-N dropped it
+			// (a copy sent again may still be on its way)
+			d = (uint8_t)(seq - (uint8_t)(base_seq + base));
+			if (d > 0 && d < next - base && link->window_mode == DPROT_WINDOW_SR)
+			{
+				sacked[d] = 1;
+				lost[d] = 0;
+			}
+			else if (d > 0 && d < next - base && first)
+			{
+				lost[d] = 1;
+			}
+			
+			// the frames sent before the one that arrived are lost
+			for (i = 0; i < next - base; i++)
+			{
+				if (!sacked[i] && sent_no[i] < arrived) lost[i] = 1;
+			}
+			continue;
+		}
+		
+		// a nack - the slave misses the frame it names (unless a
+		// copy of it is still on its way) and the one it answers
+		for (i = 0; i < next - base; i++)
+		{
+			if (!sacked[i] && (sent_no[i] == answered || (i == 0 && sent_no[0] < answered))) lost[i] = 1;
+		}
+	}
+	
+	if (acked) *acked = base;
+	link->master.next_seq = (uint8_t)(base_seq + base);
+	
+	if (base < count)
+	{
+		// the slave may hold a different view of the window now
+		link->master.window_sync = 1;
+		ret = (ret == DPROT_ACK_ACCEPTED || ret == DPROT_TIMEOUT) ? DPROT_DATA_ERROR : ret;
+		dprot_master_count_done (link, ret, started);
+		return ret;
+	}
+	
+	dprot_master_count_done (link, DPROT_ACK_ACCEPTED, started);
+	return DPROT_ACK_ACCEPTED;
+}
+
+/***********************************************************/
+uint8_t dprot_master_send_data_window (dprot_link* link, uint8_t** buffers, uint8_t* lens, uint16_t count, uint16_t* acked)
+{
+	uint8_t ret = DPROT_ACK_ACCEPTED;
+	uint16_t i;
+	
+	if (acked) *acked = 0;
+	
+	for (i = 0; i < count; i++)
+	{
+		if (lens[i] > DPROT_PAYLOAD(link->check_size) - 1)
+		{
+			// the buffer is bigger than the maximal allowed
+			// window frame size
+			return DPROT_MSG_SIZE_ERROR;
+		}
+	}
+	
+	// stop-and-wait - one by one
+	if (link->window_mode == DPROT_WINDOW_NONE)
+	{
+		for (i = 0; i < count; i++)
+		{
+			ret = dprot_master_send_data_msg (link, buffers[i], lens[i]);
+			if (ret != DPROT_ACK_ACCEPTED) break;
+			if (acked) (*acked)++;
+		}
+		return ret;
+	}
+	
+	return dprot_master_window_transfer (link, buffers, lens, count, acked);
+}
+
+/***********************************************************/
+uint8_t dprot_master_send_message (dprot_link* link, uint8_t* buffer, uint32_t len)
+{
+	uint8_t payload = DPROT_PAYLOAD(link->check_size) - (link->window_mode != DPROT_WINDOW_NONE);
+	uint32_t count = dprot_master_fragment_count (len, payload);
+	uint8_t ret = DPROT_ACK_ACCEPTED;
+	uint8_t head[DPROT_FRAG_FIRST_HEADER];
+	uint8_t head_len;
+	uint8_t* data;
+	uint8_t frag_len;
+	uint32_t i;
+	
+	if (count > DPROT_FRAG_MAX_COUNT)
+	{
+		return DPROT_MSG_SIZE_ERROR;
+	}
+	
+	link->master.msg = buffer;
+	link->master.msg_len = len;
+	
+	if (link->window_mode != DPROT_WINDOW_NONE)
+	{
+		// all the fragments in a single window transfer
+		ret = dprot_master_window_transfer (link, NULL, NULL, count, NULL);
+	}
+	else
+	{
+		// stop-and-wait - every fragment is acked on its own
+		for (i = 0; i < count && ret == DPROT_ACK_ACCEPTED; i++)
+		{
+			head_len = dprot_master_fragment (link, i, payload, head, &data, &frag_len);
+			ret = dprot_master_send_data_frame (link, DPROT_FLAG_FRAG, head, head_len, data, frag_len);
+		}
+	}
+	
+	link->master.msg = NULL;
 	return ret;
 }
 
 /***********************************************************/
-uint8_t dprot_master_send_ping ( void )
+uint8_t dprot_master_send_ping (dprot_link* link)
 {
     uint8_t ret = 0;
-    uint8_t retry = DPROT_MASTER_NUM_RETRIES;
-    uint8_t buffer[3] = { DROPT_TYPE_ARP, 0, 0 };
+    uint8_t retry = link->master.retries;
+    uint8_t buffer[2+CHECKING_MAX_SIZE] = { DROPT_TYPE_ARP, 0 };
+    uint8_t resent = 0;
+    uint32_t sent;
+    uint32_t started = 0;
     
-    // advance the parity and embed it
-    master_last_parity = !master_last_parity;
-    buffer[0] |= master_last_parity;
+    // advance the parity and embed it. the compression stays on
+    link->last_parity = !link->last_parity;
+    buffer[0] |= link->last_parity;
+    if (link->compress) buffer[0] |= DPROT_FLAG_LZ;
 	
 	// calculate checking
-	DPROT_CHECKING(buffer[2],buffer[0]);
-	DPROT_CHECKING(buffer[2],buffer[1]);
+	dprot_calc_checking (link->checking, buffer, 2, NULL, 0, buffer + 2);
 
     while (retry--)
     {
-        slip_tx(&master_channel, buffer, 3, SLIP_MSG_REG);
+        sent = dprot_master_arm_timeout (link);
+        if (resent)
+        {
+            DPROT_STAT_ADD (link, retries, 1);
+            DPROT_TRACE_EVENT (link, DPROT_TRACE_RETRY, buffer[0], 2 + link->check_size);
+        }
+        else started = sent;
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, buffer[0], 2 + link->check_size);
+        slip_tx(&link->channel, buffer, 2 + link->check_size, SLIP_MSG_REG);
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, buffer[0], 2 + link->check_size);
         
         // wait for response
-        ret = dprot_master_wait_for_ack_nack ( );
+        ret = dprot_master_wait_for_ack_nack (link);
         if (ret == DPROT_ACK_ACCEPTED)
         {
             // stop trying
+            if (!resent) dprot_master_rtt_sample (link, sent);
             break;
         }
+        
+        dprot_master_rtt_failed (link);
+        resent = 1;
     }
+    dprot_master_count_done (link, ret, started);
     
     return ret;
 }
 
 /***********************************************************/
-uint8_t dprot_master_send_sync ( void )
+uint8_t dprot_master_set_compression (dprot_link* link, uint8_t enable)
+{
+	uint8_t ret;
+	
+	// the ping carries the offer, the slave's ack the answer
+	link->compress = (enable != 0);
+	ret = dprot_master_send_ping (link);
+	link->compress = (ret == DPROT_ACK_ACCEPTED && enable && (link->master.response[0] & DPROT_FLAG_LZ));
+	return ret;
+}
+
+/***********************************************************/
+uint8_t dprot_master_send_sync (dprot_link* link)
 {
 	// currently not implemented
 	return DPROT_NO_ERROR;
 }
 
+//===============================================
+// the asynchronous requests
+
+/***********************************************************/
+/*
+ * (re)sends the request at the head of the queue
+ */
+static void dprot_master_async_transmit (dprot_link* link, dprot_request* req)
+{
+	req->state = DPROT_REQ_IN_FLIGHT;
+	req->retries--;
+	
+	link->master.async_sent = dprot_master_arm_timeout (link);
+	link->master.async_due = link->master.async_sent + link->master.rtt.timeout;
+	
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, req->header[0], 2 + req->len + link->check_size);
+	slip_tx(&link->channel, req->header, 2, SLIP_MSG_START);
+	slip_tx(&link->channel, req->buffer, req->len, SLIP_MSG_MIDDLE);
+	slip_tx(&link->channel, req->check, link->check_size, SLIP_MSG_END);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, req->header[0], 2 + req->len + link->check_size);
+}
+
+/***********************************************************/
+/*
+ * puts the next queued request in flight - a new frame, so
+ * the parity advances
+ */
+static void dprot_master_async_start (dprot_link* link)
+{
+	dprot_request* req = link->master.async_head;
+	
+	if (req == NULL || req->state == DPROT_REQ_IN_FLIGHT)
+	{
+		return;
+	}
+	
+	link->last_parity = !link->last_parity;
+	req->header[0] |= link->last_parity;
+	dprot_calc_checking (link->checking, req->header, 2, req->buffer, req->len, req->check);
+	dprot_master_async_transmit (link, req);
+	req->started = link->master.async_sent;
+}
+
+/***********************************************************/
+/*
+ * finishes the request in flight - the next one is sent
+ * before the completion, the line doesn't wait for the caller
+ */
+static void dprot_master_async_finish (dprot_link* link, uint8_t result)
+{
+	dprot_request* req = link->master.async_head;
+	
+	dprot_master_count_done (link, result, req->started);
+	link->master.async_head = req->next;
+	if (link->master.async_head == NULL)
+	{
+		link->master.async_tail = NULL;
+	}
+	dprot_master_async_start (link);
+	
+	req->next = NULL;
+	req->result = result;
+	req->state = DPROT_REQ_DONE;
+	
+	if (req->on_complete)
+	{
+		req->on_complete (req->user, req);
+		return;
+	}
+	
+	if (link->master.done_tail) link->master.done_tail->next = req;
+	else link->master.done_head = req;
+	link->master.done_tail = req;
+}
+
+/***********************************************************/
+/*
+ * the request failed one more time - retransmits while there
+ * are retries left
+ */
+static void dprot_master_async_retry (dprot_link* link, uint8_t result)
+{
+	dprot_request* req = link->master.async_head;
+	
+	dprot_master_rtt_failed (link);
+	if (req->retries == 0)
+	{
+		dprot_master_async_finish (link, result);
+		return;
+	}
+	
+	req->resent = 1;
+	DPROT_STAT_ADD (link, retries, 1);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_RETRY, req->header[0], 2 + req->len + link->check_size);
+	dprot_master_async_transmit (link, req);
+}
+
+/***********************************************************/
+static uint8_t dprot_master_async_queue (dprot_link* link, dprot_request* req, fn_dprot_complete on_complete, void* user)
+{
+	// a finished request without a completion function is in the
+	// completion queue until 'dprot_master_async_completed' takes it
+	if (link->master.clock == NULL ||
+		!(req->state == DPROT_REQ_IDLE || (req->state == DPROT_REQ_DONE && req->on_complete)))
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	req->retries = link->master.retries;
+	req->resent = 0;
+	req->state = DPROT_REQ_QUEUED;
+	req->result = DPROT_NO_ERROR;
+	req->on_complete = on_complete;
+	req->user = user;
+	req->next = NULL;
+	
+	if (link->master.async_tail) link->master.async_tail->next = req;
+	else link->master.async_head = req;
+	link->master.async_tail = req;
+	
+	// an idle link sends it right away
+	dprot_master_async_start (link);
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_master_submit_data (dprot_link* link, dprot_request* req, uint8_t* buffer, uint8_t len,
+								  fn_dprot_complete on_complete, void* user)
+{
+	if (len > DPROT_PAYLOAD(link->check_size))
+	{
+		return DPROT_MSG_SIZE_ERROR;
+	}
+	
+	req->header[0] = DPROT_TYPE_DATA;
+	req->header[1] = len;
+	req->buffer = buffer;
+	req->len = len;
+	return dprot_master_async_queue (link, req, on_complete, user);
+}
+
+/***********************************************************/
+uint8_t dprot_master_submit_ping (dprot_link* link, dprot_request* req, fn_dprot_complete on_complete, void* user)
+{
+	req->header[0] = DROPT_TYPE_ARP;
+	req->header[1] = 0;
+	req->buffer = NULL;
+	req->len = 0;
+	return dprot_master_async_queue (link, req, on_complete, user);
+}
+
+/***********************************************************/
+void dprot_master_async_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	dprot_link* link = (dprot_link*)user;
+	uint8_t ret;
+	
+	DPROT_STAT_ADD (link, rx_frames, 1);
+	DPROT_STAT_ADD (link, rx_bytes, len);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_FRAME, len ? frame[0] : 0, len);
+	if (len > DPROT_MAX_MSG)
+	{
+		DPROT_STAT_ADD (link, framing_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, frame[0], len);
+		return;
+	}
+	
+	// an answer sent after its ack - kept, it doesn't ack anything
+	if (status == DPROT_NO_ERROR && (frame[0] & (DPROT_TYPE_MASK | DPROT_FLAG_ACK)) == DPROT_TYPE_DATA)
+	{
+		memcpy (link->master.response, frame, len);
+		link->master.response_len = len;
+		return;
+	}
+	
+	if (link->master.async_head == NULL || link->master.async_head->state != DPROT_REQ_IN_FLIGHT)
+	{
+		// nothing is waiting for it
+		return;
+	}
+
+	// a late ack of the previous request (its retransmission was
+	// acked twice) - it says nothing about this one
+	if (status == DPROT_NO_ERROR && (frame[0] & 0x01) != link->last_parity)
+	{
+		DPROT_STAT_ADD (link, duplicates, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_DUPLICATE, frame[0], len);
+		return;
+	}
+
+	ret = dprot_master_check_answer (link, frame, len);
+	if (ret == DPROT_ACK_ACCEPTED)
+	{
+		if (!link->master.async_head->resent) dprot_master_rtt_sample (link, link->master.async_sent);
+		dprot_master_async_finish (link, ret);
+		return;
+	}
+	
+	// a nack or junk - the line is alive, resend now
+	dprot_master_async_retry (link, ret);
+}
+
+/***********************************************************/
+uint8_t dprot_master_async_poll (dprot_link* link)
+{
+	dprot_request* req = link->master.async_head;
+	
+	if (req && req->state == DPROT_REQ_IN_FLIGHT &&
+		(int32_t)(link->master.clock () - link->master.async_due) >= 0)
+	{
+		DPROT_STAT_ADD (link, timeouts, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_TIMEOUT, req->header[0], 0);
+		dprot_master_async_retry (link, DPROT_TIMEOUT);
+	}
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_master_async_due (dprot_link* link, uint32_t* due)
+{
+	if (link->master.async_head == NULL || link->master.async_head->state != DPROT_REQ_IN_FLIGHT)
+	{
+		return 0;
+	}
+	
+	*due = link->master.async_due;
+	return 1;
+}
+
+/***********************************************************/
+uint16_t dprot_master_async_answer (dprot_link* link, uint8_t* buffer, uint16_t max_len)
+{
+	uint16_t len = link->master.response_len;
+	
+	// a compressed answer
+	if (len && (link->master.response[0] & DPROT_FLAG_LZ))
+	{
+		len = (dprot_unpack_frame (link->master.response, DPROT_MAX_MSG) == DPROT_NO_ERROR) ?
+			link->master.response[1] + 2 + link->check_size : 0;
+	}
+	if (len > max_len) len = max_len;
+	memcpy (buffer, link->master.response, len);
+	link->master.response_len = 0;
+	return len;
+}
+
+/***********************************************************/
+dprot_request* dprot_master_async_completed (dprot_link* link)
+{
+	dprot_request* req = link->master.done_head;
+	
+	if (req == NULL)
+	{
+		return NULL;
+	}
+	
+	link->master.done_head = req->next;
+	if (link->master.done_head == NULL)
+	{
+		link->master.done_tail = NULL;
+	}
+	req->next = NULL;
+	req->state = DPROT_REQ_IDLE;
+	return req;
+}
@@ -0,0 +1,118 @@
+#include <string.h>
+#include "dprot.h"
+
+/***********************************************************/
+uint8_t dprot_calc_checking (uint8_t checking, uint8_t* head, uint16_t head_len, uint8_t* data, uint16_t len, uint8_t* out)
+{
+	uint32_t c = checking_start (checking);
+	
+	c = checking_update (checking, c, head, head_len);
+	c = checking_update (checking, c, data, len);
+	return checking_finish (checking, c, out);
+}
+
+/***********************************************************/
+uint8_t dprot_check_frame (uint8_t checking, uint8_t* frame, uint16_t len)
+{
+	uint8_t size = checking_size (checking);
+	uint8_t calc_check[CHECKING_MAX_SIZE];
+	
+	if (len < 2 + size)
+	{
+		return DPROT_FRAMING_ERROR;
+	}
+	
+	// the length field has to describe exactly the received bytes
+	if (frame[1] > DPROT_PAYLOAD(size) || len != frame[1] + 2 + size)
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	// calculate the checking bytes and compare
+	dprot_calc_checking (checking, frame, len - size, NULL, 0, calc_check);
+	if (memcmp (frame + len - size, calc_check, size))
+	{
+		return DPROT_DATA_ERROR;
+	}
+	
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_unpack_frame (uint8_t* frame, uint16_t size)
+{
+	uint8_t payload[DPROT_MAX_MSG];
+	uint16_t room = (size < DPROT_MAX_MSG ? size : DPROT_MAX_MSG) - 2;
+	uint16_t n;
+	
+	n = lzss_decompress (frame + 2, frame[1], payload, room);
+	if (n == 0 || n > 255)
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	memcpy (frame + 2, payload, n);
+	frame[0] &= ~DPROT_FLAG_LZ;
+	frame[1] = (uint8_t)n;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+void dprot_rx_init (dprot_rx_ctx* ctx, fn_dprot_frame on_frame, void* user)
+{
+	ctx->on_frame = on_frame;
+	ctx->user = user;
+	ctx->checking = DPROT_CHECKING_DEFAULT;
+	slip_decoder_init (&ctx->decoder, ctx->frame, sizeof(ctx->frame));
+}
+
+/***********************************************************/
+uint8_t dprot_rx_set_checking (dprot_rx_ctx* ctx, uint8_t checking)
+{
+	if (!checking_size (checking))
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	ctx->checking = checking;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_rx_set_framing (dprot_rx_ctx* ctx, uint8_t framing)
+{
+	return slip_decoder_set_framing (&ctx->decoder, framing) ? DPROT_LOGICAL_ERROR : DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_rx_set_fec (dprot_rx_ctx* ctx, uint8_t nroots)
+{
+	return slip_decoder_set_fec (&ctx->decoder, nroots) ? DPROT_LOGICAL_ERROR : DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+void dprot_rx_feed (dprot_rx_ctx* ctx, uint8_t* bytes, uint16_t n)
+{
+	uint16_t used;
+	uint16_t len;
+	
+	// the decoder stops at every frame end. what wasn't consumed
+	// belongs to the next frames
+	while (n)
+	{
+		used = slip_decode (&ctx->decoder, bytes, n);
+		bytes += used;
+		n -= used;
+		
+		if (!ctx->decoder.complete)
+		{
+			// the frame goes on in the next chunk
+			break;
+		}
+		
+		// frames longer than the buffer were truncated by the
+		// decoder - they fail on their length field
+		len = ctx->decoder.len;
+		ctx->on_frame (ctx->user, dprot_check_frame (ctx->checking, ctx->frame, len), ctx->frame, len);
+	}
+}
@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pty.h>
+#include "dprot_serial.h"
+#include "slip.h"
+
+/***********************************************************/
+static speed_t dprot_serial_speed (uint32_t baud)
+{
+	switch (baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		case 2000000: return B2000000;
+		case 3000000: return B3000000;
+		case 4000000: return B4000000;
+#endif
+		default: return B0;
+	}
+}
+
+/***********************************************************/
+/*
+ * raw 8N1 at 'baud'. a read returns as soon as there is a
+ * single byte, how long to wait for it is up to poll()
+ */
+static int dprot_serial_configure (dprot_serial* port, uint32_t baud)
+{
+	struct termios tio;
+	speed_t speed = dprot_serial_speed (baud);
+
+	if (speed == B0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (tcgetattr (port->fd, &tio) != 0)
+	{
+		return -1;
+	}
+	port->saved = tio;
+	port->restore = 1;
+
+	cfmakeraw (&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | PARENB);
+#ifdef CRTSCTS
+	tio.c_cflag &= ~CRTSCTS;
+#endif
+	tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed (&tio, speed);
+	cfsetospeed (&tio, speed);
+
+	if (tcsetattr (port->fd, TCSANOW, &tio) != 0)
+	{
+		return -1;
+	}
+
+	// whatever was on the line before us
+	tcflush (port->fd, TCIOFLUSH);
+	port->baud = baud;
+	return 0;
+}
+
+/***********************************************************/
+int dprot_serial_open (dprot_serial* port, const char* path, uint32_t baud)
+{
+	port->restore = 0;
+	port->fd = open (path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (port->fd < 0)
+	{
+		return -1;
+	}
+
+	if (dprot_serial_configure (port, baud) != 0)
+	{
+		dprot_serial_close (port);
+		return -1;
+	}
+	return 0;
+}
+
+/***********************************************************/
+int dprot_serial_open_pty (dprot_serial* a, dprot_serial* b, uint32_t baud)
+{
+	a->restore = 0;
+	b->restore = 0;
+
+	if (openpty (&a->fd, &b->fd, NULL, NULL, NULL) != 0)
+	{
+		a->fd = b->fd = -1;
+		return -1;
+	}
+	fcntl (a->fd, F_SETFD, FD_CLOEXEC);
+	fcntl (b->fd, F_SETFD, FD_CLOEXEC);
+
+	// both ends raw - the slave end would echo otherwise
+	if (dprot_serial_configure (b, baud) != 0 || dprot_serial_configure (a, baud) != 0)
+	{
+		dprot_serial_close (a);
+		dprot_serial_close (b);
+		return -1;
+	}
+
+	// the pty doesn't have anything to restore
+	a->restore = 0;
+	b->restore = 0;
+	return 0;
+}
+
+/***********************************************************/
+void dprot_serial_close (dprot_serial* port)
+{
+	if (port->fd < 0) return;
+
+	if (port->restore)
+	{
+		// let the last frame out first
+		tcdrain (port->fd);
+		tcsetattr (port->fd, TCSANOW, &port->saved);
+	}
+	close (port->fd);
+	port->fd = -1;
+}
+
+/***********************************************************/
+void dprot_serial_write_buf (void* ctx, uint8_t* buf, uint16_t len)
+{
+	dprot_serial* port = (dprot_serial*)ctx;
+	struct pollfd pfd = { port->fd, POLLOUT, 0 };
+	ssize_t n;
+
+	// a single write() takes the whole block most of the time
+	while (len)
+	{
+		n = write (port->fd, buf, len);
+		if (n > 0)
+		{
+			buf += n;
+			len -= n;
+			continue;
+		}
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno != EAGAIN) return;
+
+		// the driver's buffer is full
+		poll (&pfd, 1, -1);
+	}
+}
+
+/***********************************************************/
+uint16_t dprot_serial_read_buf (void* ctx, uint8_t* buf, uint16_t max, uint16_t to)
+{
+	dprot_serial* port = (dprot_serial*)ctx;
+	struct pollfd pfd = { port->fd, POLLIN, 0 };
+	ssize_t n;
+	int ret;
+
+	do
+	{
+		ret = poll (&pfd, 1, (to == SLIP_RX_BLOCKING) ? -1 : (int)to);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0 || !(pfd.revents & POLLIN))
+	{
+		// timeout (or a hangup)
+		return 0;
+	}
+
+	// all there is, up to 'max'
+	n = read (port->fd, buf, max);
+	return (n > 0) ? (uint16_t)n : 0;
+}
@@ -0,0 +1,91 @@
+#ifndef __DPROT_SERIAL_H__
+#define __DPROT_SERIAL_H__
+
+#include "spec_types.h"
+#include <termios.h>
+
+/*! \file dprot_serial.h
+ * \brief Serial port transport (POSIX termios)
+ *
+ * The bulk transport functions of a tty - ready to be given
+ * to the dprot_*_init_protocol_buf functions with the port
+ * as the transport context:
+ *
+ *	dprot_serial_open (&port, "/dev/ttyUSB0", 115200);
+ *	dprot_master_init_protocol_buf (&link, dprot_serial_write_buf,
+ *									dprot_serial_read_buf, &port);
+ *
+ * The port is raw (no echo, no line editing, 8N1) and the
+ * reads wait in poll() for the timeout dProt asks for. A
+ * pseudo terminal pair gives the same transport without
+ * hardware - for the tests and the measurements.
+ */
+
+/*********************************************************/
+/*! \struct dprot_serial
+ * \brief An open serial port
+ */
+typedef struct
+{
+	int fd;                     /**< the tty, -1 if closed */
+	uint32_t baud;              /**< the line speed [bit/s] */
+	uint8_t restore;            /**< 'saved' is to be restored on close */
+	struct termios saved;       /**< the settings before the open */
+} dprot_serial;
+
+/*********************************************************/
+
+/*!
+ * \brief Opens and configures a serial port
+ * The port is switched to raw mode, 8N1, no flow control,
+ * VMIN=1/VTIME=0 (the timeouts are handled by poll()).
+ *
+ * \param port the port to be opened
+ * \param path the tty device (e.g. /dev/ttyS0)
+ * \param baud the line speed [bit/s]
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_serial_open (dprot_serial* port, const char* path, uint32_t baud);
+
+/*!
+ * \brief Opens a pseudo terminal pair - a line between two ports
+ * Whatever is written to one port is read from the other.
+ *
+ * \param a one end of the line
+ * \param b the other end of the line
+ * \param baud the nominal line speed (a pty doesn't slow down)
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_serial_open_pty (dprot_serial* a, dprot_serial* b, uint32_t baud);
+
+/*!
+ * \brief Closes the port and restores its original settings
+ * \param port the port
+ */
+void dprot_serial_close (dprot_serial* port);
+
+/*!
+ * \brief 'fn_write_buf' of a serial port
+ * Returns when the whole buffer was handed to the driver.
+ *
+ * \param ctx the port (dprot_serial*)
+ * \param buf the bytes to be sent
+ * \param len the number of bytes
+ */
+void dprot_serial_write_buf (void* ctx, uint8_t* buf, uint16_t len);
+
+/*!
+ * \brief 'fn_read_buf' of a serial port
+ *
+ * \param ctx the port (dprot_serial*)
+ * \param buf the buffer to be filled
+ * \param max the size of the buffer
+ * \param to the timeout [ms] or SLIP_RX_BLOCKING
+ *
+ * \return the number of bytes read (0 on timeout or error)
+ */
+uint16_t dprot_serial_read_buf (void* ctx, uint8_t* buf, uint16_t max, uint16_t to);
+
+#endif //__DPROT_SERIAL_H__
@@ -1,86 +1,586 @@
+#include <string.h>
 #include "dprot.h"
 
-slip_channel    slave_channel = {0};
-uint8_t         slave_last_parity = 1;
+/***********************************************************/
+uint8_t dprot_slave_init_protocol (dprot_link* link, fn_put_char put_function, fn_get_char get_function)
+{
+    link->last_parity = 0;
+    link->window_mode = DPROT_WINDOW_NONE;
+    link->window_size = 1;
+    link->slave.expected_seq = 0;
+    memset (link->slave.reorder_valid, 0, sizeof(link->slave.reorder_valid));
+    link->slave.reorder_buf = NULL;
+    link->slave.msg_buf = NULL;
+    link->slave.msg_size = 0;
+    link->slave.msg_len = 0;
+    link->slave.msg_active = 0;
+    link->slave.piggyback = 0;
+    link->slave.ack_pending = 0;
+    link->slave.ack_delay = DPROT_ACK_DELAY;
+    link->slave.clock = NULL;
+    link->slave.resp_valid = 0;
+    link->checking = DPROT_CHECKING_DEFAULT;
+    link->check_size = checking_size (DPROT_CHECKING_DEFAULT);
+    memset (&link->stats, 0, sizeof(dprot_stats));
+    link->trace = NULL;
+    link->compress = 0;
+    link->slave.compress_ok = 0;
+    
+	// initialize the slip protocol
+	return slip_init (put_function, get_function, NULL, &link->channel);
+}
+
+/***********************************************************/
+uint8_t dprot_slave_init_protocol_buf (dprot_link* link, fn_write_buf write_function, fn_read_buf read_function, void* io_ctx)
+{
+	uint8_t ret = dprot_slave_init_protocol (link, NULL, NULL);
+	
+	// the same protocol state over the bulk functions
+	if (ret == DPROT_NO_ERROR)
+	{
+		ret = slip_init_buf (write_function, read_function, io_ctx, SLIP_RX_BLOCKING, &link->channel);
+	}
+	return ret;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_set_window (dprot_link* link, uint8_t mode, uint8_t size)
+{
+	if (mode > DPROT_WINDOW_SR || size == 0 || size > DPROT_WINDOW_MAX ||
+		(mode == DPROT_WINDOW_SR && link->slave.reorder_buf == NULL))
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	link->window_mode = mode;
+	link->window_size = size;
+	memset (link->slave.reorder_valid, 0, sizeof(link->slave.reorder_valid));
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_set_checking (dprot_link* link, uint8_t checking)
+{
+	if (!checking_size (checking))
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	link->checking = checking;
+	link->check_size = checking_size (checking);
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_set_piggyback (dprot_link* link, uint8_t enable, fn_dprot_clock clock, uint32_t delay)
+{
+	// an ack held back until now goes out
+	if (link->slave.ack_pending) dprot_slave_send_ack (link);
+	
+	link->slave.piggyback = enable;
+	link->slave.clock = clock;
+	link->slave.ack_delay = delay;
+	link->slave.resp_valid = 0;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_set_compression (dprot_link* link, uint8_t enable)
+{
+	link->slave.compress_ok = (enable != 0);
+	if (!enable) link->compress = 0;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_poll (dprot_link* link)
+{
+	if (link->slave.ack_pending && link->slave.clock &&
+		(int32_t)(link->slave.clock () - link->slave.ack_due) >= 0)
+	{
+		dprot_slave_send_ack (link);
+	}
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+/*
+ * holds the ack of a delivered request back - the answer
+ * is going to carry it
+ */
+static void dprot_slave_hold_ack (dprot_link* link)
+{
+	link->slave.ack_pending = 1;
+	if (link->slave.clock)
+	{
+		link->slave.ack_due = link->slave.clock () + link->slave.ack_delay;
+	}
+}
 
 /***********************************************************/
-uint8_t dprot_slave_init_protocol (fn_put_char put_function, fn_get_char get_function)
+/*
+ * sends a data frame - the held back ack goes with it
+ */
+static void dprot_slave_send_data_frame (dprot_link* link, uint8_t flags, uint8_t* buffer, uint8_t len)
 {
-	// initialize the crc table
-	init_crc8( );
+	uint8_t calc_check[CHECKING_MAX_SIZE];
+	uint8_t packed[DPROT_MAX_MSG];
+	uint8_t header[2] = { DPROT_TYPE_DATA | flags, len };
+	uint16_t n;
 	
-    slave_last_parity = 0;
+	// the compressed answer when it is shorter
+	if (link->compress && len >= DPROT_LZ_MIN_LEN)
+	{
+		n = lzss_compress (buffer, len, packed, len - 1);
+		if (n)
+		{
+			DPROT_STAT_ADD (link, compressed, 1);
+			DPROT_STAT_ADD (link, compress_saved, len - n);
+			header[0] |= DPROT_FLAG_LZ;
+			header[1] = (uint8_t)n;
+			buffer = packed;
+			len = (uint8_t)n;
+		}
+	}
+	
+    header[0] |= link->last_parity;
+    if (flags & DPROT_FLAG_ACK) DPROT_STAT_ADD (link, acks_tx, 1);
     
-	// initialize the slip protocol
-	return slip_init (put_function, get_function, NULL, &slave_channel);
+	// calculate the checking
+	dprot_calc_checking (link->checking, header, 2, buffer, len, calc_check);
+	
+	// finally send the data
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, header[0], 2 + len + link->check_size);
+	slip_tx(&link->channel, header, 2, SLIP_MSG_START);
+	slip_tx(&link->channel, buffer, len, SLIP_MSG_MIDDLE);
+	slip_tx(&link->channel, calc_check, link->check_size, SLIP_MSG_END);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, header[0], 2 + len + link->check_size);
+}
+
+/***********************************************************/
+uint8_t dprot_slave_set_message_buffer (dprot_link* link, uint8_t* buffer, uint32_t size)
+{
+	link->slave.msg_buf = buffer;
+	link->slave.msg_size = size;
+	link->slave.msg_len = 0;
+	link->slave.msg_active = 0;
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_set_reorder_buffer (dprot_link* link, uint8_t* buffer, uint32_t size)
+{
+	if ((buffer && size < DPROT_REORDER_SIZE) || (!buffer && link->window_mode == DPROT_WINDOW_SR))
+	{
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	link->slave.reorder_buf = (uint8_t (*)[DPROT_MAX_MSG])buffer;
+	memset (link->slave.reorder_valid, 0, sizeof(link->slave.reorder_valid));
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint32_t dprot_slave_message_len (dprot_link* link)
+{
+	return link->slave.msg_len;
+}
+
+/***********************************************************/
+/*
+ * adds an accepted fragment frame to the message buffer.
+ * returns DPROT_MSG_READY on the last fragment of a whole
+ * message, DPROT_NO_MSG while the message isn't complete.
+ */
+static uint8_t dprot_slave_reassemble (dprot_link* link, uint8_t* buffer)
+{
+	uint8_t length = buffer[1];
+	uint8_t *data_ptr = &buffer[2];
+	uint8_t marker;
+	
+	// window frames start with the sequence number
+	if ((buffer[0]&DPROT_TYPE_MASK) == DPROT_TYPE_WDATA)
+	{
+		data_ptr++;
+		length--;
+	}
+	
+	if (length < DPROT_FRAG_HEADER)
+	{
+		link->slave.msg_active = 0;
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	marker = data_ptr[0];
+	data_ptr += DPROT_FRAG_HEADER;
+	length -= DPROT_FRAG_HEADER;
+	
+	if (marker & DPROT_FRAG_FIRST)
+	{
+		if (length < DPROT_FRAG_FIRST_HEADER - DPROT_FRAG_HEADER)
+		{
+			link->slave.msg_active = 0;
+			return DPROT_LOGICAL_ERROR;
+		}
+		
+		// a new message - whatever was collected is dropped
+		link->slave.msg_total = (uint32_t)data_ptr[0] | ((uint32_t)data_ptr[1] << 8) |
+						  ((uint32_t)data_ptr[2] << 16) | ((uint32_t)data_ptr[3] << 24);
+		data_ptr += DPROT_FRAG_FIRST_HEADER - DPROT_FRAG_HEADER;
+		length -= DPROT_FRAG_FIRST_HEADER - DPROT_FRAG_HEADER;
+		link->slave.msg_len = 0;
+		link->slave.msg_active = (link->slave.msg_buf != NULL && link->slave.msg_total <= link->slave.msg_size);
+		
+		if (!link->slave.msg_active)
+		{
+			return DPROT_MSG_SIZE_ERROR;
+		}
+	}
+	
+	// a fragment of a dropped message or of a message that
+	// started before we did
+	if (!link->slave.msg_active)
+	{
+		return DPROT_NO_MSG;
+	}
+	
+	if (length > link->slave.msg_total - link->slave.msg_len)
+	{
+		link->slave.msg_active = 0;
+		return DPROT_LOGICAL_ERROR;
+	}
+	
+	memcpy (link->slave.msg_buf + link->slave.msg_len, data_ptr, length);
+	link->slave.msg_len += length;
+	
+	if (!(marker & DPROT_FRAG_LAST))
+	{
+		return DPROT_NO_MSG;
+	}
+	
+	link->slave.msg_active = 0;
+	return (link->slave.msg_len == link->slave.msg_total) ? DPROT_MSG_READY : DPROT_LOGICAL_ERROR;
+}
+
+/***********************************************************/
+/*
+ * the cumulative ack - the next expected sequence number after
+ * skipping all the frames already waiting in the reorder buffer
+ */
+static uint8_t dprot_slave_window_cum (dprot_link* link)
+{
+	uint8_t cum = link->slave.expected_seq;
+	
+	while (link->slave.reorder_valid[cum % DPROT_WINDOW_MAX] &&
+		   link->slave.reorder_buf[cum % DPROT_WINDOW_MAX][2] == cum)
+	{
+		cum++;
+	}
+	return cum;
+}
+
+/***********************************************************/
+static void dprot_slave_send_window_ack (dprot_link* link, uint8_t type, uint8_t seq)
+{
+	uint8_t buffer[4+CHECKING_MAX_SIZE] = { type, 2, dprot_slave_window_cum (link), seq };
+	uint8_t i;
+	
+	// a 'wnack' carries only the cumulative ack
+	if (type == DPROT_TYPE_WNACK)
+	{
+		buffer[1] = 1;
+		DPROT_STAT_ADD (link, nacks_tx, 1);
+	}
+	else
+	{
+		DPROT_STAT_ADD (link, acks_tx, 1);
+	}
+	
+	// calculate checking
+	i = buffer[1] + 2;
+	i += dprot_calc_checking (link->checking, buffer, i, NULL, 0, buffer + i);
+	
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, buffer[0], i);
+	slip_tx(&link->channel, buffer, i, SLIP_MSG_REG);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, buffer[0], i);
+}
+
+/***********************************************************/
+/*
+ * handles a checked window mode frame ('wdata' or 'sync').
+ * returns DPROT_NO_ERROR when 'buffer' holds the next in-order
+ * message, DPROT_NO_MSG when nothing has to be delivered.
+ */
+static uint8_t dprot_slave_window_rx (dprot_link* link, uint8_t* buffer, uint8_t type, uint8_t length)
+{
+	uint8_t seq = buffer[2];
+	uint8_t off;
+	uint8_t slot;
+	
+	if (type == DPROT_TYPE_SYNC)
+	{
+		// restart the window at the master's sequence number
+		link->slave.expected_seq = seq;
+		memset (link->slave.reorder_valid, 0, sizeof(link->slave.reorder_valid));
+		dprot_slave_send_window_ack (link, DPROT_TYPE_WACK, seq);
+		return DPROT_NO_MSG;
+	}
+	
+	off = (uint8_t)(seq - link->slave.expected_seq);
+	
+	if (off >= link->window_size)
+	{
+		// behind the window - its ack got lost
+		DPROT_STAT_ADD (link, duplicates, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_DUPLICATE, buffer[0], buffer[1] + 2 + link->check_size);
+	}
+	
+	if (off == 0)
+	{
+		// in order - deliver it
+		link->slave.expected_seq++;
+		dprot_slave_send_window_ack (link, DPROT_TYPE_WACK, seq);
+		return DPROT_NO_ERROR;
+	}
+	
+	if (link->window_mode == DPROT_WINDOW_SR && off < link->window_size)
+	{
+		// out of order but inside the window - keep it until
+		// the missing frames arrive
+		slot = seq % DPROT_WINDOW_MAX;
+		if (!link->slave.reorder_valid[slot])
+		{
+			memcpy (link->slave.reorder_buf[slot], buffer, length + 2 + link->check_size);
+			link->slave.reorder_valid[slot] = 1;
+		}
+	}
+	
+	// a duplicate (behind the window), a Go-Back-N frame out of order
+	// or a buffered frame - only let the master know where we are
+	dprot_slave_send_window_ack (link, DPROT_TYPE_WACK, seq);
+	return DPROT_NO_MSG;
+}
+
+/***********************************************************/
+/*
+ * checks a window mode frame and sends 'wnack' if it was
+ * corrupted
+ */
+static uint8_t dprot_slave_window_check (dprot_link* link, uint8_t* buffer, uint16_t actual_rx)
+{
+	uint8_t ret = dprot_check_frame (link->checking, buffer, actual_rx);
+	
+	if (ret == DPROT_NO_ERROR && buffer[1] == 0)
+	{
+		// a frame without sequence number
+		ret = DPROT_LOGICAL_ERROR;
+	}
+	
+	if (ret != DPROT_NO_ERROR)
+	{
+		// a truncated or corrupted frame
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		if (ret == DPROT_DATA_ERROR) DPROT_STAT_ADD (link, crc_errors, 1);
+		else if (ret == DPROT_LOGICAL_ERROR && buffer[1] == 0) DPROT_STAT_ADD (link, logical_errors, 1);
+		else DPROT_STAT_ADD (link, framing_errors, 1);
+		dprot_slave_send_window_ack (link, DPROT_TYPE_WNACK, 0);
+		return (ret == DPROT_DATA_ERROR) ? DPROT_DATA_ERROR : DPROT_LOGICAL_ERROR;
+	}
+	
+	return DPROT_NO_ERROR;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_reordered_msg (dprot_link* link, uint8_t* buffer, uint16_t max_len)
+{
+	uint8_t slot = link->slave.expected_seq % DPROT_WINDOW_MAX;
+	uint16_t length;
+	uint8_t ret;
+	
+	// a window mode message that arrived out of order might be ready now
+	while (link->window_mode == DPROT_WINDOW_SR && link->slave.reorder_valid[slot] &&
+		   link->slave.reorder_buf[slot][2] == link->slave.expected_seq)
+	{
+		link->slave.reorder_valid[slot] = 0;
+		link->slave.expected_seq++;
+		
+		// the fragments go to the message buffer. the next one
+		// might be waiting too
+		if (link->slave.reorder_buf[slot][0] & DPROT_FLAG_FRAG)
+		{
+			ret = dprot_slave_reassemble (link, link->slave.reorder_buf[slot]);
+			if (ret != DPROT_NO_MSG) return ret;
+			slot = link->slave.expected_seq % DPROT_WINDOW_MAX;
+			continue;
+		}
+		
+		length = link->slave.reorder_buf[slot][1];
+		length += 2 + link->check_size;
+		memcpy (buffer, link->slave.reorder_buf[slot], (length < max_len) ? length : max_len);
+		return DPROT_NO_ERROR;
+	}
+	
+	return DPROT_NO_MSG;
 }
 
 /***********************************************************/
-uint8_t dprot_slave_wait_for_msg (uint8_t* buffer, uint8_t max_len)
+uint8_t dprot_slave_wait_for_msg (dprot_link* link, uint8_t* buffer, uint16_t max_len)
+{
+	uint16_t actual_rx = 0;
+	uint8_t ret = 0;
+	
+	ret = dprot_slave_reordered_msg (link, buffer, max_len);
+	if (ret != DPROT_NO_MSG)
+	{
+		return ret;
+	}
+	
+	// no answer to the last request - don't keep the master waiting
+	if (link->slave.ack_pending)
+	{
+		dprot_slave_send_ack (link);
+	}
+	
+	do
+	{
+		// read a slip frame with maximum 'max_len' size
+		actual_rx = slip_rx(&link->channel, buffer, max_len);
+		ret = dprot_slave_process_msg (link, buffer, actual_rx, max_len);
+		
+		// wait for the next frame while there is nothing to deliver
+	} while (ret == DPROT_NO_MSG);
+	
+	return ret;
+}
+
+/***********************************************************/
+uint8_t dprot_slave_process_msg (dprot_link* link, uint8_t* buffer, uint16_t actual_rx, uint16_t max_len)
 {
-	uint8_t actual_rx = 0;
 	uint8_t type = 0;
 	uint8_t length = 0;
     uint8_t seq_parity = 0;
-	uint8_t calc_check = 0;
-	uint8_t i = 0;
-	uint8_t *data_ptr = NULL;
-	
-	// read a slip frame with maximum 'max_len' size
-	actual_rx = slip_rx(&slave_channel, buffer, max_len);
+	uint8_t ret = 0;
 	
 	// read out all needed information
-    seq_parity = (buffer[0] & 0x01);
-	type = (buffer[0]&0xfe);
+	seq_parity = (buffer[0] & 0x01);
+	type = (buffer[0]&DPROT_TYPE_MASK);
 	length = buffer[1];
-	data_ptr = &buffer[2];
-    
-    // check if we already delt with this request
-    if (seq_parity == slave_last_parity)
-    {
-        //printf("SLAVE ==> SAME PARITY\n");
-        dprot_slave_send_ack ( );
-        return DPROT_NO_ERROR;
-    }
 	
-    // check the length
-	if (length > DPROT_MAX_PAYLOAD)
+	DPROT_STAT_ADD (link, rx_frames, 1);
+	DPROT_STAT_ADD (link, rx_bytes, actual_rx);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_FRAME, actual_rx ? buffer[0] : 0, actual_rx);
+	
+	// the master didn't wait for the answer of the last request
+	if (link->slave.ack_pending)
 	{
-		// length error - checking method can't be applied
-		// because we don't know where actually the msg ends
-		// Send nack
-		dprot_slave_send_nack ( );
-		return DPROT_LOGICAL_ERROR;
+		dprot_slave_send_ack (link);
 	}
 	
-	// calculate the checking byte
-	DPROT_CHECKING(calc_check,buffer[0]);
-	DPROT_CHECKING(calc_check,buffer[1]);
-	for (i = 0; i < length; i++)
+	// window mode frames carry their own sequence numbers
+	if (link->window_mode != DPROT_WINDOW_NONE &&
+		(type == DPROT_TYPE_WDATA || (type == DPROT_TYPE_SYNC && length == 1)))
 	{
-		DPROT_CHECKING(calc_check,data_ptr[i]);
+		ret = dprot_slave_window_check (link, buffer, actual_rx);
+		if (ret != DPROT_NO_ERROR)
+		{
+			return ret;
+		}
+		
+		ret = dprot_slave_window_rx (link, buffer, type, length);
+		if (ret == DPROT_NO_ERROR && (buffer[0] & DPROT_FLAG_FRAG))
+		{
+			// the fragments it released are reassembled here too -
+			// nobody asks for them when it completes nothing
+			ret = dprot_slave_reassemble (link, buffer);
+			if (ret == DPROT_NO_MSG)
+			{
+				ret = dprot_slave_reordered_msg (link, buffer, max_len);
+			}
+		}
+		return ret;
 	}
     
-	
-	// compare the checking byte
-	if (data_ptr[i] != calc_check)
+    // check the length and the checking first - a corrupted
+    // frame must not be taken for a repeated one
+	ret = dprot_check_frame (link->checking, buffer, actual_rx);
+	if (ret == DPROT_DATA_ERROR)
 	{
-		// checksum/crc8 error. We need to send a NACK
+		// checksum/crc error. We need to send a NACK
 		// message and return a DATA_ERROR
-		dprot_slave_send_nack ( );
+		DPROT_STAT_ADD (link, crc_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		dprot_slave_send_nack (link);
 		return DPROT_DATA_ERROR;
 	}
+	if (ret != DPROT_NO_ERROR)
+	{
+		// length error - checking method can't be applied
+		// because we don't know where actually the msg ends
+		// Send nack
+		DPROT_STAT_ADD (link, framing_errors, 1);
+		DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+		dprot_slave_send_nack (link);
+		return DPROT_LOGICAL_ERROR;
+	}
+    
+    // check if we already delt with this request
+    if (seq_parity == link->last_parity)
+    {
+        //printf("SLAVE ==> SAME PARITY\n");
+        DPROT_STAT_ADD (link, duplicates, 1);
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_DUPLICATE, buffer[0], actual_rx);
+        // our answer got lost - it acks the request too
+        if (link->slave.resp_valid)
+        {
+            dprot_slave_send_data_frame (link, DPROT_FLAG_ACK, link->slave.resp_buf, link->slave.resp_len);
+        }
+        else
+        {
+            dprot_slave_send_ack (link);
+        }
+        return DPROT_NO_MSG;
+    }
 
-    // save the last request's sequencial parity
-    slave_last_parity = seq_parity;
+    // a compressed request is decoded in place. it is not taken
+    // when it is broken or doesn't fit the caller's buffer - the
+    // master gives up after its retries
+    if (type == DPROT_TYPE_DATA && (buffer[0] & DPROT_FLAG_LZ) &&
+        dprot_unpack_frame (buffer, max_len) != DPROT_NO_ERROR)
+    {
+        DPROT_STAT_ADD (link, logical_errors, 1);
+        DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
+        dprot_slave_send_nack (link);
+        return DPROT_LOGICAL_ERROR;
+    }
+
+    // save the last request's sequencial parity. a new request
+    // acks the answer to the last one
+    link->last_parity = seq_parity;
+    link->slave.resp_valid = 0;
 	
     
 	// check the type
 	switch (type)
 	{
 		case DPROT_TYPE_DATA:
+            // a fragment of a longer message - the next fragment
+            // can't come before the ack, only a whole message waits
+            if (buffer[0] & DPROT_FLAG_FRAG)
+            {
+                ret = dprot_slave_reassemble (link, buffer);
+                if (ret == DPROT_MSG_READY && link->slave.piggyback) dprot_slave_hold_ack (link);
+                else dprot_slave_send_ack (link);
+                return ret;
+            }
+            
+            if (link->slave.piggyback) dprot_slave_hold_ack (link);
+            else dprot_slave_send_ack (link);
+            break;
+            
 		case DROPT_TYPE_ARP:
-            dprot_slave_send_ack ( );
+            // the offer of compression - taken by the ack's flag
+            link->compress = link->slave.compress_ok && (buffer[0] & DPROT_FLAG_LZ);
+            dprot_slave_send_ack (link);
             break;
 		case DPROT_TYPE_SYNC:
             // can be used for auto-baudrate in the future
@@ -88,6 +588,8 @@ uint8_t dprot_slave_wait_for_msg (uint8_t* buffer, uint8_t max_len)
             
 		default:
 			// error - this msg type doesn't exist.
+			DPROT_STAT_ADD (link, logical_errors, 1);
+			DPROT_TRACE_EVENT (link, DPROT_TRACE_RX_ERROR, buffer[0], actual_rx);
 			return DPROT_LOGICAL_ERROR;
 	}
 	
@@ -96,65 +598,71 @@ uint8_t dprot_slave_wait_for_msg (uint8_t* buffer, uint8_t max_len)
 }
 
 /***********************************************************/
-uint8_t dprot_slave_send_data_msg (uint8_t* buffer, uint8_t len)
+uint8_t dprot_slave_send_data_msg (dprot_link* link, uint8_t* buffer, uint8_t len)
 {
-	uint8_t i;
-	uint8_t calc_check = 0;
-	uint8_t header[2] = { DPROT_TYPE_DATA, len };
+	uint8_t flags = 0;
 	
-    header[0] |= slave_last_parity;
-    
-	if (len > DPROT_MAX_PAYLOAD)
+	if (len > DPROT_PAYLOAD(link->check_size))
 	{
 		// the buffer is bigger than the maximal allowed
 		// transaction size
 		return DPROT_MSG_SIZE_ERROR;
 	}
-    
-	// calculate the checking
-	DPROT_CHECKING(calc_check,header[0]);
-	DPROT_CHECKING(calc_check,header[1]);
-	for (i = 0; i < len; i++)
+	
+	// the answer acks the request
+	if (link->slave.ack_pending)
 	{
-		DPROT_CHECKING(calc_check,buffer[i]);
+		flags = DPROT_FLAG_ACK;
+		link->slave.ack_pending = 0;
 	}
 	
-	// finally send the data
-	slip_tx(&slave_channel, header, 2, SLIP_MSG_START);
-	slip_tx(&slave_channel, buffer, len, SLIP_MSG_MIDDLE);
-	slip_tx(&slave_channel, &calc_check, 1, SLIP_MSG_END);
+	// kept for a repeated request
+	if (link->slave.piggyback)
+	{
+		memcpy (link->slave.resp_buf, buffer, len);
+		link->slave.resp_len = len;
+		link->slave.resp_valid = 1;
+	}
 	
+	dprot_slave_send_data_frame (link, flags, buffer, len);
 	return DPROT_NO_ERROR;
 }
 
 
 /***********************************************************/
-uint8_t dprot_slave_send_ack ( void )
+uint8_t dprot_slave_send_ack (dprot_link* link)
 {
-	uint8_t buffer[3] = { DPROT_TYPE_ACK, 0, 0 };
+	uint8_t buffer[2+CHECKING_MAX_SIZE] = { DPROT_TYPE_ACK, 0 };
+    
+    link->slave.ack_pending = 0;
+    DPROT_STAT_ADD (link, acks_tx, 1);
     
-    buffer[0] |= slave_last_parity;
+    buffer[0] |= link->last_parity;
+    if (link->compress) buffer[0] |= DPROT_FLAG_LZ;
 	
 	// calculate checking
-	DPROT_CHECKING(buffer[2],buffer[0]);
-	DPROT_CHECKING(buffer[2],buffer[1]);
+	dprot_calc_checking (link->checking, buffer, 2, NULL, 0, buffer + 2);
     
-	slip_tx(&slave_channel, buffer, 3, SLIP_MSG_REG);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, buffer[0], 2 + link->check_size);
+	slip_tx(&link->channel, buffer, 2 + link->check_size, SLIP_MSG_REG);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, buffer[0], 2 + link->check_size);
 	return DPROT_NO_ERROR;
 }
 
 /***********************************************************/
-uint8_t dprot_slave_send_nack ( void )
+uint8_t dprot_slave_send_nack (dprot_link* link)
 {
-	uint8_t buffer[3] = { DPROT_TYPE_NACK, 0, 0 };
+	uint8_t buffer[2+CHECKING_MAX_SIZE] = { DPROT_TYPE_NACK, 0 };
 	
-    buffer[0] |= slave_last_parity;
+    DPROT_STAT_ADD (link, nacks_tx, 1);
+    buffer[0] |= link->last_parity;
     
 	// calculate checking
-	DPROT_CHECKING(buffer[2],buffer[0]);
-	DPROT_CHECKING(buffer[2],buffer[1]);
+	dprot_calc_checking (link->checking, buffer, 2, NULL, 0, buffer + 2);
     
-	slip_tx(&slave_channel, buffer, 3, SLIP_MSG_REG);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_START, buffer[0], 2 + link->check_size);
+	slip_tx(&link->channel, buffer, 2 + link->check_size, SLIP_MSG_REG);
+	DPROT_TRACE_EVENT (link, DPROT_TRACE_TX_END, buffer[0], 2 + link->check_size);
 	return DPROT_NO_ERROR;
 }
 
@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dprot_trace.h"
+
+static const char* dprot_trace_names[] =
+{
+	"?", "tx_start", "tx_end", "rx_frame", "ack", "nack", "retry", "timeout", "rx_error", "duplicate"
+};
+
+//===============================================
+static unsigned long long dprot_trace_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//===============================================
+int dprot_trace_init (dprot_trace* trace, dprot_trace_record* records, uint32_t count, uint32_t id)
+{
+	if (records == NULL || count < 2 || (count & (count - 1)))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	trace->records = records;
+	trace->mask = count - 1;
+	trace->head = 0;
+	trace->id = id;
+	trace->start_ticks = dprot_trace_now ();
+	trace->start_ns = dprot_trace_ns ();
+	return 0;
+}
+
+//===============================================
+uint32_t dprot_trace_snapshot (dprot_trace* trace, dprot_trace_record* out, uint32_t max)
+{
+	uint32_t size = trace->mask + 1;
+	dprot_trace_record* r;
+	dprot_trace_record copy;
+	uint32_t head;
+	uint32_t first;
+	uint32_t n;
+	uint32_t kept = 0;
+	uint32_t i;
+
+	head = __atomic_load_n (&trace->head, __ATOMIC_ACQUIRE);
+	n = head;
+	if (n > size) n = size;
+	if (n > max) n = max;
+	first = head - n;
+
+	for (i = 0; i < n; i++)
+	{
+		r = &trace->records[(first + i) & trace->mask];
+		copy.index = __atomic_load_n (&r->index, __ATOMIC_ACQUIRE);
+		copy.time = __atomic_load_n (&r->time, __ATOMIC_RELAXED);
+		copy.event = __atomic_load_n (&r->event, __ATOMIC_RELAXED);
+		copy.header = __atomic_load_n (&r->header, __ATOMIC_RELAXED);
+		copy.len = __atomic_load_n (&r->len, __ATOMIC_RELAXED);
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		// the writer went on meanwhile and is overwriting (or has
+		// overwritten) the record - the older ones copied are
+		// dropped too, the snapshot has no holes
+		if (copy.index != first + i || __atomic_load_n (&r->index, __ATOMIC_RELAXED) != copy.index)
+		{
+			kept = 0;
+			continue;
+		}
+		out[kept++] = copy;
+	}
+
+	return kept;
+}
+
+//===============================================
+int dprot_trace_dump (dprot_trace* trace, FILE* out)
+{
+	uint32_t size = trace->mask + 1;
+	dprot_trace_record* records = malloc (size * sizeof(dprot_trace_record));
+	dprot_trace_file file;
+	uint32_t head;
+	int ret = 0;
+
+	if (records == NULL)
+	{
+		return -1;
+	}
+
+	memset (&file, 0, sizeof(file));
+	memcpy (file.magic, DPROT_TRACE_MAGIC, 4);
+	file.version = DPROT_TRACE_VERSION;
+	file.record_size = sizeof(dprot_trace_record);
+	file.id = trace->id;
+	file.count = dprot_trace_snapshot (trace, records, size);
+	file.dump_ticks = dprot_trace_now ();
+	file.dump_ns = dprot_trace_ns ();
+	file.start_ticks = trace->start_ticks;
+	file.start_ns = trace->start_ns;
+#if defined(DPROT_TRACE_NOW) || defined(__x86_64__) || defined(__i386__)
+	file.ticks_are_ns = 0;
+#else
+	file.ticks_are_ns = 1;
+#endif
+
+	// the ones before the oldest copied
+	head = file.count ? records[0].index : __atomic_load_n (&trace->head, __ATOMIC_RELAXED);
+	file.lost = head;
+
+	if (fwrite (&file, sizeof(file), 1, out) != 1 ||
+		(file.count && fwrite (records, sizeof(dprot_trace_record), file.count, out) != file.count))
+	{
+		ret = -1;
+	}
+
+	free (records);
+	return ret;
+}
+
+//===============================================
+const char* dprot_trace_event_name (uint8_t event)
+{
+	if (event >= sizeof(dprot_trace_names) / sizeof(dprot_trace_names[0]))
+	{
+		return "?";
+	}
+	return dprot_trace_names[event];
+}
@@ -0,0 +1,202 @@
+#ifndef __DPROT_TRACE_H__
+#define __DPROT_TRACE_H__
+
+#include <stdio.h>
+#include "spec_types.h"
+
+/*! \file dprot_trace.h
+ * \brief Binary event tracing of the frame lifecycle
+ *
+ * A trace is a ring of fixed size records owned by the caller
+ * and attached to a link ('dprot_link_set_trace'). The thread
+ * driving the link is the only writer - an event is a time
+ * stamp and four stores, no locks and no system calls (tens of
+ * nanoseconds), so a trace can stay attached in production. A
+ * full ring overwrites its oldest records.
+ *
+ * Any thread can take a snapshot of the newest records or dump
+ * them to a file while the link runs - the records overwritten
+ * during the copy are left out. Every record is a little seqlock:
+ * its 'index' is wrong while it is written and is published last,
+ * the reader checks it before and after copying the record.
+ *
+ * The time stamps are TSC cycles on x86, CLOCK_MONOTONIC
+ * nanoseconds elsewhere (DPROT_TRACE_NOW overrides it). A dump
+ * keeps pairs of ticks and monotonic nanoseconds taken at the
+ * attach and at the dump to convert them offline.
+ *
+ * The dump is a 'dprot_trace_file' header followed by 'count'
+ * records, both in the byte order of the host. The dumps of
+ * several links can be written to one file back to back.
+ */
+
+/*! \def DPROT_TRACING
+ * \brief The trace points of the protocol - 0 compiles them out
+ */
+#ifndef DPROT_TRACING
+#define DPROT_TRACING		1
+#endif
+
+#define DPROT_TRACE_MAGIC	"DPTR"
+#define DPROT_TRACE_VERSION	1
+
+/*! \def DPROT_TRACE_TX_START
+ * \brief The events - the first byte of a frame is going to the line
+ */
+#define DPROT_TRACE_TX_START	1
+#define DPROT_TRACE_TX_END		2   /**< its END byte was handed to the transport */
+#define DPROT_TRACE_RX_FRAME	3   /**< a frame (or nothing, 'len' 0) was received */
+#define DPROT_TRACE_ACK			4   /**< the master got an ack */
+#define DPROT_TRACE_NACK		5   /**< the master got a nack */
+#define DPROT_TRACE_RETRY		6   /**< a frame is sent again */
+#define DPROT_TRACE_TIMEOUT		7   /**< an ack wait ran out */
+#define DPROT_TRACE_RX_ERROR	8   /**< a frame failed the checking or the protocol */
+#define DPROT_TRACE_DUPLICATE	9   /**< a frame of the previous parity */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/*********************************************************/
+/*! \struct dprot_trace_record
+ * \brief An event (16 bytes)
+ */
+typedef struct
+{
+	unsigned long long time;    /**< ticks of 'dprot_trace_now' */
+	uint32_t index;             /**< the number of the record in the trace */
+	uint8_t event;              /**< DPROT_TRACE_xxx */
+	uint8_t header;             /**< the first byte of the frame - type, flags, the parity in bit 0 */
+	uint16_t len;               /**< the length of the frame (without the slip encoding) */
+} dprot_trace_record;
+
+/*! \struct dprot_trace
+ * \brief A ring of records
+ */
+typedef struct dprot_trace_s
+{
+	dprot_trace_record* records;
+	uint32_t mask;              /**< the size of the ring - 1 */
+	uint32_t head;              /**< the records written, wraps */
+	uint32_t id;                /**< the link in the dumps */
+	unsigned long long start_ticks;
+	unsigned long long start_ns;
+} dprot_trace;
+
+/*! \struct dprot_trace_file
+ * \brief The header of a dump (56 bytes)
+ */
+typedef struct
+{
+	char magic[4];              /**< DPROT_TRACE_MAGIC */
+	uint16_t version;           /**< DPROT_TRACE_VERSION */
+	uint16_t record_size;       /**< sizeof(dprot_trace_record) */
+	uint32_t id;
+	uint32_t count;             /**< the records that follow, the oldest first */
+	uint32_t lost;              /**< the records overwritten before the dump */
+	uint32_t ticks_are_ns;      /**< 1 if the time stamps are nanoseconds already */
+	unsigned long long start_ticks;
+	unsigned long long start_ns;
+	unsigned long long dump_ticks;
+	unsigned long long dump_ns;
+} dprot_trace_file;
+
+/*********************************************************/
+
+/*!
+ * \brief The time stamp of an event
+ * \return TSC cycles on x86, monotonic nanoseconds elsewhere
+ */
+static inline unsigned long long dprot_trace_now (void)
+{
+#if defined(DPROT_TRACE_NOW)
+	return DPROT_TRACE_NOW ();
+#elif defined(__x86_64__) || defined(__i386__)
+	return __rdtsc ();
+#else
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/*!
+ * \brief Adds an event - from the thread driving the link only
+ *
+ * \param trace the trace
+ * \param event DPROT_TRACE_xxx
+ * \param header the first byte of the frame
+ * \param len the length of the frame
+ */
+static inline void dprot_trace_event (dprot_trace* trace, uint8_t event, uint8_t header, uint16_t len)
+{
+	uint32_t i = trace->head;
+	dprot_trace_record* r = &trace->records[i & trace->mask];
+
+#ifdef __GNUC__
+	// while the record is written its index is one no record of
+	// the slot has (the ring has two slots at least), the stores
+	// of the record can't be seen before it
+	__atomic_store_n (&r->index, i - 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	__atomic_store_n (&r->time, dprot_trace_now (), __ATOMIC_RELAXED);
+	__atomic_store_n (&r->event, event, __ATOMIC_RELAXED);
+	__atomic_store_n (&r->header, header, __ATOMIC_RELAXED);
+	__atomic_store_n (&r->len, len, __ATOMIC_RELAXED);
+
+	// the record is complete before its index and the head say so
+	__atomic_store_n (&r->index, i, __ATOMIC_RELEASE);
+	__atomic_store_n (&trace->head, i + 1, __ATOMIC_RELEASE);
+#else
+	r->time = dprot_trace_now ();
+	r->index = i;
+	r->event = event;
+	r->header = header;
+	r->len = len;
+	trace->head = i + 1;
+#endif
+}
+
+/*!
+ * \brief Initializes a trace
+ *
+ * \param trace the trace
+ * \param records the ring
+ * \param count the size of the ring - a power of two, 2 at least
+ * \param id the link in the dumps
+ *
+ * \return 0 on success, -1 on a bad size (errno is set)
+ */
+int dprot_trace_init (dprot_trace* trace, dprot_trace_record* records, uint32_t count, uint32_t id);
+
+/*!
+ * \brief Copies the newest records
+ *
+ * \param trace the trace
+ * \param out the copy, the oldest first
+ * \param max the room in 'out'
+ *
+ * \return the number of the records copied
+ */
+uint32_t dprot_trace_snapshot (dprot_trace* trace, dprot_trace_record* out, uint32_t max);
+
+/*!
+ * \brief Writes a snapshot of the whole ring to a file
+ *
+ * \param trace the trace
+ * \param out the stream
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int dprot_trace_dump (dprot_trace* trace, FILE* out);
+
+/*!
+ * \brief The name of an event
+ * \param event DPROT_TRACE_xxx
+ * \return the name, "?" if unknown
+ */
+const char* dprot_trace_event_name (uint8_t event);
+
+#endif //__DPROT_TRACE_H__
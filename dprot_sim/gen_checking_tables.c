@@ -0,0 +1,114 @@
+/*
+ * generates 'checking_tables.h' - the crc tables of checking.c
+ *
+ * build: cc -o gen_checking_tables gen_checking_tables.c
+ * run:   ./gen_checking_tables > checking_tables.h
+ */
+#include <stdio.h>
+
+unsigned char crc8_slice[8][256];
+unsigned short crc16_slice[8][256];
+unsigned int crc32c_slice[8][256];
+
+//===============================================
+// the same tables 'init_crc8' used to build on every init
+void gen_tables (void)
+{
+	int i;
+	int j;
+	unsigned char crc;
+	unsigned short crc16;
+	unsigned int crc32;
+
+	for (i=0; i<256; i++) {
+		crc = i;
+		for (j=0; j<8; j++) {
+			crc = (crc << 1) ^ ((crc & 0x80) ? 0x07 : 0);
+		}
+		crc8_slice[0][i] = crc;
+
+		crc16 = i << 8;
+		for (j=0; j<8; j++) {
+			crc16 = (crc16 << 1) ^ ((crc16 & 0x8000) ? 0x1021 : 0);
+		}
+		crc16_slice[0][i] = crc16;
+
+		// reflected polynomial
+		crc32 = i;
+		for (j=0; j<8; j++) {
+			crc32 = (crc32 >> 1) ^ ((crc32 & 1) ? 0x82F63B78 : 0);
+		}
+		crc32c_slice[0][i] = crc32;
+	}
+
+	for (j=1; j<8; j++) {
+		for (i=0; i<256; i++) {
+			crc8_slice[j][i] = crc8_slice[0][crc8_slice[j-1][i]];
+			crc16_slice[j][i] = (crc16_slice[j-1][i] << 8) ^ crc16_slice[0][crc16_slice[j-1][i] >> 8];
+			crc32c_slice[j][i] = (crc32c_slice[j-1][i] >> 8) ^ crc32c_slice[0][crc32c_slice[j-1][i] & 0xff];
+		}
+	}
+}
+
+//===============================================
+// a table row, 'width' hex digits per entry
+void print_row (const char* indent, unsigned int* row, int width)
+{
+	int per_line = (width > 4) ? 8 : (width > 2) ? 12 : 16;
+	int i;
+
+	for (i = 0; i < 256; i++)
+	{
+		if (i % per_line == 0) printf("%s", indent);
+		printf("0x%0*x%s", width, row[i], (i == 255) ? "" : ",");
+		printf("%s", (i % per_line == per_line - 1 || i == 255) ? "\n" : " ");
+	}
+}
+
+//===============================================
+void print_slices (const char* type, const char* name, int width, unsigned int (*get)(int, int))
+{
+	unsigned int row[256];
+	int i, j;
+
+	printf("static const %s %s[8][256] =\n{\n", type, name);
+	for (j = 0; j < 8; j++)
+	{
+		for (i = 0; i < 256; i++) row[i] = get (j, i);
+		printf("\t{\n");
+		print_row ("\t\t", row, width);
+		printf("\t}%s\n", (j == 7) ? "" : ",");
+	}
+	printf("};\n\n");
+}
+
+unsigned int get_crc8 (int j, int i) { return crc8_slice[j][i]; }
+unsigned int get_crc16 (int j, int i) { return crc16_slice[j][i]; }
+unsigned int get_crc32c (int j, int i) { return crc32c_slice[j][i]; }
+
+//===============================================
+int main ()
+{
+	unsigned int row[256];
+	int i;
+
+	gen_tables ();
+
+	printf("#ifndef __CHECKING_TABLES_H__\n#define __CHECKING_TABLES_H__\n\n");
+	printf("/*\n * generated by gen_checking_tables.c - do not edit\n *\n");
+	printf(" * the slicing-by-8 tables - 'slice[k][x]' is the crc of 'x'\n");
+	printf(" * followed by 'k' zero bytes. 'crc8_slice[0]' is the same as\n");
+	printf(" * 'crc8_table'.\n */\n\n");
+
+	for (i = 0; i < 256; i++) row[i] = crc8_slice[0][i];
+	printf("const uint8_t crc8_table[256] =\n{\n");
+	print_row ("\t", row, 2);
+	printf("};\n\n");
+
+	print_slices ("uint8_t", "crc8_slice", 2, get_crc8);
+	print_slices ("uint16_t", "crc16_slice", 4, get_crc16);
+	print_slices ("uint32_t", "crc32c_slice", 8, get_crc32c);
+
+	printf("#endif //__CHECKING_TABLES_H__\n");
+	return 0;
+}
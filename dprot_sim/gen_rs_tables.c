@@ -0,0 +1,72 @@
+/*
+ * generates 'rs_tables.h' - the GF(256) tables of rs.c
+ *
+ * build: cc -o gen_rs_tables gen_rs_tables.c
+ * run:   ./gen_rs_tables > rs_tables.h
+ */
+#include <stdio.h>
+
+#define RS_POLY		0x11d	// x^8 + x^4 + x^3 + x^2 + 1, alpha = 2
+#define RS_LOG_ZERO	510		// the log of 0 - any sum with it lands on a 0
+
+unsigned int rs_exp[1024];
+unsigned int rs_log[256];
+
+//===============================================
+void gen_tables (void)
+{
+	unsigned int x = 1;
+	int i;
+
+	for (i = 0; i < 255; i++)
+	{
+		rs_exp[i] = rs_exp[i + 255] = x;
+		rs_log[x] = i;
+		x <<= 1;
+		if (x & 0x100) x ^= RS_POLY;
+	}
+	for (i = 510; i < 1024; i++)
+	{
+		rs_exp[i] = 0;
+	}
+	rs_log[0] = RS_LOG_ZERO;
+}
+
+//===============================================
+// 'count' entries, 'width' hex digits per entry
+void print_table (unsigned int* table, int count, int width)
+{
+	int per_line = (width > 2) ? 12 : 16;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (i % per_line == 0) printf("\t");
+		printf("0x%0*x%s", width, table[i], (i == count - 1) ? "" : ",");
+		printf("%s", (i % per_line == per_line - 1 || i == count - 1) ? "\n" : " ");
+	}
+}
+
+//===============================================
+int main ()
+{
+	gen_tables ();
+
+	printf("#ifndef __RS_TABLES_H__\n#define __RS_TABLES_H__\n\n");
+	printf("/*\n * generated by gen_rs_tables.c - do not edit\n *\n");
+	printf(" * GF(256) over x^8+x^4+x^3+x^2+1. 'rs_exp[i]' is alpha^i, twice\n");
+	printf(" * over (a sum of two logs needs no modulo) and zeros from 510 on.\n");
+	printf(" * 'rs_log[0]' is 510 - a product with a zero is a zero without\n");
+	printf(" * a branch.\n */\n\n");
+
+	printf("static const uint8_t rs_exp[1024] =\n{\n");
+	print_table (rs_exp, 1024, 2);
+	printf("};\n\n");
+
+	printf("static const uint16_t rs_log[256] =\n{\n");
+	print_table (rs_log, 256, 3);
+	printf("};\n\n");
+
+	printf("#endif //__RS_TABLES_H__\n");
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "lzss.h"
+
+/****************************************************/
+uint16_t lzss_compress (const uint8_t* in, uint16_t len, uint8_t* out, uint16_t max)
+{
+	uint16_t pos = 0;
+	uint16_t n = 0;
+	uint16_t ctrl = 0;          // the control byte of the group
+	uint8_t bit = 8;            // the items in the group
+	uint16_t best_len, best_dist;
+	uint16_t from, l, limit;
+
+	while (pos < len)
+	{
+		// a new group
+		if (bit == 8)
+		{
+			if (n >= max) return 0;
+			ctrl = n++;
+			out[ctrl] = 0;
+			bit = 0;
+		}
+
+		// the longest match behind
+		best_len = 0;
+		best_dist = 0;
+		limit = len - pos;
+		if (limit > LZSS_MAX_MATCH) limit = LZSS_MAX_MATCH;
+		from = (pos > LZSS_WINDOW) ? pos - LZSS_WINDOW : 0;
+		for (; from < pos && best_len < limit; from++)
+		{
+			// the match may run into the bytes it produces
+			for (l = 0; l < limit && in[from + l] == in[pos + l]; l++)
+			{
+			}
+			if (l > best_len)
+			{
+				best_len = l;
+				best_dist = pos - from;
+			}
+		}
+
+		if (best_len >= LZSS_MIN_MATCH)
+		{
+			if (n + 2 > max) return 0;
+			out[ctrl] |= 1 << bit;
+			out[n++] = (uint8_t)(best_dist - 1);
+			out[n++] = (uint8_t)(best_len - LZSS_MIN_MATCH);
+			pos += best_len;
+		}
+		else
+		{
+			if (n >= max) return 0;
+			out[n++] = in[pos++];
+		}
+		bit++;
+	}
+
+	return n;
+}
+
+/****************************************************/
+uint16_t lzss_decompress (const uint8_t* in, uint16_t len, uint8_t* out, uint16_t max)
+{
+	uint16_t i = 0;
+	uint16_t n = 0;
+	uint16_t dist, l;
+	uint8_t ctrl = 0;
+	uint8_t bit = 8;
+
+	while (i < len)
+	{
+		if (bit == 8)
+		{
+			ctrl = in[i++];
+			bit = 0;
+			continue;
+		}
+
+		if (ctrl & (1 << bit))
+		{
+			if (i + 2 > len) return 0;
+			dist = in[i] + 1;
+			l = in[i + 1] + LZSS_MIN_MATCH;
+			i += 2;
+			if (dist > n || n + l > max) return 0;
+
+			// byte by byte - an overlapping match repeats itself
+			for (; l; l--, n++)
+			{
+				out[n] = out[n - dist];
+			}
+		}
+		else
+		{
+			if (n >= max) return 0;
+			out[n++] = in[i++];
+		}
+		bit++;
+	}
+
+	return n;
+}
@@ -0,0 +1,60 @@
+#ifndef __LZSS_H__
+#define __LZSS_H__
+
+#include "spec_types.h"
+
+/*! \file lzss.h
+ * \brief A small LZSS codec for the frame payloads
+ *
+ * Made for blocks of up to a frame (256 bytes) - no tables, no
+ * state between the blocks, the decoder is a loop of copies (it
+ * fits an 8-bit micro). The encoded block is a series of groups:
+ * a control byte and up to eight items, the bit 0 of the control
+ * byte for the first item. A 0 bit is a literal byte, a 1 bit a
+ * match of two bytes - the distance back - 1 and the length -
+ * LZSS_MIN_MATCH. The encoder searches the whole block behind
+ * the position (greedy, the longest match).
+ */
+
+/*! \def LZSS_MIN_MATCH
+ * \brief The shortest match - a shorter one isn't worth its two bytes
+ */
+#define LZSS_MIN_MATCH		3
+
+/*! \def LZSS_MAX_MATCH
+ * \brief The longest match
+ */
+#define LZSS_MAX_MATCH		(LZSS_MIN_MATCH+255)
+
+/*! \def LZSS_WINDOW
+ * \brief The farthest distance back
+ */
+#define LZSS_WINDOW			256
+
+/*********************************************************/
+
+/*!
+ * \brief Encodes a block
+ *
+ * \param in the block
+ * \param len its length
+ * \param out the encoded block
+ * \param max the room in 'out' - the encoder gives up beyond it
+ *
+ * \return the encoded length, 0 if it didn't fit in 'max'
+ */
+uint16_t lzss_compress (const uint8_t* in, uint16_t len, uint8_t* out, uint16_t max);
+
+/*!
+ * \brief Decodes a block
+ *
+ * \param in the encoded block
+ * \param len its length
+ * \param out the block
+ * \param max the room in 'out'
+ *
+ * \return the decoded length, 0 on a broken block or if it didn't fit
+ */
+uint16_t lzss_decompress (const uint8_t* in, uint16_t len, uint8_t* out, uint16_t max);
+
+#endif //__LZSS_H__
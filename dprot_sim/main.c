@@ -1,20 +1,128 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <pthread.h>
 #include "ts_char_queue.h"
+#include "dprot_serial.h"
+#include "dprot_loop.h"
 #include "dprot.h"
+#include "sim_channel.h"
+#include "sim_des.h"
+#include "sim_sweep.h"
 #include "spec_types.h"
 
 
 // the input and output queues (from the master's point of view)
+#define SIM_MASTER_RX_BUFFER	4096
+
+// how long the slave waits for room on its line [us]
+#define SIM_SLAVE_TX_WAIT		10000
+
 ts_queue *in_channel = NULL;
 ts_queue *out_channel = NULL;
+
+// a simulated serial port - the queues seen by a single endpoint
+typedef struct
+{
+	ts_queue* rx;
+	ts_queue* tx;
+} sim_port;
+
+sim_port master_port = {0};
+sim_port slave_port = {0};
+dprot_link sim_links[2];
+dprot_link_pool sim_pool;
+dprot_link* master_link = NULL;
+dprot_link* slave_link = NULL;
 pthread_t master_thread;
 pthread_t slave_thread;
 unsigned int number_if_messages_to_send = 1000;
 double out_channel_ber = 0.001;
 double in_channel_ber = 0.00;
+int sim_ber_given = 0;
+
+// the impairments of the lines - '-i' for both, '-e' is the byte
+// error rate of the master's line on top of it
+const char* sim_model_spec = NULL;
+sim_channel_model sim_model_down;
+sim_channel_model sim_model_up;
+sim_channel sim_channel_down;
+sim_channel sim_channel_up;
+
+// a byte duplicated on the slave's line may not fit the master's
+// read - it waits for the next one
+uint8_t sim_up_held[2 * SLIP_TX_BLOCK];
+uint16_t sim_up_held_len = 0;
+
+// the round trips of the stop-and-wait messages [us]
+uint32_t* sim_latency = NULL;
+unsigned int sim_latencies = 0;
 int global_count = 0;
+int verbose = 1;
+volatile int sim_running = 0;
+uint8_t sim_window_mode = DPROT_WINDOW_NONE;
+uint8_t sim_window_size = 4;
+int sim_per_byte = 0;
+
+// a pseudo terminal pair instead of the queues - [0] is the master's end
+int sim_pty = 0;
+dprot_serial sim_serial[2];
+
+// many links - the slaves are served by a single event loop thread
+unsigned int sim_loop_links = 0;
+double sim_loop_cpu = 0;
+
+// the masters in the loop too - asynchronous requests
+int sim_async = 0;
+unsigned int sim_async_done = 0;
+uint8_t sim_checking = DPROT_CHECKING_DEFAULT;
+uint8_t sim_framing = SLIP_FRAMING_SLIP;
+uint8_t sim_fec = 0;
+
+// request/response - the slave answers every message
+int sim_request = 0;
+uint8_t sim_piggyback = 0;
+
+// compressed stop-and-wait frames, telemetry records as the messages
+int sim_compress = 0;
+unsigned long sim_master_ends = 0;
+unsigned long sim_slave_ends = 0;
+unsigned long sim_slave_lost = 0;
+
+// the discrete event simulation - virtual time, seeded bit errors
+int sim_des = 0;
+uint32_t sim_baud = 115200;
+unsigned long sim_seed = 1;
+
+// the parameter sweep - a grid of points over a pool of threads
+const char* sim_sweep_grid = NULL;
+uint32_t sim_sweep_workers = 0;
+int sim_sweep_json = 0;
+
+// the event traces of the threaded runs - both ends of every
+// run are dumped to the file
+#define SIM_TRACE_RECORDS	65536
+const char* sim_trace_file = NULL;
+dprot_trace sim_trace[2];
+dprot_trace_record* sim_trace_records = NULL;
+uint32_t sim_trace_runs = 0;
+
+// fragmented messages - each transfer sends the whole blob
+uint32_t sim_blob_size = 0;
+uint8_t *sim_blob = NULL;
+uint8_t *sim_blob_rx = NULL;
+uint8_t sim_reorder[DPROT_REORDER_SIZE];
+unsigned int sim_blob_ok = 0;
+
+// the messages sent in each simulation run
+uint8_t (*sim_messages)[128] = NULL;
+uint8_t *sim_lengths = NULL;
+unsigned long sim_delivered_bytes = 0;
 
 //===============================================
 // Random number
@@ -24,6 +132,16 @@ double drandom (void)
 	return ((double)(r))/((double)(RAND_MAX));
 }
 
+//===============================================
+// The master's round trip clock
+uint32_t sim_clock_us (void)
+{
+	struct timeval now;
+	
+	gettimeofday (&now, NULL);
+	return (uint32_t)(now.tv_sec * 1000000ull + now.tv_usec);
+}
+
 //===============================================
 // Random message
 uint8_t generate_random_message(uint8_t *buffer, uint8_t max_len)
@@ -40,34 +158,104 @@ uint8_t generate_random_message(uint8_t *buffer, uint8_t max_len)
     return length;
 }
 
+// a telemetry record - the same keys every time, slowly moving values
+uint8_t generate_telemetry_message(uint8_t *buffer, uint8_t max_len)
+{
+	static unsigned long t = 1700000000;
+	char text[256];
+	int n = 0;
+	int sensor = 0;
+	
+	n += snprintf (text + n, sizeof(text) - n, "{\"t\":%lu,\"node\":\"pump-07\",\"state\":\"RUN\"", t++);
+	while (n < max_len - 40 && n < (int)sizeof(text) - 48)
+	{
+		n += snprintf (text + n, sizeof(text) - n, ",\"s%d\":{\"temp\":%d,\"v\":%d}", sensor++,
+					   215 + (int)(drandom()*4), 3300 + (int)(drandom()*8));
+	}
+	n += snprintf (text + n, sizeof(text) - n, "}");
+	if (n > max_len) n = max_len;
+	
+	memcpy (buffer, text, n);
+	return (uint8_t)n;
+}
+
+//===============================================
+// '-E' is checked up front, the FEC may still be compiled out (SLIP_FEC)
+static void sim_set_fec (dprot_link* link, dprot_rx_ctx* rx)
+{
+	if ((link && dprot_link_set_fec (link, sim_fec) != DPROT_NO_ERROR) ||
+		(rx && dprot_rx_set_fec (rx, sim_fec) != DPROT_NO_ERROR))
+	{
+		fprintf(stderr, "FEC of %u parity bytes refused\n", sim_fec);
+		exit(1);
+	}
+}
+
+//===============================================
+// the END byte of the framing of the lines
+#define SIM_END		((sim_framing == SLIP_FRAMING_COBS) ? SLIP_COBS_END : SLIP_END)
+
+// every frame is put between two END bytes
+unsigned long sim_count_ends (uint8_t* buf, uint16_t len)
+{
+	unsigned long n = 0;
+	uint8_t end = SIM_END;
+	uint16_t i;
+	
+	for (i = 0; i < len; i++)
+	{
+		n += (buf[i] == end);
+	}
+	return n;
+}
+
+//===============================================
+// The slave's line as the master reads it
+uint16_t master_line_read (ts_queue* q, uint8_t* buf, uint16_t max)
+{
+	uint8_t line[SLIP_TX_BLOCK];
+	uint16_t n;
+	
+	if (sim_up_held_len == 0)
+	{
+		n = tsq_pop_n (q, line, (max < SLIP_TX_BLOCK) ? max : SLIP_TX_BLOCK);
+		sim_up_held_len = sim_channel_apply (&sim_channel_up, line, n, sim_up_held);
+	}
+	
+	n = (max < sim_up_held_len) ? max : sim_up_held_len;
+	memcpy (buf, sim_up_held, n);
+	memmove (sim_up_held, sim_up_held + n, sim_up_held_len - n);
+	sim_up_held_len -= n;
+	return n;
+}
+
 //===============================================
 // declaration of the writing/reading functions
 // in the channels
 uint8_t master_get_char ( uint8_t to, uint8_t *cout)
 {
 	*cout = 0;
-	double r = drandom ();
 	
-	while ((tsq_pop_item (in_channel, cout)==-1) && --to)
+	while ((master_line_read (in_channel, cout, 1) == 0) && --to)
 	{
         usleep(1000);
 	}
 	
     if (!to) return 0;
-    
-    //tsq_pop_item (in_channel, cout);
-    
-	if (r<in_channel_ber) *cout = (uint8_t)(drandom()*256);
-		
+	
 	return 1;
 }
 void master_put_char (uint8_t c)
 {
-	uint8_t new_c = c;
-	double r = drandom ();
+	uint8_t line[2];
+	uint16_t n;
+	
+	sim_master_ends += (c == SIM_END);
+	n = sim_channel_apply (&sim_channel_down, &c, 1, line);
 	
-	if (r<out_channel_ber) new_c = (uint8_t)(drandom()*256);
-	tsq_push_item (out_channel, new_c);
+	// a real line doesn't lose bytes when the receiver is slow -
+	// the blocking queue lets the slave catch up with the window
+	tsq_push_n (out_channel, line, n);
 }
 
 uint8_t slave_get_char ( )
@@ -75,14 +263,82 @@ uint8_t slave_get_char ( )
     uint8_t item = 0;
 	while (tsq_pop_item (out_channel, &item)==-1)
 	{
+		// the simulation run is over
+		if (!sim_running) pthread_exit (NULL);
+		sched_yield ();
 	}
 
 	return item;
 }
 
+// the master's side buffers whole answers like a tty - a slave
+// outrunning the master waits a moment for room, then the bytes
+// are lost (and counted)
+void slave_line_push (ts_queue* q, uint8_t* buf, uint16_t len)
+{
+	uint32_t waited = 0;
+	int pushed;
+	
+	while (tsq_free (q) < len && sim_running && waited < SIM_SLAVE_TX_WAIT)
+	{
+		usleep (100);
+		waited += 100;
+	}
+	
+	pushed = tsq_push_n (q, buf, len);
+	sim_slave_lost += len - pushed;
+}
+
 void slave_put_char (uint8_t c)
 {
-	tsq_push_item (in_channel, c);
+	sim_slave_ends += (c == SIM_END);
+	slave_line_push (in_channel, &c, 1);
+}
+
+//===============================================
+// the bulk versions - the context is the port of the endpoint
+uint16_t master_read_buf (void* ctx, uint8_t* buf, uint16_t max, uint16_t to)
+{
+	uint16_t n;
+	
+	while ((n = master_line_read (((sim_port*)ctx)->rx, buf, max)) == 0 && to--)
+	{
+        usleep(1000);
+	}
+	
+	return n;
+}
+
+void master_write_buf (void* ctx, uint8_t* buf, uint16_t len)
+{
+	uint8_t line[2 * SLIP_TX_BLOCK];
+	uint16_t n;
+	
+	sim_master_ends += sim_count_ends (buf, len);
+	n = sim_channel_apply (&sim_channel_down, buf, len, line);
+	
+	// a real line doesn't lose bytes when the receiver is slow
+	// (the master's line blocks)
+	tsq_push_n (((sim_port*)ctx)->tx, line, n);
+}
+
+void slave_write_buf (void* ctx, uint8_t* buf, uint16_t len)
+{
+	sim_slave_ends += sim_count_ends (buf, len);
+	slave_line_push (((sim_port*)ctx)->tx, buf, len);
+}
+
+// the pty line - the context is the end of the endpoint
+void master_write_pty (void* ctx, uint8_t* buf, uint16_t len)
+{
+	sim_master_ends += sim_count_ends (buf, len);
+	dprot_serial_write_buf (ctx, buf, len);
+}
+
+void slave_write_pty (void* ctx, uint8_t* buf, uint16_t len)
+{
+	sim_slave_ends += sim_count_ends (buf, len);
+	dprot_serial_write_buf (ctx, buf, len);
 }
 
 
@@ -94,98 +350,1039 @@ void *master_thread_function( void *ptr )
 {
 	int num_msgs = number_if_messages_to_send;
 	uint8_t ret = 0;
-	uint8_t buffer[256] = {0};
-    uint8_t length = 0;
+	uint8_t *buffers[number_if_messages_to_send];
+	uint8_t answer[256];
+	uint16_t acked = 0;
+	uint32_t sent;
+	unsigned int i;
     
-	dprot_master_init_protocol (master_put_char, master_get_char);
+	if (sim_pty)
+	{
+		dprot_master_init_protocol_buf (master_link, master_write_pty, dprot_serial_read_buf, &sim_serial[0]);
+	}
+	else if (sim_per_byte)
+	{
+		dprot_master_init_protocol (master_link, master_put_char, master_get_char);
+	}
+	else
+	{
+		dprot_master_init_protocol_buf (master_link, master_write_buf, master_read_buf, &master_port);
+	}
+	dprot_master_set_window (master_link, sim_window_mode, sim_window_size);
+	dprot_master_set_checking (master_link, sim_checking);
+	dprot_link_set_framing (master_link, sim_framing);
+	sim_set_fec (master_link, NULL);
+	dprot_master_set_clock (master_link, sim_clock_us);
+	if (sim_trace_file) dprot_link_set_trace (master_link, &sim_trace[0]);
+	if (sim_compress && sim_window_mode == DPROT_WINDOW_NONE && !sim_blob_size)
+	{
+		dprot_master_set_compression (master_link, 1);
+		printf("compression %s\n", master_link->compress ? "on" : "refused");
+	}
 	
+	if (sim_blob_size)
+	{
+		// the message layer fragments the blob in both modes
+		for (i = 0; i < number_if_messages_to_send; i++)
+		{
+			ret = dprot_master_send_message (master_link, sim_blob, sim_blob_size);
+			if (ret == DPROT_ACK_ACCEPTED)
+			{
+				sim_delivered_bytes += sim_blob_size;
+			}
+			
+			if (verbose)
+			{
+				printf("%d) Master => blob #%u sent (0x%02x)\n", global_count++, i, ret);
+			}
+		}
+		return NULL;
+	}
+	
+	if (sim_window_mode != DPROT_WINDOW_NONE)
+	{
+		// send all the messages as a single window transfer
+		for (i = 0; i < number_if_messages_to_send; i++)
+		{
+			buffers[i] = sim_messages[i];
+		}
+		
+		// like in stop-and-wait, a message that ran out of retries
+		// is skipped and the transfer goes on with the next one
+		for (i = 0; i < number_if_messages_to_send; i += acked + (ret != DPROT_ACK_ACCEPTED))
+		{
+			ret = dprot_master_send_data_window (master_link, buffers + i, sim_lengths + i, number_if_messages_to_send - i, &acked);
+			for (num_msgs = 0; num_msgs < acked; num_msgs++)
+			{
+				sim_delivered_bytes += sim_lengths[i + num_msgs];
+			}
+			
+			if (verbose)
+			{
+				printf("%d) Master => %u messages acked from #%u (0x%02x)\n", global_count++, acked, i, ret);
+			}
+		}
+		return NULL;
+	}
 	
 	while (num_msgs--)
 	{
-        // generate a random message
-        length = generate_random_message(buffer, 128);
-        
-		printf("%d) Master => sending random message (#%d)...\n", global_count++, number_if_messages_to_send-num_msgs-1);
-		//ret = dprot_master_send_ping ( );
+		i = number_if_messages_to_send-num_msgs-1;
+		
+		if (verbose)
+		{
+			printf("%d) Master => sending random message (#%d)...\n", global_count++, i);
+		}
+		//ret = dprot_master_send_ping (master_link);
         
-		ret = dprot_master_send_data_msg(buffer, length);
+		sent = sim_clock_us ();
+		ret = dprot_master_send_data_msg(master_link, sim_messages[i], sim_lengths[i]);
+		if (ret == DPROT_ACK_ACCEPTED && sim_request)
+		{
+			// the slave echoes the request
+			if (dprot_master_wait_for_data (master_link, answer, sizeof(answer) - 1) == DPROT_NO_ERROR &&
+				answer[1] == sim_lengths[i] && !memcmp (answer + 2, sim_messages[i], sim_lengths[i]))
+			{
+				sim_delivered_bytes += sim_lengths[i];
+				sim_latency[sim_latencies++] = sim_clock_us () - sent;
+			}
+		}
+		else if (ret == DPROT_ACK_ACCEPTED)
+		{
+			sim_delivered_bytes += sim_lengths[i];
+			sim_latency[sim_latencies++] = sim_clock_us () - sent;
+		}
+		
+		if (!verbose) continue;
+		
 		switch (ret)
 		{
 			case DPROT_ACK_ACCEPTED:
-				printf("%d) Master => received ACK (#%d)\n\n", global_count++, number_if_messages_to_send-num_msgs-1);
+				printf("%d) Master => received ACK (#%d)\n\n", global_count++, i);
 				break;
 			case DPROT_NACK_ACCEPTED:
-				printf("%d) Master => received NACK (#%d)\n\n", global_count++, number_if_messages_to_send-num_msgs-1);
+				printf("%d) Master => received NACK (#%d)\n\n", global_count++, i);
 				break;
 			case DPROT_DATA_ERROR:
-				printf("%d) Master => received JUNK (#%d)\n\n", global_count++, number_if_messages_to_send-num_msgs-1);
+				printf("%d) Master => received JUNK (#%d)\n\n", global_count++, i);
 				break;
 			default:
 				break;
 		}
-        
-        usleep(10000);
 	}
-	
-	number_if_messages_to_send = 0;
     
     return NULL;
 }
 
+//===============================================
+// the slave side prints
+unsigned int slave_correct_counter = 0;
+unsigned int slave_incorrect_counter = 0;
+
+void slave_report (uint8_t ret)
+{
+	// the reassembled blob has to be the same
+	if (ret == DPROT_MSG_READY && dprot_slave_message_len (slave_link) == sim_blob_size &&
+		!memcmp (sim_blob_rx, sim_blob, sim_blob_size))
+	{
+		sim_blob_ok++;
+	}
+	
+	if (!verbose) return;
+	
+	switch (ret)
+	{
+		case DPROT_MSG_READY:
+			printf("%d) Slave => got a whole message of %u bytes\n", global_count++, dprot_slave_message_len (slave_link));
+			break;
+		case DPROT_NO_ERROR:
+			printf("%d) Slave => got a proper message (#%u)\n", global_count++, slave_correct_counter++);
+			break;
+		case DPROT_FRAMING_ERROR:
+		case DPROT_DATA_ERROR:
+		case DPROT_LOGICAL_ERROR:
+			printf("%d) Slave => got error message (#%u)\n", global_count++, slave_incorrect_counter++);
+			break;
+		default:
+			break;
+	}
+}
+
+// the request/response slave echoes the data messages
+void slave_answer (dprot_link* link, uint8_t ret, uint8_t* frame)
+{
+	if (sim_request && ret == DPROT_NO_ERROR && (frame[0]&DPROT_TYPE_MASK) == DPROT_TYPE_DATA)
+	{
+		dprot_slave_send_data_msg (link, frame + 2, frame[1]);
+	}
+}
+
+// the frames of the push based slave
+void slave_on_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	dprot_link* link = (dprot_link*)user;
+	uint8_t buffer[256];
+	uint8_t ret = dprot_slave_process_msg (link, frame, len, DPROT_MAX_MSG);
+	
+	slave_answer (link, ret, frame);
+	
+	// a message might release the ones waiting for it
+	while (ret != DPROT_NO_MSG)
+	{
+		slave_report (ret);
+		ret = dprot_slave_reordered_msg (link, buffer, sizeof(buffer));
+	}
+}
+
 void *slave_thread_function( void *ptr )
 {
-	dprot_slave_init_protocol (slave_put_char, slave_get_char);
 	uint8_t buffer[256] = {0};
-	unsigned int correct_counter = 0;
-	unsigned int incorrect_counter = 0;
+	dprot_rx_ctx rx;
+	uint8_t ret;
+	int n;
 	
-	while (number_if_messages_to_send)
+	if (sim_per_byte && !sim_pty)
 	{
-		uint8_t ret = 0;
-		ret = dprot_slave_wait_for_msg (buffer, 255);
+		dprot_slave_init_protocol (slave_link, slave_put_char, slave_get_char);
+		dprot_slave_set_reorder_buffer (slave_link, sim_reorder, sizeof(sim_reorder));
+		dprot_slave_set_window (slave_link, sim_window_mode, sim_window_size);
+		dprot_slave_set_checking (slave_link, sim_checking);
+		dprot_link_set_framing (slave_link, sim_framing);
+		sim_set_fec (slave_link, NULL);
+		dprot_slave_set_message_buffer (slave_link, sim_blob_rx, sim_blob_size);
+		dprot_slave_set_piggyback (slave_link, sim_piggyback, sim_clock_us, DPROT_ACK_DELAY);
+		dprot_slave_set_compression (slave_link, sim_compress);
+		if (sim_trace_file) dprot_link_set_trace (slave_link, &sim_trace[1]);
 		
-		switch (ret)
+		while (sim_running)
 		{
-			case DPROT_NO_ERROR:
-				printf("%d) Slave => got a proper message (#%u)\n", global_count++, correct_counter++);
-				break;
-			case DPROT_FRAMING_ERROR:
-			case DPROT_DATA_ERROR:
-			case DPROT_LOGICAL_ERROR:
-				printf("%d) Slave => got error message (#%u)\n", global_count++, incorrect_counter++);
-				break;
-			default:
-				break;
-		}		
+			ret = dprot_slave_wait_for_msg (slave_link, buffer, sizeof(buffer));
+			slave_answer (slave_link, ret, buffer);
+			slave_report (ret);
+		}
+		return NULL;
+	}
+	
+	// the bulk slave doesn't block - it feeds whatever is on the
+	// line to the receive context and sleeps when there is nothing
+	if (sim_pty)
+	{
+		dprot_slave_init_protocol_buf (slave_link, slave_write_pty, NULL, &sim_serial[1]);
+	}
+	else
+	{
+		dprot_slave_init_protocol_buf (slave_link, slave_write_buf, NULL, &slave_port);
+	}
+	dprot_slave_set_reorder_buffer (slave_link, sim_reorder, sizeof(sim_reorder));
+	dprot_slave_set_window (slave_link, sim_window_mode, sim_window_size);
+	dprot_slave_set_checking (slave_link, sim_checking);
+	dprot_link_set_framing (slave_link, sim_framing);
+	sim_set_fec (slave_link, NULL);
+	dprot_slave_set_message_buffer (slave_link, sim_blob_rx, sim_blob_size);
+	dprot_slave_set_piggyback (slave_link, sim_piggyback, sim_clock_us, DPROT_ACK_DELAY);
+	dprot_slave_set_compression (slave_link, sim_compress);
+	if (sim_trace_file) dprot_link_set_trace (slave_link, &sim_trace[1]);
+	dprot_rx_init (&rx, slave_on_frame, slave_link);
+	dprot_rx_set_checking (&rx, sim_checking);
+	dprot_rx_set_framing (&rx, sim_framing);
+	sim_set_fec (NULL, &rx);
+	
+	while (sim_running && sim_pty)
+	{
+		// the tty read waits in poll() - the timeout keeps the acks going
+		n = dprot_serial_read_buf (&sim_serial[1], buffer, sizeof(buffer), 1);
+		if (n)
+		{
+			dprot_rx_feed (&rx, buffer, n);
+		}
+		else
+		{
+			dprot_slave_poll (slave_link);
+		}
+	}
+	
+	while (sim_running)
+	{
+		n = tsq_pop_n (slave_port.rx, buffer, sizeof(buffer));
+		if (n)
+		{
+			dprot_rx_feed (&rx, buffer, n);
+		}
+		else
+		{
+			// the held back acks are due now and then
+			dprot_slave_poll (slave_link);
+			usleep (100);
+		}
 	}
     
     return NULL;
 }
 
+//===============================================
+// the line buffer counters
+void sim_report_channel (const char* name, ts_queue* q)
+{
+	tsq_stats stats;
+	
+	tsq_get_stats (q, &stats);
+	printf("%s: high water %u of %u bytes, %u bytes dropped, %u waits\n",
+		   name, stats.high_water, tsq_capacity (q), stats.overflows, stats.blocked);
+}
+
+// the impairments of both lines
+void sim_report_impairments (void)
+{
+	printf("line: %llu of %llu bytes corrupted, %llu dropped, %llu duplicated\n",
+		   sim_channel_down.corrupted + sim_channel_up.corrupted, sim_channel_down.bytes + sim_channel_up.bytes,
+		   sim_channel_down.dropped + sim_channel_up.dropped, sim_channel_down.duplicated + sim_channel_up.duplicated);
+}
+
+// the traces of both ends - the first run starts the file
+void sim_dump_traces (void)
+{
+	FILE* out = fopen (sim_trace_file, sim_trace_runs ? "ab" : "wb");
+
+	if (out == NULL || dprot_trace_dump (&sim_trace[0], out) || dprot_trace_dump (&sim_trace[1], out))
+	{
+		perror (sim_trace_file);
+	}
+	else
+	{
+		printf("trace: %u master and %u slave events written to %s\n",
+			   sim_trace[0].head, sim_trace[1].head, sim_trace_file);
+	}
+	if (out) fclose (out);
+	sim_trace_runs++;
+}
+
+// the counters of a link as JSON
+void sim_report_stats (const char* name, dprot_link* link)
+{
+	dprot_stats stats;
+	char json[1024];
+	
+	dprot_link_stats (link, &stats);
+	if (dprot_stats_json (&stats, json, sizeof(json)))
+	{
+		printf("%s stats: %s\n", name, json);
+	}
+}
+
+int sim_compare_latency (const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	
+	return (x > y) - (x < y);
+}
+
+// the round trips of the delivered messages
+void sim_report_latency (void)
+{
+	double sum = 0;
+	unsigned int i;
+	
+	if (sim_latencies == 0) return;
+	
+	qsort (sim_latency, sim_latencies, sizeof(uint32_t), sim_compare_latency);
+	for (i = 0; i < sim_latencies; i++)
+	{
+		sum += sim_latency[i];
+	}
+	printf("latency: mean %.0f us, p50 %u us, p99 %u us, max %u us\n", sum / sim_latencies,
+		   sim_latency[sim_latencies / 2], sim_latency[sim_latencies * 99ul / 100], sim_latency[sim_latencies - 1]);
+}
 
 //===============================================
-int main ()
+// the event loop run - a master thread per link, all the slaves
+// in one thread. the lines are socket pairs, the impairments of
+// a direction are applied by the end writing to it
+typedef struct
 {
-	int ret1, ret2;
+	dprot_serial port;
+	sim_channel line;
+} sim_loop_port;
 
+void loop_write_buf (void* ctx, uint8_t* buf, uint16_t len)
+{
+	sim_loop_port* p = (sim_loop_port*)ctx;
+	uint8_t line[2 * SLIP_TX_BLOCK];
+	
+	dprot_serial_write_buf (&p->port, line, sim_channel_apply (&p->line, buf, len, line));
+}
+
+uint16_t loop_read_buf (void* ctx, uint8_t* buf, uint16_t max, uint16_t to)
+{
+	return dprot_serial_read_buf (&((sim_loop_port*)ctx)->port, buf, max, to);
+}
+
+typedef struct
+{
+	dprot_link* link;
+	sim_loop_port port;
+	pthread_t thread;
+	unsigned long delivered;
+	dprot_loop_master served;
+	dprot_request req;
+	unsigned int next;
+} sim_loop_master;
+
+void *loop_master_function (void *ptr)
+{
+	sim_loop_master* m = (sim_loop_master*)ptr;
+	uint8_t answer[256];
+	unsigned int i;
+	
+	dprot_master_init_protocol_buf (m->link, loop_write_buf, loop_read_buf, &m->port);
+	dprot_master_set_checking (m->link, sim_checking);
+	dprot_link_set_framing (m->link, sim_framing);
+	sim_set_fec (m->link, NULL);
+	dprot_master_set_clock (m->link, sim_clock_us);
+	
+	for (i = 0; i < number_if_messages_to_send; i++)
+	{
+		if (dprot_master_send_data_msg (m->link, sim_messages[i], sim_lengths[i]) != DPROT_ACK_ACCEPTED)
+		{
+			continue;
+		}
+		
+		if (!sim_request ||
+			(dprot_master_wait_for_data (m->link, answer, sizeof(answer) - 1) == DPROT_NO_ERROR &&
+			 answer[1] == sim_lengths[i] && !memcmp (answer + 2, sim_messages[i], sim_lengths[i])))
+		{
+			m->delivered += sim_lengths[i];
+		}
+	}
+	
+	// the slave sees the end of the line
+	shutdown (m->port.port.fd, SHUT_WR);
+	return NULL;
+}
+
+// the asynchronous master sends the next message from the completion
+void loop_master_complete (void* user, dprot_request* req)
+{
+	sim_loop_master* m = (sim_loop_master*)user;
+	
+	if (req->result == DPROT_ACK_ACCEPTED)
+	{
+		m->delivered += sim_lengths[m->next];
+	}
+	
+	if (++m->next < number_if_messages_to_send)
+	{
+		dprot_master_submit_data (m->link, req, sim_messages[m->next], sim_lengths[m->next], loop_master_complete, m);
+	}
+	else if (++sim_async_done == sim_loop_links)
+	{
+		dprot_loop_stop (m->served.loop);
+	}
+}
+
+void loop_on_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	dprot_loop_slave* s = (dprot_loop_slave*)user;
+	uint8_t ret = dprot_slave_process_msg (s->link, frame, len, DPROT_MAX_MSG);
+	
+	slave_answer (s->link, ret, frame);
+}
+
+void *loop_thread_function (void *ptr)
+{
+	dprot_loop* loop = (dprot_loop*)ptr;
+	struct timespec cpu, cpu_end;
+	
+	// the cpu time of this thread only
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu);
+	dprot_loop_run (loop);
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+	sim_loop_cpu = (cpu_end.tv_sec - cpu.tv_sec) + (cpu_end.tv_nsec - cpu.tv_nsec) * 1e-9;
+	return NULL;
+}
+
+double run_loop_simulation (void)
+{
+	unsigned int count = sim_loop_links;
+	dprot_link* links = calloc (2 * count, sizeof(dprot_link));
+	sim_loop_master* masters = calloc (count, sizeof(sim_loop_master));
+	dprot_loop_slave* slaves = calloc (count, sizeof(dprot_loop_slave));
+	sim_loop_port* slave_ports = calloc (count, sizeof(sim_loop_port));
+	dprot_timer** heap = calloc (2 * count, sizeof(dprot_timer*));
+	dprot_link_pool pool;
+	dprot_loop loop;
+	pthread_t loop_thread;
+	struct timeval start, end;
+	unsigned long delivered = 0;
+	unsigned long long bytes = 0, corrupted = 0, dropped = 0, duplicated = 0;
+	double elapsed;
+	int fds[2];
+	unsigned int i;
+	
+	dprot_link_pool_init (&pool, links, 2 * count);
+	if (dprot_loop_init (&loop, sim_clock_us, heap, 2 * count) != 0)
+	{
+		perror ("epoll");
+		exit(1);
+	}
+	
+	for (i = 0; i < count; i++)
+	{
+		if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+		{
+			perror ("socketpair");
+			exit(1);
+		}
+		masters[i].port.port.fd = fds[0];
+		masters[i].link = dprot_link_alloc (&pool);
+		slave_ports[i].port.fd = fds[1];
+		sim_channel_init (&masters[i].port.line, &sim_model_down, (sim_seed + i) * 2);
+		sim_channel_init (&slave_ports[i].line, &sim_model_up, (sim_seed + i) * 2 + 1);
+		
+		dprot_slave_init_protocol_buf (&links[count + i], loop_write_buf, NULL, &slave_ports[i]);
+		dprot_slave_set_checking (&links[count + i], sim_checking);
+		dprot_link_set_framing (&links[count + i], sim_framing);
+		sim_set_fec (&links[count + i], NULL);
+		dprot_slave_set_piggyback (&links[count + i], sim_piggyback, sim_clock_us, DPROT_ACK_DELAY);
+		dprot_loop_add_slave (&slaves[i], &loop, &links[count + i], &slave_ports[i].port, loop_on_frame);
+		
+		if (sim_async)
+		{
+			dprot_master_init_protocol_buf (masters[i].link, loop_write_buf, NULL, &masters[i].port);
+			dprot_master_set_checking (masters[i].link, sim_checking);
+			dprot_link_set_framing (masters[i].link, sim_framing);
+			sim_set_fec (masters[i].link, NULL);
+			dprot_master_set_clock (masters[i].link, sim_clock_us);
+			dprot_loop_add_master (&masters[i].served, &loop, masters[i].link, &masters[i].port.port);
+		}
+	}
+	
+	gettimeofday (&start, NULL);
+	if (sim_async)
+	{
+		// every link starts with its first message, the completions
+		// send the rest - a single thread does it all
+		sim_async_done = 0;
+		for (i = 0; i < count; i++)
+		{
+			dprot_master_submit_data (masters[i].link, &masters[i].req, sim_messages[0], sim_lengths[0],
+									  loop_master_complete, &masters[i]);
+			dprot_loop_master_update (&masters[i].served);
+		}
+		loop_thread_function (&loop);
+	}
+	else
+	{
+		pthread_create (&loop_thread, NULL, loop_thread_function, &loop);
+		for (i = 0; i < count; i++)
+		{
+			pthread_create (&masters[i].thread, NULL, loop_master_function, &masters[i]);
+		}
+		
+		for (i = 0; i < count; i++)
+		{
+			pthread_join (masters[i].thread, NULL);
+		}
+		dprot_loop_stop (&loop);
+		pthread_join (loop_thread, NULL);
+	}
+	gettimeofday (&end, NULL);
+	
+	for (i = 0; i < count; i++)
+	{
+		delivered += masters[i].delivered;
+		if (sim_async) dprot_loop_remove_master (&masters[i].served);
+		dprot_loop_remove_slave (&slaves[i]);
+		close (masters[i].port.port.fd);
+		close (slave_ports[i].port.fd);
+		bytes += masters[i].port.line.bytes + slave_ports[i].line.bytes;
+		corrupted += masters[i].port.line.corrupted + slave_ports[i].line.corrupted;
+		dropped += masters[i].port.line.dropped + slave_ports[i].line.dropped;
+		duplicated += masters[i].port.line.duplicated + slave_ports[i].line.duplicated;
+	}
+	
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+	printf("event loop: %u %slinks%s, %lu bytes delivered in %.3f sec, goodput %.1f bytes/sec\n",
+		   count, sim_async ? "asynchronous " : "", sim_piggyback ? " (piggybacked acks)" : "", delivered, elapsed, delivered / elapsed);
+	printf("event loop: %u wakeups, %u events, %u timers, cpu %.3f sec (%.1f%%)\n",
+		   loop.wakeups, loop.events, loop.fired, sim_loop_cpu, sim_loop_cpu * 100 / elapsed);
+	printf("line: %llu of %llu bytes corrupted, %llu dropped, %llu duplicated\n", corrupted, bytes, dropped, duplicated);
+	
+	dprot_loop_close (&loop);
+	free (links);
+	free (masters);
+	free (slaves);
+	free (slave_ports);
+	free (heap);
+	
+	return delivered / elapsed;
+}
+
+//===============================================
+// A single simulation run - returns the goodput [bytes/sec]
+double run_simulation (uint8_t mode, uint8_t size)
+{
+	struct timeval start, end;
+	double elapsed;
+
+	sim_window_mode = mode;
+	sim_window_size = size;
+	sim_delivered_bytes = 0;
+	sim_blob_ok = 0;
+	sim_master_ends = 0;
+	sim_slave_ends = 0;
+	sim_slave_lost = 0;
+	sim_latencies = 0;
+	sim_running = 1;
+	
+	// the same impairments in every run
+	sim_channel_init (&sim_channel_down, &sim_model_down, sim_seed * 2);
+	sim_channel_init (&sim_channel_up, &sim_model_up, sim_seed * 2 + 1);
+	sim_up_held_len = 0;
+	
+	// both ends of the line
+	master_link = dprot_link_alloc (&sim_pool);
+	slave_link = dprot_link_alloc (&sim_pool);
+	
+	if (sim_trace_file)
+	{
+		dprot_trace_init (&sim_trace[0], sim_trace_records, SIM_TRACE_RECORDS, sim_trace_runs * 2);
+		dprot_trace_init (&sim_trace[1], sim_trace_records + SIM_TRACE_RECORDS, SIM_TRACE_RECORDS, sim_trace_runs * 2 + 1);
+	}
+	
 	// create the channels
-	in_channel = tsq_create();
-	out_channel = tsq_create();
+	in_channel = tsq_create(SIM_MASTER_RX_BUFFER);
+	out_channel = tsq_create(TSQ_DEFAULT_SIZE);
+	
+	// the master waits for the slave, the slave's answers get
+	// lost when the master doesn't read them (and are counted).
+	// the master's side buffers whole answers, like a tty does
+	tsq_set_mode (out_channel, TSQ_MODE_BLOCK);
+	tsq_set_mode (in_channel, TSQ_MODE_FAIL);
+	master_port.rx = in_channel;
+	master_port.tx = out_channel;
+	slave_port.rx = out_channel;
+	slave_port.tx = in_channel;
+	
+	if (sim_pty && dprot_serial_open_pty (&sim_serial[0], &sim_serial[1], 115200) != 0)
+	{
+		perror ("openpty");
+		exit(1);
+	}
 
+	gettimeofday (&start, NULL);
+	
 	// create the threads
-	ret1 = pthread_create( &slave_thread, NULL, slave_thread_function, NULL);
-	ret2 = pthread_create( &master_thread, NULL, master_thread_function, NULL);
+	pthread_create( &slave_thread, NULL, slave_thread_function, NULL);
+	pthread_create( &master_thread, NULL, master_thread_function, NULL);
 	
-	// wait for join
+	// wait for the master to finish and stop the slave
 	pthread_join( master_thread, NULL);
+	gettimeofday (&end, NULL);
+	sim_running = 0;
 	pthread_join( slave_thread, NULL);
+	
+	printf("master link: rtt %u us, rto %u us\n", dprot_master_get_rtt (master_link), dprot_master_get_rto (master_link));
+	sim_report_stats ("master", master_link);
+	sim_report_stats ("slave", slave_link);
+	if (sim_trace_file)
+	{
+		sim_dump_traces ();
+	}
+	
+	dprot_link_free (&sim_pool, slave_link);
+	dprot_link_free (&sim_pool, master_link);
+
+	if (sim_pty)
+	{
+		dprot_serial_close (&sim_serial[0]);
+		dprot_serial_close (&sim_serial[1]);
+	}
+	else
+	{
+		sim_report_channel ("master -> slave", out_channel);
+		sim_report_channel ("slave -> master", in_channel);
+		if (sim_slave_lost)
+		{
+			printf("slave -> master: %lu bytes lost on a full line\n", sim_slave_lost);
+		}
+		sim_report_impairments ();
+	}
 
 	// delete the channels
 	tsq_delete (in_channel);
 	tsq_delete (out_channel);
+	
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+	printf("%s%s: %lu bytes delivered in %.3f sec, goodput %.1f bytes/sec\n",
+		   mode == DPROT_WINDOW_GBN ? "go-back-n" : mode == DPROT_WINDOW_SR ? "selective-repeat" : "stop-and-wait",
+		   sim_piggyback ? " (piggybacked acks)" : "",
+		   sim_delivered_bytes, elapsed, sim_delivered_bytes / elapsed);
+	if (sim_request)
+	{
+		printf("%lu frames on the line, %.2f per request\n", (sim_master_ends + sim_slave_ends) / 2,
+			   (sim_master_ends + sim_slave_ends) / 2.0 / number_if_messages_to_send);
+	}
+	else if (!sim_blob_size)
+	{
+		printf("%.3f retransmissions per message\n", sim_master_ends / 2.0 / number_if_messages_to_send - 1);
+	}
+	sim_report_latency ();
+	if (sim_blob_size)
+	{
+		printf("%u of %u messages reassembled correctly\n", sim_blob_ok, number_if_messages_to_send);
+	}
+	
+	return sim_delivered_bytes / elapsed;
+}
 
-	printf("Both threads returned.\n");
-	exit(0);
+//===============================================
+// The links in virtual time - the same seed, the same run
+void des_run (sim_des_result* res)
+{
+	sim_des_config cfg;
+
+	cfg.links = sim_loop_links ? sim_loop_links : 1;
+	cfg.messages = number_if_messages_to_send;
+	cfg.data = sim_messages;
+	cfg.lengths = sim_lengths;
+	cfg.baud = sim_baud;
+	cfg.seed = sim_seed;
+	cfg.down = &sim_model_down;
+	cfg.up = &sim_model_up;
+	cfg.checking = sim_checking;
+	cfg.framing = sim_framing;
+	cfg.fec = sim_fec;
+	cfg.request = sim_request;
+	cfg.piggyback = sim_piggyback;
+
+	if (sim_des_run (&cfg, res) != 0)
+	{
+		perror ("sim_des_run");
+		exit(1);
+	}
+}
+
+double run_des_simulation (void)
+{
+	sim_des_result res;
+	unsigned int links = sim_loop_links ? sim_loop_links : 1;
+	char model[160];
+	double elapsed;
+
+	des_run (&res);
+
+	elapsed = res.virtual_ns * 1e-9;
+	sim_channel_format (&sim_model_down, model, sizeof(model));
+	printf("des: %u links at %u baud, seed %lu, line %s: %lu events in %.3f sec (%.0f events/sec)\n",
+		   links, sim_baud, sim_seed, model, (unsigned long)res.events, res.wall_sec, res.events / res.wall_sec);
+	printf("%lu acked, %lu failed", (unsigned long)res.acked, (unsigned long)res.failed);
+	if (sim_request)
+	{
+		printf(", %lu answered, %lu frames on the line, %.2f per request", (unsigned long)res.answered,
+			   (unsigned long)res.frames, (double)res.frames / number_if_messages_to_send / links);
+	}
+	printf("\n%.3f retransmissions per message\n", (double)res.retransmissions / number_if_messages_to_send / links);
+	printf("line: %llu bytes corrupted, %llu dropped, %llu duplicated\n", res.corrupted, res.dropped, res.duplicated);
+	if (sim_fec)
+	{
+		printf("fec: %llu bytes corrected, %llu frames beyond repair\n", res.fec_corrected, res.fec_failed);
+	}
+	printf("latency: mean %.0f us, p50 %u us, p99 %u us, max %u us\n",
+		   res.latency_mean, res.latency_p50, res.latency_p99, res.latency_max);
+	printf("digest %016llx\n", res.digest);
+	printf("stop-and-wait%s: %lu bytes delivered in %.3f virtual sec, goodput %.1f bytes/sec\n",
+		   sim_piggyback ? " (piggybacked acks)" : "",
+		   (unsigned long)res.delivered, elapsed, res.delivered / elapsed);
+
+	return res.delivered / elapsed;
+}
+
+// Every preset model on both lines, one after the other
+void run_channel_sweep (void)
+{
+	const sim_channel_preset* preset;
+	sim_des_result res;
+	unsigned long messages = number_if_messages_to_send * (unsigned long)(sim_loop_links ? sim_loop_links : 1);
+
+	printf("%-8s %12s %10s %10s %10s %10s\n", "model", "goodput B/s", "retrans", "mean us", "p50 us", "p99 us");
+	for (preset = sim_channel_presets; preset->name; preset++)
+	{
+		sim_channel_parse (&sim_model_down, preset->name);
+		sim_channel_parse (&sim_model_up, preset->name);
+		des_run (&res);
+
+		printf("%-8s %12.1f %10.3f %10.0f %10u %10u  %s\n", preset->name, res.delivered / (res.virtual_ns * 1e-9),
+			   (double)res.retransmissions / messages, res.latency_mean, res.latency_p50, res.latency_p99,
+			   preset->desc);
+	}
+}
+
+//===============================================
+// The grid of the parameters - every point in virtual time,
+// all the cpus at once
+int run_sweep (void)
+{
+	sim_sweep_config cfg;
+	sim_sweep_point* points;
+	sim_sweep_stats stats;
+
+	memset (&cfg, 0, sizeof(cfg));
+	cfg.ber[0] = sim_model_down.ber;
+	cfg.bers = 1;
+	cfg.size[0] = 64;
+	cfg.sizes = 1;
+	cfg.retries[0] = DPROT_MASTER_NUM_RETRIES;
+	cfg.retry_counts = 1;
+	cfg.fec[0] = sim_fec;
+	cfg.fecs = 1;
+	cfg.runs = 8;
+	cfg.links = sim_loop_links ? sim_loop_links : 1;
+	cfg.messages = number_if_messages_to_send;
+	cfg.baud = sim_baud;
+	cfg.seed = sim_seed;
+	cfg.checking = sim_checking;
+	cfg.framing = sim_framing;
+	cfg.model = &sim_model_down;
+	cfg.workers = sim_sweep_workers;
+
+	if (sim_sweep_parse (&cfg, sim_sweep_grid) != 0)
+	{
+		fprintf(stderr, "bad sweep grid '%s'\n", sim_sweep_grid);
+		return -1;
+	}
+
+	points = malloc (sim_sweep_points (&cfg) * sizeof(sim_sweep_point));
+	if (points == NULL || sim_sweep_run (&cfg, points, &stats) != 0)
+	{
+		perror ("sim_sweep_run");
+		free (points);
+		return -1;
+	}
+
+	sim_sweep_write (stdout, &cfg, points, sim_sweep_json);
+	fprintf(stderr, "sweep: %u points x %u runs of %u links x %u messages, %u workers, %u steals: "
+			"%llu events in %.3f sec (%.0f events/sec)\n",
+			sim_sweep_points (&cfg), cfg.runs, cfg.links, cfg.messages, stats.workers, stats.steals,
+			stats.events, stats.wall_sec, stats.events / stats.wall_sec);
+
+	free (points);
+	return 0;
+}
+
+//===============================================
+void usage (char* name)
+{
+	int i;
+	
+	printf("usage: %s [-n messages] [-m none|gbn|sr] [-w window] [-e ber] [-f bytes]\n", name);
+	printf("          [-c crc8|chs8|xor8|crc16|crc32c] [-r] [-p] [-t] [-l links [-a]] [-q]\n");
+	printf("          [-d [-b baud]] [-s seed] [-i model|all] [-S grid [-j workers] [-J]]\n");
+	printf("          [-T file] [-z] [-F slip|cobs] [-E parity]\n");
+	printf("  -m  ARQ mode; a window mode is compared against stop-and-wait\n");
+	printf("      (the '-r', '-l' and '-d' runs are stop-and-wait only)\n");
+	printf("  -f  send 'bytes' long fragmented messages instead of single frames\n");
+	printf("  -c  the checking of the frames\n");
+	printf("  -F  the framing of the lines - SLIP byte stuffing or COBS\n");
+	printf("  -E  Reed-Solomon FEC - 'parity' bytes (up to %u) in every 255 byte\n", RS_MAX_PARITY);
+	printf("      block of a frame correct half as many bytes (rs.h)\n");
+	printf("  -r  request/response - the slave answers every message, acked\n");
+	printf("      separately and piggybacked on the answer are compared\n");
+	printf("  -p  per-byte transport functions instead of the bulk ones\n");
+	printf("  -t  a pseudo terminal pair as the line (no bit errors, bulk only)\n");
+	printf("  -l  'links' stop-and-wait links over socket pairs, all the slaves\n");
+	printf("      served by a single event loop thread\n");
+	printf("  -a  the masters of '-l' in the loop thread too (asynchronous requests)\n");
+	printf("  -d  discrete event simulation in virtual time ('-l' links, deterministic)\n");
+	printf("  -b  the baud rate of the '-d' lines (115200)\n");
+	printf("  -s  the seed of the messages and the impairments (1)\n");
+	printf("  -i  the impairments of both lines - presets and key=value pairs, e.g.\n");
+	printf("      'burst,delay=2000' (keys ber p r bad drop dup delay jitter baud);\n");
+	printf("      the timing ones need '-d'. 'all' compares the presets in '-d'\n");
+	printf("      presets:");
+	for (i = 0; sim_channel_presets[i].name; i++)
+	{
+		printf(" %s", sim_channel_presets[i].name);
+	}
+	printf("\n");
+	printf("  -S  a parallel sweep of '-d' runs over a grid of 'key=v1,v2,...' lists\n");
+	printf("      separated by ';' - ber, size (up to 128), retries, fec (the parity\n");
+	printf("      bytes) and runs (per point), e.g.\n");
+	printf("      'ber=1e-4,1e-3;size=16,64,128;retries=3,5;fec=0,8;runs=16'.\n");
+	printf("      a run is '-l' links of '-n' messages each; CSV on stdout\n");
+	printf("  -j  the worker threads of '-S' (one per cpu)\n");
+	printf("  -J  JSON lines instead of CSV\n");
+	printf("  -z  compressed stop-and-wait frames (lzss.h) and telemetry records\n");
+	printf("      instead of random messages - the threaded runs only, the\n");
+	printf("      asynchronous requests of '-d', '-l' and '-S' aren't compressed\n");
+	printf("  -T  binary event traces of both ends of the threaded runs to 'file'\n");
+	printf("      (dprot_trace.h), the last %u events of each\n", SIM_TRACE_RECORDS);
+	printf("  -q  quiet - no per message prints\n");
 }
 
+//===============================================
+int main (int argc, char** argv)
+{
+	int opt;
+	unsigned int i;
+	unsigned long fec = 0;
+	char* end;
+	double saw_goodput, window_goodput;
+	uint8_t window_mode = DPROT_WINDOW_NONE;
+	unsigned int window_size = sim_window_size;
+	
+	while ((opt = getopt (argc, argv, "n:m:w:e:f:c:F:E:l:b:s:i:S:j:T:Jdarptzqh")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': number_if_messages_to_send = atoi (optarg); break;
+			case 'w': window_size = atoi (optarg); break;
+			case 'e': out_channel_ber = atof (optarg); sim_ber_given = 1; break;
+			case 'i': sim_model_spec = optarg; break;
+			case 'S': sim_sweep_grid = optarg; break;
+			case 'j': sim_sweep_workers = atoi (optarg); break;
+			case 'J': sim_sweep_json = 1; break;
+			case 'T': sim_trace_file = optarg; break;
+			case 'q': verbose = 0; break;
+			case 'p': sim_per_byte = 1; break;
+			case 't': sim_pty = 1; break;
+			case 'l': sim_loop_links = atoi (optarg); break;
+			case 'a': sim_async = 1; break;
+			case 'd': sim_des = 1; break;
+			case 'b': sim_baud = strtoul (optarg, NULL, 0); break;
+			case 's': sim_seed = strtoul (optarg, NULL, 0); break;
+			case 'r': sim_request = 1; break;
+			case 'z': sim_compress = 1; break;
+			case 'E':
+				fec = strtoul (optarg, &end, 0);
+				if (end == optarg || *end) fec = RS_MAX_PARITY + 1;
+				break;
+			case 'F':
+				if (!strcmp (optarg, "slip")) sim_framing = SLIP_FRAMING_SLIP;
+				else if (!strcmp (optarg, "cobs")) sim_framing = SLIP_FRAMING_COBS;
+				else
+				{
+					usage (argv[0]);
+					exit(1);
+				}
+				break;
+			case 'f': sim_blob_size = strtoul (optarg, NULL, 0); break;
+			case 'c':
+				if (!strcmp (optarg, "chs8")) sim_checking = CHECKING_CHS8;
+				else if (!strcmp (optarg, "xor8")) sim_checking = CHECKING_XOR8;
+				else if (!strcmp (optarg, "crc16")) sim_checking = CHECKING_CRC16;
+				else if (!strcmp (optarg, "crc32c")) sim_checking = CHECKING_CRC32C;
+				else sim_checking = CHECKING_CRC8;
+				break;
+			case 'm':
+				if (!strcmp (optarg, "gbn")) window_mode = DPROT_WINDOW_GBN;
+				else if (!strcmp (optarg, "sr")) window_mode = DPROT_WINDOW_SR;
+				else if (!strcmp (optarg, "none")) window_mode = DPROT_WINDOW_NONE;
+				else
+				{
+					usage (argv[0]);
+					exit(1);
+				}
+				break;
+			default:
+				usage (argv[0]);
+				exit(1);
+		}
+	}
+	
+	// (the loop, the des and the request masters are stop-and-wait)
+	if (window_size == 0 || window_size > DPROT_WINDOW_MAX ||
+		(window_mode != DPROT_WINDOW_NONE && (sim_des || sim_loop_links || sim_request)) ||
+		number_if_messages_to_send == 0 || number_if_messages_to_send > 65535 || sim_baud == 0 ||
+		(sim_compress && (sim_des || sim_loop_links || sim_sweep_grid)) || fec > RS_MAX_PARITY)
+	{
+		usage (argv[0]);
+		exit(1);
+	}
+	sim_fec = (uint8_t)fec;
+	
+	// the impairments - '-e' alone is the old byte error model
+	if (sim_model_spec == NULL)
+	{
+		sim_model_down.ber = out_channel_ber;
+		sim_model_up.ber = in_channel_ber;
+	}
+	else if (strcmp (sim_model_spec, "all") &&
+			 (sim_channel_parse (&sim_model_down, sim_model_spec) || sim_channel_parse (&sim_model_up, sim_model_spec)))
+	{
+		printf("unknown line model '%s'\n", sim_model_spec);
+		usage (argv[0]);
+		exit(1);
+	}
+	else if (sim_ber_given)
+	{
+		sim_model_down.ber = out_channel_ber;
+	}
+	
+	if (sim_sweep_grid)
+	{
+		exit (run_sweep () ? 1 : 0);
+	}
+	
+	// the same random messages are sent in each run
+	srand ((unsigned int)sim_seed);
+	sim_messages = malloc (number_if_messages_to_send * sizeof(*sim_messages));
+	sim_lengths = malloc (number_if_messages_to_send);
+	for (i = 0; i < number_if_messages_to_send; i++)
+	{
+		sim_lengths[i] = sim_compress ? generate_telemetry_message(sim_messages[i], 128) :
+			generate_random_message(sim_messages[i], 128);
+	}
+	
+	sim_blob = malloc (sim_blob_size + 1);
+	sim_blob_rx = malloc (sim_blob_size + 1);
+	for (i = 0; i < sim_blob_size; i++)
+	{
+		sim_blob[i] = (uint8_t)(drandom()*256);
+	}
+	
+	dprot_link_pool_init (&sim_pool, sim_links, 2);
+	if (sim_trace_file)
+	{
+		sim_trace_records = malloc (2 * SIM_TRACE_RECORDS * sizeof(dprot_trace_record));
+	}
+	sim_latency = malloc (number_if_messages_to_send * sizeof(uint32_t));
+	
+	if (sim_model_spec && !strcmp (sim_model_spec, "all"))
+	{
+		// (the impairments of the presets are timed in virtual time)
+		run_channel_sweep ();
+		exit(0);
+	}
+	
+	saw_goodput = sim_des ? run_des_simulation () :
+		sim_loop_links ? run_loop_simulation () : run_simulation (DPROT_WINDOW_NONE, 1);
+	
+	if (sim_request)
+	{
+		// the answers are stop-and-wait
+		sim_piggyback = 1;
+		window_goodput = sim_des ? run_des_simulation () :
+			sim_loop_links ? run_loop_simulation () : run_simulation (DPROT_WINDOW_NONE, 1);
+		printf("goodput gain of the piggybacked acks: x%.2f\n", window_goodput / saw_goodput);
+	}
+	else if (window_mode != DPROT_WINDOW_NONE)
+	{
+		// 'run_simulation' keeps the size of the last run
+		window_goodput = run_simulation (window_mode, (uint8_t)window_size);
+		printf("goodput gain against stop-and-wait: x%.2f\n", window_goodput / saw_goodput);
+	}
+	
+	free (sim_messages);
+	free (sim_lengths);
+	free (sim_blob);
+	free (sim_blob_rx);
+	free (sim_latency);
+	free (sim_trace_records);
 
+	if (!sim_des && !sim_loop_links)
+	{
+		printf("Both threads returned.\n");
+	}
+	exit(0);
+}
@@ -0,0 +1,201 @@
+#include <string.h>
+#include "rs.h"
+#include "rs_tables.h"
+
+/****************************************************/
+uint8_t rs_init (rs_code* rs, uint8_t nroots)
+{
+	uint8_t g[RS_MAX_PARITY + 1];
+	uint8_t i, k;
+
+	if (nroots == 0 || nroots > RS_MAX_PARITY)
+	{
+		return 1;
+	}
+
+	// the product of (x + alpha^i), g[k] is the coefficient of x^k
+	memset (g, 0, sizeof(g));
+	g[0] = 1;
+	for (i = 0; i < nroots; i++)
+	{
+		for (k = i + 1; k > 0; k--)
+		{
+			g[k] = g[k - 1] ^ rs_exp[rs_log[g[k]] + i];
+		}
+		g[0] = rs_exp[rs_log[g[0]] + i];
+	}
+
+	// the encoder runs from the highest power down (g[nroots] is 1)
+	rs->nroots = nroots;
+	for (i = 0; i < nroots; i++)
+	{
+		rs->genlog[i] = rs_log[g[nroots - 1 - i]];
+	}
+	return 0;
+}
+
+/****************************************************/
+void rs_encode (const rs_code* rs, uint8_t* parity, const uint8_t* data, uint16_t len)
+{
+	uint8_t n = rs->nroots - 1;
+	uint16_t fb;
+	uint8_t j;
+
+	// the remainder of a division by the generator - a byte in,
+	// the register shifts and the feedback times the generator
+	// is added (a zero feedback adds zeros)
+	while (len--)
+	{
+		fb = rs_log[*data++ ^ parity[0]];
+		for (j = 0; j < n; j++)
+		{
+			parity[j] = parity[j + 1] ^ rs_exp[fb + rs->genlog[j]];
+		}
+		parity[n] = rs_exp[fb + rs->genlog[n]];
+	}
+}
+
+/****************************************************/
+int rs_decode (const rs_code* rs, uint8_t* block, uint16_t len)
+{
+	uint8_t s[RS_MAX_PARITY];
+	uint8_t lambda[RS_MAX_PARITY + 1];
+	uint8_t b[RS_MAX_PARITY + 1];
+	uint8_t t[RS_MAX_PARITY + 1];
+	uint8_t omega[RS_MAX_PARITY];
+	uint8_t value[RS_MAX_PARITY];
+	uint8_t loc[RS_MAX_PARITY];
+	uint8_t nroots = rs->nroots;
+	uint8_t d, bd, num, den, v, any;
+	uint16_t i, j, k, e, step, p, q;
+	uint16_t count, L, m;
+
+	if (len <= nroots || len > RS_BLOCK)
+	{
+		return -1;
+	}
+
+	// the syndromes - the block at alpha^i (Horner, the first
+	// byte is the highest power)
+	memset (s, 0, nroots);
+	for (k = 0; k < len; k++)
+	{
+		for (i = 0; i < nroots; i++)
+		{
+			s[i] = rs_exp[rs_log[s[i]] + i] ^ block[k];
+		}
+	}
+	for (any = 0, i = 0; i < nroots; i++)
+	{
+		any |= s[i];
+	}
+	if (!any)
+	{
+		return 0;
+	}
+
+	// Berlekamp-Massey - the error locator 'lambda' of degree 'L'
+	memset (lambda, 0, sizeof(lambda));
+	memset (b, 0, sizeof(b));
+	lambda[0] = b[0] = 1;
+	L = 0;
+	m = 1;
+	bd = 1;
+	for (k = 0; k < nroots; k++)
+	{
+		d = s[k];
+		for (i = 1; i <= L; i++)
+		{
+			d ^= rs_exp[rs_log[lambda[i]] + rs_log[s[k - i]]];
+		}
+		if (d == 0)
+		{
+			m++;
+			continue;
+		}
+
+		// lambda -= d / bd * x^m * b
+		memcpy (t, lambda, sizeof(t));
+		p = (rs_log[d] + 255 - rs_log[bd]) % 255;
+		for (i = 0; i + m <= nroots; i++)
+		{
+			lambda[i + m] ^= rs_exp[p + rs_log[b[i]]];
+		}
+
+		if (2 * L <= k)
+		{
+			L = k + 1 - L;
+			memcpy (b, t, sizeof(b));
+			bd = d;
+			m = 1;
+		}
+		else
+		{
+			m++;
+		}
+	}
+	if (2 * L > nroots)
+	{
+		return -1;
+	}
+
+	// omega = s * lambda mod x^nroots - the error values
+	for (i = 0; i < nroots; i++)
+	{
+		omega[i] = 0;
+		for (j = 0; j <= i && j <= L; j++)
+		{
+			omega[i] ^= rs_exp[rs_log[lambda[j]] + rs_log[s[i - j]]];
+		}
+	}
+
+	// Chien search - the byte 'k' is the power 'e', wrong if
+	// lambda(alpha^-e) is 0. Forney gives its value
+	for (count = 0, k = 0; k < len; k++)
+	{
+		e = len - 1 - k;
+		step = (255 - e) % 255;
+
+		for (v = 0, p = 0, i = 0; i <= L; i++, p = (p + step) % 255)
+		{
+			v ^= rs_exp[rs_log[lambda[i]] + p];
+		}
+		if (v)
+		{
+			continue;
+		}
+		if (count == L)
+		{
+			return -1;
+		}
+
+		// omega(x^-1) / lambda'(x^-1), lambda' has the odd powers
+		for (num = 0, p = 0, i = 0; i < nroots; i++, p = (p + step) % 255)
+		{
+			num ^= rs_exp[rs_log[omega[i]] + p];
+		}
+		for (den = 0, q = 0, i = 1; i <= L; i += 2, q = (q + 2 * step) % 255)
+		{
+			den ^= rs_exp[rs_log[lambda[i]] + q];
+		}
+		if (den == 0)
+		{
+			return -1;
+		}
+
+		loc[count] = (uint8_t)k;
+		value[count++] = num ? rs_exp[(rs_log[num] + e + 255 - rs_log[den]) % 255] : 0;
+	}
+
+	// the roots are all in the block - otherwise it's beyond repair
+	if (count != L)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		block[loc[i]] ^= value[i];
+	}
+	return count;
+}
@@ -0,0 +1,78 @@
+#ifndef __RS_H__
+#define __RS_H__
+
+#include "spec_types.h"
+
+/*! \file rs.h
+ * \brief A Reed-Solomon codec over GF(256)
+ *
+ * Systematic codes of 'nroots' parity bytes - a block of up to
+ * 255 - nroots data bytes is followed by its parity, and up to
+ * nroots / 2 wrong bytes anywhere in the block are corrected.
+ * Shorter blocks are shortened codes (the missing data bytes
+ * are zeros). The roots of the generator are alpha^0 ..
+ * alpha^(nroots-1) of x^8+x^4+x^3+x^2+1.
+ *
+ * The arithmetic is table driven (rs_tables.h, 1.5 KB) - a
+ * multiplication is a sum of two logs, no branches. Encoding
+ * costs 'nroots' lookups a byte and can be done piece by piece,
+ * a block without errors is checked by its syndromes only.
+ */
+
+/*! \def RS_MAX_PARITY
+ * \brief The most parity bytes of a code - 16 corrected bytes
+ */
+#define RS_MAX_PARITY		32
+
+/*! \def RS_BLOCK
+ * \brief The longest block - data and parity
+ */
+#define RS_BLOCK			255
+
+/*********************************************************/
+/*! \struct rs_code
+ * \brief A code - the generator polynomial
+ */
+typedef struct
+{
+	uint8_t nroots;                     /**< the parity bytes */
+	uint16_t genlog[RS_MAX_PARITY];     /**< the logs of the generator, the highest power first */
+} rs_code;
+
+/*********************************************************/
+
+/*!
+ * \brief Builds a code
+ *
+ * \param rs the code
+ * \param nroots the parity bytes, 1 to RS_MAX_PARITY
+ *
+ * \return 0 on success, 1 on a bad 'nroots'
+ */
+uint8_t rs_init (rs_code* rs, uint8_t nroots);
+
+/*!
+ * \brief Adds data bytes to the parity of a block
+ * The parity starts zeroed, the pieces of a block are added
+ * in their order - then the parity follows them.
+ *
+ * \param rs the code
+ * \param parity 'nroots' bytes
+ * \param data the data bytes
+ * \param len their number - up to 255 - nroots in all the pieces
+ */
+void rs_encode (const rs_code* rs, uint8_t* parity, const uint8_t* data, uint16_t len);
+
+/*!
+ * \brief Corrects a block in place
+ *
+ * \param rs the code
+ * \param block the data and the parity bytes
+ * \param len their number - nroots + 1 to RS_BLOCK
+ *
+ * \return the number of the corrected bytes, -1 if there are too
+ * many errors (the block is left as it is)
+ */
+int rs_decode (const rs_code* rs, uint8_t* block, uint16_t len);
+
+#endif //__RS_H__
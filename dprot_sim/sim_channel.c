@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sim_channel.h"
+
+const sim_channel_preset sim_channel_presets[] =
+{
+	{ "clean",  "",                                   "no impairments" },
+	{ "bsc",    "ber=0.001",                          "independent byte errors" },
+	{ "burst",  "p=0.0005,r=0.05,bad=0.3",            "Gilbert-Elliott bursts of ~20 bytes" },
+	{ "drop",   "drop=0.0005",                        "lost bytes (overruns)" },
+	{ "dup",    "dup=0.0005",                         "duplicated bytes (glitches)" },
+	{ "delay",  "delay=5000,jitter=2000",             "a modem/radio latency" },
+	{ "slow",   "baud=9600",                          "a 9600 baud line" },
+	{ "field",  "ber=0.0001,p=0.0002,r=0.05,bad=0.3,drop=0.0001,delay=2000,jitter=1000",
+	  "all of them, a bit of each" },
+	{ NULL, NULL, NULL }
+};
+
+//===============================================
+static int sim_channel_set (sim_channel_model* model, const char* key, const char* value)
+{
+	double v = atof (value);
+
+	if (!strcmp (key, "ber")) model->ber = v;
+	else if (!strcmp (key, "p")) model->ge_p = v;
+	else if (!strcmp (key, "r")) model->ge_r = v;
+	else if (!strcmp (key, "bad")) model->ber_bad = v;
+	else if (!strcmp (key, "drop")) model->drop = v;
+	else if (!strcmp (key, "dup")) model->dup = v;
+	else if (!strcmp (key, "delay")) model->delay = (uint32_t)v;
+	else if (!strcmp (key, "jitter")) model->jitter = (uint32_t)v;
+	else if (!strcmp (key, "baud")) model->baud = (uint32_t)v;
+	else return -1;
+
+	return 0;
+}
+
+static int sim_channel_token (sim_channel_model* model, char* token)
+{
+	char* value = strchr (token, '=');
+	const sim_channel_preset* preset;
+	char spec[128];
+
+	if (value)
+	{
+		*value++ = 0;
+		return sim_channel_set (model, token, value);
+	}
+
+	// a preset - its pairs on top of what's there
+	for (preset = sim_channel_presets; preset->name; preset++)
+	{
+		if (strcmp (preset->name, token)) continue;
+
+		strncpy (spec, preset->spec, sizeof(spec) - 1);
+		spec[sizeof(spec) - 1] = 0;
+		for (token = strtok (spec, ","); token; token = strtok (NULL, ","))
+		{
+			value = strchr (token, '=');
+			*value++ = 0;
+			sim_channel_set (model, token, value);
+		}
+		return 0;
+	}
+	return -1;
+}
+
+//===============================================
+int sim_channel_parse (sim_channel_model* model, const char* spec)
+{
+	char* copy = strdup (spec);
+	char* token;
+	char* next;
+	int ret = 0;
+
+	memset (model, 0, sizeof(*model));
+	if (copy == NULL) return -1;
+
+	// (the presets use strtok, the list is split by hand)
+	for (token = copy; token && ret == 0; token = next)
+	{
+		next = strchr (token, ',');
+		if (next) *next++ = 0;
+		if (*token) ret = sim_channel_token (model, token);
+	}
+
+	free (copy);
+	return ret;
+}
+
+//===============================================
+void sim_channel_format (const sim_channel_model* model, char* buf, uint32_t size)
+{
+	int n = 0;
+
+	buf[0] = 0;
+	if (model->ber > 0) n += snprintf (buf + n, size - n, ",ber=%g", model->ber);
+	if (model->ge_p > 0)
+	{
+		n += snprintf (buf + n, size - n, ",p=%g,r=%g,bad=%g", model->ge_p, model->ge_r, model->ber_bad);
+	}
+	if (model->drop > 0) n += snprintf (buf + n, size - n, ",drop=%g", model->drop);
+	if (model->dup > 0) n += snprintf (buf + n, size - n, ",dup=%g", model->dup);
+	if (model->delay) n += snprintf (buf + n, size - n, ",delay=%u", model->delay);
+	if (model->jitter) n += snprintf (buf + n, size - n, ",jitter=%u", model->jitter);
+	if (model->baud) n += snprintf (buf + n, size - n, ",baud=%u", model->baud);
+
+	// without the leading comma
+	if (n) memmove (buf, buf + 1, strlen (buf));
+	else snprintf (buf, size, "clean");
+}
+
+//===============================================
+void sim_channel_init (sim_channel* ch, const sim_channel_model* model, unsigned long long seed)
+{
+	memset (ch, 0, sizeof(*ch));
+	ch->model = model;
+	ch->rng = seed | 1;
+}
+
+// xorshift64*
+unsigned long long sim_channel_random (sim_channel* ch)
+{
+	ch->rng ^= ch->rng >> 12;
+	ch->rng ^= ch->rng << 25;
+	ch->rng ^= ch->rng >> 27;
+	return ch->rng * 0x2545f4914f6cdd1dull;
+}
+
+// a uniform number in [0, 1)
+static double sim_channel_uniform (sim_channel* ch)
+{
+	return (sim_channel_random (ch) >> 11) * 0x1.0p-53;
+}
+
+//===============================================
+uint16_t sim_channel_apply (sim_channel* ch, const uint8_t* in, uint16_t len, uint8_t* out)
+{
+	const sim_channel_model* m = ch->model;
+	uint16_t n = 0;
+	uint16_t i;
+	double ber;
+	uint8_t c;
+
+	ch->bytes += len;
+	for (i = 0; i < len; i++)
+	{
+		c = in[i];
+
+		// the burst state moves on every byte
+		if (m->ge_p > 0)
+		{
+			if (ch->bad) ch->bad = !(sim_channel_uniform (ch) < m->ge_r);
+			else ch->bad = (sim_channel_uniform (ch) < m->ge_p);
+		}
+
+		ber = ch->bad ? m->ber_bad : m->ber;
+		if (ber > 0 && sim_channel_uniform (ch) < ber)
+		{
+			c = (uint8_t)sim_channel_random (ch);
+			ch->corrupted++;
+		}
+
+		if (m->drop > 0 && sim_channel_uniform (ch) < m->drop)
+		{
+			ch->dropped++;
+			continue;
+		}
+
+		out[n++] = c;
+		if (m->dup > 0 && sim_channel_uniform (ch) < m->dup)
+		{
+			out[n++] = c;
+			ch->duplicated++;
+		}
+	}
+	return n;
+}
+
+//===============================================
+uint32_t sim_channel_delay (sim_channel* ch)
+{
+	uint32_t delay = ch->model->delay;
+
+	if (ch->model->jitter) delay += (uint32_t)(sim_channel_random (ch) % (ch->model->jitter + 1));
+	return delay;
+}
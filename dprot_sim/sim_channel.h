@@ -0,0 +1,130 @@
+#ifndef __SIM_CHANNEL_H__
+#define __SIM_CHANNEL_H__
+
+#include "spec_types.h"
+
+/*! \file sim_channel.h
+ * \brief Impairment models of the simulated lines
+ *
+ * A channel sits between the writer of a line and its reader
+ * and spoils the bytes on the way: substitutions (independent
+ * or in Gilbert-Elliott bursts), lost and duplicated bytes.
+ * The timing part of the model - a fixed delay, a jitter and
+ * a bandwidth limit - is up to the simulation that has a clock
+ * ('sim_channel_delay' and the baud rate). Every channel has
+ * its own generator, seeded by the caller.
+ *
+ * A model is given as a list of presets and 'key=value' pairs
+ * separated by commas, e.g. "burst,delay=2000":
+ *
+ *   ber      the byte error rate (the good state of the bursts)
+ *   p, r     the good->bad and bad->good probabilities per byte
+ *   bad      the byte error rate of the bad state
+ *   drop     the rate of the lost bytes
+ *   dup      the rate of the duplicated bytes
+ *   delay    the latency of the line [us]
+ *   jitter   the random latency added to a block, 0..jitter [us]
+ *   baud     the line speed [bit/s], 0 for the simulation's
+ */
+
+/*********************************************************/
+/*! \struct sim_channel_model
+ * \brief The impairments of a line
+ */
+typedef struct
+{
+	double ber;                 /**< byte substitutions (the good state) */
+	double ge_p;                /**< good -> bad, per byte */
+	double ge_r;                /**< bad -> good, per byte */
+	double ber_bad;             /**< byte substitutions in the bad state */
+	double drop;                /**< lost bytes */
+	double dup;                 /**< duplicated bytes */
+	uint32_t delay;             /**< fixed latency [us] */
+	uint32_t jitter;            /**< random latency of a block [us] */
+	uint32_t baud;              /**< the bandwidth limit, 0 if not limited by the model */
+} sim_channel_model;
+
+/*! \struct sim_channel_preset
+ * \brief A named model
+ */
+typedef struct
+{
+	const char* name;
+	const char* spec;
+	const char* desc;
+} sim_channel_preset;
+
+/*! \struct sim_channel
+ * \brief A direction of a line
+ */
+typedef struct
+{
+	const sim_channel_model* model;
+	unsigned long long rng;
+	uint8_t bad;                /**< the burst state */
+	unsigned long long bytes;
+	unsigned long long corrupted;
+	unsigned long long dropped;
+	unsigned long long duplicated;
+} sim_channel;
+
+/*! The presets, terminated by a NULL name */
+extern const sim_channel_preset sim_channel_presets[];
+
+/*********************************************************/
+
+/*!
+ * \brief Reads a model - it starts from a clean line
+ *
+ * \param model the model
+ * \param spec the presets and the 'key=value' pairs
+ *
+ * \return 0 on success, -1 on an unknown name or key
+ */
+int sim_channel_parse (sim_channel_model* model, const char* spec);
+
+/*!
+ * \brief Prints a model in the syntax of 'sim_channel_parse'
+ *
+ * \param model the model
+ * \param buf the text
+ * \param size the size of 'buf'
+ */
+void sim_channel_format (const sim_channel_model* model, char* buf, uint32_t size);
+
+/*!
+ * \brief Initializes a channel
+ *
+ * \param ch the channel
+ * \param model the model - it has to stay valid
+ * \param seed the seed of the channel's generator
+ */
+void sim_channel_init (sim_channel* ch, const sim_channel_model* model, unsigned long long seed);
+
+/*!
+ * \brief The next number of the channel's generator
+ * \param ch the channel
+ * \return 64 random bits
+ */
+unsigned long long sim_channel_random (sim_channel* ch);
+
+/*!
+ * \brief Sends a block through the channel
+ *
+ * \param ch the channel
+ * \param in the bytes written
+ * \param len the number of the bytes written
+ * \param out the bytes read - room for 2*len
+ *
+ * \return the number of the bytes read
+ */
+uint16_t sim_channel_apply (sim_channel* ch, const uint8_t* in, uint16_t len, uint8_t* out);
+
+/*!
+ * \brief The latency of a block - the fixed delay and a jitter
+ * \param ch the channel
+ * \return the latency [us]
+ */
+uint32_t sim_channel_delay (sim_channel* ch);
+
+#endif //__SIM_CHANNEL_H__
@@ -0,0 +1,557 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim_des.h"
+
+// the bytes a line holds - what doesn't fit is lost, like in
+// an overrun uart
+#define SIM_DES_LINE_SIZE	16384
+
+// the kinds of the events
+enum
+{
+	SIM_DES_TO_SLAVE = 0x00,    /**< a block arrives at the slave */
+	SIM_DES_TO_MASTER = 0x01,   /**< a block arrives at the master */
+	SIM_DES_MASTER_TIMER = 0x02,/**< the ack (or answer) deadline of the master */
+	SIM_DES_SLAVE_TIMER = 0x03  /**< the held back ack of the slave */
+};
+
+typedef struct
+{
+	unsigned long long at;          // the virtual time [ns]
+	unsigned long long seq;         // the order of the events at the same time
+	uint32_t link;
+	uint16_t len;
+	uint8_t kind;
+} sim_des_event;
+
+struct sim_des_link_s;
+
+// a direction of a line - the bytes on the way in a ring
+typedef struct
+{
+	struct sim_des_link_s* owner;
+	uint8_t kind;               // the event of the arrival
+	sim_channel ch;
+	uint32_t byte_ns;
+	unsigned long long busy_until;  // the last byte written leaves the sender
+	unsigned long long arrival;     // of the last block - the line keeps the order
+	uint32_t head;
+	uint32_t tail;
+	uint8_t ring[SIM_DES_LINE_SIZE];
+} sim_des_line;
+
+typedef struct
+{
+	const sim_des_config* cfg;
+	sim_des_result* res;
+	struct sim_des_link_s* links;
+	sim_des_event* heap;
+	uint32_t events;
+	uint32_t size;
+	unsigned long long seq;
+	uint32_t done;
+	uint32_t* latency;          // of every completed message [us]
+	uint32_t latencies;
+} sim_des;
+
+typedef struct sim_des_link_s
+{
+	sim_des* des;
+	uint32_t index;
+	dprot_link master;
+	dprot_link slave;
+	dprot_rx_ctx master_rx;
+	dprot_rx_ctx slave_rx;
+	sim_des_line down;
+	sim_des_line up;
+	dprot_request req;
+	uint32_t next;              // the message being sent
+	uint8_t waiting;            // for the answer of 'next'
+	unsigned long long answer_due;
+	unsigned long long submitted;
+	unsigned long long master_timer;  // the time of the master's pending timer, 0 if none
+	unsigned long long slave_timer;
+} sim_des_link;
+
+// the virtual clock - of the simulation running in the thread
+static __thread unsigned long long sim_des_now = 0;
+
+//===============================================
+// the seeds of the channels
+static unsigned long long sim_des_splitmix (unsigned long long x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+//===============================================
+// the hash of the completions (FNV-1a)
+static void sim_des_digest (sim_des* des, unsigned long long value)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		des->res->digest ^= (value >> (8 * i)) & 0xff;
+		des->res->digest *= 0x100000001b3ull;
+	}
+}
+
+//===============================================
+// the event queue - a binary min-heap on (time, order)
+static int sim_des_before (sim_des_event* a, sim_des_event* b)
+{
+	return (a->at < b->at) || (a->at == b->at && a->seq < b->seq);
+}
+
+static void sim_des_push (sim_des* des, unsigned long long at, uint8_t kind, uint32_t link, uint16_t len)
+{
+	sim_des_event ev = { at, des->seq++, link, len, kind };
+	sim_des_event* grown;
+	uint32_t slot, parent;
+
+	if (des->events == des->size)
+	{
+		grown = realloc (des->heap, 2 * des->size * sizeof(sim_des_event));
+		if (grown == NULL) abort ();
+		des->heap = grown;
+		des->size *= 2;
+	}
+
+	for (slot = des->events++; slot; slot = parent)
+	{
+		parent = (slot - 1) / 2;
+		if (!sim_des_before (&ev, &des->heap[parent])) break;
+		des->heap[slot] = des->heap[parent];
+	}
+	des->heap[slot] = ev;
+}
+
+static int sim_des_pop (sim_des* des, sim_des_event* out)
+{
+	sim_des_event last;
+	uint32_t slot, child;
+
+	if (des->events == 0) return 0;
+
+	*out = des->heap[0];
+	last = des->heap[--des->events];
+
+	for (slot = 0; (child = 2 * slot + 1) < des->events; slot = child)
+	{
+		if (child + 1 < des->events && sim_des_before (&des->heap[child + 1], &des->heap[child])) child++;
+		if (!sim_des_before (&des->heap[child], &last)) break;
+		des->heap[slot] = des->heap[child];
+	}
+	des->heap[slot] = last;
+	return 1;
+}
+
+//===============================================
+// the clock of the links [us]
+static uint32_t sim_des_clock (void)
+{
+	return (uint32_t)(sim_des_now / 1000);
+}
+
+// a deadline of the link clock in virtual time - never in the past
+static unsigned long long sim_des_at (uint32_t due)
+{
+	long long left = (int32_t)(due - sim_des_clock ());
+	unsigned long long at = (sim_des_now / 1000 + left) * 1000;
+
+	return (left <= 0 || at < sim_des_now) ? sim_des_now : at;
+}
+
+//===============================================
+// every frame is put between two END bytes of the framing
+static uint16_t sim_des_ends (uint8_t framing, uint8_t* buf, uint16_t len)
+{
+	uint8_t end = (framing == SLIP_FRAMING_COBS) ? SLIP_COBS_END : SLIP_END;
+	uint16_t n = 0;
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		n += (buf[i] == end);
+	}
+	return n;
+}
+
+// 'fn_write_buf' of both ends - the block is on the line until
+// its last byte is serialized
+static void sim_des_write (void* ctx, uint8_t* buf, uint16_t len)
+{
+	sim_des_line* line = (sim_des_line*)ctx;
+	sim_des_link* l = line->owner;
+	sim_des* des = l->des;
+	uint8_t out[2 * SLIP_TX_BLOCK];
+	uint16_t n = sim_channel_apply (&line->ch, buf, len, out);
+	uint16_t stored = 0;
+	unsigned long long at;
+	uint16_t i;
+
+	des->res->frames += sim_des_ends (des->cfg->framing, buf, len);
+	for (i = 0; i < n && line->tail - line->head < SIM_DES_LINE_SIZE; i++)
+	{
+		line->ring[line->tail++ % SIM_DES_LINE_SIZE] = out[i];
+		stored++;
+	}
+
+	// the line is busy with the bytes it carries - the dropped
+	// ones don't take its time, the duplicated ones take it twice
+	if (line->busy_until < sim_des_now) line->busy_until = sim_des_now;
+	line->busy_until += (unsigned long long)n * line->byte_ns;
+
+	// a jitter doesn't reorder the bytes of a serial line
+	at = line->busy_until + 1000ull * sim_channel_delay (&line->ch);
+	if (at > line->arrival) line->arrival = at;
+	sim_des_push (des, line->arrival, line->kind, l->index, stored);
+}
+
+static uint16_t sim_des_read (sim_des_line* line, uint8_t* buf, uint16_t len)
+{
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		buf[i] = line->ring[line->head++ % SIM_DES_LINE_SIZE];
+	}
+	return len;
+}
+
+//===============================================
+// the master's timer follows the ack deadline - or the answer's
+static void sim_des_master_arm (sim_des_link* l)
+{
+	unsigned long long at = 0;
+	uint32_t due;
+
+	if (l->waiting) at = l->answer_due;
+	else if (dprot_master_async_due (&l->master, &due)) at = sim_des_at (due);
+
+	// the events of the older deadlines are ignored
+	if (at && at != l->master_timer)
+	{
+		sim_des_push (l->des, at, SIM_DES_MASTER_TIMER, l->index, 0);
+	}
+	l->master_timer = at;
+}
+
+static void sim_des_slave_arm (sim_des_link* l)
+{
+	unsigned long long at = 0;
+
+	if (l->slave.slave.ack_pending)
+	{
+		at = sim_des_at (l->slave.slave.ack_due);
+		if (at != l->slave_timer) sim_des_push (l->des, at, SIM_DES_SLAVE_TIMER, l->index, 0);
+	}
+	l->slave_timer = at;
+}
+
+//===============================================
+// the masters - every completion sends the next message
+static void sim_des_complete (void* user, dprot_request* req);
+
+static void sim_des_submit (sim_des_link* l)
+{
+	sim_des* des = l->des;
+	uint8_t stale[DPROT_MAX_MSG];
+
+	// an answer repeated for a retransmitted request
+	dprot_master_async_answer (&l->master, stale, sizeof(stale));
+	l->submitted = sim_des_now;
+	dprot_master_submit_data (&l->master, &l->req, des->cfg->data[l->next], des->cfg->lengths[l->next],
+							  sim_des_complete, l);
+}
+
+static void sim_des_next (sim_des_link* l)
+{
+	l->waiting = 0;
+	if (++l->next == l->des->cfg->messages)
+	{
+		l->des->done++;
+		return;
+	}
+	sim_des_submit (l);
+}
+
+// the message made it - acked (and answered)
+static void sim_des_delivered (sim_des_link* l, uint8_t len)
+{
+	sim_des* des = l->des;
+
+	des->res->delivered += len;
+	des->latency[des->latencies++] = (uint32_t)((sim_des_now - l->submitted) / 1000);
+}
+
+static void sim_des_check_answer (sim_des_link* l)
+{
+	sim_des* des = l->des;
+	uint8_t answer[DPROT_MAX_MSG];
+	uint8_t len = des->cfg->lengths[l->next];
+	uint16_t n = dprot_master_async_answer (&l->master, answer, sizeof(answer));
+
+	// nothing yet - or the late answer of the previous message
+	if (n == 0 || answer[1] != len || memcmp (answer + 2, des->cfg->data[l->next], len))
+	{
+		return;
+	}
+
+	des->res->answered++;
+	sim_des_delivered (l, len);
+	sim_des_digest (des, ((unsigned long long)l->index << 32) | l->next);
+	sim_des_digest (des, sim_des_now);
+	sim_des_next (l);
+}
+
+static void sim_des_complete (void* user, dprot_request* req)
+{
+	sim_des_link* l = (sim_des_link*)user;
+	sim_des* des = l->des;
+
+	sim_des_digest (des, ((unsigned long long)l->index << 32) | l->next);
+	sim_des_digest (des, ((unsigned long long)req->result << 56) | sim_des_now);
+	des->res->retransmissions += l->master.master.retries - req->retries - 1;
+
+	if (req->result != DPROT_ACK_ACCEPTED)
+	{
+		des->res->failed++;
+		sim_des_next (l);
+		return;
+	}
+
+	des->res->acked++;
+	if (!des->cfg->request)
+	{
+		sim_des_delivered (l, req->len);
+		sim_des_next (l);
+		return;
+	}
+
+	// the answer came with the ack or comes after it - the
+	// round trip of the ack covers neither its serialization
+	// nor the jitter of the line
+	l->waiting = 1;
+	l->answer_due = sim_des_now + DPROT_MAX_MSG * (unsigned long long)l->up.byte_ns +
+		1000ull * (dprot_master_get_rto (&l->master) + l->up.ch.model->jitter);
+	sim_des_check_answer (l);
+}
+
+static void sim_des_master_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	sim_des_link* l = (sim_des_link*)user;
+
+	dprot_master_async_frame (&l->master, status, frame, len);
+	if (l->waiting) sim_des_check_answer (l);
+}
+
+//===============================================
+// the slaves - they echo the requests
+static void sim_des_slave_frame (void* user, uint8_t status, uint8_t* frame, uint16_t len)
+{
+	sim_des_link* l = (sim_des_link*)user;
+	uint8_t ret = dprot_slave_process_msg (&l->slave, frame, len, DPROT_MAX_MSG);
+
+	if (l->des->cfg->request && ret == DPROT_NO_ERROR && (frame[0]&DPROT_TYPE_MASK) == DPROT_TYPE_DATA)
+	{
+		dprot_slave_send_data_msg (&l->slave, frame + 2, frame[1]);
+	}
+}
+
+//===============================================
+static int sim_des_link_init (sim_des* des, sim_des_link* l, uint32_t index)
+{
+	const sim_des_config* cfg = des->cfg;
+	uint8_t fec;
+
+	l->des = des;
+	l->index = index;
+
+	l->down.owner = l->up.owner = l;
+	l->down.kind = SIM_DES_TO_SLAVE;
+	l->up.kind = SIM_DES_TO_MASTER;
+	sim_channel_init (&l->down.ch, cfg->down, sim_des_splitmix (cfg->seed ^ sim_des_splitmix (2 * index)));
+	sim_channel_init (&l->up.ch, cfg->up, sim_des_splitmix (cfg->seed ^ sim_des_splitmix (2 * index + 1)));
+
+	// the model's bandwidth limit or the simulation's baud rate
+	l->down.byte_ns = 10000000000ull / (cfg->down->baud ? cfg->down->baud : cfg->baud);
+	l->up.byte_ns = 10000000000ull / (cfg->up->baud ? cfg->up->baud : cfg->baud);
+
+	dprot_master_init_protocol_buf (&l->master, sim_des_write, NULL, &l->down);
+	dprot_master_set_checking (&l->master, cfg->checking);
+	dprot_link_set_framing (&l->master, cfg->framing);
+	fec = dprot_link_set_fec (&l->master, cfg->fec);
+	dprot_master_set_clock (&l->master, sim_des_clock);
+	if (cfg->retries) dprot_master_set_retries (&l->master, cfg->retries);
+	dprot_master_set_seed (&l->master, (uint32_t)sim_channel_random (&l->down.ch));
+	dprot_rx_init (&l->master_rx, sim_des_master_frame, l);
+	dprot_rx_set_checking (&l->master_rx, cfg->checking);
+	dprot_rx_set_framing (&l->master_rx, cfg->framing);
+	fec |= dprot_rx_set_fec (&l->master_rx, cfg->fec);
+
+	dprot_slave_init_protocol_buf (&l->slave, sim_des_write, NULL, &l->up);
+	dprot_slave_set_checking (&l->slave, cfg->checking);
+	dprot_link_set_framing (&l->slave, cfg->framing);
+	fec |= dprot_link_set_fec (&l->slave, cfg->fec);
+	dprot_slave_set_piggyback (&l->slave, cfg->piggyback, sim_des_clock, DPROT_ACK_DELAY);
+	dprot_rx_init (&l->slave_rx, sim_des_slave_frame, l);
+	dprot_rx_set_checking (&l->slave_rx, cfg->checking);
+	dprot_rx_set_framing (&l->slave_rx, cfg->framing);
+	fec |= dprot_rx_set_fec (&l->slave_rx, cfg->fec);
+
+	// a FEC the build doesn't have (SLIP_FEC) fails the run
+	return (fec == DPROT_NO_ERROR) ? 0 : -1;
+}
+
+//===============================================
+static void sim_des_handle (sim_des* des, sim_des_event* ev)
+{
+	sim_des_link* l = &des->links[ev->link];
+	uint8_t block[2 * SLIP_TX_BLOCK];
+
+	switch (ev->kind)
+	{
+		case SIM_DES_TO_SLAVE:
+			dprot_rx_feed (&l->slave_rx, block, sim_des_read (&l->down, block, ev->len));
+			sim_des_slave_arm (l);
+			break;
+
+		case SIM_DES_TO_MASTER:
+			dprot_rx_feed (&l->master_rx, block, sim_des_read (&l->up, block, ev->len));
+			sim_des_master_arm (l);
+			break;
+
+		case SIM_DES_MASTER_TIMER:
+			if (ev->at != l->master_timer) break;
+			l->master_timer = 0;
+
+			if (l->waiting)
+			{
+				// the answer got lost - the request was acked though
+				sim_des_digest (des, ((unsigned long long)l->index << 32) | l->next);
+				sim_des_next (l);
+			}
+			else
+			{
+				dprot_master_async_poll (&l->master);
+			}
+			sim_des_master_arm (l);
+			break;
+
+		case SIM_DES_SLAVE_TIMER:
+			if (ev->at != l->slave_timer) break;
+			l->slave_timer = 0;
+			dprot_slave_poll (&l->slave);
+			break;
+
+		default:
+			break;
+	}
+}
+
+//===============================================
+static int sim_des_compare (const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void sim_des_latency (sim_des* des)
+{
+	sim_des_result* res = des->res;
+	double sum = 0;
+	uint32_t i;
+
+	if (des->latencies == 0) return;
+
+	qsort (des->latency, des->latencies, sizeof(uint32_t), sim_des_compare);
+	for (i = 0; i < des->latencies; i++)
+	{
+		sum += des->latency[i];
+	}
+	res->latency_mean = sum / des->latencies;
+	res->latency_p50 = des->latency[des->latencies / 2];
+	res->latency_p99 = des->latency[(unsigned long)des->latencies * 99 / 100];
+	res->latency_max = des->latency[des->latencies - 1];
+}
+
+//===============================================
+int sim_des_run (const sim_des_config* cfg, sim_des_result* res)
+{
+	sim_des des;
+	sim_des_event ev;
+	struct timespec start, end;
+	uint32_t i;
+
+	memset (res, 0, sizeof(*res));
+	res->digest = 0xcbf29ce484222325ull;
+	if (cfg->links == 0 || cfg->messages == 0) return 0;
+
+	memset (&des, 0, sizeof(des));
+	des.cfg = cfg;
+	des.res = res;
+	des.size = 1024;
+	des.heap = malloc (des.size * sizeof(sim_des_event));
+	des.links = calloc (cfg->links, sizeof(sim_des_link));
+	des.latency = malloc ((unsigned long)cfg->links * cfg->messages * sizeof(uint32_t));
+	if (des.heap == NULL || des.links == NULL || des.latency == NULL)
+	{
+		free (des.heap);
+		free (des.links);
+		free (des.latency);
+		return -1;
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	sim_des_now = 0;
+
+	// every master starts with its first message at once
+	for (i = 0; i < cfg->links; i++)
+	{
+		if (sim_des_link_init (&des, &des.links[i], i) != 0)
+		{
+			free (des.heap);
+			free (des.links);
+			free (des.latency);
+			errno = EINVAL;
+			return -1;
+		}
+		sim_des_submit (&des.links[i]);
+		sim_des_master_arm (&des.links[i]);
+	}
+
+	while (des.done < cfg->links && sim_des_pop (&des, &ev))
+	{
+		sim_des_now = ev.at;
+		res->events++;
+		sim_des_handle (&des, &ev);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	res->virtual_ns = sim_des_now;
+	res->wall_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	res->frames /= 2;
+
+	for (i = 0; i < cfg->links; i++)
+	{
+		res->corrupted += des.links[i].down.ch.corrupted + des.links[i].up.ch.corrupted;
+		res->dropped += des.links[i].down.ch.dropped + des.links[i].up.ch.dropped;
+		res->duplicated += des.links[i].down.ch.duplicated + des.links[i].up.ch.duplicated;
+		res->fec_corrected += des.links[i].master_rx.decoder.fec_corrected + des.links[i].slave_rx.decoder.fec_corrected;
+		res->fec_failed += des.links[i].master_rx.decoder.fec_failed + des.links[i].slave_rx.decoder.fec_failed;
+	}
+	sim_des_latency (&des);
+
+	free (des.heap);
+	free (des.links);
+	free (des.latency);
+	return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef __SIM_DES_H__
+#define __SIM_DES_H__
+
+#include "spec_types.h"
+#include "dprot.h"
+#include "sim_channel.h"
+
+/*! \file sim_des.h
+ * \brief Discrete event simulation of dProt links
+ *
+ * A single thread and a virtual clock - nothing sleeps and
+ * nothing depends on the scheduler. The lines are modelled
+ * by their baud rate: a block written to a line arrives when
+ * its last byte has been serialized (10 bits a byte, 8N1)
+ * behind whatever was on the line before it, plus the latency
+ * of the line's channel model. The masters run the asynchronous
+ * requests, their timeouts are events of the virtual clock.
+ * The impairments come from a seeded generator of every line,
+ * so a seed always gives the same run - bit for bit. The
+ * clock is per thread, the threads can run a simulation each.
+ */
+
+/*********************************************************/
+/*! \struct sim_des_config
+ * \brief The parameters of a run
+ */
+typedef struct
+{
+	uint32_t links;             /**< independent master/slave pairs */
+	uint32_t messages;          /**< sent by every master, stop-and-wait */
+	uint8_t (*data)[128];       /**< the messages */
+	uint8_t* lengths;           /**< ... and their lengths */
+	uint32_t baud;              /**< the line speed [bit/s] */
+	unsigned long long seed;
+	const sim_channel_model* down;  /**< the impairments master -> slave */
+	const sim_channel_model* up;    /**< the impairments slave -> master */
+	uint8_t checking;
+	uint8_t framing;            /**< SLIP_FRAMING_XXX of both lines */
+	uint8_t fec;                /**< the Reed-Solomon parity bytes of the frames, 0 for none */
+	uint8_t request;            /**< the slave echoes every message */
+	uint8_t piggyback;          /**< ... with the ack piggybacked */
+	uint8_t retries;            /**< the transmissions of a frame, 0 for the default */
+} sim_des_config;
+
+/*! \struct sim_des_result
+ * \brief The outcome of a run
+ */
+typedef struct
+{
+	unsigned long long virtual_ns;  /**< the virtual time of the last event */
+	unsigned long long events;
+	unsigned long long acked;       /**< requests acked */
+	unsigned long long failed;      /**< requests out of retries */
+	unsigned long long answered;    /**< correct answers (request mode) */
+	unsigned long long delivered;   /**< payload bytes acked (and answered) */
+	unsigned long long frames;      /**< frames written to the lines */
+	unsigned long long retransmissions; /**< frames sent again by the masters */
+	unsigned long long corrupted;   /**< bytes spoiled by the channels */
+	unsigned long long fec_corrected;   /**< bytes corrected by the receivers */
+	unsigned long long fec_failed;  /**< frames beyond the FEC's repair */
+	unsigned long long dropped;
+	unsigned long long duplicated;
+	double latency_mean;            /**< from the submit to the ack (or the answer) [us] */
+	uint32_t latency_p50;
+	uint32_t latency_p99;
+	uint32_t latency_max;
+	unsigned long long digest;      /**< a hash of every completion - equal runs, equal digests */
+	double wall_sec;                /**< the real time of the run */
+} sim_des_result;
+
+/*********************************************************/
+
+/*!
+ * \brief Runs a simulation to the end
+ *
+ * \param cfg the parameters
+ * \param res the outcome
+ *
+ * \return 0 on success, -1 if out of memory
+ */
+int sim_des_run (const sim_des_config* cfg, sim_des_result* res);
+
+#endif //__SIM_DES_H__
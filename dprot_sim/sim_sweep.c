@@ -0,0 +1,475 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim_sweep.h"
+#include "slip.h"
+
+// the tasks a worker hasn't started yet - [head, tail)
+typedef struct
+{
+	pthread_mutex_t lock;
+	uint32_t head;
+	uint32_t tail;
+} sim_sweep_range;
+
+typedef struct
+{
+	const sim_sweep_config* cfg;
+	sim_sweep_range* ranges;    // of every worker
+	uint32_t workers;
+	sim_channel_model* models;  // of every ber
+	uint8_t (**data)[128];      // the messages of every size
+	uint8_t** lengths;
+	sim_des_result* results;    // of every task
+	volatile int error;
+	uint32_t steals;
+} sim_sweep;
+
+typedef struct
+{
+	sim_sweep* sw;
+	uint32_t id;
+	pthread_t thread;
+} sim_sweep_worker;
+
+//===============================================
+static unsigned long long sim_sweep_splitmix (unsigned long long x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+//===============================================
+// a list of values - 'n' of them at most
+static int sim_sweep_values (char* list, double* values, uint32_t* n)
+{
+	char* end;
+
+	for (*n = 0; *list; (*n)++)
+	{
+		if (*n == SIM_SWEEP_MAX_VALUES) return -1;
+
+		values[*n] = strtod (list, &end);
+		if (end == list || (*end && *end != ',')) return -1;
+		list = *end ? end + 1 : end;
+	}
+	return *n ? 0 : -1;
+}
+
+int sim_sweep_parse (sim_sweep_config* cfg, const char* grid)
+{
+	double values[SIM_SWEEP_MAX_VALUES];
+	char* copy = strdup (grid);
+	char* key;
+	char* next;
+	char* list;
+	uint32_t n, i;
+	int ret = 0;
+
+	if (copy == NULL) return -1;
+
+	for (key = copy; key && ret == 0; key = next)
+	{
+		next = strchr (key, ';');
+		if (next) *next++ = 0;
+		if (*key == 0) continue;
+
+		list = strchr (key, '=');
+		if (list == NULL || sim_sweep_values (list + 1, values, &n))
+		{
+			ret = -1;
+			break;
+		}
+		*list = 0;
+
+		if (!strcmp (key, "ber"))
+		{
+			for (i = 0; i < n; i++) cfg->ber[i] = values[i];
+			cfg->bers = n;
+		}
+		else if (!strcmp (key, "size"))
+		{
+			for (i = 0; i < n && ret == 0; i++)
+			{
+				if (values[i] < 0 || values[i] > 128) ret = -1;
+				cfg->size[i] = (uint8_t)values[i];
+			}
+			cfg->sizes = n;
+		}
+		else if (!strcmp (key, "retries"))
+		{
+			for (i = 0; i < n && ret == 0; i++)
+			{
+				if (values[i] < 1 || values[i] > 255) ret = -1;
+				cfg->retries[i] = (uint8_t)values[i];
+			}
+			cfg->retry_counts = n;
+		}
+		else if (!strcmp (key, "fec"))
+		{
+			for (i = 0; i < n && ret == 0; i++)
+			{
+				if (values[i] < 0 || values[i] > RS_MAX_PARITY) ret = -1;
+				cfg->fec[i] = (uint8_t)values[i];
+			}
+			cfg->fecs = n;
+		}
+		else if (!strcmp (key, "runs") && n == 1 && values[0] >= 1)
+		{
+			cfg->runs = (uint32_t)values[0];
+		}
+		else
+		{
+			ret = -1;
+		}
+	}
+
+	free (copy);
+	return ret;
+}
+
+uint32_t sim_sweep_points (const sim_sweep_config* cfg)
+{
+	return cfg->bers * cfg->sizes * cfg->retry_counts * cfg->fecs;
+}
+
+//===============================================
+// a single run of a point
+static void sim_sweep_task (sim_sweep* sw, uint32_t task)
+{
+	const sim_sweep_config* cfg = sw->cfg;
+	uint32_t point = task / cfg->runs;
+	uint32_t ber = point / (cfg->sizes * cfg->retry_counts * cfg->fecs);
+	uint32_t size = (point / (cfg->retry_counts * cfg->fecs)) % cfg->sizes;
+	sim_des_config des;
+
+	memset (&des, 0, sizeof(des));
+	des.links = cfg->links;
+	des.messages = cfg->messages;
+	des.data = sw->data[size];
+	des.lengths = sw->lengths[size];
+	des.baud = cfg->baud;
+	des.seed = sim_sweep_splitmix (cfg->seed ^ sim_sweep_splitmix (task));
+	des.down = &sw->models[ber];
+	des.up = &sw->models[ber];
+	des.checking = cfg->checking;
+	des.framing = cfg->framing;
+	des.retries = cfg->retries[(point / cfg->fecs) % cfg->retry_counts];
+	des.fec = cfg->fec[point % cfg->fecs];
+
+	if (sim_des_run (&des, &sw->results[task]) != 0)
+	{
+		sw->error = errno ? errno : ENOMEM;
+	}
+}
+
+static int sim_sweep_take (sim_sweep_range* r, uint32_t* task)
+{
+	int ret = 0;
+
+	pthread_mutex_lock (&r->lock);
+	if (r->head < r->tail)
+	{
+		*task = r->head++;
+		ret = 1;
+	}
+	pthread_mutex_unlock (&r->lock);
+	return ret;
+}
+
+// the back half of the busiest worker's tasks - 0 when all is taken
+static int sim_sweep_steal (sim_sweep* sw, uint32_t self)
+{
+	sim_sweep_range* victim;
+	uint32_t most, left, half, start, w;
+
+	for (;;)
+	{
+		victim = NULL;
+		most = 0;
+		for (w = 0; w < sw->workers; w++)
+		{
+			if (w == self) continue;
+
+			pthread_mutex_lock (&sw->ranges[w].lock);
+			left = sw->ranges[w].tail - sw->ranges[w].head;
+			pthread_mutex_unlock (&sw->ranges[w].lock);
+
+			if (left > most)
+			{
+				most = left;
+				victim = &sw->ranges[w];
+			}
+		}
+		if (victim == NULL) return 0;
+
+		// it could have run out in the meantime
+		pthread_mutex_lock (&victim->lock);
+		left = victim->tail - victim->head;
+		half = (left + 1) / 2;
+		victim->tail -= half;
+		start = victim->tail;
+		pthread_mutex_unlock (&victim->lock);
+		if (half == 0) continue;
+
+		pthread_mutex_lock (&sw->ranges[self].lock);
+		sw->ranges[self].head = start;
+		sw->ranges[self].tail = start + half;
+		pthread_mutex_unlock (&sw->ranges[self].lock);
+
+		__sync_fetch_and_add (&sw->steals, 1);
+		return 1;
+	}
+}
+
+static void* sim_sweep_worker_function (void* ptr)
+{
+	sim_sweep_worker* worker = (sim_sweep_worker*)ptr;
+	sim_sweep* sw = worker->sw;
+	uint32_t task;
+
+	while (!sw->error)
+	{
+		if (sim_sweep_take (&sw->ranges[worker->id], &task))
+		{
+			sim_sweep_task (sw, task);
+			continue;
+		}
+		if (!sim_sweep_steal (sw, worker->id)) break;
+	}
+	return NULL;
+}
+
+//===============================================
+// the sums of the runs of every point
+static void sim_sweep_collect (sim_sweep* sw, sim_sweep_point* points, sim_sweep_stats* stats)
+{
+	const sim_sweep_config* cfg = sw->cfg;
+	sim_sweep_point* p;
+	sim_des_result* r;
+	uint32_t point, run;
+	double latency;
+
+	for (point = 0; point < sim_sweep_points (cfg); point++)
+	{
+		p = &points[point];
+		memset (p, 0, sizeof(*p));
+		p->ber = cfg->ber[point / (cfg->sizes * cfg->retry_counts * cfg->fecs)];
+		p->size = cfg->size[(point / (cfg->retry_counts * cfg->fecs)) % cfg->sizes];
+		p->retries = cfg->retries[(point / cfg->fecs) % cfg->retry_counts];
+		p->fec = cfg->fec[point % cfg->fecs];
+		latency = 0;
+
+		for (run = 0; run < cfg->runs; run++)
+		{
+			r = &sw->results[point * cfg->runs + run];
+			p->messages += (unsigned long long)cfg->links * cfg->messages;
+			p->acked += r->acked;
+			p->failed += r->failed;
+			p->retransmissions += r->retransmissions;
+			p->corrupted += r->corrupted;
+			p->fec_corrected += r->fec_corrected;
+			p->delivered += r->delivered;
+			p->link_ns += r->virtual_ns * cfg->links;
+			latency += r->latency_mean * r->acked;
+			if (r->latency_p99 > p->latency_p99) p->latency_p99 = r->latency_p99;
+			if (r->latency_max > p->latency_max) p->latency_max = r->latency_max;
+			if (stats) stats->events += r->events;
+		}
+
+		p->goodput = p->link_ns ? p->delivered / (p->link_ns * 1e-9) : 0;
+		p->latency_mean = p->acked ? latency / p->acked : 0;
+	}
+}
+
+//===============================================
+static int sim_sweep_prepare (sim_sweep* sw)
+{
+	const sim_sweep_config* cfg = sw->cfg;
+	unsigned long long x;
+	uint32_t i, m, b;
+
+	sw->models = calloc (cfg->bers, sizeof(sim_channel_model));
+	sw->data = calloc (cfg->sizes, sizeof(*sw->data));
+	sw->lengths = calloc (cfg->sizes, sizeof(*sw->lengths));
+	sw->results = calloc ((unsigned long)sim_sweep_points (cfg) * cfg->runs, sizeof(sim_des_result));
+	sw->ranges = calloc (sw->workers, sizeof(sim_sweep_range));
+	if (!sw->models || !sw->data || !sw->lengths || !sw->results || !sw->ranges) return -1;
+
+	for (i = 0; i < cfg->bers; i++)
+	{
+		if (cfg->model) sw->models[i] = *cfg->model;
+		sw->models[i].ber = cfg->ber[i];
+	}
+
+	// the same messages in every run of a size
+	for (i = 0; i < cfg->sizes; i++)
+	{
+		sw->data[i] = malloc ((unsigned long)cfg->messages * sizeof(**sw->data));
+		sw->lengths[i] = malloc (cfg->messages);
+		if (!sw->data[i] || !sw->lengths[i]) return -1;
+
+		memset (sw->lengths[i], cfg->size[i], cfg->messages);
+		for (m = 0; m < cfg->messages; m++)
+		{
+			x = sim_sweep_splitmix (cfg->seed + m);
+			for (b = 0; b < 128; b++, x >>= 8)
+			{
+				if ((b & 7) == 0) x = sim_sweep_splitmix (x + b);
+				sw->data[i][m][b] = (uint8_t)x;
+			}
+		}
+	}
+	return 0;
+}
+
+static void sim_sweep_release (sim_sweep* sw)
+{
+	uint32_t i;
+
+	for (i = 0; sw->data && i < sw->cfg->sizes; i++)
+	{
+		free (sw->data[i]);
+		free (sw->lengths[i]);
+	}
+	free (sw->models);
+	free (sw->data);
+	free (sw->lengths);
+	free (sw->results);
+	free (sw->ranges);
+}
+
+//===============================================
+int sim_sweep_run (const sim_sweep_config* cfg, sim_sweep_point* points, sim_sweep_stats* stats)
+{
+	sim_sweep sw;
+	sim_sweep_worker* workers;
+	struct timespec start, end;
+	uint32_t tasks = sim_sweep_points (cfg) * cfg->runs;
+	uint32_t i, started = 0;
+	long cpus;
+
+	if (tasks == 0 || cfg->links == 0 || cfg->messages == 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset (&sw, 0, sizeof(sw));
+	sw.cfg = cfg;
+	sw.workers = cfg->workers;
+	if (sw.workers == 0)
+	{
+		cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		sw.workers = (cpus > 0) ? (uint32_t)cpus : 1;
+	}
+	if (sw.workers > tasks) sw.workers = tasks;
+
+	workers = calloc (sw.workers, sizeof(sim_sweep_worker));
+	if (workers == NULL || sim_sweep_prepare (&sw) != 0)
+	{
+		free (workers);
+		sim_sweep_release (&sw);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	// picked before the threads share it
+	slip_set_kernel (SLIP_KERNEL_AUTO);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	// every worker starts with its own slice of the tasks
+	for (i = 0; i < sw.workers; i++)
+	{
+		pthread_mutex_init (&sw.ranges[i].lock, NULL);
+		sw.ranges[i].head = (unsigned long long)tasks * i / sw.workers;
+		sw.ranges[i].tail = (unsigned long long)tasks * (i + 1) / sw.workers;
+	}
+	for (i = 0; i < sw.workers; i++)
+	{
+		workers[i].sw = &sw;
+		workers[i].id = i;
+		if (pthread_create (&workers[i].thread, NULL, sim_sweep_worker_function, &workers[i]) != 0)
+		{
+			// the others take its tasks
+			workers[i].sw = NULL;
+			continue;
+		}
+		started++;
+	}
+	if (started == 0)
+	{
+		workers[0].sw = &sw;
+		sim_sweep_worker_function (&workers[0]);
+		workers[0].sw = NULL;
+	}
+	for (i = 0; i < sw.workers; i++)
+	{
+		if (workers[i].sw) pthread_join (workers[i].thread, NULL);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	for (i = 0; i < sw.workers; i++)
+	{
+		pthread_mutex_destroy (&sw.ranges[i].lock);
+	}
+
+	if (stats)
+	{
+		memset (stats, 0, sizeof(*stats));
+		stats->workers = sw.workers;
+		stats->tasks = tasks;
+		stats->steals = sw.steals;
+		stats->wall_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	}
+	if (!sw.error) sim_sweep_collect (&sw, points, stats);
+
+	free (workers);
+	sim_sweep_release (&sw);
+	if (sw.error)
+	{
+		errno = sw.error;
+		return -1;
+	}
+	return 0;
+}
+
+//===============================================
+void sim_sweep_write (FILE* out, const sim_sweep_config* cfg, const sim_sweep_point* points, int json)
+{
+	const sim_sweep_point* p;
+	uint32_t i;
+
+	if (!json)
+	{
+		fprintf (out, "ber,size,retries,fec,messages,acked,failed,retransmissions,retrans_per_msg,frame_loss,"
+				 "corrupted,fec_corrected,goodput,latency_mean_us,latency_p99_us,latency_max_us\n");
+	}
+
+	for (i = 0; i < sim_sweep_points (cfg); i++)
+	{
+		p = &points[i];
+		if (json)
+		{
+			fprintf (out, "{\"ber\": %g, \"size\": %u, \"retries\": %u, \"fec\": %u, \"messages\": %llu, \"acked\": %llu, "
+					 "\"failed\": %llu, \"retransmissions\": %llu, \"retrans_per_msg\": %.4f, \"frame_loss\": %.6f, "
+					 "\"corrupted\": %llu, \"fec_corrected\": %llu, \"goodput\": %.1f, \"latency_mean_us\": %.0f, "
+					 "\"latency_p99_us\": %u, \"latency_max_us\": %u}\n",
+					 p->ber, p->size, p->retries, p->fec, p->messages, p->acked, p->failed, p->retransmissions,
+					 (double)p->retransmissions / p->messages, (double)p->failed / p->messages, p->corrupted,
+					 p->fec_corrected, p->goodput, p->latency_mean, p->latency_p99, p->latency_max);
+		}
+		else
+		{
+			fprintf (out, "%g,%u,%u,%u,%llu,%llu,%llu,%llu,%.4f,%.6f,%llu,%llu,%.1f,%.0f,%u,%u\n",
+					 p->ber, p->size, p->retries, p->fec, p->messages, p->acked, p->failed, p->retransmissions,
+					 (double)p->retransmissions / p->messages, (double)p->failed / p->messages, p->corrupted,
+					 p->fec_corrected, p->goodput, p->latency_mean, p->latency_p99, p->latency_max);
+		}
+	}
+}
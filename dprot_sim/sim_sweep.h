@@ -0,0 +1,140 @@
+#ifndef __SIM_SWEEP_H__
+#define __SIM_SWEEP_H__
+
+#include <stdio.h>
+#include "spec_types.h"
+#include "sim_channel.h"
+#include "sim_des.h"
+
+/*! \file sim_sweep.h
+ * \brief Parallel parameter sweeps of the discrete event simulation
+ *
+ * A grid of byte error rates x payload sizes x retries x FEC
+ * parity. Every point of the grid is simulated by a number of
+ * independent runs of 'sim_des_run' (the tasks), each with its
+ * own seed - the results don't depend on the number of the
+ * threads or on which thread ran what.
+ *
+ * The tasks are spread over a pool of worker threads. Every
+ * worker starts with a contiguous range of the tasks and takes
+ * them from its front; an idle worker steals the back half of
+ * the range of the busiest one, so the expensive points (high
+ * error rates, slow lines) don't leave the other cores idle.
+ *
+ * A grid is given as 'key=v1,v2,...' lists separated by
+ * semicolons, e.g. "ber=1e-4,1e-3,1e-2;size=16,64,128;retries=3,5":
+ *
+ *   ber      the byte error rates of both lines
+ *   size     the payload sizes (up to 128)
+ *   retries  the transmissions of a frame
+ *   fec      the Reed-Solomon parity bytes of the frames (0 - none)
+ *   runs     the simulation runs of every point (a single value)
+ */
+
+/*! \def SIM_SWEEP_MAX_VALUES
+ * \brief The most values of a single parameter
+ */
+#define SIM_SWEEP_MAX_VALUES	32
+
+/*********************************************************/
+/*! \struct sim_sweep_config
+ * \brief The grid and the parameters of every run
+ */
+typedef struct
+{
+	double ber[SIM_SWEEP_MAX_VALUES];
+	uint32_t bers;
+	uint8_t size[SIM_SWEEP_MAX_VALUES];
+	uint32_t sizes;
+	uint8_t retries[SIM_SWEEP_MAX_VALUES];
+	uint32_t retry_counts;
+	uint8_t fec[SIM_SWEEP_MAX_VALUES];
+	uint32_t fecs;
+	uint32_t runs;              /**< the runs of every point */
+	uint32_t links;             /**< the links of a run */
+	uint32_t messages;          /**< the messages of a link */
+	uint32_t baud;
+	unsigned long long seed;
+	uint8_t checking;
+	uint8_t framing;            /**< SLIP_FRAMING_XXX */
+	const sim_channel_model* model; /**< the rest of the impairments - the ber is the point's */
+	uint32_t workers;           /**< the threads, 0 for one per cpu */
+} sim_sweep_config;
+
+/*! \struct sim_sweep_point
+ * \brief The results of a point - the sums of its runs
+ */
+typedef struct
+{
+	double ber;
+	uint8_t size;
+	uint8_t retries;
+	uint8_t fec;
+	unsigned long long messages;
+	unsigned long long acked;
+	unsigned long long failed;
+	unsigned long long retransmissions;
+	unsigned long long corrupted;
+	unsigned long long fec_corrected;
+	unsigned long long delivered;
+	unsigned long long link_ns; /**< the virtual time of all the links */
+	double goodput;             /**< of a single link [bytes/sec] */
+	double latency_mean;        /**< [us] */
+	uint32_t latency_p99;       /**< the worst run's [us] */
+	uint32_t latency_max;
+} sim_sweep_point;
+
+/*! \struct sim_sweep_stats
+ * \brief How the pool did
+ */
+typedef struct
+{
+	uint32_t workers;
+	uint32_t tasks;
+	uint32_t steals;
+	unsigned long long events;
+	double wall_sec;
+} sim_sweep_stats;
+
+/*********************************************************/
+
+/*!
+ * \brief Reads a grid (the other parameters stay)
+ *
+ * \param cfg the configuration
+ * \param grid the 'key=values' lists
+ *
+ * \return 0 on success, -1 on an unknown key or a bad value
+ */
+int sim_sweep_parse (sim_sweep_config* cfg, const char* grid);
+
+/*!
+ * \brief The number of the points of the grid
+ * \param cfg the configuration
+ * \return bers x sizes x retries x fecs
+ */
+uint32_t sim_sweep_points (const sim_sweep_config* cfg);
+
+/*!
+ * \brief Runs the sweep
+ *
+ * \param cfg the configuration
+ * \param points the results - room for 'sim_sweep_points', ber
+ * major, fec minor
+ * \param stats how the pool did (can be NULL)
+ *
+ * \return 0 on success, -1 on error (errno is set)
+ */
+int sim_sweep_run (const sim_sweep_config* cfg, sim_sweep_point* points, sim_sweep_stats* stats);
+
+/*!
+ * \brief Writes the results
+ *
+ * \param out the stream
+ * \param cfg the configuration
+ * \param points the results of 'sim_sweep_run'
+ * \param json JSON lines instead of CSV
+ */
+void sim_sweep_write (FILE* out, const sim_sweep_config* cfg, const sim_sweep_point* points, int json);
+
+#endif //__SIM_SWEEP_H__
@@ -1,103 +1,432 @@
+#include <string.h>
 #include "slip.h"
 
-
-/*
- * slip_get_char, slip_put_cher definitions
- */
-fn_put_char slip_put_char = NULL;
-fn_get_char slip_get_char = NULL;
-
-
 /***********************************************************/
 uint8_t slip_init(fn_put_char put_function, fn_get_char get_function, fn_get_char_to get_function_to, slip_channel* ch)
 {
 	ch->slip_put_char = put_function;
 	ch->slip_get_char = get_function;
 	ch->slip_get_char_to = get_function_to;
+	ch->slip_write_buf = NULL;
+	ch->slip_read_buf = NULL;
+	ch->io_ctx = NULL;
+	ch->slip_clock = NULL;
+	ch->rx_timeout = SLIP_RX_TIMEOUT;
+	ch->rx_deadline = 0;
+	ch->tx_len = 0;
+	ch->rx_pos = 0;
+	ch->rx_len = 0;
+	ch->tx_frames = 0;
+	ch->tx_bytes = 0;
+	ch->tx_wire = 0;
+	ch->tx_escapes = 0;
+	ch->rx_wire = 0;
+	ch->rx_fec_corrected = 0;
+	ch->rx_fec_failed = 0;
+	ch->framing = SLIP_FRAMING_SLIP;
+	ch->cobs_len = 0;
+#if SLIP_FEC
+	ch->fec_len = 0;
+	ch->fec.nroots = 0;
+#endif
+	return 0;
+}
+
+/***********************************************************/
+uint8_t slip_init_buf(fn_write_buf write_function, fn_read_buf read_function, void* io_ctx, uint16_t rx_timeout, slip_channel* ch)
+{
+	slip_init (NULL, NULL, NULL, ch);
+	ch->slip_write_buf = write_function;
+	ch->slip_read_buf = read_function;
+	ch->io_ctx = io_ctx;
+	ch->rx_timeout = rx_timeout;
+	return 0;
+}
+
+/***********************************************************/
+uint8_t slip_set_framing(slip_channel* ch, uint8_t framing)
+{
+	if (framing != SLIP_FRAMING_SLIP && framing != SLIP_FRAMING_COBS)
+	{
+		return 1;
+	}
+
+	ch->framing = framing;
+	ch->cobs_len = 0;
+	return 0;
+}
+
+/***********************************************************/
+uint8_t slip_set_clock(slip_channel* ch, fn_clock_us clock)
+{
+	ch->slip_clock = clock;
+	return 0;
+}
+
+/***********************************************************/
+uint8_t slip_set_fec(slip_channel* ch, uint8_t nroots)
+{
+#if SLIP_FEC
+	if (nroots == 0)
+	{
+		ch->fec.nroots = 0;
+	}
+	else if (rs_init (&ch->fec, nroots))
+	{
+		return 1;
+	}
+
+	memset (ch->fec_parity, 0, sizeof(ch->fec_parity));
+	ch->fec_len = 0;
 	return 0;
+#else
+	(void)ch;
+	return nroots != 0;
+#endif
+}
+
+/***********************************************************/
+uint16_t slip_fec_correct(const rs_code* rs, uint8_t* frame, uint16_t len, int* corrected)
+{
+	uint16_t pos = 0;
+	uint16_t out = 0;
+	uint16_t n;
+	int failed = 0;
+	int r;
+
+	*corrected = 0;
+
+	// the blocks of RS_BLOCK bytes, the last one shorter
+	while (pos < len)
+	{
+		n = (len - pos < RS_BLOCK) ? len - pos : RS_BLOCK;
+		if (n <= rs->nroots)
+		{
+			// a piece of parity - the frame was cut short
+			failed = 1;
+			break;
+		}
+
+		r = rs_decode (rs, frame + pos, n);
+		if (r < 0) failed = 1;
+		else *corrected += r;
+
+		// the frame bytes of the block close up
+		memmove (frame + out, frame + pos, n - rs->nroots);
+		out += n - rs->nroots;
+		pos += n;
+	}
+
+	if (failed) *corrected = -1;
+	return out;
+}
+/***********************************************************/
+/*
+ * hands the encoded bytes collected in 'tx_buf' to the
+ * transport - at once or byte by byte
+ */
+static void slip_flush(slip_channel* ch)
+{
+	uint16_t i;
+
+	SLIP_STAT_ADD (ch->tx_wire, ch->tx_len);
+	if (ch->slip_write_buf != NULL)
+	{
+		if (ch->tx_len) ch->slip_write_buf (ch->io_ctx, ch->tx_buf, ch->tx_len);
+	}
+	else
+	{
+		for (i = 0; i < ch->tx_len; i++)
+		{
+			ch->slip_put_char (ch->tx_buf[i]);
+		}
+	}
+
+	ch->tx_len = 0;
+}
+
+/***********************************************************/
+/*
+ * a channel with a clock waits until the deadline of the
+ * 'slip_rx' call (a poll and a blocking read don't have one)
+ */
+static uint8_t slip_has_deadline(slip_channel* ch)
+{
+	return ch->slip_clock != NULL && ch->rx_timeout != 0 && ch->rx_timeout != SLIP_RX_BLOCKING;
+}
+
+/***********************************************************/
+/*
+ * pulls the next block of received bytes into 'rx_buf'.
+ * the per-byte functions fill up a single byte.
+ * returns 0 on timeout.
+ */
+static uint8_t slip_fill(slip_channel* ch)
+{
+	uint16_t timeout = ch->rx_timeout;
+	int32_t left;
+
+	ch->rx_pos = 0;
+	ch->rx_len = 0;
+
+	do
+	{
+		// what is left of the call's deadline [ms]
+		if (slip_has_deadline (ch))
+		{
+			left = (int32_t)(ch->rx_deadline - ch->slip_clock ());
+			if (left <= 0)
+			{
+				break;
+			}
+			timeout = (uint16_t)((left + 999) / 1000);
+		}
+
+		if (ch->slip_read_buf != NULL)
+		{
+			ch->rx_len = ch->slip_read_buf (ch->io_ctx, ch->rx_buf, SLIP_RX_BLOCK, timeout);
+		}
+		else if (ch->slip_get_char == NULL)
+		{
+			// the per-byte timeout is 8-bit
+			ch->rx_len = ch->slip_get_char_to((timeout > 0xff) ? 0xff : timeout, ch->rx_buf);
+		}
+		else
+		{
+			ch->rx_buf[0] = (ch->slip_get_char) ();
+			ch->rx_len = 1;
+		}
+
+		// a read that gave up early waits again until the deadline
+	} while (ch->rx_len == 0 && slip_has_deadline (ch));
+
+	SLIP_STAT_ADD (ch->rx_wire, ch->rx_len);
+	return ch->rx_len != 0;
 }
 
 /***********************************************************/
-uint8_t slip_rx(slip_channel* ch, uint8_t* buffer, uint8_t len)
+/*
+ * sends the code byte and the collected COBS block
+ */
+static void slip_tx_cobs_block(slip_channel* ch, uint8_t code)
 {
-	uint8_t bytes_read_so_far = 0;
-	uint8_t c = 0;
-    
+	uint16_t i = 0;
+	uint16_t n;
+
+	if (ch->tx_len == SLIP_TX_BLOCK)
+	{
+		slip_flush (ch);
+	}
+	ch->tx_buf[ch->tx_len++] = code;
+
+	while (i < ch->cobs_len)
+	{
+		if (ch->tx_len == SLIP_TX_BLOCK)
+		{
+			slip_flush (ch);
+		}
+		n = SLIP_TX_BLOCK - ch->tx_len;
+		if (n > ch->cobs_len - i) n = ch->cobs_len - i;
+
+		memcpy (ch->tx_buf + ch->tx_len, ch->cobs_block + i, n);
+		ch->tx_len += n;
+		i += n;
+	}
+
+	ch->cobs_len = 0;
+}
+
+/***********************************************************/
+/*
+ * collects the bytes of a COBS frame into blocks. a block is
+ * sent when a zero ends it or when it's full - the code byte
+ * (its length) goes before it
+ */
+static void slip_tx_cobs(slip_channel* ch, uint8_t* buffer, uint16_t len)
+{
+	uint8_t* zero;
+	uint16_t n;
+
+	while (len)
+	{
+		n = SLIP_COBS_BLOCK - ch->cobs_len;
+		if (n > len) n = len;
+		zero = memchr (buffer, 0, n);
+		if (zero != NULL) n = zero - buffer;
+
+		memcpy (ch->cobs_block + ch->cobs_len, buffer, n);
+		ch->cobs_len += n;
+		buffer += n;
+		len -= n;
+
+		if (zero != NULL)
+		{
+			// the code byte takes the place of the zero
+			slip_tx_cobs_block (ch, ch->cobs_len + 1);
+			buffer++;
+			len--;
+		}
+		else if (ch->cobs_len == SLIP_COBS_BLOCK)
+		{
+			SLIP_STAT_ADD (ch->tx_escapes, 1);
+			slip_tx_cobs_block (ch, 0xff);
+		}
+	}
+}
+
+/***********************************************************/
+/*
+ * encodes the bytes of a frame into 'tx_buf' - SLIP or COBS
+ */
+static void slip_tx_data(slip_channel* ch, uint8_t* buffer, uint16_t len)
+{
+	uint16_t chunk;
+	uint16_t n;
+
+	if (ch->framing == SLIP_FRAMING_COBS)
+	{
+		slip_tx_cobs (ch, buffer, len);
+		return;
+	}
+
+	// encode as much as surely fits into the block (every
+	// byte might be escaped) and hand full blocks over
+	while (len)
+	{
+		chunk = (SLIP_TX_BLOCK - ch->tx_len) / 2;
+		if (chunk < 16 && chunk < len && ch->tx_len)
+		{
+			slip_flush (ch);
+			continue;
+		}
+		if (chunk > len) chunk = len;
+		
+		n = slip_encode (buffer, chunk, ch->tx_buf + ch->tx_len, SLIP_MSG_MIDDLE);
+		SLIP_STAT_ADD (ch->tx_escapes, n - chunk);
+		ch->tx_len += n;
+		buffer += chunk;
+		len -= chunk;
+	}
+}
+
+#if SLIP_FEC
+/***********************************************************/
+/*
+ * sends the parity of the FEC block and starts the next one
+ */
+static void slip_tx_fec_parity(slip_channel* ch)
+{
+	slip_tx_data (ch, ch->fec_parity, ch->fec.nroots);
+	memset (ch->fec_parity, 0, ch->fec.nroots);
+	ch->fec_len = 0;
+}
+
+/***********************************************************/
+/*
+ * the bytes of a FEC frame - they are sent as they are and
+ * added to the parity. a full block is followed by its parity
+ */
+static void slip_tx_fec(slip_channel* ch, uint8_t* buffer, uint16_t len)
+{
+	uint16_t n;
+
+	while (len)
+	{
+		n = SLIP_FEC_DATA(ch->fec.nroots) - ch->fec_len;
+		if (n > len) n = len;
+
+		rs_encode (&ch->fec, ch->fec_parity, buffer, n);
+		slip_tx_data (ch, buffer, n);
+		ch->fec_len += n;
+		buffer += n;
+		len -= n;
+
+		if (ch->fec_len == SLIP_FEC_DATA(ch->fec.nroots))
+		{
+			slip_tx_fec_parity (ch);
+		}
+	}
+}
+#endif
+
+/***********************************************************/
+uint16_t slip_rx(slip_channel* ch, uint8_t* buffer, uint16_t len)
+{
+	slip_decoder d;
+#if SLIP_FEC
+	uint16_t n;
+	int corrected;
+#endif
+
 	// check the initialization of the get function
-	if (ch->slip_get_char == NULL && ch->slip_get_char_to == NULL)
+	if (ch->slip_get_char == NULL && ch->slip_get_char_to == NULL && ch->slip_read_buf == NULL)
 	{
 		return 0;
 	}
-	
-	// run over the bytes and try to fill up the buffer
+
+	// a FEC frame is collected with its parity and corrected
+	// before it's handed over
+#if SLIP_FEC
+	if (ch->fec.nroots)
+	{
+		slip_decoder_init (&d, ch->fec_buf, sizeof(ch->fec_buf));
+	}
+	else
+#endif
+	{
+		slip_decoder_init (&d, buffer, len);
+	}
+	slip_decoder_set_framing (&d, ch->framing);
+
+	// the bytes of the line don't extend the wait
+	if (slip_has_deadline (ch))
+	{
+		ch->rx_deadline = ch->slip_clock () + (uint32_t)ch->rx_timeout * 1000;
+	}
+
+	// run over the blocks and try to fill up the buffer. if we reach
+	// the end of the buffer, the decoder stops writing into it and just
+	// exhousts the frame until its end. The layer over this layer should
+	// check that the buffer contains a proper information (crc?)
 	while (1)
 	{
-		// read a character
-        if (ch->slip_get_char == NULL)
-        {
-            if (!ch->slip_get_char_to(SLIP_RX_TIMEOUT, &c))
-            {
-                // waited and a timeout occured
-                return bytes_read_so_far;
-            }
-        }
-        else c = (ch->slip_get_char) ();
-		
-		switch (c)
-		{
-			//==========================================================/
-			case SLIP_END:
-				// The end of a transmission. If the end comes without
-				// any input bytes, don't return - try to read the next
-				// transmission that actually means something
-				if (bytes_read_so_far)
-				{
-					return bytes_read_so_far;
-				}
-				else
-				{
-					break;
-				}
-				
-			//==========================================================/
-			case SLIP_ESC:
-				// if it's the same code as the ESC character, wait
-				// and get another character and then figure out what
-				// to store in the packet.
-                if (ch->slip_get_char == NULL)
-                {
-                    if (!ch->slip_get_char_to(SLIP_RX_TIMEOUT, &c))
-                    {
-                        // waited and a timeout occured
-                        return bytes_read_so_far;
-                    }
-                }
-                else c = (ch->slip_get_char) ();
-				
-				// check if 'c' if one of the two possible combinations.
-				// if none of them complies, just push everything into
-				// the buffer - it was a violation but what can we do.
-				if (c==SLIP_DATA_END) c = SLIP_END;
-				else if (c==SLIP_DATA_ESC) c = SLIP_ESC;
-			
-				// the 'c' from here goes to the default part
-				
-			//==========================================================/
-			default:
-				// if we reached the end of the buffer, we stop writing
-				// into it and just exhoust the frame until its end 
-				// (read more and more characters untill we get END)
-				// The layer over this layer should check that the buffer
-				// contains a proper information (crc?)
-				if (bytes_read_so_far<len)
-				{
-					buffer[bytes_read_so_far++] = c;
-				}
-		}
-	}
-	
-	// we shouldn't get here anyway
-	return bytes_read_so_far;
+		// read a block - the rest of the last block first
+		if (ch->rx_pos == ch->rx_len && !slip_fill (ch))
+		{
+			// waited and a timeout occured
+			break;
+		}
+
+		ch->rx_pos += slip_decode (&d, ch->rx_buf + ch->rx_pos, ch->rx_len - ch->rx_pos);
+
+		// The end of a transmission. Ends without any input bytes
+		// are skipped by the decoder
+		if (d.complete)
+		{
+			break;
+		}
+	}
+
+#if SLIP_FEC
+	if (!ch->fec.nroots)
+#endif
+	{
+		return d.len;
+	}
+#if SLIP_FEC
+
+	// a frame cut by the timeout isn't worth the correction
+	n = d.len;
+	if (d.complete)
+	{
+		n = slip_fec_correct (&ch->fec, ch->fec_buf, d.len, &corrected);
+		if (corrected < 0) SLIP_STAT_ADD (ch->rx_fec_failed, 1);
+		else SLIP_STAT_ADD (ch->rx_fec_corrected, corrected);
+	}
+	if (n > len) n = len;
+	memcpy (buffer, ch->fec_buf, n);
+	return n;
+#endif
 }
 
 
@@ -105,58 +434,71 @@ uint8_t slip_rx(slip_channel* ch, uint8_t* buffer, uint8_t len)
 uint8_t slip_tx(slip_channel* ch, uint8_t* buffer, uint8_t len, uint8_t start_end)
 {
 	uint8_t bytes_written = len;
-	
+
 	// check the initialization of the put function
-	if (ch->slip_put_char == NULL)
+	if (ch->slip_put_char == NULL && ch->slip_write_buf == NULL)
 	{
 		return 0;
 	}
-	
+
+	SLIP_STAT_ADD (ch->tx_bytes, len);
+
 	// Send an initial END character to flush out any data
 	// that may have accumulated in the receiver (line noise)
 	if (start_end&SLIP_MSG_START)
 	{
-		ch->slip_put_char (SLIP_END);
-	}
-	
-	// for each byte send an appripriate byte sequence
-	while (len--)
-	{
-		switch (*buffer) 
+		if (ch->tx_len == SLIP_TX_BLOCK)
 		{
-			//==========================================================/
-			case SLIP_END:
-				// if it the same character as END we need to send 
-				// a sequence 'ESC'+'DATA_END'
-				ch->slip_put_char (SLIP_ESC);
-				ch->slip_put_char (SLIP_DATA_END);
-				break;
-				
-			//==========================================================/
-			case SLIP_ESC:
-				// if it the same code as ESC, write the sequence 'ESC'+
-				// +'DATA_ESC'
-				ch->slip_put_char (SLIP_ESC);
-				ch->slip_put_char (SLIP_DATA_ESC);
-				break;
-				
-			//==========================================================/
-			default:
-				// otherwise just send the character as it is
-				ch->slip_put_char (*buffer);
+			slip_flush (ch);
 		}
-		
-		// go to the next byte
-		buffer ++;
+		ch->tx_buf[ch->tx_len++] = (ch->framing == SLIP_FRAMING_COBS) ? SLIP_COBS_END : SLIP_END;
+		ch->cobs_len = 0;
+#if SLIP_FEC
+		if (ch->fec.nroots)
+		{
+			memset (ch->fec_parity, 0, ch->fec.nroots);
+			ch->fec_len = 0;
+		}
+#endif
+	}
+
+#if SLIP_FEC
+	if (ch->fec.nroots)
+	{
+		slip_tx_fec (ch, buffer, len);
+	}
+	else
+#endif
+	{
+		slip_tx_data (ch, buffer, len);
 	}
-	
-	// send the END byte to end the frame
+
+	// send the END byte to end the frame and hand the
+	// whole thing to the transport
 	if (start_end&SLIP_MSG_END)
 	{
-		ch->slip_put_char (SLIP_END);
+#if SLIP_FEC
+		// the parity of the last FEC block
+		if (ch->fec.nroots && ch->fec_len)
+		{
+			slip_tx_fec_parity (ch);
+		}
+#endif
+		if (ch->framing == SLIP_FRAMING_COBS)
+		{
+			// the last block - no zero behind it
+			SLIP_STAT_ADD (ch->tx_escapes, 1);
+			slip_tx_cobs_block (ch, ch->cobs_len + 1);
+		}
+		if (ch->tx_len == SLIP_TX_BLOCK)
+		{
+			slip_flush (ch);
+		}
+		ch->tx_buf[ch->tx_len++] = (ch->framing == SLIP_FRAMING_COBS) ? SLIP_COBS_END : SLIP_END;
+		SLIP_STAT_ADD (ch->tx_frames, 1);
+		slip_flush (ch);
 	}
-	
+
 	return bytes_written;
 }
 
-
@@ -2,6 +2,7 @@
 #define __SLIP_H__
 
 #include "spec_types.h"
+#include "rs.h"
 
 /*! \file slip.h
  * \brief Data-link layer
@@ -16,6 +17,31 @@
  *	|------------------------------------------------------------|----------|
  *  | N bytes                                                    |   8 bit  |
  *
+ * Alternatively a channel frames with COBS (Consistent Overhead
+ * Byte Stuffing, 'slip_set_framing'). The frame is cut at its zero
+ * bytes into blocks, every block is sent as a code byte (its length
+ * + 1) and its bytes without the zero; a block of 254 bytes without
+ * a zero has the code 0xff and no zero behind it. The zero byte
+ * ends the frame (SLIP_COBS_END):
+ *
+ *	| code | up to 254 non-zero bytes | code | ... | END byte (0x00) |
+ *
+ * SLIP adds a byte for every END/ESC byte of the frame - up to twice
+ * its size for binary data. COBS adds a byte per 254 bytes at most,
+ * so the length on the wire is known up front. Both sides of a
+ * channel have to use the same framing.
+ *
+ * A channel can protect its frames with a Reed-Solomon code (rs.h,
+ * 'slip_set_fec') under either framing. The parity of every
+ * SLIP_FEC_DATA bytes of a frame follows them, and the parity of
+ * the rest goes before the END byte. The receiver corrects up to
+ * nroots / 2 wrong bytes in every block of the frame. A frame
+ * beyond repair is returned as it is (without the parity) - the
+ * checking of the layer above rejects it. Errors that break the
+ * framing itself (a byte turned into END, a lost ESC) can't be
+ * corrected. The FEC costs a channel some 400 bytes - SLIP_FEC 0
+ * compiles it out.
+ *
  */
 
 
@@ -23,7 +49,97 @@
 #define	SLIP_DATA_END	220		/**< D_END byte (0xdc) - the pair ESC+DATA_END = END */
 #define	SLIP_DATA_ESC	221 	/**< D_ESC byte (0xdd) - stuffing ASC+DATA_ESC = ESC */
 #define	SLIP_ESC		219 	/**< ESC byte (0xdb) - stuffing before middle END/ESC */
+#define	SLIP_COBS_END	0		/**< COBS END byte - message ending */
+#define	SLIP_COBS_BLOCK	254		/**< the longest COBS block (the code 0xff) */
 #define SLIP_RX_TIMEOUT 50      /**< number of milliseconds to wait for a single byte rx */
+#define SLIP_RX_BLOCKING 0xffff /**< 'fn_read_buf' timeout meaning 'wait forever' */
+
+/*! \def SLIP_TX_BLOCK
+ * \brief The size of the encoding buffer handed to 'fn_write_buf' at once
+ */
+#ifndef SLIP_TX_BLOCK
+#define SLIP_TX_BLOCK	128
+#endif
+
+/*! \def SLIP_RX_BLOCK
+ * \brief The size of the block pulled from 'fn_read_buf' at once
+ */
+#ifndef SLIP_RX_BLOCK
+#define SLIP_RX_BLOCK	64
+#endif
+
+/*! \def SLIP_FEC
+ * \brief The Reed-Solomon code of the frames - 0 compiles it out
+ * ('slip_set_fec' accepts no parity then)
+ */
+#ifndef SLIP_FEC
+#define SLIP_FEC		1
+#endif
+
+/*! \def SLIP_FEC_FRAME
+ * \brief The longest frame a FEC channel receives
+ */
+#ifndef SLIP_FEC_FRAME
+#define SLIP_FEC_FRAME	256
+#endif
+
+/*! \def SLIP_FEC_DATA
+ * \brief The frame bytes protected by a block of 'nroots' parity bytes
+ */
+#define SLIP_FEC_DATA(nroots)	(RS_BLOCK-(nroots))
+
+/*! \def SLIP_FEC_ENCODED_MAX
+ * \brief The worst case size of a 'len' bytes long frame with its
+ * parity (before the framing)
+ */
+#if SLIP_FEC
+#define SLIP_FEC_ENCODED_MAX(len)	((len)+((len)/SLIP_FEC_DATA(RS_MAX_PARITY)+1)*RS_MAX_PARITY)
+#else
+#define SLIP_FEC_ENCODED_MAX(len)	(len)
+#endif
+
+/*! \def SLIP_FEC_NROOTS
+ * \brief The parity bytes of a block of a channel ('slip_set_fec')
+ */
+#if SLIP_FEC
+#define SLIP_FEC_NROOTS(ch)		((ch)->fec.nroots)
+#else
+#define SLIP_FEC_NROOTS(ch)		0
+#endif
+
+/*! \def SLIP_STATS
+ * \brief The link counters (slip and dProt) - 0 compiles them out
+ */
+#ifndef SLIP_STATS
+#define SLIP_STATS		1
+#endif
+
+/*! \def SLIP_STAT_ADD
+ * \brief Adds to a counter. Every counter has a single writer (the
+ * thread driving the link) - the relaxed atomic store keeps it a
+ * plain add, while a snapshot from another thread still reads whole
+ * values.
+ */
+#if SLIP_STATS && defined(__GNUC__)
+#define SLIP_STAT_ADD(counter, n)	__atomic_store_n (&(counter), __atomic_load_n (&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#elif SLIP_STATS
+#define SLIP_STAT_ADD(counter, n)	((counter) += (n))
+#else
+#define SLIP_STAT_ADD(counter, n)	((void)0)
+#endif
+
+/*! \def SLIP_ENCODED_MAX
+ * \brief The worst case encoded size of 'len' bytes in either
+ * framing - every byte escaped and END bytes on both sides (an
+ * empty COBS frame takes a code byte too)
+ */
+#define SLIP_ENCODED_MAX(len)	(2*(len)+3)
+
+/*! \def SLIP_COBS_ENCODED_MAX
+ * \brief The worst case COBS encoded size of 'len' bytes - a code
+ * byte per started block and END bytes on both sides
+ */
+#define SLIP_COBS_ENCODED_MAX(len)	((len)+(len)/SLIP_COBS_BLOCK+3)
 
 /*********************************************************/
 /*! slip message sending stages
@@ -39,6 +155,55 @@ enum
 };
 
 
+/*********************************************************/
+/*! framing of a channel
+ */
+enum
+{
+	SLIP_FRAMING_SLIP = 0x00,   /**< END/ESC byte stuffing (the default) */
+	SLIP_FRAMING_COBS = 0x01    /**< consistent overhead byte stuffing */
+};
+
+
+/*********************************************************/
+/*! slip block encoding kernels
+ * The x86 SIMD kernels are chosen at runtime according
+ * to the cpu. All the kernels produce the same bytes.
+ */
+enum
+{
+	SLIP_KERNEL_AUTO = 0x00,    /**< the fastest kernel the cpu supports */
+	SLIP_KERNEL_SCALAR = 0x01,  /**< byte by byte */
+	SLIP_KERNEL_SSE2 = 0x02,    /**< 16 bytes at a time */
+	SLIP_KERNEL_AVX2 = 0x03     /**< 32 bytes at a time */
+};
+
+
+/*********************************************************/
+/*! \struct slip_decoder
+ * The state of the block decoder - the frame collected so
+ * far, including an ESC that ended the previous block (or
+ * the rest of a COBS block). Bytes beyond 'size' are
+ * dropped until the frame ends (like 'slip_rx' does).
+ */
+typedef struct
+{
+    uint8_t* buffer;        /**< preallocated frame buffer */
+    uint16_t size;          /**< the size of 'buffer' */
+    uint16_t len;           /**< the number of bytes in 'buffer' */
+    uint8_t esc;            /**< the last block ended with ESC */
+    uint8_t complete;       /**< 'buffer' holds a whole frame */
+    uint8_t framing;        /**< SLIP_FRAMING_XXX */
+    uint8_t code;           /**< COBS - the bytes left in the block */
+    uint8_t zero;           /**< COBS - a zero follows the block (unless the frame ends) */
+#if SLIP_FEC
+    rs_code fec;            /**< the code of the frames, 'nroots' 0 without FEC */
+#endif
+    uint32_t fec_corrected; /**< the bytes corrected */
+    uint32_t fec_failed;    /**< the frames beyond repair */
+} slip_decoder;
+
+
 /*********************************************************/
 /*! \struct slip_channel
  * This structure defines the physical channel as 3 kinds
@@ -46,12 +211,45 @@ enum
  * and receiving a byte (timeouted).
  * The required functions for most applications are 
  * 'slip_put_char' and one of the receiving.
+ * Alternatively the channel is defined by a pair of bulk
+ * functions - writing a buffer and reading a block. The
+ * encoded frames are collected in 'tx_buf' and handed to
+ * the transport in blocks, the received blocks are kept in
+ * 'rx_buf' until they are decoded. The per-byte functions
+ * are adapted to the same buffers.
  */
 typedef struct
 {
     fn_put_char slip_put_char;
     fn_get_char slip_get_char;
     fn_get_char_to slip_get_char_to;
+    fn_write_buf slip_write_buf;
+    fn_read_buf slip_read_buf;
+    void* io_ctx;                   /**< the context of the bulk functions */
+    fn_clock_us slip_clock;         /**< makes 'rx_timeout' a deadline of 'slip_rx' ('slip_set_clock') */
+    uint16_t rx_timeout;            /**< the 'slip_rx' timeout [ms] - of every block read without a clock ('fn_get_char_to' up to 255) */
+    uint32_t rx_deadline;           /**< the clock when the 'slip_rx' call times out */
+    uint16_t tx_len;
+    uint16_t rx_pos;
+    uint16_t rx_len;
+    uint32_t tx_frames;             /**< frames sent */
+    uint32_t tx_bytes;              /**< their bytes before the encoding */
+    uint32_t tx_wire;               /**< the bytes handed to the transport */
+    uint32_t tx_escapes;            /**< the bytes added by the encoding (ESC, COBS codes) */
+    uint32_t rx_wire;               /**< the bytes read from the transport */
+    uint32_t rx_fec_corrected;      /**< the bytes corrected by the FEC */
+    uint32_t rx_fec_failed;         /**< the frames beyond its repair */
+    uint8_t framing;                /**< SLIP_FRAMING_XXX */
+    uint8_t cobs_len;               /**< the bytes in 'cobs_block' */
+    uint8_t tx_buf[SLIP_TX_BLOCK];
+    uint8_t rx_buf[SLIP_RX_BLOCK];
+    uint8_t cobs_block[SLIP_COBS_BLOCK]; /**< the COBS block being sent - its code isn't known yet */
+#if SLIP_FEC
+    uint8_t fec_len;                /**< the frame bytes in the FEC block being sent */
+    rs_code fec;                    /**< the code of the frames, 'nroots' 0 without FEC */
+    uint8_t fec_parity[RS_MAX_PARITY]; /**< the parity of the block being sent */
+    uint8_t fec_buf[SLIP_FEC_ENCODED_MAX(SLIP_FEC_FRAME)]; /**< the received frame with its parity */
+#endif
 } slip_channel;
 
 /***********************************************************/
@@ -72,6 +270,76 @@ uint8_t slip_init(fn_put_char put_function,
                   slip_channel* ch);
 
 
+/*!
+ * \brief initialize slip datalink layer over a bulk transport
+ *
+ * \param write_function the buffer writing function
+ * \param read_function the block reading function
+ * \param io_ctx the context passed to both functions
+ * \param rx_timeout the read timeout [ms] or SLIP_RX_BLOCKING
+ * \param ch a preallocated 'slip_channel' structure to contain the channel information
+ 
+ * \return result - success(0), failure (otherwise)
+ */
+uint8_t slip_init_buf(fn_write_buf write_function,
+                      fn_read_buf read_function,
+                      void* io_ctx,
+                      uint16_t rx_timeout,
+                      slip_channel* ch);
+
+
+/*!
+ * \brief Choose the framing of a channel (SLIP after the init)
+ *
+ * \param ch pre-initialized channel
+ * \param framing one of the SLIP_FRAMING_XXX values
+ *
+ * \return result - success(0), failure (otherwise - unknown framing)
+ */
+uint8_t slip_set_framing(slip_channel* ch, uint8_t framing);
+
+
+/*!
+ * \brief Set the clock of a channel's receive timeout
+ * Without a clock every block (byte) read waits 'rx_timeout' - the
+ * bytes of line noise keep a 'slip_rx' call waiting. With a clock
+ * 'rx_timeout' is the deadline of the whole call, and the per-byte
+ * reads wait past 255 ms.
+ *
+ * \param ch pre-initialized channel
+ * \param clock the microsecond clock, NULL for the timeout per read
+ *
+ * \return result - success(0)
+ */
+uint8_t slip_set_clock(slip_channel* ch, fn_clock_us clock);
+
+
+/*!
+ * \brief Protect the frames of a channel by a Reed-Solomon code
+ * Both sides of the channel have to use the same code.
+ *
+ * \param ch pre-initialized channel
+ * \param nroots the parity bytes of a block (up to RS_MAX_PARITY,
+ * nroots / 2 bytes corrected), 0 turns the FEC off (after the init)
+ *
+ * \return result - success(0), failure (otherwise - bad 'nroots',
+ * or any parity without SLIP_FEC)
+ */
+uint8_t slip_set_fec(slip_channel* ch, uint8_t nroots);
+
+/*!
+ * \brief Correct a received frame and strip its parity
+ *
+ * \param rs the code
+ * \param frame the frame with its parity, corrected in place
+ * \param len the amount of bytes in 'frame'
+ * \param corrected the bytes corrected, -1 if the frame is beyond repair
+ *
+ * \return the length of the frame without the parity
+ */
+uint16_t slip_fec_correct(const rs_code* rs, uint8_t* frame, uint16_t len, int* corrected);
+
+
 /*!
  * \brief receive data from the channel
  *
@@ -81,7 +349,7 @@ uint8_t slip_init(fn_put_char put_function,
  *
  * \return the amount of data read before framing (or timeout) occured
  */
-uint8_t slip_rx(slip_channel* ch, uint8_t* buffer, uint8_t len);
+uint16_t slip_rx(slip_channel* ch, uint8_t* buffer, uint16_t len);
 
 /*!
  * \brief Send data to the channel
@@ -91,9 +359,120 @@ uint8_t slip_rx(slip_channel* ch, uint8_t* buffer, uint8_t len);
  * \param len the amount of data to be sent from the 'buffer'
  * \param start_end the stage of sending a frame
  *
+ * The encoded data is collected in the channel and handed to
+ * the transport when the buffer fills up and on SLIP_MSG_END.
+ * With COBS the bytes wait in the channel until their block is
+ * complete (a zero, 254 bytes or the end of the frame).
+ *
  * \return the amount of data actually sent
  */
 uint8_t slip_tx(slip_channel* ch, uint8_t* buffer, uint8_t len, uint8_t start_end);
 
+/*!
+ * \brief Encode a buffer into a contiguous output buffer
+ * Produces exactly the bytes 'slip_tx' sends for the same
+ * 'start_end' stage. Runs of bytes without END/ESC are
+ * found 16/32 bytes at a time and copied as they are.
+ *
+ * \param in the data to be encoded
+ * \param len the amount of data in 'in'
+ * \param out preallocated buffer of at least SLIP_ENCODED_MAX(len) bytes
+ * \param start_end the stage of sending a frame
+ *
+ * \return the number of bytes written to 'out'
+ */
+uint16_t slip_encode(uint8_t* in, uint16_t len, uint8_t* out, uint8_t start_end);
+
+/*!
+ * \brief COBS encode a frame into a contiguous output buffer
+ * Produces exactly the bytes 'slip_tx' sends over a COBS channel
+ * when the frame is given with the same 'start_end' stages - the
+ * blocks end within 'in', only the END bytes depend on the stage.
+ * The zero bytes are found by memchr and the blocks are copied as
+ * they are.
+ *
+ * \param in the frame to be encoded
+ * \param len the amount of data in 'in'
+ * \param out preallocated buffer of at least SLIP_COBS_ENCODED_MAX(len) bytes
+ * \param start_end SLIP_MSG_START/SLIP_MSG_END add the END bytes
+ *
+ * \return the number of bytes written to 'out'
+ */
+uint16_t slip_cobs_encode(uint8_t* in, uint16_t len, uint8_t* out, uint8_t start_end);
+
+/*!
+ * \brief Initialize a block decoder (SLIP framing)
+ *
+ * \param d the decoder state
+ * \param buffer preallocated buffer for the decoded frames
+ * \param size the size of 'buffer'
+ */
+void slip_decoder_init(slip_decoder* d, uint8_t* buffer, uint16_t size);
+
+/*!
+ * \brief Choose the framing a block decoder reads
+ *
+ * \param d the decoder state - between the frames
+ * \param framing one of the SLIP_FRAMING_XXX values
+ *
+ * \return result - success(0), failure (otherwise - unknown framing)
+ */
+uint8_t slip_decoder_set_framing(slip_decoder* d, uint8_t framing);
+
+/*!
+ * \brief Correct the frames of a block decoder ('slip_set_fec')
+ * The frames are returned without their parity - 'buffer' needs
+ * room for SLIP_FEC_ENCODED_MAX bytes of the longest frame.
+ *
+ * \param d the decoder state - between the frames
+ * \param nroots the parity bytes of a block, 0 for none (after the init)
+ *
+ * \return result - success(0), failure (otherwise - bad 'nroots',
+ * or any parity without SLIP_FEC)
+ */
+uint8_t slip_decoder_set_fec(slip_decoder* d, uint8_t nroots);
+
+/*!
+ * \brief Decode a block of received bytes
+ * Decodes up to the end of the first frame found in the block.
+ * Runs of bytes without END/ESC are found 16/32 bytes at a
+ * time and copied as they are. An ESC+DATA_END/DATA_ESC pair
+ * may be split between blocks. When 'complete' is set the
+ * frame is in 'buffer' ('len' bytes) - the next call starts
+ * a new frame. A COBS decoder ('slip_decoder_set_framing')
+ * copies the blocks up to their end or a zero byte - an END
+ * within a block ends the frame cut short (the checking of
+ * the layer above catches it).
+ *
+ * \param d the decoder state
+ * \param in the received bytes
+ * \param len the amount of bytes in 'in'
+ *
+ * \return the number of bytes consumed from 'in'
+ */
+uint16_t slip_decode(slip_decoder* d, uint8_t* in, uint16_t len);
+
+/*!
+ * \brief Decode a block of received COBS bytes
+ * The COBS part of 'slip_decode' - for a decoder of any framing.
+ *
+ * \param d the decoder state
+ * \param in the received bytes
+ * \param len the amount of bytes in 'in'
+ *
+ * \return the number of bytes consumed from 'in'
+ */
+uint16_t slip_cobs_decode(slip_decoder* d, uint8_t* in, uint16_t len);
+
+/*!
+ * \brief Choose the block encoding/decoding kernel
+ *
+ * \param kernel one of the SLIP_KERNEL_XXX values
+ *
+ * \return the kernel in use - SLIP_KERNEL_SCALAR if the requested
+ * one isn't supported by the cpu
+ */
+uint8_t slip_set_kernel(uint8_t kernel);
+
 #endif //__SLIP_H__
 
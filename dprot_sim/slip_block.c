@@ -0,0 +1,413 @@
+#include "slip.h"
+
+/*
+ * Block (buffer to buffer) SLIP coding. Most of the payloads
+ * don't contain END/ESC bytes at all, thus the SIMD kernels
+ * look for them 16/32 bytes at a time and the clean runs are
+ * copied as they are.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SLIP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef uint16_t (*fn_slip_encode)(uint8_t* in, uint16_t len, uint8_t* out);
+typedef uint16_t (*fn_slip_run)(uint8_t* in, uint16_t len, uint8_t* out, uint16_t room);
+
+static fn_slip_encode slip_encode_kernel = NULL;
+static fn_slip_run slip_run_kernel = NULL;
+
+/***********************************************************/
+static uint16_t slip_encode_scalar(uint8_t* in, uint16_t len, uint8_t* out)
+{
+	uint8_t* o = out;
+
+	while (len--)
+	{
+		switch (*in)
+		{
+			case SLIP_END:
+				*o++ = SLIP_ESC;
+				*o++ = SLIP_DATA_END;
+				break;
+
+			case SLIP_ESC:
+				*o++ = SLIP_ESC;
+				*o++ = SLIP_DATA_ESC;
+				break;
+
+			default:
+				*o++ = *in;
+		}
+		in++;
+	}
+
+	return o - out;
+}
+
+/***********************************************************/
+/*
+ * the run kernels copy the bytes up to the first END/ESC into
+ * 'out' (at most 'room' bytes) and return the length of the
+ * run - 'len' if there is no END/ESC at all.
+ */
+static uint16_t slip_run_scalar(uint8_t* in, uint16_t len, uint8_t* out, uint16_t room)
+{
+	uint16_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (in[i] == SLIP_END || in[i] == SLIP_ESC) break;
+		if (i < room) out[i] = in[i];
+	}
+	return i;
+}
+
+#ifdef SLIP_X86_SIMD
+/***********************************************************/
+/*
+ * Whole vectors are stored while they fit into 'room' - the
+ * bytes stored after the run are overwritten later or lay
+ * beyond the frame. The copy is done here and not by memcpy,
+ * the AVX library memcpy makes the legacy SSE code stall.
+ */
+__attribute__((target("sse2")))
+static uint16_t slip_run_sse2(uint8_t* in, uint16_t len, uint8_t* out, uint16_t room)
+{
+	const __m128i end = _mm_set1_epi8((char)SLIP_END);
+	const __m128i esc = _mm_set1_epi8((char)SLIP_ESC);
+	uint16_t i = 0;
+	uint32_t mask;
+	__m128i v;
+
+	for (; i + 16 <= len && i + 16 <= room; i += 16)
+	{
+		v = _mm_loadu_si128((__m128i*)(in + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, end), _mm_cmpeq_epi8(v, esc)));
+		_mm_storeu_si128((__m128i*)(out + i), v);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	return i + slip_run_scalar(in + i, len - i, out + i, (room > i) ? room - i : 0);
+}
+
+/***********************************************************/
+__attribute__((target("avx2")))
+static uint16_t slip_run_avx2(uint8_t* in, uint16_t len, uint8_t* out, uint16_t room)
+{
+	const __m256i end = _mm256_set1_epi8((char)SLIP_END);
+	const __m256i esc = _mm256_set1_epi8((char)SLIP_ESC);
+	uint16_t i = 0;
+	uint32_t mask;
+	__m256i v;
+	__m128i t;
+
+	for (; i + 32 <= len && i + 32 <= room; i += 32)
+	{
+		v = _mm256_loadu_si256((__m256i*)(in + i));
+		mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, end), _mm256_cmpeq_epi8(v, esc)));
+		_mm256_storeu_si256((__m256i*)(out + i), v);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+
+	// VEX encoded 16 bytes - no SSE/AVX transition
+	if (i + 16 <= len && i + 16 <= room)
+	{
+		t = _mm_loadu_si128((__m128i*)(in + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(t, _mm256_castsi256_si128(end)),
+											  _mm_cmpeq_epi8(t, _mm256_castsi256_si128(esc))));
+		_mm_storeu_si128((__m128i*)(out + i), t);
+		if (mask) return i + __builtin_ctz(mask);
+		i += 16;
+	}
+
+	return i + slip_run_scalar(in + i, len - i, out + i, (room > i) ? room - i : 0);
+}
+
+/***********************************************************/
+/*
+ * The vector is stored as it is and the output advances
+ * only up to the first END/ESC. The output buffer is big
+ * enough for the worst case, so the store never overflows.
+ */
+__attribute__((target("sse2")))
+static uint16_t slip_encode_sse2(uint8_t* in, uint16_t len, uint8_t* out)
+{
+	const __m128i end = _mm_set1_epi8((char)SLIP_END);
+	const __m128i esc = _mm_set1_epi8((char)SLIP_ESC);
+	uint8_t* o = out;
+	uint16_t i = 0;
+	uint32_t mask;
+	uint32_t n;
+	__m128i v;
+
+	while (i + 16 <= len)
+	{
+		v = _mm_loadu_si128((__m128i*)(in + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, end), _mm_cmpeq_epi8(v, esc)));
+		_mm_storeu_si128((__m128i*)o, v);
+
+		if (!mask)
+		{
+			o += 16;
+			i += 16;
+			continue;
+		}
+
+		// copy up to the special byte and escape it
+		n = __builtin_ctz(mask);
+		o += n;
+		i += n;
+		*o++ = SLIP_ESC;
+		*o++ = (in[i++] == SLIP_END) ? SLIP_DATA_END : SLIP_DATA_ESC;
+	}
+
+	return (o - out) + slip_encode_scalar(in + i, len - i, o);
+}
+
+/***********************************************************/
+__attribute__((target("avx2")))
+static uint16_t slip_encode_avx2(uint8_t* in, uint16_t len, uint8_t* out)
+{
+	const __m256i end = _mm256_set1_epi8((char)SLIP_END);
+	const __m256i esc = _mm256_set1_epi8((char)SLIP_ESC);
+	uint8_t* o = out;
+	uint16_t i = 0;
+	uint32_t mask;
+	uint32_t n;
+	__m256i v;
+	__m128i t;
+
+	while (i + 32 <= len)
+	{
+		v = _mm256_loadu_si256((__m256i*)(in + i));
+		mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, end), _mm256_cmpeq_epi8(v, esc)));
+		_mm256_storeu_si256((__m256i*)o, v);
+
+		if (!mask)
+		{
+			o += 32;
+			i += 32;
+			continue;
+		}
+
+		// copy up to the special byte and escape it
+		n = __builtin_ctz(mask);
+		o += n;
+		i += n;
+		*o++ = SLIP_ESC;
+		*o++ = (in[i++] == SLIP_END) ? SLIP_DATA_END : SLIP_DATA_ESC;
+	}
+
+	// the tail 16 bytes at a time - VEX encoded, calling the
+	// SSE2 kernel here would pay for the SSE/AVX transition
+	while (i + 16 <= len)
+	{
+		t = _mm_loadu_si128((__m128i*)(in + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(t, _mm256_castsi256_si128(end)),
+											  _mm_cmpeq_epi8(t, _mm256_castsi256_si128(esc))));
+		_mm_storeu_si128((__m128i*)o, t);
+
+		if (!mask)
+		{
+			o += 16;
+			i += 16;
+			continue;
+		}
+
+		n = __builtin_ctz(mask);
+		o += n;
+		i += n;
+		*o++ = SLIP_ESC;
+		*o++ = (in[i++] == SLIP_END) ? SLIP_DATA_END : SLIP_DATA_ESC;
+	}
+
+	return (o - out) + slip_encode_scalar(in + i, len - i, o);
+}
+#endif
+
+/***********************************************************/
+uint8_t slip_set_kernel(uint8_t kernel)
+{
+#ifdef SLIP_X86_SIMD
+	__builtin_cpu_init ();
+
+	if (kernel == SLIP_KERNEL_AUTO)
+	{
+		kernel = __builtin_cpu_supports ("avx2") ? SLIP_KERNEL_AVX2 : SLIP_KERNEL_SSE2;
+	}
+
+	if (kernel == SLIP_KERNEL_AVX2 && __builtin_cpu_supports ("avx2"))
+	{
+		slip_encode_kernel = slip_encode_avx2;
+		slip_run_kernel = slip_run_avx2;
+		return SLIP_KERNEL_AVX2;
+	}
+
+	if (kernel == SLIP_KERNEL_SSE2 && __builtin_cpu_supports ("sse2"))
+	{
+		slip_encode_kernel = slip_encode_sse2;
+		slip_run_kernel = slip_run_sse2;
+		return SLIP_KERNEL_SSE2;
+	}
+#endif
+
+	slip_encode_kernel = slip_encode_scalar;
+	slip_run_kernel = slip_run_scalar;
+	return SLIP_KERNEL_SCALAR;
+}
+
+/***********************************************************/
+uint16_t slip_encode(uint8_t* in, uint16_t len, uint8_t* out, uint8_t start_end)
+{
+	uint16_t n = 0;
+
+	if (slip_encode_kernel == NULL)
+	{
+		slip_set_kernel (SLIP_KERNEL_AUTO);
+	}
+
+	// an initial END flushes the receiver (see 'slip_tx')
+	if (start_end&SLIP_MSG_START)
+	{
+		out[n++] = SLIP_END;
+	}
+
+	n += slip_encode_kernel (in, len, out + n);
+
+	if (start_end&SLIP_MSG_END)
+	{
+		out[n++] = SLIP_END;
+	}
+
+	return n;
+}
+
+/***********************************************************/
+void slip_decoder_init(slip_decoder* d, uint8_t* buffer, uint16_t size)
+{
+	d->buffer = buffer;
+	d->size = size;
+	d->len = 0;
+	d->esc = 0;
+	d->complete = 0;
+	d->framing = SLIP_FRAMING_SLIP;
+	d->code = 0;
+	d->zero = 0;
+#if SLIP_FEC
+	d->fec.nroots = 0;
+#endif
+	d->fec_corrected = 0;
+	d->fec_failed = 0;
+}
+
+/***********************************************************/
+uint8_t slip_decoder_set_framing(slip_decoder* d, uint8_t framing)
+{
+	if (framing != SLIP_FRAMING_SLIP && framing != SLIP_FRAMING_COBS)
+	{
+		return 1;
+	}
+
+	d->framing = framing;
+	return 0;
+}
+
+/***********************************************************/
+uint8_t slip_decoder_set_fec(slip_decoder* d, uint8_t nroots)
+{
+#if SLIP_FEC
+	if (nroots == 0)
+	{
+		d->fec.nroots = 0;
+		return 0;
+	}
+
+	return rs_init (&d->fec, nroots);
+#else
+	(void)d;
+	return nroots != 0;
+#endif
+}
+
+/***********************************************************/
+static uint16_t slip_decode_slip(slip_decoder* d, uint8_t* in, uint16_t len)
+{
+	uint16_t i = 0;
+	uint16_t run;
+	uint8_t c;
+
+	if (slip_run_kernel == NULL)
+	{
+		slip_set_kernel (SLIP_KERNEL_AUTO);
+	}
+
+	// the last call returned a whole frame - start a new one
+	if (d->complete)
+	{
+		d->len = 0;
+		d->complete = 0;
+	}
+
+	while (i < len)
+	{
+		if (d->esc)
+		{
+			// the second byte of an escaped pair. anything else
+			// than DATA_END/DATA_ESC goes into the frame as it
+			// is - a violation, but what can we do (see 'slip_rx')
+			c = in[i++];
+			if (c==SLIP_DATA_END) c = SLIP_END;
+			else if (c==SLIP_DATA_ESC) c = SLIP_ESC;
+			d->esc = 0;
+
+			if (d->len < d->size) d->buffer[d->len++] = c;
+			continue;
+		}
+
+		// copy the run of plain bytes as it is. the bytes that
+		// don't fit are dropped until the frame ends
+		run = slip_run_kernel (in + i, len - i, d->buffer + d->len, d->size - d->len);
+		d->len = (run > d->size - d->len) ? d->size : d->len + run;
+		i += run;
+
+		if (i == len) break;
+
+		if (in[i++] == SLIP_ESC)
+		{
+			d->esc = 1;
+		}
+		else if (d->len)
+		{
+			// END of a non empty frame
+			d->complete = 1;
+			break;
+		}
+	}
+
+	return i;
+}
+
+/***********************************************************/
+uint16_t slip_decode(slip_decoder* d, uint8_t* in, uint16_t len)
+{
+	uint16_t i;
+#if SLIP_FEC
+	int corrected;
+#endif
+
+	i = (d->framing == SLIP_FRAMING_COBS) ? slip_cobs_decode (d, in, len) : slip_decode_slip (d, in, len);
+
+#if SLIP_FEC
+	// a whole FEC frame is corrected and its parity stripped
+	if (d->complete && d->fec.nroots)
+	{
+		d->len = slip_fec_correct (&d->fec, d->buffer, d->len, &corrected);
+		if (corrected < 0) d->fec_failed++;
+		else d->fec_corrected += corrected;
+	}
+#endif
+
+	return i;
+}
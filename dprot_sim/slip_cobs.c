@@ -0,0 +1,154 @@
+#include <string.h>
+#include "slip.h"
+
+/*
+ * Block (buffer to buffer) COBS coding. The blocks end at the
+ * zero bytes - memchr finds them (a vector loop in the library)
+ * and the non-zero runs are copied as they are.
+ */
+
+#define SLIP_COBS_SHORT		16	/**< the bytes looked at one by one before memchr */
+
+/***********************************************************/
+/*
+ * copies the bytes up to the first zero (at most 'len') and
+ * returns the length of the run. the first bytes are checked
+ * here - the call of memchr doesn't pay for short runs (text
+ * with zeros, binary records)
+ */
+static inline uint16_t slip_cobs_run(uint8_t* in, uint16_t len, uint8_t* out)
+{
+	uint16_t i;
+	uint8_t* zero;
+
+	for (i = 0; i < len && i < SLIP_COBS_SHORT; i++)
+	{
+		if (in[i] == 0) return i;
+		out[i] = in[i];
+	}
+	if (i == len) return i;
+
+	zero = memchr (in + i, 0, len - i);
+	if (zero != NULL) len = zero - in;
+	memcpy (out + i, in + i, len - i);
+	return len;
+}
+
+/***********************************************************/
+/*
+ * the length of the run up to the first zero (at most 'len')
+ */
+static inline uint16_t slip_cobs_scan(uint8_t* in, uint16_t len)
+{
+	uint8_t* zero = memchr (in, 0, len);
+
+	return (zero != NULL) ? zero - in : len;
+}
+
+/***********************************************************/
+uint16_t slip_cobs_encode(uint8_t* in, uint16_t len, uint8_t* out, uint8_t start_end)
+{
+	uint8_t* o = out;
+	uint16_t max;
+	uint16_t n;
+
+	// an initial END flushes the receiver (see 'slip_tx')
+	if (start_end&SLIP_MSG_START)
+	{
+		*o++ = SLIP_COBS_END;
+	}
+
+	// every frame ends with a block shorter than SLIP_COBS_BLOCK
+	// (an empty one after a zero or a full block)
+	while (1)
+	{
+		max = (len < SLIP_COBS_BLOCK) ? len : SLIP_COBS_BLOCK;
+		n = slip_cobs_run (in, max, o + 1);
+
+		*o = (n == SLIP_COBS_BLOCK) ? 0xff : n + 1;
+		o += n + 1;
+		in += n;
+		len -= n;
+
+		if (n < max)
+		{
+			// the zero is the end of the block
+			in++;
+			len--;
+		}
+		else if (n < SLIP_COBS_BLOCK)
+		{
+			break;
+		}
+	}
+
+	if (start_end&SLIP_MSG_END)
+	{
+		*o++ = SLIP_COBS_END;
+	}
+
+	return o - out;
+}
+
+/***********************************************************/
+uint16_t slip_cobs_decode(slip_decoder* d, uint8_t* in, uint16_t len)
+{
+	uint16_t i = 0;
+	uint16_t n;
+	uint16_t max;
+	uint8_t c;
+
+	// the last call returned a whole frame - start a new one
+	if (d->complete)
+	{
+		d->len = 0;
+		d->complete = 0;
+		d->code = 0;
+		d->zero = 0;
+	}
+
+	while (i < len)
+	{
+		if (d->code == 0)
+		{
+			c = in[i++];
+			if (c == SLIP_COBS_END)
+			{
+				// the zero behind the last block isn't a part of
+				// the frame. ENDs without any bytes are skipped
+				d->zero = 0;
+				if (d->len)
+				{
+					d->complete = 1;
+					break;
+				}
+				continue;
+			}
+
+			// a new block - the zero ending the previous one first
+			if (d->zero && d->len < d->size) d->buffer[d->len++] = 0;
+			d->zero = (c != 0xff);
+			d->code = c - 1;
+			continue;
+		}
+
+		// the run of the block. a zero inside it is an END, the
+		// frame was cut short - it's handled as a code byte
+		max = (len - i < d->code) ? len - i : d->code;
+		n = slip_cobs_scan (in + i, max);
+
+		// the bytes that don't fit are dropped until the frame ends
+		memcpy (d->buffer + d->len, in + i, (n < d->size - d->len) ? n : d->size - d->len);
+		d->len = (n > d->size - d->len) ? d->size : d->len + n;
+
+		if (n < max)
+		{
+			d->code = n;
+			d->zero = 0;
+		}
+		d->code -= n;
+		i += n;
+	}
+
+	return i;
+}
@@ -44,5 +44,31 @@ typedef uint8_t (*fn_get_char)(void);
 typedef uint8_t (*fn_get_char_to)(uint8_t to, uint8_t* cout);
 
 
+/*! \typedef fn_write_buf
+ * this pointer to function should send a whole buffer of
+ * 'len' characters and returns when it was handed to the
+ * transport. 'ctx' is the transport context given on init.
+ */
+typedef void (*fn_write_buf)(void* ctx, uint8_t* buf, uint16_t len);
+
+
+/*! \typedef fn_read_buf
+ * this pointer to function should read up to 'max' characters
+ * that are available in the input into 'buf'. This call is
+ * blocking UNTIL at least a single character is available or
+ * it reaches the timeout [ms] specified in 'to'. The returned
+ * value is the number of characters read (0 on timeout).
+ * 'ctx' is the transport context given on init.
+ */
+typedef uint16_t (*fn_read_buf)(void* ctx, uint8_t* buf, uint16_t max, uint16_t to);
+
+
+/*! \typedef fn_clock_us
+ * this pointer to function should return a free running
+ * microsecond clock. The value may wrap.
+ */
+typedef uint32_t (*fn_clock_us)(void);
+
+
 #endif //__SPEC_TYPES_H__
 
@@ -1,29 +1,62 @@
+
+#include <sched.h>
+#include <time.h>
 #include "ts_char_queue.h"
 
 
 //==================================================
-ts_queue* 	tsq_create (void)
+ts_queue* 	tsq_create (uint32_t capacity)
 {
-	ts_queue* new_q = (ts_queue*)malloc (sizeof(ts_queue));
-	
+	ts_queue* new_q;
+	uint32_t size = 1;
+
+	// round up to a power of two
+	while (size < capacity && size < 0x80000000u)
+	{
+		size <<= 1;
+	}
+
+	new_q = (ts_queue*)aligned_alloc (TSQ_CACHE_LINE, sizeof(ts_queue));
 	if (new_q == NULL)
 	{
-		return NULL;	
+		return NULL;
 	}
-	
-	// initialize the data
-	memset(new_q->ar, 0, TSQ_MAX_SIZE);
-	new_q->front = 0;
-	new_q->rear = 0;
-	new_q->size = 0;	// current
-	
-	if (0!=pthread_mutex_init(&new_q->q_mutex, NULL))
-	{
-		// error creating mutex
+
+	new_q->ar = (uint8_t*)malloc (size);
+	if (new_q->ar == NULL)
+	{
+		free (new_q);
+		return NULL;
+	}
+
+	if (0!=pthread_mutex_init(&new_q->room_mutex, NULL))
+	{
+		free (new_q->ar);
 		free (new_q);
-		new_q = NULL;
+		return NULL;
 	}
-	
+	if (0!=pthread_cond_init(&new_q->room, NULL))
+	{
+		pthread_mutex_destroy(&new_q->room_mutex);
+		free (new_q->ar);
+		free (new_q);
+		return NULL;
+	}
+
+	// initialize the data
+	memset(new_q->ar, 0, size);
+	new_q->mask = size - 1;
+	new_q->mode = TSQ_MODE_FAIL;
+	atomic_init (&new_q->head, 0);
+	atomic_init (&new_q->tail, 0);
+	atomic_init (&new_q->waiting, 0);
+	atomic_init (&new_q->wake_at, 0);
+	atomic_init (&new_q->overflows, 0);
+	atomic_init (&new_q->high_water, 0);
+	atomic_init (&new_q->blocked, 0);
+	new_q->tail_cache = 0;
+	new_q->head_cache = 0;
+
 	return new_q;
 }
 
@@ -31,71 +64,365 @@ ts_queue* 	tsq_create (void)
 void 		tsq_delete (ts_queue* q)
 {
 	if (q==NULL) return;
-	
-	// destroy mutex
-	pthread_mutex_destroy(&q->q_mutex);
-	
+
+	pthread_cond_destroy(&q->room);
+	pthread_mutex_destroy(&q->room_mutex);
+	free (q->ar);
 	free (q);
 }
 
+//==================================================
+// before the threads start
+void		tsq_set_mode (ts_queue* q, uint8_t mode)
+{
+	q->mode = mode;
+}
+
+//==================================================
+uint32_t	tsq_capacity (ts_queue* q)
+{
+	return q->mask + 1;
+}
+
+//==================================================
+void		tsq_get_stats (ts_queue* q, tsq_stats* stats)
+{
+	stats->overflows = atomic_load_explicit (&q->overflows, memory_order_relaxed);
+	stats->high_water = atomic_load_explicit (&q->high_water, memory_order_relaxed);
+	stats->blocked = atomic_load_explicit (&q->blocked, memory_order_relaxed);
+}
+
+//==================================================
+// the producer side - how many bytes can be pushed
+int			tsq_free (ts_queue* q)
+{
+	uint32_t tail = atomic_load_explicit (&q->tail, memory_order_relaxed);
+
+	q->head_cache = atomic_load_explicit (&q->head, memory_order_acquire);
+	return q->mask + 1 - (tail - q->head_cache);
+}
+
 //==================================================
 int			tsq_is_full (ts_queue* q)
-{ 
-	int full = 0;
-	pthread_mutex_lock(&q->q_mutex);
-	full = q->size == TSQ_MAX_SIZE;
-	pthread_mutex_unlock(&q->q_mutex);
-	
-	return full;
+{
+	return tsq_free (q) == 0;
+}
+
+//==================================================
+// the consumer side
+int			tsq_empty (ts_queue* q)
+{
+	uint32_t head = atomic_load_explicit (&q->head, memory_order_relaxed);
+
+	q->tail_cache = atomic_load_explicit (&q->tail, memory_order_acquire);
+	return q->tail_cache == head;
+}
+
+//==================================================
+// the producer has to wait for the consumer, until there is
+// room for 'want' bytes (up to half of the ring) - not for
+// every byte popped. the consumer is usually about to make
+// room, so the producer yields to it before going to sleep
+static void tsq_wait_room (ts_queue* q, uint32_t want)
+{
+	uint32_t tail = atomic_load_explicit (&q->tail, memory_order_relaxed);
+	struct timespec until;
+	int i;
+
+	if (want > (q->mask + 1) / 2) want = (q->mask + 1) / 2;
+	if (want == 0) want = 1;
+
+	atomic_fetch_add_explicit (&q->blocked, 1, memory_order_relaxed);
+
+	for (i = 0; i < TSQ_WAIT_YIELDS; i++)
+	{
+		sched_yield ();
+		if ((uint32_t)tsq_free (q) >= want) return;
+	}
+
+	// 'waiting' is set before 'head' is looked at. the consumer
+	// looks at 'waiting' after moving 'head' without a fence, so
+	// a wake can be missed - the sleep is a timed one
+	pthread_mutex_lock(&q->room_mutex);
+	atomic_store_explicit (&q->wake_at, tail - (q->mask + 1) + want, memory_order_relaxed);
+	atomic_store (&q->waiting, 1);
+	atomic_thread_fence (memory_order_seq_cst);
+	while ((uint32_t)tsq_free (q) < want)
+	{
+		clock_gettime (CLOCK_REALTIME, &until);
+		until.tv_nsec += TSQ_WAIT_US * 1000;
+		if (until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&q->room, &q->room_mutex, &until);
+	}
+	atomic_store (&q->waiting, 0);
+	pthread_mutex_unlock(&q->room_mutex);
+}
+
+//==================================================
+// 'wake_at' only grows - an old look at it wakes the producer
+// too early, it checks the room again and goes back to sleep.
+// without a sleeper a pop costs the relaxed load only
+static void tsq_wake (ts_queue* q, uint32_t head)
+{
+	if (!atomic_load_explicit (&q->waiting, memory_order_relaxed)) return;
+
+	atomic_thread_fence (memory_order_seq_cst);
+	if (atomic_load_explicit (&q->waiting, memory_order_relaxed) &&
+		(int32_t)(head - atomic_load_explicit (&q->wake_at, memory_order_relaxed)) >= 0)
+	{
+		pthread_mutex_lock(&q->room_mutex);
+		pthread_cond_signal(&q->room);
+		pthread_mutex_unlock(&q->room_mutex);
+	}
+}
+
+//==================================================
+// the overwrite mode - the producer moves 'head' over the
+// oldest bytes. the consumer may move it at the same time,
+// thus both of them do it by compare and swap
+static void tsq_drop_oldest (ts_queue* q, uint32_t tail, uint32_t n)
+{
+	uint32_t head = atomic_load_explicit (&q->head, memory_order_acquire);
+	uint32_t room;
+
+	while (1)
+	{
+		room = q->mask + 1 - (tail - head);
+		if (room >= n) break;
+
+		if (atomic_compare_exchange_weak_explicit (&q->head, &head, head + (n - room),
+												   memory_order_acq_rel, memory_order_acquire))
+		{
+			atomic_fetch_add_explicit (&q->overflows, n - room, memory_order_relaxed);
+			head += n - room;
+			break;
+		}
+	}
+
+	q->head_cache = head;
+}
+
+//==================================================
+// the fill level after a push. 'head_cache' is old and
+// gives too high a level, so a new record is checked
+static void tsq_mark (ts_queue* q, uint32_t tail)
+{
+	uint32_t level = tail - q->head_cache;
+
+	if (level <= atomic_load_explicit (&q->high_water, memory_order_relaxed)) return;
+
+	q->head_cache = atomic_load_explicit (&q->head, memory_order_acquire);
+	level = tail - q->head_cache;
+	if (level > atomic_load_explicit (&q->high_water, memory_order_relaxed))
+	{
+		atomic_store_explicit (&q->high_water, level, memory_order_relaxed);
+	}
+}
+
+//==================================================
+// the consumer of an overwrite mode queue - the bytes are
+// taken only when 'head' wasn't moved while copying them
+static int tsq_pop_overwrite (ts_queue* q, uint8_t* items, int max)
+{
+	uint32_t head = atomic_load_explicit (&q->head, memory_order_acquire);
+	uint32_t n;
+	uint32_t pos;
+	uint32_t chunk;
+
+	do
+	{
+		q->tail_cache = atomic_load_explicit (&q->tail, memory_order_acquire);
+		n = q->tail_cache - head;
+		if (n > (uint32_t)max) n = max;
+
+		pos = head & q->mask;
+		chunk = q->mask + 1 - pos;
+		if (chunk > n) chunk = n;
+
+		memcpy (items, &q->ar[pos], chunk);
+		memcpy (items + chunk, q->ar, n - chunk);
+	}
+	while (n && !atomic_compare_exchange_weak_explicit (&q->head, &head, head + n,
+														 memory_order_acq_rel, memory_order_acquire));
+
+	return n;
 }
 
 //==================================================
 int		tsq_pop_item (ts_queue* q, uint8_t *c)
 {
-	pthread_mutex_lock(&q->q_mutex);
-    
-    if (q->size == 0)
-    {
-        pthread_mutex_unlock(&q->q_mutex);
-        return -1;
-    }
-	
-    q->size--;
-    *c = q->ar[q->front];
-    q->front++;
-    if (q->front >= TSQ_MAX_SIZE) q->front = 0;
-    
-	pthread_mutex_unlock(&q->q_mutex);
-	
+	uint32_t head;
+
+	if (q->mode == TSQ_MODE_OVERWRITE)
+	{
+		return (tsq_pop_overwrite (q, c, 1) == 1) ? 0 : -1;
+	}
+
+	head = atomic_load_explicit (&q->head, memory_order_relaxed);
+
+	// the other side's index is read only when the cached one runs out
+	if (q->tail_cache == head)
+	{
+		q->tail_cache = atomic_load_explicit (&q->tail, memory_order_acquire);
+		if (q->tail_cache == head)
+		{
+			return -1;
+		}
+	}
+
+	*c = q->ar[head & q->mask];
+	atomic_store_explicit (&q->head, head + 1, memory_order_release);
+
+	if (q->mode == TSQ_MODE_BLOCK) tsq_wake (q, head + 1);
+
+	return 0;
+}
+
+//==================================================
+int			tsq_push_item (ts_queue* q, uint8_t item)
+{
+	uint32_t tail = atomic_load_explicit (&q->tail, memory_order_relaxed);
+
+	if (tail - q->head_cache > q->mask)
+	{
+		q->head_cache = atomic_load_explicit (&q->head, memory_order_acquire);
+		if (tail - q->head_cache > q->mask)
+		{
+			switch (q->mode)
+			{
+				case TSQ_MODE_OVERWRITE:
+					tsq_drop_oldest (q, tail, 1);
+					break;
+
+				case TSQ_MODE_BLOCK:
+					tsq_wait_room (q, 1);
+					break;
+
+				default:
+					// full - the consumer owns the oldest byte
+					atomic_fetch_add_explicit (&q->overflows, 1, memory_order_relaxed);
+					return -1;
+			}
+		}
+	}
+
+	q->ar[tail & q->mask] = item;
+	atomic_store_explicit (&q->tail, tail + 1, memory_order_release);
+	tsq_mark (q, tail + 1);
+
 	return 0;
 }
 
 //==================================================
-void		tsq_push_item (ts_queue* q, uint8_t item)
+// pushes the items into the room there is - returns
+// their number (in the blocking mode all of them)
+static int tsq_push_some (ts_queue* q, uint8_t* items, int n)
 {
-	pthread_mutex_lock(&q->q_mutex);
-    
-    /*if (q->size == TSQ_MAX_SIZE)
-    {
-        pthread_mutex_unlock(&q->q_mutex);
-        return;
-    }*/
-	
-    q->ar[q->rear] = item;          // if needed overwrite
-    
-    q->rear ++;
-    if (q->rear >=TSQ_MAX_SIZE) q->rear = 0;
-    q->size++;
-    if (q->size > TSQ_MAX_SIZE) q->size = TSQ_MAX_SIZE;
-      
-    pthread_mutex_unlock(&q->q_mutex);
+	uint32_t tail = atomic_load_explicit (&q->tail, memory_order_relaxed);
+	uint32_t room = q->mask + 1 - (tail - q->head_cache);
+	uint32_t pos;
+	uint32_t chunk;
+
+	if (room < (uint32_t)n)
+	{
+		q->head_cache = atomic_load_explicit (&q->head, memory_order_acquire);
+		room = q->mask + 1 - (tail - q->head_cache);
+
+		if (room < (uint32_t)n && q->mode == TSQ_MODE_OVERWRITE)
+		{
+			tsq_drop_oldest (q, tail, n);
+			room = n;
+		}
+	}
+	if ((uint32_t)n > room) n = room;
+
+	// at most two copies - up to the end of the ring and from its start
+	pos = tail & q->mask;
+	chunk = q->mask + 1 - pos;
+	if (chunk > (uint32_t)n) chunk = n;
+
+	memcpy (&q->ar[pos], items, chunk);
+	memcpy (q->ar, items + chunk, n - chunk);
+	atomic_store_explicit (&q->tail, tail + n, memory_order_release);
+	tsq_mark (q, tail + n);
+
+	return n;
 }
 
 //==================================================
-int			tsq_empty (ts_queue* q)
+int			tsq_push_n (ts_queue* q, uint8_t* items, int n)
 {
-	int empty = 0;
-	empty = q->size == 0;
-	return empty;
+	int pushed = 0;
+
+	if (n <= 0) return 0;
+
+	switch (q->mode)
+	{
+		case TSQ_MODE_OVERWRITE:
+			// only the last capacity items can be kept
+			if ((uint32_t)n > q->mask + 1)
+			{
+				atomic_fetch_add_explicit (&q->overflows, n - (q->mask + 1), memory_order_relaxed);
+				pushed = n - (q->mask + 1);
+			}
+			return pushed + tsq_push_some (q, items + pushed, n - pushed);
+
+		case TSQ_MODE_BLOCK:
+			while (1)
+			{
+				pushed += tsq_push_some (q, items + pushed, n - pushed);
+				if (pushed == n) return n;
+				tsq_wait_room (q, n - pushed);
+			}
+
+		default:
+			pushed = tsq_push_some (q, items, n);
+			if (pushed < n)
+			{
+				atomic_fetch_add_explicit (&q->overflows, n - pushed, memory_order_relaxed);
+			}
+			return pushed;
+	}
 }
 
+//==================================================
+int			tsq_pop_n (ts_queue* q, uint8_t* items, int max)
+{
+	uint32_t head;
+	uint32_t avail;
+	uint32_t pos;
+	uint32_t chunk;
+
+	if (max <= 0) return 0;
+
+	if (q->mode == TSQ_MODE_OVERWRITE)
+	{
+		return tsq_pop_overwrite (q, items, max);
+	}
+
+	head = atomic_load_explicit (&q->head, memory_order_relaxed);
+	avail = q->tail_cache - head;
+
+	if (avail < (uint32_t)max)
+	{
+		q->tail_cache = atomic_load_explicit (&q->tail, memory_order_acquire);
+		avail = q->tail_cache - head;
+	}
+	if ((uint32_t)max > avail) max = avail;
+
+	pos = head & q->mask;
+	chunk = q->mask + 1 - pos;
+	if (chunk > (uint32_t)max) chunk = max;
+
+	memcpy (items, &q->ar[pos], chunk);
+	memcpy (items + chunk, q->ar, max - chunk);
+	atomic_store_explicit (&q->head, head + max, memory_order_release);
+
+	if (q->mode == TSQ_MODE_BLOCK && max) tsq_wake (q, head + max);
+
+	return max;
+}
@@ -6,24 +6,83 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdatomic.h>
 
-#define TSQ_MAX_SIZE	128
+/*
+ * A single producer / single consumer byte ring. One thread
+ * pushes, one thread pops - no locks, the two indices are
+ * the only shared state. They run free (wrap at 2^32) and
+ * the capacity is a power of two, so 'tail - head' is the
+ * fill level and 'index & mask' the position in the ring.
+ *
+ * What happens to a push into a full ring is up to the mode:
+ * the oldest bytes are dropped, the push fails or it waits
+ * for the consumer. A waiting producer first yields to the
+ * consumer a few times, then it sleeps. The mutex and the
+ * condition are touched only by a producer that has to sleep
+ * (and by the consumer waking it up) - a pop without a sleeper
+ * costs a single load more.
+ */
 
+#define TSQ_DEFAULT_SIZE	128
+#define TSQ_CACHE_LINE		64
+#define TSQ_WAIT_YIELDS		64		/**< the yields of a waiting producer before it sleeps */
+#define TSQ_WAIT_US			1000	/**< a sleeping producer looks at the room this often [us] */
+
+/*!
+ * What a push does when the ring is full
+ */
+typedef enum
+{
+	TSQ_MODE_OVERWRITE = 0,	/**< the oldest bytes are dropped */
+	TSQ_MODE_FAIL = 1,		/**< the push takes what fits (the default) */
+	TSQ_MODE_BLOCK = 2		/**< the producer waits for room */
+} TSQ_MODE;
+
+/*!
+ * The queue counters - for sizing the buffers
+ */
 typedef struct
 {
-	uint8_t ar[TSQ_MAX_SIZE];
-	int32_t front;
-	int32_t rear;
-	int32_t size;
-	pthread_mutex_t q_mutex;
+	uint32_t overflows;		/**< bytes dropped (overwritten or refused) */
+	uint32_t high_water;	/**< the highest fill level seen */
+	uint32_t blocked;		/**< the times the producer had to wait */
+} tsq_stats;
+
+typedef struct
+{
+	// written by the consumer
+	_Alignas(TSQ_CACHE_LINE) _Atomic uint32_t head;
+	uint32_t tail_cache;		// the consumer's last look at 'tail'
+
+	// written by the producer
+	_Alignas(TSQ_CACHE_LINE) _Atomic uint32_t tail;
+	uint32_t head_cache;		// the producer's last look at 'head'
+	_Atomic uint32_t waiting;	// the producer sleeps on 'room'
+	_Atomic uint32_t wake_at;	// ... until 'head' gets here
+	_Atomic uint32_t overflows;
+	_Atomic uint32_t high_water;
+	_Atomic uint32_t blocked;
+
+	// constant after 'tsq_create'/'tsq_set_mode'
+	_Alignas(TSQ_CACHE_LINE) uint32_t mask;
+	uint8_t mode;
+	uint8_t* ar;
+	pthread_mutex_t room_mutex;
+	pthread_cond_t room;
 } ts_queue;
 
-ts_queue* 	tsq_create (void);
+ts_queue* 	tsq_create (uint32_t capacity);
 void 		tsq_delete (ts_queue* q);
+void		tsq_set_mode (ts_queue* q, uint8_t mode);
+uint32_t	tsq_capacity (ts_queue* q);
+void		tsq_get_stats (ts_queue* q, tsq_stats* stats);
 int			tsq_is_full (ts_queue* q);
 int         tsq_pop_item (ts_queue* q, uint8_t *c);
-void		tsq_push_item (ts_queue* q, uint8_t item);
+int			tsq_push_item (ts_queue* q, uint8_t item);
 int			tsq_empty (ts_queue* q);
+int			tsq_free (ts_queue* q);
+int			tsq_push_n (ts_queue* q, uint8_t* items, int n);
+int			tsq_pop_n (ts_queue* q, uint8_t* items, int max);
 
 #endif //__TS_CHAR_QUEUE_H__
-